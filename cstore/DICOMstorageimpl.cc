@@ -13,6 +13,17 @@
 #include <control/orbnaming.h>
 #include "DICOMstorageimpl.h"
 #include "cstoremanager.h"
+#include "targetHealth.h"
+#include "exportScheduler.h"
+#include "inFlightBudget.h"
+#include "bandwidthShaper.h"
+#include "targetGroup.h"
+#include "readAhead.h"
+#include "metadataCache.h"
+#include "commitListener.h"
+#include "commitCoalescer.h"
+#include "commitHistory.h"
+#include "commitReactor.h"
 
 DICOMStorageImpl*  DICOMStorageImpl::_instance = NULL;
 bool DICOMStorageImpl::_isShuttingDown = false;
@@ -164,11 +175,7 @@ DICOMStorageImpl::storeAndCommit(const DICOMStoragePkg::FileNameList& fileNames,
 	int i;
 
 	for(i=0; i<(int)fileNames.length(); i++)
-	{	if (UNKNOWN_FORMAT != CheckFileFormat(fileNames[i].in()))
-			filelist.push_back(fileNames[i].in());
-		else
-			::Message(MWARNING, toEndUser | toService | MLoverall, "File [%s] doesn't exist or not in DICOM format. Cstore will skip it.", fileNames[i].in());
-	}
+		filelist.push_back(fileNames[i].in());
 
 	for(i=0; i<(int)storageTargets.length(); i++)
 		storagetargetlist.push_back(storageTargets[i]);
@@ -188,11 +195,7 @@ DICOMStorageImpl::store(const DICOMStoragePkg::FileNameList& fileNames,
 	int i;
 
 	for(i=0; i<(int)fileNames.length(); i++)
-	{	if (UNKNOWN_FORMAT != CheckFileFormat(fileNames[i].in()))
-			filelist.push_back(fileNames[i].in());
-		else
-			::Message(MWARNING, toEndUser | toService | MLoverall, "Skip file [%s] because it either doesn't exist or is not in DICOM format.", fileNames[i].in());
-	}
+		filelist.push_back(fileNames[i].in());
 
 	for(i=0; i<(int)storageTargets.length(); i++)
 		storagetargetlist.push_back(storageTargets[i]);
@@ -205,39 +208,96 @@ void
 DICOMStorageImpl::commit(const DICOMStoragePkg::ResultByStorageTargetList& UIDList,
 						 const DICOMStoragePkg::CommitTargetList& commitTargets)
 {	list<DICOMStoragePkg::CommitTarget>            committargetlist;
-	int                                            i, j, cnt = 0;
-	DICOMStoragePkg::ResultByStorageTargetList_var tmpResult;
-	DICOMStoragePkg::ResultByStorageTargetList_var resultByStorageTargets;
+	int                                            i;
 
 	// Convert from IDL sequence to STL list
 	for(i=0; i<(int)commitTargets.length(); i++)
 		committargetlist.push_back(commitTargets[i]);
 
-	// The following code removes the UIDList element which doesn't need storage commit
-	tmpResult = new DICOMStoragePkg::ResultByStorageTargetList;
-	tmpResult->length(UIDList.length());
+	// Copy the UIDList once, without the elements which don't need storage
+	// commit, and share the copy among the commit targets
+	return _cstoreManager->commit(SharedResult::copyOf(UIDList, true), committargetlist);
+}
 
-    for(i=0; i < (int)UIDList.length(); i++)
-		if (UIDList[i].storageCommitRequired == true)
-			cnt++;
 
-	resultByStorageTargets = new DICOMStoragePkg::ResultByStorageTargetList;
-	resultByStorageTargets->length(cnt);
+unsigned long
+DICOMStorageImpl::submitStore(const DICOMStoragePkg::FileNameList& fileNames,
+							const DICOMStoragePkg::StorageTargetList& storageTargets,
+							EXPORT_PRIORITY priority)
+{	list<string> filelist;
+	list<DICOMStoragePkg::StorageTarget> storagetargetlist;
+	int i;
 
-	j=0;
-    for(i=0; i < (int)UIDList.length(); i++)
-	{	if (UIDList[i].storageCommitRequired == true)
-			resultByStorageTargets[j++]=UIDList[i];
-#ifdef DEBUG_PRINTF
-		else
-		{	// Skip this UIDList[i] because storageCommit is not required
-			::Message(MNOTE, toEndUser | toService | MLoverall, 
-					"Storage commit is not required for this UIDList. The intermediate result is skipped");
-		}
-#endif
-	}
-	
-	return _cstoreManager->commit(resultByStorageTargets.in(), committargetlist);
+	for(i=0; i<(int)fileNames.length(); i++)
+		filelist.push_back(fileNames[i].in());
+
+	for(i=0; i<(int)storageTargets.length(); i++)
+		storagetargetlist.push_back(storageTargets[i]);
+
+	return _cstoreManager->submitStore(filelist, storagetargetlist, priority);
+}
+
+unsigned long
+DICOMStorageImpl::submitStoreAndCommit(const DICOMStoragePkg::FileNameList& fileNames,
+									const DICOMStoragePkg::StorageTargetList& storageTargets,
+									const DICOMStoragePkg::CommitTargetList& commitTargets,
+									EXPORT_PRIORITY priority)
+{	list<string> filelist;
+	list<DICOMStoragePkg::StorageTarget> storagetargetlist;
+	list<DICOMStoragePkg::CommitTarget> committargetlist;
+	int i;
+
+	for(i=0; i<(int)fileNames.length(); i++)
+		filelist.push_back(fileNames[i].in());
+
+	for(i=0; i<(int)storageTargets.length(); i++)
+		storagetargetlist.push_back(storageTargets[i]);
+
+	for(i=0; i<(int)commitTargets.length(); i++)
+		committargetlist.push_back(commitTargets[i]);
+
+	return _cstoreManager->submitStoreAndCommit(filelist, storagetargetlist, committargetlist, priority);
+}
+
+bool
+DICOMStorageImpl::getJobStatus(unsigned long jobID, ExportJobStatus& status)
+{
+	return _cstoreManager->getJobStatus(jobID, status);
+}
+
+bool
+DICOMStorageImpl::cancelJob(unsigned long jobID)
+{
+	return _cstoreManager->cancelJob(jobID);
+}
+
+DICOMStoragePkg::ResultByStorageTargetList*
+DICOMStorageImpl::getJobResult(unsigned long jobID)
+{
+	return _cstoreManager->getJobResult(jobID);
+}
+
+DICOMStoragePkg::ResultByStorageTargetList*
+DICOMStorageImpl::storeSummary(const DICOMStoragePkg::FileNameList& fileNames,
+							const DICOMStoragePkg::StorageTargetList& storageTargets,
+							ExportResultSummary& summary)
+{	list<string> filelist;
+	list<DICOMStoragePkg::StorageTarget> storagetargetlist;
+	int i;
+
+	for(i=0; i<(int)fileNames.length(); i++)
+		filelist.push_back(fileNames[i].in());
+
+	for(i=0; i<(int)storageTargets.length(); i++)
+		storagetargetlist.push_back(storageTargets[i]);
+
+	return _cstoreManager->storeSummary(filelist, storagetargetlist, summary);
+}
+
+DICOMStoragePkg::ResultByStorageTargetList*
+DICOMStorageImpl::getJobSummary(unsigned long jobID, ExportResultSummary& summary)
+{
+	return _cstoreManager->getJobSummary(jobID, summary);
 }
 
 
@@ -245,6 +305,61 @@ void DICOMStorageImpl::
 remoteDebug( const char *action )
 {
 	// do something ourselves based on string command in "action"
+	if ( action && !strcmp(action, "health") )
+		TargetHealth::instance()->report();
+	else if ( action && !strcmp(action, "bandwidth") )
+		BandwidthShaper::instance()->report();
+	else if ( action && !strcmp(action, "bandwidth reload") )
+	{
+		BandwidthShaper::instance()->loadProfiles();
+		BandwidthShaper::instance()->report();
+	}
+	else if ( action && !strcmp(action, "groups") )
+		TargetGroupTable::instance()->report();
+	else if ( action && !strcmp(action, "groups reload") )
+	{
+		TargetGroupTable::instance()->loadGroups();
+		TargetGroupTable::instance()->report();
+	}
+	else if ( action && !strcmp(action, "readahead") )
+		ReadAheadEngine::instance()->report();
+	else if ( action && !strcmp(action, "metadata") )
+		MetadataCache::instance()->report();
+	else if ( action && !strcmp(action, "inflight") )
+		InFlightBudget::instance()->report();
+	else if ( action && !strcmp(action, "workers") )
+		WorkerPool::instance()->report();
+	else if ( action && !strcmp(action, "scheduler") )
+		ExportScheduler::instance()->report();
+	else if ( action && !strcmp(action, "results") )
+		ReportResultCounters();
+	else if ( action && !strcmp(action, "commits") )
+	{
+		CommitListener::instance()->report();
+		CommitCoalescer::instance()->report();
+		CommitHistory::instance()->report();
+		CommitReactor::instance()->report();
+	}
+	else if ( action && !strcmp(action, "jobs") )
+		ExportJobManager::instance()->report();
+	else if ( action && !strncmp(action, "job ", 4) )
+	{
+		ExportJobStatus status;
+		unsigned long jobID = strtoul(action+4, NULL, 10);
+
+		if (getJobStatus(jobID, status))
+			::Message(MNOTE, toEndUser | toService | MLoverall, "Export job %lu is %s, processed %d of %d file(s), %d failed",
+					  jobID, JobStateName(status.state), status.filesProcessed, status.totalFiles, status.filesFailed);
+		else
+			::Message(MWARNING, toEndUser | toService | MLoverall, "Export job %lu is unknown", jobID);
+	}
+	else if ( action && !strncmp(action, "cancel ", 7) )
+	{
+		unsigned long jobID = strtoul(action+7, NULL, 10);
+
+		if (!cancelJob(jobID))
+			::Message(MWARNING, toEndUser | toService | MLoverall, "Export job %lu is unknown or already finished", jobID);
+	}
 
 	// optionally call one from portalimpl (may not always want/need to call this one)
 	PortalImpl::remoteDebug(action);
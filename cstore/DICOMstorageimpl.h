@@ -67,6 +67,72 @@ public:
     }
 
     virtual void remoteDebug( const char *action );
+
+    /*
+     * Asynchronous export jobs. submitStore and submitStoreAndCommit
+     * return a job ID without waiting for the transfer.
+     *
+     * Deferred: these are not operations of the DICOMStorage IDL yet. The
+     * IDL is kept with control/, outside of cstore, so remote clients can
+     * only list and cancel jobs through remoteDebug("jobs"/"job"/"cancel").
+     * They become client-usable once DICOMStoragePkg::DICOMStorage gains
+     *
+     *   enum JobState { JOB_QUEUED, JOB_RUNNING, JOB_COMPLETED,
+     *                   JOB_FAILED, JOB_CANCELLED };
+     *   struct JobStatus { unsigned long jobID; JobState state;
+     *                      long totalFiles; long filesProcessed;
+     *                      long filesFailed; };
+     *   unsigned long submitStore(in FileNameList fileNames,
+     *                             in StorageTargetList storageTargets,
+     *                             in short priority);
+     *   unsigned long submitStoreAndCommit(in FileNameList fileNames,
+     *                             in StorageTargetList storageTargets,
+     *                             in CommitTargetList commitTargets,
+     *                             in short priority);
+     *   boolean getJobStatus(in unsigned long jobID, out JobStatus status);
+     *   boolean cancelJob(in unsigned long jobID);
+     *   ResultByStorageTargetList getJobResult(in unsigned long jobID);
+     *
+     * and the methods below are made virtual overrides taking the IDL
+     * types. Until then store() and storeAndCommit() remain the interface.
+     */
+    unsigned long submitStore(
+						const DICOMStoragePkg::FileNameList& fileNames,
+						const DICOMStoragePkg::StorageTargetList& storageTargets,
+						EXPORT_PRIORITY priority = PRIORITY_ROUTINE);
+    unsigned long submitStoreAndCommit(
+						const DICOMStoragePkg::FileNameList& fileNames,
+						const DICOMStoragePkg::StorageTargetList& storageTargets,
+						const DICOMStoragePkg::CommitTargetList& commitTargets,
+						EXPORT_PRIORITY priority = PRIORITY_ROUTINE);
+    bool getJobStatus(unsigned long jobID, ExportJobStatus& status);
+    bool cancelJob(unsigned long jobID);
+    DICOMStoragePkg::ResultByStorageTargetList* getJobResult(unsigned long jobID);
+
+    /*
+     * Summary result mode. Like store, but returns only the files that
+     * were not stored, with the counts and the job ID to fetch the full
+     * result with getJobResult.
+     *
+     * Deferred with the job API above: no CORBA caller can use it until
+     * DICOMStoragePkg::DICOMStorage gains
+     *
+     *   struct ResultSummary { unsigned long jobID; long numTargets;
+     *                          long numFiles; long stored;
+     *                          long notStored; };
+     *   ResultByStorageTargetList storeSummary(in FileNameList fileNames,
+     *                             in StorageTargetList storageTargets,
+     *                             out ResultSummary summary);
+     *   ResultByStorageTargetList getJobSummary(in unsigned long jobID,
+     *                             out ResultSummary summary);
+     *
+     * together with getJobResult, which fetches the full result.
+     */
+    DICOMStoragePkg::ResultByStorageTargetList* storeSummary(
+						const DICOMStoragePkg::FileNameList& fileNames,
+						const DICOMStoragePkg::StorageTargetList& storageTargets,
+						ExportResultSummary& summary);
+    DICOMStoragePkg::ResultByStorageTargetList* getJobSummary(unsigned long jobID, ExportResultSummary& summary);
 };
 
 #endif
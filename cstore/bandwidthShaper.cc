@@ -0,0 +1,269 @@
+/*
+ * file:	bandwidthShaper.cc
+ * purpose:	Implementation of the BandwidthShaper class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <fstream>
+
+#include "bandwidthShaper.h"
+#include "cstoreutils.h"
+
+static const char bandwidthFile[] = "data/Facility/Cstore/bandwidth.txt";
+static const int  BusyPeriodGap = 60;   /* seconds without sending that end a busy period */
+
+BandwidthShaper* BandwidthShaper::_instance = NULL;  /* handle of singleton object */
+
+static double elapsedMilliseconds(const struct timeval& from, const struct timeval& to)
+{
+	return (to.tv_sec - from.tv_sec) * 1000.0 + (to.tv_usec - from.tv_usec) / 1000.0;
+}
+
+static void initBucket(TokenBucket& bucket)
+{
+	memset(&bucket, 0, sizeof(bucket));
+	gettimeofday(&bucket.lastRefill, NULL);
+}
+
+BandwidthShaper* BandwidthShaper::instance()
+{
+	if (!_instance)
+		_instance = new BandwidthShaper();
+
+	return _instance;
+}
+
+BandwidthShaper::BandwidthShaper()
+{
+	pthread_mutex_init(&_lock, NULL);
+	initBucket(_global);
+}
+
+BandwidthShaper::~BandwidthShaper()
+{
+	pthread_mutex_destroy(&_lock);
+}
+
+BandwidthShaper::BandwidthShaper(const BandwidthShaper&)
+{
+}
+
+BandwidthShaper& BandwidthShaper::operator=(const BandwidthShaper&)
+{
+	return *this;
+}
+
+void BandwidthShaper::loadProfiles()
+{
+	vector<BandwidthRule> rules;
+	char                  line[256];
+	char                  remoteAE[AE_LENGTH+2];
+	int                   startHour, startMinute, endHour, endMinute;
+	unsigned long         kiloBytesPerSecond;
+
+	std::ifstream bandwidthConfigFile(bandwidthFile);
+	if (!bandwidthConfigFile)
+	{
+		::Message( MNOTE, MLoverall | toService | toDeveloper, "Cstore: no \"%s\", the storage bandwidth is not limited.", bandwidthFile);
+		pthread_mutex_lock(&_lock);
+		_rules.clear();
+		pthread_mutex_unlock(&_lock);
+		return;
+	}
+
+	memset(line, 0, sizeof(line));
+	while(!bandwidthConfigFile.getline(line, sizeof(line)).eof())
+	{
+		if (isalpha(line[0]) || isdigit(line[0]) || line[0] == '*')
+		{
+			if (sscanf(line, "%16s %d:%d %d:%d %lu", remoteAE, &startHour, &startMinute,
+					   &endHour, &endMinute, &kiloBytesPerSecond) == 6)
+			{
+				BandwidthRule rule;
+
+				rule.remoteAE = remoteAE;
+				rule.startMinute = startHour * 60 + startMinute;
+				rule.endMinute = endHour * 60 + endMinute;
+				rule.bytesPerSecond = kiloBytesPerSecond * 1024;
+				rules.push_back(rule);
+
+				::Message( MNOTE, MLoverall | toService | toDeveloper, "Set storage bandwidth of %s to %luKB/s from %02d:%02d to %02d:%02d",
+						   remoteAE, kiloBytesPerSecond, startHour, startMinute, endHour, endMinute);
+			}
+			else
+				::Message( MWARNING, MLoverall | toService | toDeveloper, "Cstore: ignoring line \"%s\" of \"%s\"", line, bandwidthFile);
+		}
+		memset(line, 0, sizeof(line));
+	}
+
+	pthread_mutex_lock(&_lock);
+	_rules = rules;
+	pthread_mutex_unlock(&_lock);
+}
+
+/*
+ * The caller must hold _lock
+ */
+unsigned long BandwidthShaper::currentRate(const string& remoteAE)
+{
+	time_t    now = time(NULL);
+	struct tm local;
+	int       minute;
+
+	localtime_r(&now, &local);
+	minute = local.tm_hour * 60 + local.tm_min;
+
+	for(vector<BandwidthRule>::const_iterator iter=_rules.begin(); iter != _rules.end(); ++iter)
+	{
+		if (iter->remoteAE != remoteAE)
+			continue;
+
+		if (iter->startMinute <= iter->endMinute)
+		{
+			if (minute >= iter->startMinute && minute < iter->endMinute)
+				return iter->bytesPerSecond;
+		}
+		else if (minute >= iter->startMinute || minute < iter->endMinute)
+			return iter->bytesPerSecond;
+	}
+
+	return 0;
+}
+
+/****************************************************************************
+ *
+ *  Function    :   take
+ *
+ *  Parameters  :   bucket - the token bucket to charge
+ *                  rate   - bytes per second in force now, 0 is unlimited
+ *                  bytes  - size of the image about to be sent
+ *                  now    - current time
+ *
+ *  Returns     :   milliseconds the sender has to wait
+ *
+ *  Description :   Refill the bucket for the time since the last refill,
+ *                  up to one second worth of tokens, and take the bytes.
+ *                  The balance may go negative: the sender then waits until
+ *                  it would be back at zero, and later senders queue up
+ *                  behind it, so no one polls.
+ *
+ *                  The caller must hold _lock
+ *
+ ****************************************************************************/
+double BandwidthShaper::take(TokenBucket& bucket, unsigned long rate, size_t bytes, const struct timeval& now)
+{
+	double wait = 0.0;
+
+	// Throughput accounting
+	if (bucket.windowBytes == 0 || now.tv_sec - bucket.lastSend.tv_sec > BusyPeriodGap)
+	{
+		bucket.windowStart = now;
+		bucket.windowBytes = 0;
+	}
+	bucket.windowBytes += bytes;
+	bucket.totalBytes += bytes;
+	bucket.lastSend = now;
+
+	if (rate != bucket.rate)
+	{
+		// A new profile starts with a full second of tokens
+		bucket.rate = rate;
+		bucket.tokens = rate;
+		bucket.lastRefill = now;
+	}
+
+	if (rate == 0)
+		return 0.0;
+
+	bucket.tokens += elapsedMilliseconds(bucket.lastRefill, now) * rate / 1000.0;
+	if (bucket.tokens > rate)
+		bucket.tokens = rate;
+	bucket.lastRefill = now;
+
+	bucket.tokens -= bytes;
+	if (bucket.tokens < 0)
+	{
+		wait = -bucket.tokens * 1000.0 / rate;
+		bucket.totalDelay += wait;
+	}
+
+	return wait;
+}
+
+void BandwidthShaper::consume(const char* remoteAE, size_t bytes)
+{
+	struct timeval  now;
+	struct timespec delay;
+	double          wait, globalWait;
+
+	gettimeofday(&now, NULL);
+
+	pthread_mutex_lock(&_lock);
+	map<string, TokenBucket>::iterator iter = _buckets.find(remoteAE);
+	if (iter == _buckets.end())
+	{
+		TokenBucket bucket;
+
+		initBucket(bucket);
+		iter = _buckets.insert(make_pair(string(remoteAE), bucket)).first;
+	}
+
+	wait = take(iter->second, currentRate(remoteAE), bytes, now);
+	globalWait = take(_global, currentRate("*"), bytes, now);
+	pthread_mutex_unlock(&_lock);
+
+	if (globalWait > wait)
+		wait = globalWait;
+
+	if (wait > 0.0)
+	{
+		delay.tv_sec = (time_t)(wait / 1000.0);
+		delay.tv_nsec = (long)((wait - delay.tv_sec * 1000.0) * 1000000.0);
+		while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+			;
+	}
+}
+
+/*
+ * The caller must hold _lock
+ */
+void BandwidthShaper::reportBucket(const char* name, const TokenBucket& bucket, const struct timeval& now)
+{
+	double seconds = elapsedMilliseconds(bucket.windowStart, bucket.lastSend) / 1000.0;
+	bool   busy = bucket.windowBytes > 0 && now.tv_sec - bucket.lastSend.tv_sec <= BusyPeriodGap;
+	char   configured[32];
+
+	if (seconds < 1.0)
+		seconds = 1.0;
+
+	if (bucket.rate)
+		sprintf(configured, "%luKB/s", bucket.rate / 1024);
+	else
+		strcpy(configured, "unlimited");
+
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "  %-18s configured=%s achieved=%.1fKB/s%s sent=%.0fKB held back=%.1fs",
+			  name, configured, bucket.windowBytes / seconds / 1024.0, busy ? "" : " (idle)",
+			  bucket.totalBytes / 1024.0, bucket.totalDelay / 1000.0);
+}
+
+void BandwidthShaper::report()
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall, "Storage bandwidth, %d rule(s):", (int)_rules.size());
+	reportBucket("all targets", _global, now);
+	for(map<string, TokenBucket>::const_iterator iter=_buckets.begin(); iter != _buckets.end(); ++iter)
+		reportBucket(iter->first.c_str(), iter->second, now);
+	pthread_mutex_unlock(&_lock);
+}
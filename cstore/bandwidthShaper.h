@@ -0,0 +1,90 @@
+#ifndef _BANDWIDTHSHAPER_H_
+#define _BANDWIDTHSHAPER_H_
+
+/*
+ * file:	bandwidthShaper.h
+ * purpose:	BandwidthShaper singleton class that limits the C-STORE send
+ *          rate with token buckets, one per remote AE title and one for
+ *          all targets together. The rates come from time-of-day profiles
+ *          in data/Facility/Cstore/bandwidth.txt, one rule per line:
+ *
+ *              <remote AE title or *> <HH:MM start> <HH:MM end> <KB per second>
+ *
+ *          "*" is the global limit. A window whose end is before its start
+ *          runs past midnight. The first matching rule wins; with no match,
+ *          or a rate of 0, the rate is not limited.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <map>
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+using namespace std;
+
+/*
+ * One line of bandwidth.txt
+ */
+typedef struct bandwidth_rule
+{
+    string        remoteAE;         /* "*" for the global limit */
+    int           startMinute;      /* minutes after midnight */
+    int           endMinute;
+    unsigned long bytesPerSecond;   /* 0 means unlimited */
+} BandwidthRule;
+
+/*
+ * Token bucket and throughput of one target, or of all targets
+ */
+typedef struct token_bucket
+{
+    double         tokens;          /* bytes; negative while senders wait for it */
+    struct timeval lastRefill;
+    unsigned long  rate;            /* bytes per second in force, 0 is unlimited */
+
+    double         totalBytes;
+    double         totalDelay;      /* milliseconds senders were held back */
+    struct timeval windowStart;     /* start of the current busy period */
+    double         windowBytes;
+    struct timeval lastSend;
+} TokenBucket;
+
+class BandwidthShaper
+{
+	static BandwidthShaper*      _instance;
+	pthread_mutex_t              _lock;      /* protects everything below */
+	vector<BandwidthRule>        _rules;
+	map<string, TokenBucket>     _buckets;
+	TokenBucket                  _global;
+
+	BandwidthShaper();
+
+	// Disallow copying or assignment.
+	BandwidthShaper(const BandwidthShaper&);
+	BandwidthShaper& operator=(const BandwidthShaper&);
+
+	unsigned long currentRate(const string& remoteAE);
+	double take(TokenBucket& bucket, unsigned long rate, size_t bytes, const struct timeval& now);
+	void reportBucket(const char* name, const TokenBucket& bucket, const struct timeval& now);
+
+public:
+	static BandwidthShaper* instance();
+	~BandwidthShaper();
+
+	// Read bandwidth.txt. Called at startup and on request.
+	void loadProfiles();
+
+	// Account for bytes about to be sent to remoteAE, sleeping as long
+	// as the target or the global bucket requires.
+	void consume(const char* remoteAE, size_t bytes);
+
+	// Write achieved vs configured throughput to the log
+	void report();
+};
+
+#endif
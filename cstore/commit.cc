@@ -29,6 +29,16 @@ Commit& Commit::operator=(const Commit& obj)
 	return *this;
 }
 
+void Commit::submit(CommitFunction function, COMMIT_ARGS& commitArgs,
+					list<TaskFuture*>& tasks)
+{
+	// A coalesced commit reports to its waiter like an asynchronous one
+	if (CommitCoalescer::instance()->join(function, commitArgs))
+		return;
+
+	tasks.push_back(WorkerPool::instance()->submit(function, (void*)&commitArgs));
+}
+
 /*
  * Synchronous Commit class
  */
@@ -53,11 +63,9 @@ SynchCommit& SynchCommit::operator=(const SynchCommit& obj)
 }
 
 void SynchCommit::commit(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids)
+						list<TaskFuture*>& tasks)
 {	
-	pthread_t      a_tid;
-
-    tids.clear();
+    tasks.clear();
 
     /*
      * Now, do Synch Storage Commitment
@@ -66,20 +74,12 @@ void SynchCommit::commit(vector<COMMIT_ARGS>& commitArgs,
 	{
 		::Message(MNOTE, toEndUser | toService | MLoverall, 
 				"Synchronous storage commitment from %s for data stored on %s.",
-				commitArgs[i].options.RemoteHostname, commitArgs[i].result->storageHostName.in());
+				commitArgs[i].options.RemoteHostname, commitArgs[i].result->stored->storageHostName.in());
 
 // Use EitherStorageCommitment in place of SynchStorageCommitment will not slow down the Synch commit
 // but will provide extra protection against incorrect configuration and increase the reliablity of cstore
-//		if( pthread_create(&a_tid, NULL, SynchStorageCommitment, (void*)commit_args) != 0)
-		if( pthread_create(&a_tid, NULL, EitherStorageCommitment, (void*)&commitArgs[i]) != 0)
-		{
-			::Message( MALARM, toEndUser | toService | MLoverall, 
-					"#Software error: cannot create a thread for synch storage commitment from %s for data stored on %s.",
-					commitArgs[i].options.RemoteHostname, commitArgs[i].result->storageHostName.in());
-			tids.push_back((pthread_t)(-1));
-		}
-
-		tids.push_back(a_tid);
+//		tasks.push_back(WorkerPool::instance()->submit(SynchStorageCommitment, (void*)&commitArgs[i]));
+		submit(EitherStorageCommitment, commitArgs[i], tasks);
 	}
 }
 
@@ -107,11 +107,9 @@ AsynchCommit& AsynchCommit::operator=(const AsynchCommit& obj)
 }
 
 void AsynchCommit::commit(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids)
+						list<TaskFuture*>& tasks)
 {	
-	pthread_t      a_tid;
-
-    tids.clear();
+    tasks.clear();
 
     /*
      * Now, do Asynch Storage Commitment
@@ -120,17 +118,9 @@ void AsynchCommit::commit(vector<COMMIT_ARGS>& commitArgs,
 	{
 		::Message(MNOTE, toEndUser | toService | MLoverall, 
 				"Asynchronous storage commitment from %s for data stored on %s.",
-				commitArgs[i].options.RemoteHostname, commitArgs[i].result->storageHostName.in());
-
-		if( pthread_create(&a_tid, NULL, AsynchStorageCommitment, (void*)&commitArgs[i]) != 0)
-		{
-			::Message( MALARM, toEndUser | toService | MLoverall, 
-					"#Software error: cannot create a thread for asynch storage commitment from %s for data stored on %s.",
-					commitArgs[i].options.RemoteHostname, commitArgs[i].result->storageHostName.in());
-			tids.push_back((pthread_t)(-1));
-		}
+				commitArgs[i].options.RemoteHostname, commitArgs[i].result->stored->storageHostName.in());
 
-		tids.push_back(a_tid);
+		submit(AsynchStorageCommitment, commitArgs[i], tasks);
 	}
 }
 
@@ -158,11 +148,9 @@ EitherCommit& EitherCommit::operator=(const EitherCommit& obj)
 }
 
 void EitherCommit::commit(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids)
+						list<TaskFuture*>& tasks)
 {	
-	pthread_t      a_tid;
-
-    tids.clear();
+    tasks.clear();
 
     /*
      * Now, do Either Storage Commitment
@@ -171,16 +159,8 @@ void EitherCommit::commit(vector<COMMIT_ARGS>& commitArgs,
 	{
 		::Message(MNOTE, toEndUser | toService | MLoverall, 
 				  "'Either storage commitment' from %s for data stored on %s.",
-				  commitArgs[i].options.RemoteHostname, commitArgs[i].result->storageHostName.in());
-
-		if( pthread_create(&a_tid, NULL, EitherStorageCommitment, (void*)&commitArgs[i]) != 0)
-		{
-			::Message( MALARM, toEndUser | toService | MLoverall, 
-					"#Software error: cannot create a thread for 'either storage commitment' from %s for data stored on %s.",
-					commitArgs[i].options.RemoteHostname, commitArgs[i].result->storageHostName.in());
-			tids.push_back((pthread_t)(-1));
-		}
+				  commitArgs[i].options.RemoteHostname, commitArgs[i].result->stored->storageHostName.in());
 
-		tids.push_back(a_tid);
+		submit(EitherStorageCommitment, commitArgs[i], tasks);
 	}
 }
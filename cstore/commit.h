@@ -11,6 +11,7 @@
  */
 
 #include "cstoreutils.h"
+#include "commitCoalescer.h"
 
 struct CommitConfig
 {
@@ -31,7 +32,13 @@ public:
 	Commit& operator=(const Commit& obj);
 
 	virtual void commit(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids) = 0;
+						list<TaskFuture*>& tasks) = 0;
+
+protected:
+	// Hand the commit to the CommitCoalescer, or run it on its own if
+	// it cannot wait for other commits to the same commit target
+	static void submit(CommitFunction function, COMMIT_ARGS& commitArgs,
+					   list<TaskFuture*>& tasks);
 };
 
 /*
@@ -47,7 +54,7 @@ public:
 	SynchCommit& operator=(const SynchCommit& obj);
 
 	void commit(vector<COMMIT_ARGS>& commitArgs,
-				list<pthread_t>& tids);
+				list<TaskFuture*>& tasks);
 };
 
 /*
@@ -63,7 +70,7 @@ public:
 	AsynchCommit& operator=(const AsynchCommit& obj);
 
 	void commit(vector<COMMIT_ARGS>& commitArgs,
-				list<pthread_t>& tids);
+				list<TaskFuture*>& tasks);
 };
 
 /*
@@ -79,7 +86,7 @@ public:
 	EitherCommit& operator=(const EitherCommit& obj);
 
 	void commit(vector<COMMIT_ARGS>& commitArgs,
-				list<pthread_t>& tids);
+				list<TaskFuture*>& tasks);
 };
 
 #endif
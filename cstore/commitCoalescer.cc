@@ -0,0 +1,344 @@
+/*
+ * file:	commitCoalescer.cc
+ * purpose:	Implementation of the CommitBatch and CommitCoalescer classes
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include "commitCoalescer.h"
+
+extern int CommitCoalesceWindow;
+
+CommitCoalescer* CommitCoalescer::_instance = NULL;  /* handle of singleton object */
+
+static bool isDue(const struct timeval& due, const struct timeval& now)
+{
+	return now.tv_sec > due.tv_sec || (now.tv_sec == due.tv_sec && now.tv_usec >= due.tv_usec);
+}
+
+/*
+ * CommitBatch class
+ */
+
+CommitBatch::CommitBatch(CommitFunction function, const COMMIT_ARGS& commitArgs)
+			: _outstanding (0),
+			  _armed (false),
+			  _failed (false),
+			  _function (function),
+			  _args (commitArgs),
+			  _result (NULL)
+{
+	pthread_mutex_init(&_lock, NULL);
+
+	_merged.storageHostName = CORBA::string_dup(commitArgs.result->stored->storageHostName.in());
+	_merged.storageCommitRequired = true;
+	_merged.transactionUID = CORBA::string_dup("");
+	CountResultStrings(2);
+
+	gettimeofday(&due, NULL);
+	due.tv_sec += CommitCoalesceWindow / 1000;
+	due.tv_usec += (CommitCoalesceWindow % 1000) * 1000;
+	if (due.tv_usec >= 1000000)
+	{
+		due.tv_sec++;
+		due.tv_usec -= 1000000;
+	}
+}
+
+CommitBatch::~CommitBatch()
+{
+	delete _result;
+	pthread_mutex_destroy(&_lock);
+}
+
+CommitBatch::CommitBatch(const CommitBatch&)
+{
+}
+
+CommitBatch& CommitBatch::operator=(const CommitBatch&)
+{
+	return *this;
+}
+
+bool CommitBatch::matches(CommitFunction function, const COMMIT_OPTIONS& options) const
+{
+	return function == _function &&
+		   options.RemotePort == _args.options.RemotePort &&
+		   !strcmp(options.RemoteAE, _args.options.RemoteAE) &&
+		   !strcmp(options.RemoteHostname, _args.options.RemoteHostname);
+}
+
+/*
+ * Append the files of the commit. The caller must hold the lock of the
+ * CommitCoalescer.
+ */
+void CommitBatch::add(const COMMIT_ARGS& commitArgs)
+{
+	const DICOMStoragePkg::ResultByFileList& files = commitArgs.result->stored->resultByFiles;
+	int offset = (int)_merged.resultByFiles.length();
+
+	_merged.resultByFiles.length(offset + files.length());
+	for (int i=0; i<(int)files.length(); i++)
+	{
+		DICOMStoragePkg::ResultByFile& file = _merged.resultByFiles[offset + i];
+
+		file.imgFile = CORBA::string_dup(files[i].imgFile.in());
+		file.SOPClassUID = CORBA::string_dup(files[i].SOPClassUID.in());
+		file.SOPInstanceUID = CORBA::string_dup(files[i].SOPInstanceUID.in());
+		file.storageOutcome = files[i].storageOutcome;
+		file.commitOutcome = files[i].commitOutcome;
+	}
+	CountResultStrings(3 * files.length());
+
+	_members.push_back(commitArgs.result);
+	_waiters.push_back(commitArgs.waiter);
+	_offsets.push_back(offset);
+
+	// The member is reported when the batch is
+	commitArgs.waiter->commitExpected();
+}
+
+void CommitBatch::commitExpected()
+{
+	pthread_mutex_lock(&_lock);
+	_outstanding++;
+	pthread_mutex_unlock(&_lock);
+}
+
+void CommitBatch::commitReported()
+{
+	bool last;
+
+	pthread_mutex_lock(&_lock);
+	last = --_outstanding == 0 && _armed;
+	pthread_mutex_unlock(&_lock);
+
+	if (last)
+		finish();
+}
+
+void CommitBatch::commitFailed()
+{
+	pthread_mutex_lock(&_lock);
+	_failed = true;
+	pthread_mutex_unlock(&_lock);
+}
+
+/*
+ * Copy the outcomes and the transactions that cover them back to each
+ * commit, tell its waiter and delete the batch
+ */
+void CommitBatch::finish()
+{
+	for (unsigned int m=0; m<_members.size(); m++)
+	{
+		CommitResult* member = _members[m];
+		int           first = _offsets[m];
+		int           end = first + (int)member->commitOutcome.size();
+
+		for (int i=first; i<end; i++)
+		{
+			member->commitOutcome[i - first] = _result->commitOutcome[i];
+			member->missing[i - first] = _result->missing[i];
+		}
+
+		member->transactions.clear();
+		for (unsigned int t=0; t<_result->transactions.size(); t++)
+		{
+			CommitTransaction transaction = _result->transactions[t];
+
+			if (transaction.endFile <= first || transaction.firstFile >= end)
+				continue;
+			transaction.firstFile = (transaction.firstFile > first ? transaction.firstFile : first) - first;
+			transaction.endFile = (transaction.endFile < end ? transaction.endFile : end) - first;
+			member->transactions.push_back(transaction);
+		}
+
+		if (_failed)
+			_waiters[m]->commitFailed();
+		_waiters[m]->commitReported();
+	}
+
+	delete this;
+}
+
+void* CommitBatch::run(void* thisBatch)
+{
+	CommitBatch* batch = (CommitBatch*)thisBatch;
+	void*        status;
+	bool         ready;
+
+	if (batch->_members.size() > 1)
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				  "Storage commitment of %d objects from %d commits to %s is sent together",
+				  batch->numFiles(), batch->numMembers(), batch->_args.options.RemoteHostname);
+
+	batch->_result = new CommitResult(&batch->_merged);
+	batch->_args.result = batch->_result;
+	batch->_args.waiter = batch;
+
+	status = batch->_function((void*)&batch->_args);
+
+	pthread_mutex_lock(&batch->_lock);
+	if ( status == NULL || *(const int*)status == THREAD_EXCEPTION )
+		batch->_failed = true;
+	batch->_armed = true;
+	ready = batch->_outstanding == 0;
+	pthread_mutex_unlock(&batch->_lock);
+
+	if (ready)
+		batch->finish();
+
+	return (void *) &THREAD_NORMAL_EXIT;
+}
+
+/*
+ * CommitCoalescer class
+ */
+
+CommitCoalescer* CommitCoalescer::instance()
+{
+	if (!_instance)
+		_instance = new CommitCoalescer();
+
+	return _instance;
+}
+
+CommitCoalescer::CommitCoalescer()
+			: _started (false),
+			  _numBatches (0),
+			  _numCommits (0),
+			  _numFiles (0)
+{
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_wakeup, NULL);
+}
+
+CommitCoalescer::~CommitCoalescer()
+{
+	pthread_cond_destroy(&_wakeup);
+	pthread_mutex_destroy(&_lock);
+}
+
+CommitCoalescer::CommitCoalescer(const CommitCoalescer&)
+{
+}
+
+CommitCoalescer& CommitCoalescer::operator=(const CommitCoalescer&)
+{
+	return *this;
+}
+
+bool CommitCoalescer::join(CommitFunction function, COMMIT_ARGS& commitArgs)
+{
+	CommitBatch*   batch = NULL;
+	pthread_t      tid;
+	pthread_attr_t attr;
+
+	if (CommitCoalesceWindow <= 0 || !commitArgs.waiter || !commitArgs.result->stored->resultByFiles.length())
+		return false;
+
+	pthread_mutex_lock(&_lock);
+	if (!_started)
+	{
+		pthread_attr_init(&attr); // Initialize with the default value
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if( pthread_create(&tid, &attr, CommitCoalescer::flusher, (void*)this) != 0)
+			::Message( MALARM, toEndUser | toService | MLoverall,
+					   "Cstore failed to create a thread to send coalesced storage commitments");
+		else
+			_started = true;
+		pthread_attr_destroy(&attr);
+	}
+	if (!_started)
+	{
+		pthread_mutex_unlock(&_lock);
+		return false;
+	}
+
+	for (list<CommitBatch*>::iterator iter = _open.begin(); iter != _open.end(); ++iter)
+		if ((*iter)->matches(function, commitArgs.options))
+		{
+			batch = *iter;
+			break;
+		}
+
+	if (!batch)
+	{
+		batch = new CommitBatch(function, commitArgs);
+		_open.push_back(batch);
+		_numBatches++;
+		pthread_cond_signal(&_wakeup);
+	}
+
+	batch->add(commitArgs);
+	_numCommits++;
+	_numFiles += commitArgs.result->stored->resultByFiles.length();
+	pthread_mutex_unlock(&_lock);
+
+	return true;
+}
+
+void CommitCoalescer::report()
+{
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "Commit coalescing window %dms: %lu commit(s) of %lu object(s) sent in %lu batch(es), %d batch(es) open",
+			  CommitCoalesceWindow, _numCommits, _numFiles, _numBatches, (int)_open.size());
+	pthread_mutex_unlock(&_lock);
+}
+
+/****************************************************************************
+ *
+ *  Function    :   flusher
+ *
+ *  Parameters  :   thisClass - the CommitCoalescer instance
+ *
+ *  Returns     :   NULL
+ *
+ *  Description :   Sleeps until the window of the oldest open batch is
+ *                  over, then hands the batch to the worker pool to run.
+ *
+ ****************************************************************************/
+void* CommitCoalescer::flusher(void* thisClass)
+{
+	CommitCoalescer*    coalescer = (CommitCoalescer*)thisClass;
+	list<CommitBatch*>  due;
+	struct timeval      now;
+	struct timespec     wakeup;
+
+	pthread_mutex_lock(&coalescer->_lock);
+	for (;;)
+	{
+		if (coalescer->_open.empty())
+		{
+			pthread_cond_wait(&coalescer->_wakeup, &coalescer->_lock);
+			continue;
+		}
+
+		// Batches are opened in order, so the first is due first
+		gettimeofday(&now, NULL);
+		while (!coalescer->_open.empty() && isDue(coalescer->_open.front()->due, now))
+		{
+			due.push_back(coalescer->_open.front());
+			coalescer->_open.pop_front();
+		}
+
+		if (due.empty())
+		{
+			wakeup.tv_sec = coalescer->_open.front()->due.tv_sec;
+			wakeup.tv_nsec = coalescer->_open.front()->due.tv_usec * 1000;
+			pthread_cond_timedwait(&coalescer->_wakeup, &coalescer->_lock, &wakeup);
+			continue;
+		}
+
+		pthread_mutex_unlock(&coalescer->_lock);
+		for (list<CommitBatch*>::iterator iter = due.begin(); iter != due.end(); ++iter)
+			WorkerPool::instance()->submit(CommitBatch::run, (void*)*iter, true);
+		due.clear();
+		pthread_mutex_lock(&coalescer->_lock);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,110 @@
+#ifndef _COMMITCOALESCER_H_
+#define _COMMITCOALESCER_H_
+
+/*
+ * file:	commitCoalescer.h
+ * purpose:	CommitCoalescer singleton that holds the commits to one commit
+ *          target for CommitCoalesceWindow milliseconds (line 16 of
+ *          cstoredefaults.txt, 0 turns it off) and commits the files of
+ *          all of them in one go, on one association. A series by series
+ *          export then sends one N-ACTION rather than one per series. When
+ *          the reports are in, the outcomes are copied back into the
+ *          CommitResult of each commit and its CommitWaiter is told.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <list>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "cstoreutils.h"
+#include "commitListener.h"
+
+using namespace std;
+
+/*
+ * SynchStorageCommitment, AsynchStorageCommitment or EitherStorageCommitment
+ */
+typedef void* (*CommitFunction)(void* commit_args);
+
+/*
+ * The commits to one commit target that are sent together
+ */
+class CommitBatch : public CommitWaiter
+{
+	pthread_mutex_t                        _lock;         /* protects the three below */
+	int                                    _outstanding;  /* N-EVENT-REPORTs still expected */
+	bool                                   _armed;        /* the commit function returned */
+	bool                                   _failed;
+
+	CommitFunction                         _function;
+	COMMIT_ARGS                            _args;         /* of the first commit, for the merged files */
+	DICOMStoragePkg::ResultByStorageTarget _merged;       /* the files of all the commits */
+	CommitResult*                          _result;       /* over _merged, made when run */
+	vector<CommitResult*>                  _members;
+	vector<CommitWaiter*>                  _waiters;
+	vector<int>                            _offsets;      /* first file of each member in _merged */
+
+	// Disallow copying or assignment.
+	CommitBatch(const CommitBatch&);
+	CommitBatch& operator=(const CommitBatch&);
+
+	void finish();
+
+public:
+	struct timeval                         due;
+
+	CommitBatch(CommitFunction function, const COMMIT_ARGS& commitArgs);
+	~CommitBatch();
+
+	bool matches(CommitFunction function, const COMMIT_OPTIONS& options) const;
+	void add(const COMMIT_ARGS& commitArgs);
+	int numMembers() const { return (int)_members.size(); }
+	int numFiles() const { return (int)_merged.resultByFiles.length(); }
+
+	// CommitWaiter
+	void commitExpected();
+	void commitReported();
+	void commitFailed();
+
+	// Commit the merged files, then deletes the batch once they are reported
+	static void* run(void* thisBatch);
+};
+
+class CommitCoalescer
+{
+	static CommitCoalescer* _instance;
+	pthread_mutex_t         _lock;      /* protects everything below */
+	pthread_cond_t          _wakeup;
+	list<CommitBatch*>      _open;      /* still taking commits */
+	bool                    _started;
+	unsigned long           _numBatches;
+	unsigned long           _numCommits;
+	unsigned long           _numFiles;
+
+	CommitCoalescer();
+
+	// Disallow copying or assignment.
+	CommitCoalescer(const CommitCoalescer&);
+	CommitCoalescer& operator=(const CommitCoalescer&);
+
+public:
+	static CommitCoalescer* instance();
+	~CommitCoalescer();
+
+	// Hold the commit for a batch to its commit target. Returns false if
+	// it is not held and must be run on its own: the window is 0, or it
+	// has no CommitWaiter or no files.
+	bool join(CommitFunction function, COMMIT_ARGS& commitArgs);
+
+	// Write the counts to the log
+	void report();
+
+	static void* flusher(void* thisClass);
+};
+
+#endif
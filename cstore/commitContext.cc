@@ -10,33 +10,37 @@
 
 static const char *cameraName = "camera";
 ThreadMutex g_lock_commitWait;  /* Serialize access to the critical section.*/
+extern int CommitRetryLimit;
 
 /*
  * CommitContext class
  */
 
 CommitContext::CommitContext(int applicationID, const CommitConfig& commitConfig, 
-							 const DICOMStoragePkg::ResultByStorageTargetList& resultByStorageTargets,
+							 SharedResult* sharedResult,
 							 CommitStrategy* commitStrategy)
 				:_commitConfig (commitConfig),
 				 _commitStrategy (commitStrategy),
-				 _tid (0),
-				 _resultByStorageTargets (resultByStorageTargets)
+				 _sharedResult (sharedResult)
 {
-	unsigned int i;
+	int          i;
 	COMMIT_ARGS  commitArgs;
 
+	_sharedResult->addReference();
+
 	commitArgs.options = buildOptions();
 	commitArgs.appID   = applicationID;
 
     /*
-     * Now, build _commitArgs to point to local _resultByStorageTargets
+     * Now, build _commitArgs to point to local _commitResults, which point
+     * to the shared files and UIDs
      */
-	for(i=0; i<_resultByStorageTargets.length(); i++)
+	for(i=0; i<_sharedResult->numTargets(); i++)
 	{
-		commitArgs.result = const_cast<DICOMStoragePkg::ResultByStorageTarget*>(&(_resultByStorageTargets[i]));
+		_commitResults.push_back(CommitResult(&_sharedResult->target(i)));
 		_commitArgs.push_back(commitArgs);
 	}
+	pointArgsToResults();
 }
 
 CommitContext::~CommitContext()
@@ -44,94 +48,162 @@ CommitContext::~CommitContext()
 	// So we return immediately. And leave ~CommitContextPool()
 	// to clean all commitStrategies nicely.
 	// There should be no memory leak.
+	releaseResult();
 }
 
 CommitContext::CommitContext(const CommitContext& obj)
 				:_commitConfig (obj._commitConfig),
 				 _commitStrategy (obj._commitStrategy),
-				 _tid (obj._tid),
-				 _resultByStorageTargets (obj._resultByStorageTargets),
+				 _tasks (obj._tasks),
+				 _sharedResult (obj._sharedResult),
+				 _commitResults (obj._commitResults),
 				 _commitArgs (obj._commitArgs)
 {
-    /*
-     * Now, redirect _commitArgs to point to local _resultByStorageTargets
-     */
-	for(unsigned int i=0; i<_resultByStorageTargets.length(); i++)
-		_commitArgs[i].result = &(_resultByStorageTargets[i]);
+	if (_sharedResult)
+		_sharedResult->addReference();
+	pointArgsToResults();
 }
 
 CommitContext& CommitContext::operator=(const CommitContext& obj)
 {
+	if (obj._sharedResult)
+		obj._sharedResult->addReference();
+	releaseResult();
+
 	_commitConfig = obj._commitConfig;
 	_commitStrategy = obj._commitStrategy;
-	_tid = obj._tid;
-	_resultByStorageTargets = obj._resultByStorageTargets;
+	_tasks = obj._tasks;
+	_sharedResult = obj._sharedResult;
+	_commitResults = obj._commitResults;
 	_commitArgs = obj._commitArgs;
-
-    /*
-     * Now, redirect _commitArgs to point to local _resultByStorageTargets
-     */
-	for(unsigned int i=0; i<_resultByStorageTargets.length(); i++)
-		_commitArgs[i].result = &(_resultByStorageTargets[i]);
+	pointArgsToResults();
 
 	return *this;
 }
 
-list<pthread_t> CommitContext::execute()
+/*
+ * Redirect _commitArgs to point to local _commitResults
+ */
+void CommitContext::pointArgsToResults()
+{
+	for(unsigned int i=0; i<_commitResults.size(); i++)
+		_commitArgs[i].result = &(_commitResults[i]);
+}
+
+void CommitContext::releaseResult()
+{
+	if (_sharedResult)
+		_sharedResult->release();
+	_sharedResult = NULL;
+}
+
+list<TaskFuture*> CommitContext::execute()
 {
-	_commitStrategy->commitAlgorithm(_commitArgs, _tid);
-	return _tid;
+	_commitStrategy->commitAlgorithm(_commitArgs, _tasks);
+	return _tasks;
+}
+
+void CommitContext::setWaiter(CommitWaiter* waiter)
+{
+	for(unsigned int i=0; i<_commitArgs.size(); i++)
+		_commitArgs[i].waiter = waiter;
+}
+
+bool CommitContext::waitForTasks(bool& lost)
+{
+	void* status;
+	bool  completed = true;
+
+    for(list<TaskFuture*>::const_iterator iter=_tasks.begin(); iter != _tasks.end(); ++iter)
+	{
+		// Wait for the task to finish. It is released in cleanCommitStrategy().
+		status = (*iter)->wait();
+
+		// A commit function returns THREAD_EXCEPTION when the association
+		// or an N-ACTION failed. Its files are not committed yet.
+		if ( status == NULL )
+			completed = false;
+		else if ( *(const int*)status == THREAD_EXCEPTION )
+			lost = true;
+	}
+
+	return completed;
 }
 
 bool CommitContext::getResult(DICOMStoragePkg::ResultByCommitTarget& retnValue)
 {
 	DICOMStoragePkg::CommitType ct = _commitStrategy->commitType();
-	int                         status;
+	bool                        move;
+	bool                        lost = false;
 
-	if( ct == DICOMStoragePkg::NO_COMMIT )
+	if( ct == DICOMStoragePkg::NO_COMMIT || !_sharedResult )
+	{
+		releaseResult();
 		return false;
+	}
 
-    for(list<pthread_t>::const_iterator iter=_tid.begin(); iter != _tid.end(); ++iter)
+	// The files of a commit that did not get through stay COMMIT_UNKNOWN
+	if ( !waitForTasks(lost) )
 	{
-		if (*iter == (pthread_t)(-1))
-		{
-			::Message(MWARNING, toEndUser | toService | MLoverall, 
-				"CommitContext::getResult() should not be called before the thread is created.");
-			continue;
-		}
-
-		// Wait for the thread to finish.
-		pthread_join(*iter, (void **)&status);
-
-		if ( status == THREAD_EXCEPTION )
-		{
-			::Message(MWARNING, toEndUser | toService | MLoverall, 
-				"CommitContext::getResult() catches thread exception.");
-			throw ( DictionaryPkg::NucMedException( DictionaryPkg::NUCMED_NETWORK ) );
-			return false;
-		}
+		::Message(MWARNING, toEndUser | toService | MLoverall, 
+			"CommitContext::getResult() catches thread exception.");
+		throw ( DictionaryPkg::NucMedException( DictionaryPkg::NUCMED_NETWORK ) );
+		return false;
 	}
 
     /*
-     * Now, build and return the table
+     * Now, build and return the table. The files and UIDs are copied from
+     * the shared result, or moved if no other commit target needs them.
      */
 	retnValue.commitHostName = CORBA::string_dup(_commitConfig.reportingSystem.hostName);
-	retnValue.resultByStorageTargets = _resultByStorageTargets;
+	retnValue.resultByStorageTargets.length(_commitResults.size());
+
+	move = !_sharedResult->isShared();
+	for(unsigned int i=0; i<_commitResults.size(); i++)
+	{
+		if (move)
+			MoveResultByStorageTarget(_sharedResult->takeTarget(i), retnValue.resultByStorageTargets[i]);
+		else
+			CopyResultByStorageTarget(_sharedResult->target(i), retnValue.resultByStorageTargets[i]);
+		ApplyCommitResult(_commitResults[i], retnValue.resultByStorageTargets[i]);
+	}
+	releaseResult();
 
     return true;
 }
 
+CommitRetry* CommitContext::makeRetry(CommitWaiter* waiter,
+									  const list<DICOMStoragePkg::StorageTarget>& storageTargets)
+{
+	CommitRetry* retry;
+	bool         added = false;
+
+	if( _commitStrategy->commitType() == DICOMStoragePkg::NO_COMMIT || !_sharedResult )
+		return NULL;
+
+	retry = new CommitRetry(waiter, _commitStrategy, storageTargets);
+	for(unsigned int i=0; i<_commitArgs.size(); i++)
+		if (retry->add(_commitArgs[i]))
+			added = true;
+
+	if (!added)
+	{
+		delete retry;
+		return NULL;
+	}
+	return retry;
+}
+
 void CommitContext::cleanCommitStrategy()
-{	list<pthread_t>::iterator iter;
+{	list<TaskFuture*>::iterator iter;
 
-    for(iter=_tid.begin(); iter != _tid.end(); ++iter)
+    for(iter=_tasks.begin(); iter != _tasks.end(); ++iter)
 	{
-		if (*iter != (pthread_t)(-1))
-		{
-			// Wait for the thread to finish.
-			pthread_join(*iter, NULL);
-		}
+		// Wait for the task to finish.
+		(*iter)->wait();
+		(*iter)->release();
 	}
+	_tasks.clear();
 
 	delete _commitStrategy;
 }
@@ -152,25 +224,40 @@ void CommitContextPool::cleanCommitStrategies()
 CommitContextPool::CommitContextPool()
 {
 	_cameraConnection = NULL;
+	_outstanding = 0;
+	_armed = false;
+	_failed = false;
+	_lost = false;
+	gettimeofday(&_started, NULL);
+	_storeStarted.tv_sec = 0;
+	_storeStarted.tv_usec = 0;
+	_attempts = 0;
+	pthread_mutex_init(&_lock, NULL);
 }
 
 CommitContextPool::~CommitContextPool()
 {
 	cleanCommitStrategies();
 	// _cameraConnection is used by all instances of CommitContextPool
+	pthread_mutex_destroy(&_lock);
 }
 
 CommitContextPool::CommitContextPool(const CommitContextPool& obj)
-					: _pool (obj._pool), _tid (obj._tid),
-					  _cameraConnection (obj._cameraConnection)
+					: _pool (obj._pool), _tasks (obj._tasks),
+					  _cameraConnection (obj._cameraConnection),
+					  _outstanding (0), _armed (false), _failed (false), _lost (false),
+					  _started (obj._started), _storeStarted (obj._storeStarted),
+					  _attempts (0), _storageTargets (obj._storageTargets)
 {
+	pthread_mutex_init(&_lock, NULL);
 }
 
 CommitContextPool& CommitContextPool::operator=(const CommitContextPool& obj)
 {
 	_pool = obj._pool;
-	_tid = obj._tid;
+	_tasks = obj._tasks;
 	_cameraConnection = obj._cameraConnection;
+	_storageTargets = obj._storageTargets;
 
 	return *this;
 }
@@ -183,23 +270,43 @@ void CommitContextPool::operator+=(CommitContext& commitContext)
 void CommitContextPool::clear()
 {
 	_pool.clear();
-	_tid.clear();
+	_tasks.clear();
 	_cameraConnection = NULL; // local copy cleared
 }
 
-list<list<pthread_t> > CommitContextPool::execute()
+list<list<TaskFuture*> > CommitContextPool::execute()
 {	list<CommitContext>::iterator iter;
 
-	_tid.clear();
+	_tasks.clear();
+	gettimeofday(&_started, NULL);
     for(iter=_pool.begin(); iter != _pool.end(); ++iter)
-	{	// Each execute returns a list of thread IDs
-		_tid.push_back(iter->execute());
+	{	// Each execute returns a list of submitted tasks
+		iter->setWaiter(this);
+		_tasks.push_back(iter->execute());
 	}
 
-	return _tid;
+	return _tasks;
 }
 
 void CommitContextPool::setCamera(ConnectCamera*& cameraConnection)
+{
+	connectCamera(cameraConnection);
+
+	// Finally, keep a local copy
+	_cameraConnection = cameraConnection;
+}
+
+void CommitContextPool::setStoreStarted(const struct timeval& storeStarted)
+{
+	_storeStarted = storeStarted;
+}
+
+void CommitContextPool::setStorageTargets(const list<DICOMStoragePkg::StorageTarget>& storageTargets)
+{
+	_storageTargets = storageTargets;
+}
+
+void CommitContextPool::connectCamera(ConnectCamera*& cameraConnection)
 {
 	if (cameraConnection == NULL)
 	{
@@ -233,12 +340,132 @@ void CommitContextPool::setCamera(ConnectCamera*& cameraConnection)
 		}
 		fprintf(stderr,"\n");
 	}
+}
 
-	// Finally, keep a local copy
-	_cameraConnection = cameraConnection;
+void CommitContextPool::commitExpected()
+{
+	pthread_mutex_lock(&_lock);
+	_outstanding++;
+	pthread_mutex_unlock(&_lock);
+}
+
+void CommitContextPool::commitReported()
+{
+	bool last;
+
+	pthread_mutex_lock(&_lock);
+	last = --_outstanding == 0 && _armed;
+	pthread_mutex_unlock(&_lock);
+
+	// Report from a worker rather than the listener thread
+	if (last)
+		WorkerPool::instance()->submit(CommitContextPool::completeResult, (void *)this, true);
+}
+
+void CommitContextPool::commitFailed()
+{
+	pthread_mutex_lock(&_lock);
+	_lost = true;
+	pthread_mutex_unlock(&_lock);
 }
 
 void* CommitContextPool::getResult(void* thisClass)
+{
+	CommitContextPool *pCommitContextPool;
+	list<CommitContext>::iterator iter;
+	list<list<TaskFuture*> >::const_iterator tasks;
+	struct timeval done;
+	bool failed = false, lost = false, reportNow;
+	int numTransactions = 0;
+
+	pCommitContextPool = (CommitContextPool*)thisClass;
+
+	// An asynchronous commit task only sends the N-ACTION, so this does not
+	// wait for its report
+	for(iter=pCommitContextPool->_pool.begin(); iter != pCommitContextPool->_pool.end(); ++iter)
+		if (!iter->waitForTasks(lost))
+			failed = true;
+
+	// The commit targets and their transactions run side by side, so this
+	// should stay near the time of the slowest one
+	gettimeofday(&done, NULL);
+	for(tasks=pCommitContextPool->_tasks.begin(); tasks != pCommitContextPool->_tasks.end(); ++tasks)
+		numTransactions += tasks->size();
+	::Message(MNOTE, toEndUser | toService | MLoverall, 
+			"Commit tasks of %d commit target(s), %d transaction(s) done in %.2fs",
+			(int)pCommitContextPool->_pool.size(), numTransactions,
+			(done.tv_sec - pCommitContextPool->_started.tv_sec) + (done.tv_usec - pCommitContextPool->_started.tv_usec) / 1000000.0);
+
+	pthread_mutex_lock(&pCommitContextPool->_lock);
+	pCommitContextPool->_failed = pCommitContextPool->_failed || failed;
+	pCommitContextPool->_lost = pCommitContextPool->_lost || lost;
+	pCommitContextPool->_armed = true;
+	reportNow = pCommitContextPool->_outstanding == 0;
+	pthread_mutex_unlock(&pCommitContextPool->_lock);
+
+	if (reportNow)
+		return completeResult(thisClass);
+
+	::Message(MNOTE, toEndUser | toService | MLoverall, 
+			"Commit status is reported when the asynchronous N-EVENT-REPORT(s) are in");
+	return NULL;
+}
+
+/*
+ * Commit the files that failed or were never reported again, with the
+ * next backoff. A commit whose association or N-ACTION failed left all
+ * its files COMMIT_UNKNOWN, so they are committed again too. Return false
+ * if there are none, no retries are left or a commit task itself failed.
+ */
+bool CommitContextPool::retry()
+{
+	list<CommitRetry*> retries;
+	list<CommitContext>::iterator iter;
+	list<CommitRetry*>::iterator r;
+	CommitRetry* retry;
+	int numFiles = 0, delay;
+
+	if (_failed || _attempts >= CommitRetryLimit)
+		return false;
+
+	for(iter=_pool.begin(); iter != _pool.end(); ++iter)
+		if ((retry = iter->makeRetry(this, _storageTargets)) != NULL)
+		{
+			retries.push_back(retry);
+			numFiles += retry->numFiles();
+		}
+	if (retries.empty())
+		return false;
+
+	delay = CommitRetry::backoff(_attempts++);
+	::Message(MNOTE, toEndUser | toService | MLoverall, 
+			"%d file(s) are not committed, committing them again in %ds, attempt %d of %d",
+			numFiles, delay, _attempts, CommitRetryLimit);
+
+	// The pool is reported once every retry is done. What the retries
+	// cannot commit is reported as not committed.
+	pthread_mutex_lock(&_lock);
+	_lost = false;
+	pthread_mutex_unlock(&_lock);
+	for(r=retries.begin(); r != retries.end(); ++r)
+		commitExpected();
+	for(r=retries.begin(); r != retries.end(); ++r)
+		CommitRetry::schedule(*r, delay);
+
+	return true;
+}
+
+void* CommitContextPool::completeResult(void* thisClass)
+{
+	CommitContextPool *pCommitContextPool = (CommitContextPool*)thisClass;
+
+	if (pCommitContextPool->retry())
+		return NULL;
+
+	return reportResult(thisClass);
+}
+
+void* CommitContextPool::reportResult(void* thisClass)
 {	MutexGuard guard (g_lock_commitWait);
 
 	CommitContextPool *pCommitContextPool;
@@ -248,19 +475,25 @@ void* CommitContextPool::getResult(void* thisClass)
 	int i = 0;
 
 	pCommitContextPool = (CommitContextPool*)thisClass;
+	if (pCommitContextPool->_failed || pCommitContextPool->_lost)
+	{
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				"CommitContextPool::reportResult() skips report, a commit task failed\n");
+		delete pCommitContextPool;
+		guard.release();
+		return NULL;
+	}
+
 	commitReport = new DICOMStoragePkg::CommitReport;
 	commitReport->length(pCommitContextPool->_pool.size());
 
 	try
 	{
 		for(iter=pCommitContextPool->_pool.begin(); iter != pCommitContextPool->_pool.end(); ++iter, ++i)
-		{	DICOMStoragePkg::ResultByCommitTarget resultByCommitTarget;
-
-			if (iter->getResult(resultByCommitTarget))
-			{
-				commitReport[i]=resultByCommitTarget;
+		{
+			// Filled in place, the report is the only copy
+			if (iter->getResult(commitReport[i]))
 				hasResult = 1; // There will be no result if NoCommit on
-			}
 		}
 	}
 	catch(...)
@@ -269,7 +502,7 @@ void* CommitContextPool::getResult(void* thisClass)
 				"CommitContextPool::getResult() caught exception\n");
 		delete pCommitContextPool;
 		guard.release();
-		pthread_exit( NULL );
+		return NULL;
 	}
 
 	// Call the controller or imageHandlingServer back to return the commit results;
@@ -280,7 +513,19 @@ void* CommitContextPool::getResult(void* thisClass)
 		if ( hasResult )
 		{
 			if ( pCommitContextPool->_cameraConnection != NULL )
+			{
 				pCommitContextPool->_cameraConnection->reportCommitStatus(commitReport.in());
+				if (pCommitContextPool->_storeStarted.tv_sec)
+				{
+					struct timeval reported;
+
+					gettimeofday(&reported, NULL);
+					::Message(MNOTE, toEndUser | toService | MLoverall, 
+							"Commit status reported %.2fs after the store started",
+							(reported.tv_sec - pCommitContextPool->_storeStarted.tv_sec) +
+							(reported.tv_usec - pCommitContextPool->_storeStarted.tv_usec) / 1000000.0);
+				}
+			}
 			else
 				::Message(MWARNING, toEndUser | toService | MLoverall, 
 						"Cstore is unable to report Commit Status due to no connection");
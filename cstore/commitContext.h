@@ -5,51 +5,80 @@
  * file:	commitContext.h
  * purpose:	CommitContext is a place holder for the commitment information,
  *          one per storage commitment target. CommitContextPool manages the
- *          group of storage commitment targets.
+ *          group of storage commitment targets. The contexts of an export
+ *          share one SharedResult and keep only their own commit outcomes.
+ *          The commit report goes to the camera once the commit tasks are
+ *          done and every asynchronous N-EVENT-REPORT the CommitListener
+ *          expects for the pool has come in.
  *
  * revision history:
  *   Jiantao Huang		    initial version
  */
 
+#include <sys/time.h>
+
 #include "control/connectcamera.h"
 #include "commitStrategy.h"
+#include "commitListener.h"
+#include "commitRetry.h"
 
 class CommitContext
 {
 public:
 	CommitConfig              _commitConfig;
 	CommitStrategy*           _commitStrategy;
-	list<pthread_t>           _tid;
-	DICOMStoragePkg::ResultByStorageTargetList _resultByStorageTargets;
+	list<TaskFuture*>         _tasks;
+	SharedResult*             _sharedResult;   /* NULL once the result is reported */
+	vector<CommitResult>      _commitResults;  /* one per storage target */
 
 public:
 
+	// Adds a reference to sharedResult
 	CommitContext(int applicationID, const CommitConfig& commitConfig, 
-				const DICOMStoragePkg::ResultByStorageTargetList& resultByStorageTargets,
+				SharedResult* sharedResult,
 				CommitStrategy* commitStrategy);
 	~CommitContext();
 	CommitContext(const CommitContext& obj);
 	CommitContext& operator=(const CommitContext& obj);
 
-	list<pthread_t> execute();
+	list<TaskFuture*> execute();
+	void setWaiter(CommitWaiter* waiter);
 
+	// return false if a commit task failed, set lost if the association or
+	// an N-ACTION of one failed
+	bool waitForTasks(bool& lost);
 	// return true if retnValue is usable
 	bool getResult(DICOMStoragePkg::ResultByCommitTarget& retnValue);
 	void cleanCommitStrategy();
+	// Return a retry of the files that are not committed, NULL if all are
+	CommitRetry* makeRetry(CommitWaiter* waiter,
+						   const list<DICOMStoragePkg::StorageTarget>& storageTargets);
 
 private:
 	vector<COMMIT_ARGS>       _commitArgs;
 
 	COMMIT_OPTIONS            buildOptions();
+	void                      pointArgsToResults();
+	void                      releaseResult();
 };
 
-class CommitContextPool
+class CommitContextPool : public CommitWaiter
 {
 	list<CommitContext>    _pool;
-	list<list<pthread_t> > _tid;
+	list<list<TaskFuture*> > _tasks;
 	ConnectCamera*         _cameraConnection;
+	pthread_mutex_t        _lock;          /* protects the four below */
+	int                    _outstanding;   /* N-EVENT-REPORTs still expected */
+	bool                   _armed;         /* the commit tasks are done */
+	bool                   _failed;        /* a commit task failed, nothing is reported */
+	bool                   _lost;          /* an association or N-ACTION failed, retried if allowed */
+	struct timeval         _started;       /* when the commit tasks were submitted */
+	struct timeval         _storeStarted;  /* when the store of the files started, if known */
+	int                    _attempts;      /* retries of the files not committed so far */
+	list<DICOMStoragePkg::StorageTarget> _storageTargets;  /* to store missing files again, if known */
 
 	void cleanCommitStrategies();
+	bool retry();
 
 public:
 
@@ -61,9 +90,27 @@ public:
 	void operator+=(CommitContext& obj);
 	void clear();
 
-	list<list<pthread_t> > execute();
+	list<list<TaskFuture*> > execute();
 	void setCamera(ConnectCamera*& cameraConnection);
+	// Connect to the camera if cameraConnection is NULL. It stays NULL if
+	// the camera cannot be reached.
+	static void connectCamera(ConnectCamera*& cameraConnection);
+	// Log the time from the start of the store to the report
+	void setStoreStarted(const struct timeval& storeStarted);
+	// Where the files were stored, for a retry to store missing files again
+	void setStorageTargets(const list<DICOMStoragePkg::StorageTarget>& storageTargets);
+
+	// CommitWaiter
+	void commitExpected();
+	void commitReported();
+	void commitFailed();
+
+	// Wait for the commit tasks, then report, now or after the last
+	// asynchronous N-EVENT-REPORT. The pool deletes itself after reporting.
 	static void* getResult(void* thisClass);
+	// Retry the files that are not committed, or report
+	static void* completeResult(void* thisClass);
+	static void* reportResult(void* thisClass);
 };
 
 #endif
@@ -0,0 +1,235 @@
+/*
+ * file:	commitHistory.cc
+ * purpose:	Implementation of the CommitHistory class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "commitHistory.h"
+
+static const char historyFile[] = "data/Facility/Cstore/commithistory.txt";
+static const char historyTempFile[] = "data/Facility/Cstore/commithistory.txt.tmp";
+static const int  RecentAnswers = 16;      /* answers the prediction looks at */
+static const int  MinRecentAnswers = 3;    /* answers needed before the wait is cut */
+static const int  AsynchPercent = 75;      /* recent answers asynchronous to not wait at all */
+static const int  CheckInterval = 20;      /* commits between two that wait the whole time */
+static const int  MinSynchWait = 5;        /* seconds a synchronous target is waited for at least */
+static const double LatencyWeight = 0.2;   /* of the newest answer in the moving averages */
+static const double PeakDecay = 0.9;       /* of the slowest answer per answer after it */
+
+CommitHistory* CommitHistory::_instance = NULL;  /* handle of singleton object */
+
+CommitTargetHistory::CommitTargetHistory()
+			: numSynch (0),
+			  numAsynch (0),
+			  recent (0),
+			  numRecent (0),
+			  synchLatency (0.0),
+			  synchPeak (0.0),
+			  asynchLatency (0.0),
+			  sinceCheck (0),
+			  savedWait (0.0)
+{
+}
+
+int CommitTargetHistory::numRecentAsynch() const
+{
+	int count = 0;
+
+	for (int i = 0; i < numRecent; i++)
+		if (recent & (1U << i))
+			count++;
+	return count;
+}
+
+CommitHistory* CommitHistory::instance()
+{
+	if (!_instance)
+		_instance = new CommitHistory();
+
+	return _instance;
+}
+
+CommitHistory::CommitHistory()
+{
+	pthread_mutex_init(&_lock, NULL);
+	load();
+}
+
+CommitHistory::~CommitHistory()
+{
+	pthread_mutex_destroy(&_lock);
+}
+
+CommitHistory::CommitHistory(const CommitHistory&)
+{
+}
+
+CommitHistory& CommitHistory::operator=(const CommitHistory&)
+{
+	return *this;
+}
+
+string CommitHistory::key(const COMMIT_OPTIONS& options)
+{
+	char buffer[AE_LENGTH + 128 + 32];
+
+	sprintf(buffer, "%s@%s:%d", options.RemoteAE, options.RemoteHostname, options.RemotePort);
+	return buffer;
+}
+
+/*
+ * One line per commit target, its key and then the numbers, tab separated
+ */
+void CommitHistory::load()
+{
+	std::ifstream       file(historyFile);
+	string              line;
+	char                name[AE_LENGTH + 128 + 32];
+	CommitTargetHistory target;
+
+	while (file.good() && getline(file, line))
+	{
+		if (sscanf(line.c_str(), "%175[^\t]\t%u\t%u\t%u\t%d\t%lf\t%lf\t%lf\t%d\t%lf",
+				   name, &target.numSynch, &target.numAsynch, &target.recent, &target.numRecent,
+				   &target.synchLatency, &target.synchPeak, &target.asynchLatency,
+				   &target.sinceCheck, &target.savedWait) != 10)
+			continue;
+		if (target.numRecent < 0 || target.numRecent > RecentAnswers)
+			target.numRecent = RecentAnswers;
+		_targets[name] = target;
+	}
+
+	if (_targets.size())
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				  "Storage commitment history of %d commit target(s) loaded", (int)_targets.size());
+}
+
+/*
+ * Rewrite the file. The caller holds the lock.
+ */
+void CommitHistory::save()
+{
+	FILE* temp = fopen(historyTempFile, "w");
+	bool  written;
+
+	if (!temp)
+	{
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				  "Cannot write the storage commitment history %s", historyTempFile);
+		return;
+	}
+
+	for (map<string, CommitTargetHistory>::const_iterator iter = _targets.begin(); iter != _targets.end(); ++iter)
+		fprintf(temp, "%s\t%u\t%u\t%u\t%d\t%.3f\t%.3f\t%.3f\t%d\t%.1f\n",
+				iter->first.c_str(), iter->second.numSynch, iter->second.numAsynch,
+				iter->second.recent, iter->second.numRecent, iter->second.synchLatency,
+				iter->second.synchPeak, iter->second.asynchLatency, iter->second.sinceCheck,
+				iter->second.savedWait);
+
+	written = fflush(temp) == 0 && fsync(fileno(temp)) == 0;
+	fclose(temp);
+	if (!written || rename(historyTempFile, historyFile) != 0)
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				  "Cannot write the storage commitment history %s", historyFile);
+}
+
+int CommitHistory::synchWait(const COMMIT_OPTIONS& options)
+{
+	int configured = options.RoleReversalWaitTime;
+	int wait = configured;
+	int numAsynch;
+
+	pthread_mutex_lock(&_lock);
+	CommitTargetHistory& target = _targets[key(options)];
+
+	if (target.numRecent >= MinRecentAnswers && ++target.sinceCheck < CheckInterval)
+	{
+		numAsynch = target.numRecentAsynch();
+		if (numAsynch * 100 >= target.numRecent * AsynchPercent)
+			wait = 0;
+		else if (numAsynch == 0)
+		{
+			// Twice the slowest recent answer, so a slow one is not taken
+			// for an asynchronous target
+			wait = (int)(2.0 * target.synchPeak) + 1;
+			if (wait < MinSynchWait)
+				wait = MinSynchWait;
+		}
+	}
+	if (wait >= configured)
+	{
+		wait = configured;
+		target.sinceCheck = 0;
+	}
+	pthread_mutex_unlock(&_lock);
+
+	return wait;
+}
+
+void CommitHistory::record(const string& key, bool asynch, double latency)
+{
+	pthread_mutex_lock(&_lock);
+	CommitTargetHistory& target = _targets[key];
+
+	target.recent = (target.recent << 1) | (asynch ? 1U : 0U);
+	target.recent &= (1U << RecentAnswers) - 1;
+	if (target.numRecent < RecentAnswers)
+		target.numRecent++;
+
+	if (asynch)
+	{
+		target.asynchLatency = target.numAsynch++ ? (1.0 - LatencyWeight) * target.asynchLatency + LatencyWeight * latency
+												  : latency;
+	}
+	else
+	{
+		target.synchLatency = target.numSynch++ ? (1.0 - LatencyWeight) * target.synchLatency + LatencyWeight * latency
+												: latency;
+		target.synchPeak = latency > PeakDecay * target.synchPeak ? latency : PeakDecay * target.synchPeak;
+	}
+
+	save();
+	pthread_mutex_unlock(&_lock);
+}
+
+void CommitHistory::recordSynch(const string& target, double latency)
+{
+	record(target, false, latency);
+}
+
+void CommitHistory::recordAsynch(const string& target, double latency)
+{
+	record(target, true, latency);
+}
+
+void CommitHistory::recordSaved(const string& target, double saved)
+{
+	if (saved <= 0.0)
+		return;
+
+	pthread_mutex_lock(&_lock);
+	_targets[target].savedWait += saved;
+	save();
+	pthread_mutex_unlock(&_lock);
+}
+
+void CommitHistory::report()
+{
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "Storage commitment history of %d commit target(s)", (int)_targets.size());
+	for (map<string, CommitTargetHistory>::const_iterator iter = _targets.begin(); iter != _targets.end(); ++iter)
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				  "  %s: %u synchronous (%.1fs, slowest %.1fs), %u asynchronous (%.1fs), %d of the last %d asynchronous, %.0fs of waiting saved",
+				  iter->first.c_str(), iter->second.numSynch, iter->second.synchLatency, iter->second.synchPeak,
+				  iter->second.numAsynch, iter->second.asynchLatency, iter->second.numRecentAsynch(),
+				  iter->second.numRecent, iter->second.savedWait);
+	pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,84 @@
+#ifndef _COMMITHISTORY_H_
+#define _COMMITHISTORY_H_
+
+/*
+ * file:	commitHistory.h
+ * purpose:	CommitHistory singleton that remembers, per commit target, how
+ *          its recent storage commitments were answered: on the N-ACTION
+ *          association (synchronous) or on an association of its own
+ *          (asynchronous), and how long that took. EitherStorageCommitment
+ *          asks it how long to wait for a synchronous answer: not at all
+ *          for a target that answers asynchronously, a little over the
+ *          slowest recent answer for one that answers synchronously, and
+ *          the whole RoleReversalWaitTime while too little is known or
+ *          to check now and then whether the target has changed. The
+ *          history is kept in data/Facility/Cstore/commithistory.txt.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <map>
+#include <string>
+#include <pthread.h>
+
+#include "cstoreutils.h"
+
+using namespace std;
+
+class CommitTargetHistory
+{
+public:
+	unsigned int numSynch;        /* answers on the N-ACTION association */
+	unsigned int numAsynch;       /* answers on an association of their own */
+	unsigned int recent;          /* the last answers, 1 bits asynchronous, newest lowest */
+	int          numRecent;       /* answers in recent */
+	double       synchLatency;    /* seconds to a synchronous answer, moving average */
+	double       synchPeak;       /* slowest recent synchronous answer, decaying */
+	double       asynchLatency;   /* seconds to an asynchronous answer, moving average */
+	int          sinceCheck;      /* commits since the whole wait was last used */
+	double       savedWait;       /* seconds not waited for synchronous answers */
+
+	CommitTargetHistory();
+	int numRecentAsynch() const;
+};
+
+class CommitHistory
+{
+	static CommitHistory*             _instance;
+	pthread_mutex_t                   _lock;      /* protects everything below */
+	map<string, CommitTargetHistory>  _targets;   /* by AE title, host and port */
+
+	CommitHistory();
+
+	// Disallow copying or assignment.
+	CommitHistory(const CommitHistory&);
+	CommitHistory& operator=(const CommitHistory&);
+
+	void load();
+	void save();
+	void record(const string& target, bool asynch, double latency);
+
+public:
+	static CommitHistory* instance();
+	~CommitHistory();
+
+	// The commit target of the options, AE title, host and port
+	static string key(const COMMIT_OPTIONS& options);
+
+	// Seconds to wait for a synchronous answer, at most the configured
+	// RoleReversalWaitTime. 0 means the answer is expected asynchronously.
+	int synchWait(const COMMIT_OPTIONS& options);
+
+	// How the commit was answered, latency seconds after the N-ACTION
+	void recordSynch(const string& target, double latency);
+	void recordAsynch(const string& target, double latency);
+
+	// Seconds of the configured wait that were not waited
+	void recordSaved(const string& target, double saved);
+
+	// Write the history to the log
+	void report();
+};
+
+#endif
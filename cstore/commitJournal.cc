@@ -0,0 +1,375 @@
+/*
+ * file:	commitJournal.cc
+ * purpose:	Implementation of the CommitJournal class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <fstream>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "acquire/mesg.h"
+#include "commitJournal.h"
+
+static const char journalFile[] = "data/Facility/Cstore/pendingcommits.log";
+static const char journalTempFile[] = "data/Facility/Cstore/pendingcommits.log.tmp";
+static const int  MinFinishedToCompact = 64;
+
+CommitJournal* CommitJournal::_instance = NULL;  /* handle of singleton object */
+
+/*
+ * A tab or new line would split the record
+ */
+static string field(const char* value)
+{
+	string str = value ? value : "";
+
+	for (size_t i = 0; i < str.size(); i++)
+		if (str[i] == '\t' || str[i] == '\n' || str[i] == '\r')
+			str[i] = ' ';
+	return str;
+}
+
+static string number(long value)
+{
+	char buffer[32];
+
+	sprintf(buffer, "%ld", value);
+	return buffer;
+}
+
+static void splitFields(const string& line, vector<string>& fields)
+{
+	size_t start = 0, end;
+
+	fields.clear();
+	while ((end = line.find('\t', start)) != string::npos)
+	{
+		fields.push_back(line.substr(start, end - start));
+		start = end + 1;
+	}
+	fields.push_back(line.substr(start));
+}
+
+static string entryRecord(const JournalEntry& entry)
+{
+	string record;
+
+	record = "C\t" + entry.transactionUID + "\t" + number((long)entry.expires) + "\t"
+		   + entry.commitHostName + "\t" + entry.storageHostName + "\t"
+		   + (entry.commitRequired ? "1" : "0") + "\t" + number((long)entry.files.size()) + "\n";
+	for (size_t i = 0; i < entry.files.size(); i++)
+		record += "F\t" + number((long)entry.files[i].storageOutcome) + "\t" + entry.files[i].SOPClassUID + "\t"
+				+ entry.files[i].SOPInstanceUID + "\t" + entry.files[i].imgFile + "\n";
+
+	return record;
+}
+
+/*
+ * Read the log into entries, leaving out the finished commits. Returns the
+ * number of finished commits read.
+ */
+static int readJournal(map<string, JournalEntry>& entries)
+{
+	std::ifstream log(journalFile);
+	string        line;
+	vector<string> fields;
+	JournalEntry  entry;
+	JournalFile   file;
+	int           expected = -1;    /* F records still to come, -1 outside a C record */
+	int           finished = 0;
+
+	entries.clear();
+	while (log.good() && getline(log, line))
+	{
+		splitFields(line, fields);
+
+		if (fields[0] == "F" && fields.size() == 5 && expected > 0)
+		{
+			file.storageOutcome = (DICOMStoragePkg::StorageStatus)atoi(fields[1].c_str());
+			file.SOPClassUID = fields[2];
+			file.SOPInstanceUID = fields[3];
+			file.imgFile = fields[4];
+			entry.files.push_back(file);
+			if (--expected == 0)
+			{
+				entries[entry.transactionUID] = entry;
+				expected = -1;
+			}
+			continue;
+		}
+
+		// Anything else ends a C record that was cut short
+		expected = -1;
+
+		if (fields[0] == "C" && fields.size() == 7)
+		{
+			entry.transactionUID = fields[1];
+			entry.expires = (time_t)atol(fields[2].c_str());
+			entry.commitHostName = fields[3];
+			entry.storageHostName = fields[4];
+			entry.commitRequired = fields[5] == "1";
+			entry.files.clear();
+			expected = atoi(fields[6].c_str());
+			if (expected <= 0)
+			{
+				entries[entry.transactionUID] = entry;
+				expected = -1;
+			}
+		}
+		else if (fields[0] == "D" && fields.size() == 2)
+		{
+			if (entries.erase(fields[1]))
+				finished++;
+		}
+		else if (!line.empty())
+			::Message(MWARNING, toEndUser | toService | MLoverall,
+					  "Ignoring a bad record in %s", journalFile);
+	}
+
+	return finished;
+}
+
+/*
+ * Replace the log with the entries, written through
+ */
+static bool writeJournal(const map<string, JournalEntry>& entries)
+{
+	FILE* temp = fopen(journalTempFile, "w");
+	bool  written;
+
+	if (!temp)
+		return false;
+
+	for (map<string, JournalEntry>::const_iterator iter = entries.begin(); iter != entries.end(); ++iter)
+		fputs(entryRecord(iter->second).c_str(), temp);
+
+	written = fflush(temp) == 0 && fsync(fileno(temp)) == 0;
+	fclose(temp);
+
+	if (!written || rename(journalTempFile, journalFile) != 0)
+	{
+		unlink(journalTempFile);
+		return false;
+	}
+
+	return true;
+}
+
+CommitJournal* CommitJournal::instance()
+{
+	if (!_instance)
+		_instance = new CommitJournal();
+
+	return _instance;
+}
+
+CommitJournal::CommitJournal()
+			: _log (NULL),
+			  _numWaiting (0),
+			  _numFinished (0)
+{
+	pthread_mutex_init(&_lock, NULL);
+}
+
+CommitJournal::~CommitJournal()
+{
+	if (_log)
+		fclose(_log);
+
+	pthread_mutex_destroy(&_lock);
+}
+
+CommitJournal::CommitJournal(const CommitJournal&)
+{
+}
+
+CommitJournal& CommitJournal::operator=(const CommitJournal&)
+{
+	return *this;
+}
+
+int CommitJournal::load()
+{
+	map<string, JournalEntry>           entries;
+	map<string, JournalEntry>::iterator iter;
+	time_t                              now = time(NULL);
+	int                                 expired = 0;
+
+	pthread_mutex_lock(&_lock);
+	if (_log)
+		fclose(_log);
+
+	readJournal(entries);
+	iter = entries.begin();
+	while (iter != entries.end())
+	{
+		if (iter->second.expires <= now)
+		{
+			entries.erase(iter++);
+			expired++;
+		}
+		else
+			++iter;
+	}
+
+	if (!writeJournal(entries))
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				  "Cstore cannot rewrite %s", journalFile);
+
+	_log = fopen(journalFile, "a");
+	if (!_log)
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				  "Cstore cannot open %s, commits waiting for N-EVENT-REPORT will not survive a restart", journalFile);
+
+	_recovered = entries;
+	_numWaiting = (int)entries.size();
+	_numFinished = 0;
+	pthread_mutex_unlock(&_lock);
+
+	if (entries.size() || expired)
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				  "%d commit(s) from before the restart still wait for N-EVENT-REPORT, %d expired",
+				  (int)entries.size(), expired);
+
+	return (int)entries.size();
+}
+
+/*
+ * The caller must hold _lock
+ */
+void CommitJournal::append(const string& record, bool sync)
+{
+	if (!_log)
+		return;
+
+	if (fputs(record.c_str(), _log) < 0 || fflush(_log) != 0 || (sync && fsync(fileno(_log)) != 0))
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				  "Cstore cannot write %s", journalFile);
+}
+
+/*
+ * Rewrite the log without the finished commits. The waiting ones are read
+ * back from the log, they are not kept in memory. The caller must hold
+ * _lock.
+ */
+void CommitJournal::compact()
+{
+	map<string, JournalEntry> entries;
+
+	if (!_log)
+		return;
+
+	fclose(_log);
+	readJournal(entries);
+	if (!writeJournal(entries))
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				  "Cstore cannot rewrite %s", journalFile);
+	else
+	{
+		_numWaiting = (int)entries.size();
+		_numFinished = 0;
+	}
+
+	_log = fopen(journalFile, "a");
+}
+
+void CommitJournal::add(const string& transactionUID, time_t expires, const string& commitHostName,
+						const DICOMStoragePkg::ResultByStorageTarget& stored, int firstFile, int endFile,
+						bool sync)
+{
+	JournalEntry entry;
+	JournalFile  file;
+
+	entry.transactionUID = field(transactionUID.c_str());
+	entry.expires = expires;
+	entry.commitHostName = field(commitHostName.c_str());
+	entry.storageHostName = field(stored.storageHostName.in());
+	entry.commitRequired = stored.storageCommitRequired;
+	entry.files.reserve(endFile - firstFile);
+	for (int i = firstFile; i < endFile; i++)
+	{
+		file.imgFile = field(stored.resultByFiles[i].imgFile.in());
+		file.SOPClassUID = field(stored.resultByFiles[i].SOPClassUID.in());
+		file.SOPInstanceUID = field(stored.resultByFiles[i].SOPInstanceUID.in());
+		file.storageOutcome = stored.resultByFiles[i].storageOutcome;
+		entry.files.push_back(file);
+	}
+
+	pthread_mutex_lock(&_lock);
+	append(entryRecord(entry), sync);
+	_numWaiting++;
+	pthread_mutex_unlock(&_lock);
+}
+
+void CommitJournal::sync()
+{
+	pthread_mutex_lock(&_lock);
+	if (_log && fsync(fileno(_log)) != 0)
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				  "Cstore cannot write %s", journalFile);
+	pthread_mutex_unlock(&_lock);
+}
+
+void CommitJournal::remove(const string& transactionUID)
+{
+	pthread_mutex_lock(&_lock);
+	_recovered.erase(transactionUID);
+
+	// Losing this record only leaves a commit that nobody reports on
+	append("D\t" + field(transactionUID.c_str()) + "\n", false);
+	if (_numWaiting > 0)
+		_numWaiting--;
+	_numFinished++;
+
+	if (_numFinished >= MinFinishedToCompact && _numFinished > _numWaiting)
+		compact();
+	pthread_mutex_unlock(&_lock);
+}
+
+bool CommitJournal::findRecovered(const string& transactionUID, JournalEntry& entry)
+{
+	map<string, JournalEntry>::iterator iter;
+	bool                                found = false;
+
+	pthread_mutex_lock(&_lock);
+	iter = _recovered.find(transactionUID);
+	if (iter != _recovered.end())
+	{
+		entry = iter->second;
+		found = true;
+	}
+	pthread_mutex_unlock(&_lock);
+
+	return found;
+}
+
+void CommitJournal::expireRecovered(time_t now, list<JournalEntry>& expired)
+{
+	map<string, JournalEntry>::iterator iter;
+
+	pthread_mutex_lock(&_lock);
+	iter = _recovered.begin();
+	while (iter != _recovered.end())
+	{
+		if (iter->second.expires <= now)
+			expired.push_back((iter++)->second);
+		else
+			++iter;
+	}
+	pthread_mutex_unlock(&_lock);
+
+	for (list<JournalEntry>::iterator entry = expired.begin(); entry != expired.end(); ++entry)
+		remove(entry->transactionUID);
+}
+
+void CommitJournal::report()
+{
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "Commit journal %s: %d commit(s) waiting, %d from before the restart, %d finished since the last rewrite",
+			  _log ? journalFile : "not written", _numWaiting, (int)_recovered.size(), _numFinished);
+	pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,107 @@
+#ifndef _COMMITJOURNAL_H_
+#define _COMMITJOURNAL_H_
+
+/*
+ * file:	commitJournal.h
+ * purpose:	CommitJournal singleton that keeps the commits waiting for an
+ *          asynchronous N-EVENT-REPORT in data/Facility/Cstore/pendingcommits.log,
+ *          so a report that comes after cstore was restarted is still
+ *          matched and forwarded to the camera. The log is appended to,
+ *          one tab separated record per line:
+ *
+ *              C <transaction UID> <expires> <commit host> <storage host> <commit required> <file count>
+ *              F <storage outcome> <SOP class UID> <SOP instance UID> <image file>
+ *              D <transaction UID>
+ *
+ *          A C record is followed by its F records. D means the report came,
+ *          was given up or expired. A C record cut short by a crash is
+ *          dropped. The log is rewritten without the finished commits when
+ *          loaded and whenever they outnumber the waiting ones.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <map>
+#include <list>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "control/DICOMStorage_s.h"
+
+using namespace std;
+
+/*
+ * One file of a journaled commit
+ */
+typedef struct journal_file
+{
+	string                         imgFile;
+	string                         SOPClassUID;
+	string                         SOPInstanceUID;
+	DICOMStoragePkg::StorageStatus storageOutcome;
+} JournalFile;
+
+/*
+ * What is needed to forward the report of a commit made before a restart
+ */
+typedef struct journal_entry
+{
+	string              transactionUID;
+	time_t              expires;
+	string              commitHostName;
+	string              storageHostName;
+	bool                commitRequired;
+	vector<JournalFile> files;
+} JournalEntry;
+
+class CommitJournal
+{
+	static CommitJournal*      _instance;
+	pthread_mutex_t            _lock;        /* protects everything below */
+	FILE*                      _log;         /* open for append, NULL if it cannot be written */
+	map<string, JournalEntry>  _recovered;   /* loaded at start, no commit is waiting for them */
+	int                        _numWaiting;  /* C records without a D */
+	int                        _numFinished; /* C records with a D */
+
+	CommitJournal();
+
+	// Disallow copying or assignment.
+	CommitJournal(const CommitJournal&);
+	CommitJournal& operator=(const CommitJournal&);
+
+	void append(const string& record, bool sync);
+	void compact();
+
+public:
+	static CommitJournal* instance();
+	~CommitJournal();
+
+	// Read the log, keep the commits that have not expired and rewrite it.
+	// Returns the number of recovered commits.
+	int load();
+
+	// A commit of the files [firstFile, endFile) of stored is waiting for a
+	// report. Written through unless sync is false, then sync() must follow.
+	void add(const string& transactionUID, time_t expires, const string& commitHostName,
+			 const DICOMStoragePkg::ResultByStorageTarget& stored, int firstFile, int endFile,
+			 bool sync = true);
+	// Write the commits added without sync through
+	void sync();
+	// The commit is done with, also one that was recovered
+	void remove(const string& transactionUID);
+
+	// Find a commit made before the restart. Returns false if there is
+	// none. It stays in the journal until remove() is called.
+	bool findRecovered(const string& transactionUID, JournalEntry& entry);
+	// Remove the recovered commits that expired and return them
+	void expireRecovered(time_t now, list<JournalEntry>& expired);
+
+	// Write the counts to the log
+	void report();
+};
+
+#endif
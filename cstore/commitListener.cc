@@ -0,0 +1,611 @@
+/*
+ * file:	commitListener.cc
+ * purpose:	Implementation of the CommitListener class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <stdio.h>
+
+#include "commitListener.h"
+#include "commitContext.h"
+#include "commitHistory.h"
+
+extern int AsyncCommitIncomingPort;
+
+static const int NumBuckets = 256;
+static const int CommitReportLifetime = 604800;  /* seconds, some PACS report days later */
+static const int ReportReadTimeout = 30;         /* seconds to wait for the next message */
+static const int ReportReadRetries = 10;
+static const int ExpiryInterval = 60;            /* seconds between looks for expired commits */
+
+CommitListener* CommitListener::_instance = NULL;  /* handle of singleton object */
+
+/*
+ * 32 bit FNV-1a
+ */
+static unsigned int hashUID(const string& uid)
+{
+	unsigned int hash = 2166136261U;
+
+	for (size_t i = 0; i < uid.size(); i++)
+	{
+		hash ^= (unsigned char)uid[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static bool sendNEventResponse(int associationID, RESP_STATUS respStatus)
+{
+	MC_STATUS mcStatus;
+	int       rspMessageID;
+
+	mcStatus = MC_Open_Message ( &rspMessageID, "STORAGE_COMMITMENT_PUSH", N_EVENT_REPORT_RSP );
+	if (mcStatus != MC_NORMAL_COMPLETION)
+	{
+		PrintError("MC_Open_Message error of N-EVENT response",mcStatus);
+		return false;
+	}
+
+	mcStatus = MC_Send_Response_Message( associationID, respStatus, rspMessageID );
+	if (mcStatus != MC_NORMAL_COMPLETION)
+	{
+		PrintError("MC_Send_Response_Message for N_EVENT_REPORT_RSP error",mcStatus);
+		MC_Free_Message(&rspMessageID);
+		return false;
+	}
+
+	mcStatus = MC_Free_Message(&rspMessageID);
+	if (mcStatus != MC_NORMAL_COMPLETION)
+	{
+		PrintError("MC_Free_Message of N_EVENT_REPORT_RSP error",mcStatus);
+		return false;
+	}
+
+	return true;
+}
+
+CommitListener* CommitListener::instance()
+{
+	if (!_instance)
+		_instance = new CommitListener();
+
+	return _instance;
+}
+
+CommitListener::CommitListener()
+			: _buckets (NumBuckets),
+			  _numPending (0),
+			  _applicationID (-1),
+			  _started (false),
+			  _numReports (0),
+			  _numUnknown (0),
+			  _numExpired (0),
+			  _numForwarded (0)
+{
+	pthread_mutex_init(&_lock, NULL);
+}
+
+CommitListener::~CommitListener()
+{
+	for (int i = 0; i < NumBuckets; i++)
+		for (list<PendingCommit*>::iterator iter = _buckets[i].begin(); iter != _buckets[i].end(); ++iter)
+			delete *iter;
+
+	pthread_mutex_destroy(&_lock);
+}
+
+CommitListener::CommitListener(const CommitListener&)
+{
+}
+
+CommitListener& CommitListener::operator=(const CommitListener&)
+{
+	return *this;
+}
+
+/*
+ * The caller must hold _lock
+ */
+void CommitListener::startListener(int applicationID)
+{
+	pthread_t      tid;
+	pthread_attr_t attr;
+
+	if (_started)
+		return;
+
+	_applicationID = applicationID;
+	pthread_attr_init(&attr); // Initialize with the default value
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if( pthread_create(&tid, &attr, CommitListener::listener, (void*)this) != 0)
+		::Message( MALARM, toEndUser | toService | MLoverall,
+				   "Cstore failed to create a thread to listen to N-EVENT-REPORT");
+	else
+		_started = true;
+	pthread_attr_destroy(&attr);
+}
+
+/*
+ * The caller must hold _lock
+ */
+list<PendingCommit*>& CommitListener::bucket(const string& transactionUID)
+{
+	return _buckets[hashUID(transactionUID) % NumBuckets];
+}
+
+/*
+ * Remove the pending commit of the transaction from the table, NULL if
+ * there is none
+ */
+PendingCommit* CommitListener::take(const string& transactionUID)
+{
+	PendingCommit* pending = NULL;
+
+	pthread_mutex_lock(&_lock);
+	list<PendingCommit*>& entries = bucket(transactionUID);
+	for (list<PendingCommit*>::iterator iter = entries.begin(); iter != entries.end(); ++iter)
+		if ((*iter)->transactionUID == transactionUID)
+		{
+			pending = *iter;
+			entries.erase(iter);
+			_numPending--;
+			break;
+		}
+	pthread_mutex_unlock(&_lock);
+
+	return pending;
+}
+
+/*
+ * Tell the waiter and forget the commit. It must have been taken out of the
+ * table.
+ */
+void CommitListener::finish(PendingCommit* pending)
+{
+	if (pending->journaled)
+		CommitJournal::instance()->remove(pending->transactionUID);
+	if (pending->waiter)
+		pending->waiter->commitReported();
+	delete pending;
+}
+
+void CommitListener::expect(int applicationID, const COMMIT_OPTIONS& options, CommitResult* result,
+							int transaction, CommitWaiter* waiter, DICOMStoragePkg::CommitType commitType)
+{
+	PendingCommit*           pending = new PendingCommit;
+	const CommitTransaction& commitTransaction = result->transactions[transaction];
+
+	pending->transactionUID = commitTransaction.transactionUID;
+	pending->result = result;
+	pending->numFiles = commitTransaction.endFile - commitTransaction.firstFile;
+	pending->waiter = waiter;
+	pending->commitType = commitType;
+	pending->remoteHostname = options.RemoteHostname;
+	pending->remotePort = options.RemotePort;
+	pending->commitTarget = CommitHistory::key(options);
+	gettimeofday(&pending->sent, NULL);
+	pending->expires = time(NULL) + CommitReportLifetime;
+	pending->journaled = false;
+	pending->verbose = options.Verbose;
+
+	if (waiter)
+		waiter->commitExpected();
+
+	pthread_mutex_lock(&_lock);
+	bucket(pending->transactionUID).push_back(pending);
+	_numPending++;
+	startListener(applicationID);
+	pthread_mutex_unlock(&_lock);
+}
+
+void CommitListener::recover(int applicationID)
+{
+	if (CommitJournal::instance()->load() == 0)
+		return;
+
+	pthread_mutex_lock(&_lock);
+	startListener(applicationID);
+	pthread_mutex_unlock(&_lock);
+}
+
+/*
+ * Most commits are answered on their own association and never need the
+ * journal, so a commit is only journaled when the listener may get its
+ * report. Done under the lock, so a report taken meanwhile is not
+ * journaled after it was removed.
+ */
+void CommitListener::journal(const CommitResult* result)
+{
+	bool added = false;
+
+	pthread_mutex_lock(&_lock);
+	for (unsigned int t = 0; t < result->transactions.size(); t++)
+	{
+		const CommitTransaction& transaction = result->transactions[t];
+
+		if (transaction.reported)
+			continue;
+
+		list<PendingCommit*>& entries = bucket(transaction.transactionUID);
+		for (list<PendingCommit*>::iterator iter = entries.begin(); iter != entries.end(); ++iter)
+			if ((*iter)->transactionUID == transaction.transactionUID && !(*iter)->journaled)
+			{
+				CommitJournal::instance()->add(transaction.transactionUID, (*iter)->expires, (*iter)->remoteHostname,
+											   *result->stored, transaction.firstFile, transaction.endFile, false);
+				(*iter)->journaled = true;
+				added = true;
+				break;
+			}
+	}
+	pthread_mutex_unlock(&_lock);
+
+	// One flush for all the transactions of the commit
+	if (added)
+		CommitJournal::instance()->sync();
+}
+
+void CommitListener::cancel(const string& transactionUID)
+{
+	PendingCommit* pending = take(transactionUID);
+
+	if (pending)
+		finish(pending);
+}
+
+void CommitListener::expirePending()
+{
+	list<PendingCommit*> expired;
+	list<JournalEntry>   expiredRecovered;
+	time_t               now = time(NULL);
+
+	pthread_mutex_lock(&_lock);
+	for (int i = 0; i < NumBuckets; i++)
+	{
+		list<PendingCommit*>::iterator iter = _buckets[i].begin();
+		while (iter != _buckets[i].end())
+		{
+			if ((*iter)->expires <= now)
+			{
+				expired.push_back(*iter);
+				iter = _buckets[i].erase(iter);
+				_numPending--;
+				_numExpired++;
+			}
+			else
+				++iter;
+		}
+	}
+	pthread_mutex_unlock(&_lock);
+
+	for (list<PendingCommit*>::iterator iter = expired.begin(); iter != expired.end(); ++iter)
+	{
+		::Message(MWARNING, toEndUser | toService | MLoverall, "Cstore cannot get asynchronous N-EVENT-REPORT call back from %s for transaction %s",
+				  (*iter)->remoteHostname.c_str(), (*iter)->transactionUID.c_str());
+		::Message(MWARNING, toEndUser | toService | MLoverall, "Please make sure the camera incoming port %d is open. And make sure %s is asynchronous. If not, re-configure the camera to use synchronous commit and try again",
+				  (*iter)->remotePort, (*iter)->remoteHostname.c_str());
+		finish(*iter);
+	}
+
+	CommitJournal::instance()->expireRecovered(now, expiredRecovered);
+	for (list<JournalEntry>::iterator iter = expiredRecovered.begin(); iter != expiredRecovered.end(); ++iter)
+		::Message(MWARNING, toEndUser | toService | MLoverall, "Cstore cannot get asynchronous N-EVENT-REPORT call back from %s for transaction %s made before the restart",
+				  iter->commitHostName.c_str(), iter->transactionUID.c_str());
+
+	pthread_mutex_lock(&_lock);
+	_numExpired += expiredRecovered.size();
+	pthread_mutex_unlock(&_lock);
+}
+
+/*
+ * Fill in the commit outcomes of a commit made before the restart from its
+ * report and send them to the camera. Returns false if the report could
+ * not be read or forwarded, the commit is then kept for the PACS to retry.
+ */
+bool CommitListener::forwardRecovered(int messageID, const JournalEntry& entry)
+{
+	DICOMStoragePkg::ResultByStorageTarget stored;
+	DICOMStoragePkg::CommitReport_var      commitReport;
+	ConnectCamera*                         cameraConnection = NULL;
+	int                                    numFiles = (int)entry.files.size();
+
+	stored.storageHostName = CORBA::string_dup(entry.storageHostName.c_str());
+	stored.storageCommitRequired = entry.commitRequired;
+	stored.transactionUID = CORBA::string_dup(entry.transactionUID.c_str());
+	stored.resultByFiles.length(numFiles);
+	for (int i=0; i<numFiles; i++)
+	{
+		stored.resultByFiles[i].imgFile = CORBA::string_dup(entry.files[i].imgFile.c_str());
+		stored.resultByFiles[i].SOPClassUID = CORBA::string_dup(entry.files[i].SOPClassUID.c_str());
+		stored.resultByFiles[i].SOPInstanceUID = CORBA::string_dup(entry.files[i].SOPInstanceUID.c_str());
+		stored.resultByFiles[i].storageOutcome = entry.files[i].storageOutcome;
+		stored.resultByFiles[i].commitOutcome = DICOMStoragePkg::COMMIT_UNKNOWN;
+	}
+
+	CommitResult result(&stored);
+	result.makeTransactions(0);
+	result.transactions[0].transactionUID = entry.transactionUID;
+	if (!ProcessNEventMessage(messageID, &result))
+		return false;
+
+	commitReport = new DICOMStoragePkg::CommitReport;
+	commitReport->length(1);
+	commitReport[0].commitHostName = CORBA::string_dup(entry.commitHostName.c_str());
+	commitReport[0].resultByStorageTargets.length(1);
+	MoveResultByStorageTarget(stored, commitReport[0].resultByStorageTargets[0]);
+	ApplyCommitResult(result, commitReport[0].resultByStorageTargets[0]);
+
+	CommitContextPool::connectCamera(cameraConnection);
+	if (cameraConnection == NULL)
+		return false;
+
+	try
+	{
+		cameraConnection->reportCommitStatus(commitReport.in());
+	}
+	catch( ...)
+	{
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				"Exception was thrown when reporting Commit Status");
+		return false;
+	}
+
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "Forwarded N-EVENT-REPORT from %s for transaction %s made before the restart",
+			  entry.commitHostName.c_str(), entry.transactionUID.c_str());
+	return true;
+}
+
+/*
+ * Process one N-EVENT-REPORT and answer it. Returns false if the
+ * association cannot be used any more.
+ */
+bool CommitListener::handleReport(int associationID, int messageID)
+{
+	char           uidBuffer[UI_LENGTH+2];
+	MC_STATUS      mcStatus;
+	PendingCommit* pending = NULL;
+	JournalEntry   entry;
+	struct timeval now;
+	bool           processed = false;
+	bool           forwarded = false;
+
+	mcStatus = MC_Get_Value_To_String( messageID, MC_ATT_TRANSACTION_UID, sizeof(uidBuffer), uidBuffer);
+	if (mcStatus != MC_NORMAL_COMPLETION)
+	{
+		PrintError("Unable to retreive transaction UID", mcStatus);
+		uidBuffer[0] = '\0';
+	}
+	else
+		pending = take(uidBuffer);
+
+	if (pending)
+	{
+		processed = ProcessNEventMessage(messageID, pending->result, pending->verbose);
+		if (pending->commitType == DICOMStoragePkg::EITHER_COMMIT)
+		{
+			::Message(MWARNING, toEndUser | toService | MLoverall, "Cstore detected asynchronous commit from %s. Please re-configure the camera to use asynchronous for this host as this will save significant amount of time for each storage commitment",
+					  pending->remoteHostname.c_str());
+
+			// One answer per commit, not per transaction of it
+			if (pending->transactionUID == pending->result->transactions[0].transactionUID)
+			{
+				gettimeofday(&now, NULL);
+				CommitHistory::instance()->recordAsynch(pending->commitTarget,
+														(now.tv_sec - pending->sent.tv_sec) + (now.tv_usec - pending->sent.tv_usec) / 1000000.0);
+			}
+		}
+	}
+	else if (uidBuffer[0] && CommitJournal::instance()->findRecovered(uidBuffer, entry))
+	{
+		processed = forwarded = forwardRecovered(messageID, entry);
+	}
+	else if (uidBuffer[0])
+	{
+		::Message(MWARNING, toEndUser | toService | MLoverall, "N-EVENT-REPORT for transaction %s that no commit is waiting for", uidBuffer);
+		pthread_mutex_lock(&_lock);
+		_numUnknown++;
+		pthread_mutex_unlock(&_lock);
+	}
+
+	mcStatus = MC_Free_Message(&messageID);
+	if (mcStatus != MC_NORMAL_COMPLETION)
+		PrintError("MC_Free_Message of N-EVENT-REPORT error",mcStatus);
+
+	if (pending)
+	{
+		pthread_mutex_lock(&_lock);
+		_numReports++;
+		pthread_mutex_unlock(&_lock);
+		finish(pending);
+	}
+	else if (forwarded)
+	{
+		CommitJournal::instance()->remove(uidBuffer);
+		pthread_mutex_lock(&_lock);
+		_numForwarded++;
+		pthread_mutex_unlock(&_lock);
+	}
+
+	return sendNEventResponse(associationID, processed ? N_EVENT_SUCCESS : N_EVENT_PROCESSING_FAILURE);
+}
+
+/*
+ * Read the reports of an accepted association until the PACS closes it.
+ * Only the requestor of an association can close the association.
+ */
+void CommitListener::handleAssociation(int associationID)
+{
+	MC_STATUS  mcStatus;
+	int        messageID;
+	MC_COMMAND command;
+	char*      serviceName;
+	int        timeouts = 0;
+
+	while (timeouts <= ReportReadRetries)
+	{
+		mcStatus = MC_Read_Message( associationID, ReportReadTimeout, &messageID, &serviceName, &command);
+		if (mcStatus == MC_TIMEOUT)
+		{
+			timeouts++;
+			continue;
+		}
+		else if (mcStatus == MC_ASSOCIATION_CLOSED)
+			return;
+		else if (mcStatus == MC_NETWORK_SHUT_DOWN
+			 ||  mcStatus == MC_ASSOCIATION_ABORTED
+			 ||  mcStatus == MC_INVALID_MESSAGE_RECEIVED
+			 ||  mcStatus == MC_CONFIG_INFO_ERROR)
+		{
+			// The association has already been closed for us
+			PrintError("Unexpected event while reading N-EVENT-REPORT, association aborted", mcStatus);
+			return;
+		}
+		else if (mcStatus != MC_NORMAL_COMPLETION)
+		{
+			PrintError("Error on MC_Read_Message for N-EVENT-REPORT", mcStatus);
+			break;
+		}
+
+		timeouts = 0;
+		if (!handleReport(associationID, messageID))
+			break;
+	}
+
+	MC_Abort_Association(&associationID);
+}
+
+void CommitListener::report()
+{
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall, "%d commit(s) waiting for N-EVENT-REPORT, %lu report(s) handled, %lu forwarded from before the restart, %lu for unknown transactions, %lu expired",
+			  _numPending, _numReports, _numForwarded, _numUnknown, _numExpired);
+	for (int i = 0; i < NumBuckets; i++)
+		for (list<PendingCommit*>::iterator iter = _buckets[i].begin(); iter != _buckets[i].end(); ++iter)
+			::Message(MNOTE, toEndUser | toService | MLoverall, "  transaction %s from %s, %d file(s), waiting %lds",
+					  (*iter)->transactionUID.c_str(), (*iter)->remoteHostname.c_str(),
+					  (*iter)->numFiles, (long)(now - ((*iter)->expires - CommitReportLifetime)));
+	pthread_mutex_unlock(&_lock);
+
+	CommitJournal::instance()->report();
+}
+
+/****************************************************************************
+ *
+ *  Function    :   listener
+ *
+ *  Parameters  :   thisClass - the CommitListener instance
+ *
+ *  Returns     :   NULL
+ *
+ *  Description :   Listener thread. Waits as an SCU for associations from
+ *                  storage commitment SCPs, each with one or more
+ *                  N-EVENT-REPORT-RQ messages, and hands every report to
+ *                  the commit with its Transaction UID.
+ *
+ ****************************************************************************/
+void* CommitListener::listener(void* thisClass)
+{
+	CommitListener* commitListener = (CommitListener*)thisClass;
+	int             associationID = -1;
+	int             calledApplicationID = commitListener->_applicationID;
+	MC_STATUS       mcStatus;
+	time_t          lastExpiry = time(NULL);
+
+	for (;;)
+	{
+		// Telling the waiters of expired commits may report to the camera,
+		// which is not done on this thread
+		if (time(NULL) - lastExpiry >= ExpiryInterval)
+		{
+			WorkerPool::instance()->submit(CommitListener::expire, (void*)commitListener, true);
+			lastExpiry = time(NULL);
+		}
+
+#ifdef linux
+		if (AsyncCommitIncomingPort == -1)
+			mcStatus = MC_Wait_For_Association( "Storage_Commit_SCU_Service_List", 5,
+				                                &calledApplicationID,
+					                            &associationID);
+		else
+			mcStatus = MC_Wait_For_Association_On_Port( "Storage_Commit_SCU_Service_List", 5,
+				                                calledApplicationID,
+												AsyncCommitIncomingPort,
+					                            &associationID);
+#else
+		mcStatus = MC_Wait_For_Association( "Storage_Commit_SCU_Service_List", 5,
+			                                &calledApplicationID,
+				                            &associationID);
+#endif
+
+		if (mcStatus == MC_TIMEOUT)
+			continue;
+		else if (mcStatus == MC_UNKNOWN_HOST_CONNECTED)
+		{
+			::Message(MWARNING, toEndUser | toService | MLoverall, "\tUnknown host connected, association rejected ");
+			sleep(1);
+			continue;
+		}
+		else if (mcStatus == MC_NEGOTIATION_ABORTED)
+		{
+			::Message(MWARNING, toEndUser | toService | MLoverall, "\tAssociation aborted during negotiation ");
+			sleep(1);
+			continue;
+		}
+		else if (mcStatus != MC_NORMAL_COMPLETION)
+		{
+			PrintError("Error on MC_Wait_For_Association for asynch storage commitment",mcStatus);
+			sleep(5);
+			continue;
+		}
+
+		mcStatus = MC_Accept_Association( associationID );
+		if (mcStatus != MC_NORMAL_COMPLETION)
+		{
+			// Make sure the association is cleaned up
+			MC_Reject_Association( associationID, TRANSIENT_NO_REASON_GIVEN );
+			PrintError("Error on MC_Accept_Association", mcStatus);
+			continue;
+		}
+
+		// Read on the worker pool, so a slow PACS does not hold up the
+		// reports of the others
+		WorkerPool::instance()->submit(CommitListener::readAssociation, (void*)new int(associationID), true);
+	}
+
+	return NULL;
+}
+
+/****************************************************************************
+ *
+ *  Function    :   readAssociation
+ *
+ *  Parameters  :   association - new int with the accepted association,
+ *                                deleted here
+ *
+ *  Returns     :   THREAD_NORMAL_EXIT
+ *
+ *  Description :   Worker pool task reading the reports of one association
+ *                  the listener accepted.
+ *
+ ****************************************************************************/
+void* CommitListener::readAssociation(void* association)
+{
+	int associationID = *(int*)association;
+
+	delete (int*)association;
+	instance()->handleAssociation(associationID);
+
+	return (void *) &THREAD_NORMAL_EXIT;
+}
+
+void* CommitListener::expire(void* thisClass)
+{
+	((CommitListener*)thisClass)->expirePending();
+
+	return (void *) &THREAD_NORMAL_EXIT;
+}
@@ -0,0 +1,129 @@
+#ifndef _COMMITLISTENER_H_
+#define _COMMITLISTENER_H_
+
+/*
+ * file:	commitListener.h
+ * purpose:	CommitListener singleton that accepts every storage commitment
+ *          association the PACS opens to report on an asynchronous commit,
+ *          and on the worker pool reads the Transaction UID of each N-EVENT-REPORT and hands the
+ *          report to the commit that asked for it. A commit waiting for its
+ *          report is an entry in a hash table keyed by Transaction UID, not
+ *          a thread. When the report is in, or the commit has waited too
+ *          long, the CommitWaiter of the commit is told.
+ *
+ *          Every commit left to the listener, an asynchronous one or an
+ *          either-commitment that stopped waiting on its association, is
+ *          also kept in the CommitJournal. A report
+ *          for a commit made before cstore was restarted is forwarded to
+ *          the camera from there.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <list>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "cstoreutils.h"
+#include "commitJournal.h"
+
+using namespace std;
+
+/*
+ * Told once for every commit it is expecting a report for
+ */
+class CommitWaiter
+{
+public:
+	virtual ~CommitWaiter() {}
+
+	virtual void commitExpected() = 0;
+	// The report came, could not be read, or never came
+	virtual void commitReported() = 0;
+	// Called before commitReported() when the commit was run for the
+	// waiter by someone else and its association or N-ACTION failed. The
+	// files not reported keep COMMIT_UNKNOWN.
+	virtual void commitFailed() = 0;
+};
+
+class PendingCommit
+{
+public:
+	string                      transactionUID;
+	CommitResult*               result;      /* filled in from the report */
+	int                         numFiles;    /* of the transaction */
+	CommitWaiter*               waiter;
+	DICOMStoragePkg::CommitType commitType;
+	string                      remoteHostname;
+	int                         remotePort;
+	string                      commitTarget;  /* key in the CommitHistory */
+	struct timeval              sent;          /* when the N-ACTION went out */
+	time_t                      expires;
+	bool                        journaled;     /* in the CommitJournal */
+	bool                        verbose;       /* log every SOP instance of the report */
+};
+
+class CommitListener
+{
+	static CommitListener*           _instance;
+	pthread_mutex_t                  _lock;      /* protects everything below */
+	vector< list<PendingCommit*> >   _buckets;
+	int                              _numPending;
+	int                              _applicationID;
+	bool                             _started;
+	unsigned long                    _numReports;
+	unsigned long                    _numUnknown;
+	unsigned long                    _numExpired;
+	unsigned long                    _numForwarded;  /* reports of commits made before the restart */
+
+	CommitListener();
+
+	// Disallow copying or assignment.
+	CommitListener(const CommitListener&);
+	CommitListener& operator=(const CommitListener&);
+
+	void startListener(int applicationID);
+	list<PendingCommit*>& bucket(const string& transactionUID);
+	PendingCommit* take(const string& transactionUID);
+	void finish(PendingCommit* pending);
+	void expirePending();
+	void handleAssociation(int associationID);
+	bool handleReport(int associationID, int messageID);
+	bool forwardRecovered(int messageID, const JournalEntry& entry);
+
+public:
+	static CommitListener* instance();
+	~CommitListener();
+
+	// Load the commits that were waiting when cstore stopped, and listen
+	// for their reports
+	void recover(int applicationID);
+
+	// Expect a report for a transaction of result, whose UID must be set.
+	// Call it before the N-ACTION goes out, so no report can come first.
+	void expect(int applicationID, const COMMIT_OPTIONS& options, CommitResult* result,
+				int transaction, CommitWaiter* waiter, DICOMStoragePkg::CommitType commitType);
+
+	// Keep the expected transactions of result that were not reported yet
+	// in the CommitJournal, written through at once. Call it before the
+	// report is left to the listener, an asynchronous N-ACTION goes out or
+	// an either-commitment stops waiting on its association.
+	void journal(const CommitResult* result);
+
+	// Stop expecting a report, because the N-ACTION failed or the report
+	// came synchronously. The waiter is told.
+	void cancel(const string& transactionUID);
+
+	// Write the pending commits and counts to the log
+	void report();
+
+	static void* listener(void* thisClass);
+	static void* readAssociation(void* association);
+	static void* expire(void* thisClass);
+};
+
+#endif
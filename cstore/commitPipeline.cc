@@ -0,0 +1,121 @@
+/*
+ * file:	commitPipeline.cc
+ * purpose:	Implementation of the CommitPipeline class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include "commitPipeline.h"
+#include "cstoremanager.h"
+
+CommitPipeline::CommitPipeline(const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+							   const list<DICOMStoragePkg::CommitTarget>& committargetlist,
+							   int chunkSize)
+			: _storageTargets (storagetargetlist),
+			  _commitTargets (committargetlist),
+			  _chunkSize (chunkSize > 0 ? chunkSize : 1),
+			  _numChunks (0)
+{
+	gettimeofday(&_started, NULL);
+	pthread_mutex_init(&_lock, NULL);
+}
+
+CommitPipeline::~CommitPipeline()
+{
+	pthread_mutex_destroy(&_lock);
+}
+
+CommitPipeline::CommitPipeline(const CommitPipeline&)
+{
+}
+
+CommitPipeline& CommitPipeline::operator=(const CommitPipeline&)
+{
+	return *this;
+}
+
+bool CommitPipeline::commitChunk(const char* storageHostName, InstanceNode* first, InstanceNode* end)
+{
+	DICOMStoragePkg::ResultByStorageTargetList_var chunk;
+	InstanceNode*                                  node;
+	struct timeval                                 now;
+	int                                            numFiles = 0, i, chunkNumber;
+
+	pthread_mutex_lock(&_lock);
+	_pipelined.insert(storageHostName);
+	pthread_mutex_unlock(&_lock);
+
+	for (node = first; node != end; node = node->Next)
+		numFiles++;
+	if (!numFiles)
+		return true;
+
+	chunk = new DICOMStoragePkg::ResultByStorageTargetList;
+	chunk->length(1);
+	DICOMStoragePkg::ResultByStorageTarget& result = chunk[0];
+
+	result.storageHostName = CORBA::string_dup(storageHostName);
+	result.storageCommitRequired = true;
+	for (list<DICOMStoragePkg::StorageTarget>::const_iterator iter=_storageTargets.begin();
+		 iter != _storageTargets.end(); ++iter)
+		if (!strcmp(iter->exportSystem.hostName.in(), storageHostName))
+		{
+			result.storageCommitRequired = iter->storageCommitRequired;
+			break;
+		}
+
+	result.resultByFiles.length(numFiles);
+	for (i = 0, node = first; node != end; node = node->Next, i++)
+	{
+		DICOMStoragePkg::ResultByFile& resultByFile = result.resultByFiles[i];
+
+		resultByFile.imgFile = CORBA::string_dup(node->fname);
+		resultByFile.SOPClassUID = CORBA::string_dup(node->SOPClassUID);
+		resultByFile.SOPInstanceUID = CORBA::string_dup(node->SOPInstanceUID);
+		resultByFile.storageOutcome = node->storageStatus;
+		resultByFile.commitOutcome = node->commitStatus;
+
+		// The export fails, as storeAndCommit would not commit at all
+		if (resultByFile.storageOutcome != DICOMStoragePkg::STORAGE_SUCCEESS && !IsNotDICOMResult(resultByFile))
+		{
+			::Message(MWARNING, toEndUser | toService | MLoverall,
+					  "File \"%s\" was not stored on %s, the files from it on are not committed",
+					  node->fname, storageHostName);
+			return false;
+		}
+	}
+	CountResultStrings(1 + 3 * numFiles);
+
+	pthread_mutex_lock(&_lock);
+	chunkNumber = ++_numChunks;
+	pthread_mutex_unlock(&_lock);
+
+	gettimeofday(&now, NULL);
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "Storage commitment of chunk %d, %d file(s) stored on %s, started %.2fs after the store",
+			  chunkNumber, numFiles, storageHostName,
+			  (now.tv_sec - _started.tv_sec) + (now.tv_usec - _started.tv_usec) / 1000000.0);
+
+	CstoreManager::instance()->commit(new SharedResult(chunk._retn()), _commitTargets, &_started, &_storageTargets);
+	return true;
+}
+
+void CommitPipeline::commitRest(const DICOMStoragePkg::ResultByStorageTargetList& result)
+{
+	DICOMStoragePkg::ResultByStorageTargetList_var rest;
+	int                                            numRest = 0;
+
+	rest = new DICOMStoragePkg::ResultByStorageTargetList;
+	rest->length(result.length());
+
+	pthread_mutex_lock(&_lock);
+	for (int i=0; i<(int)result.length(); i++)
+		if (!_pipelined.count(result[i].storageHostName.in()))
+			CopyResultByStorageTarget(result[i], rest[numRest++]);
+	pthread_mutex_unlock(&_lock);
+
+	rest->length(numRest);
+	if (numRest)
+		CstoreManager::instance()->commit(new SharedResult(rest._retn()), _commitTargets, &_started, &_storageTargets);
+}
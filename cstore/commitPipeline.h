@@ -0,0 +1,60 @@
+#ifndef _COMMITPIPELINE_H_
+#define _COMMITPIPELINE_H_
+
+/*
+ * file:	commitPipeline.h
+ * purpose:	CommitPipeline class that commits the files of a store and
+ *          commit while the later files are still being sent. The store
+ *          task of each storage target hands over every CommitPipelineChunk
+ *          files (line 17 of cstoredefaults.txt, 0 commits after the store
+ *          as before) once they are all answered, and each chunk is
+ *          committed and reported to the camera on its own. A target group
+ *          is committed as a whole after the store.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <list>
+#include <set>
+#include <string>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "cstoreutils.h"
+
+using namespace std;
+
+class CommitPipeline
+{
+	list<DICOMStoragePkg::StorageTarget> _storageTargets;
+	list<DICOMStoragePkg::CommitTarget>  _commitTargets;
+	int                                  _chunkSize;
+	struct timeval                       _started;     /* when the store started */
+	pthread_mutex_t                      _lock;        /* protects the two below */
+	set<string>                          _pipelined;   /* storage hosts committed chunk by chunk */
+	int                                  _numChunks;
+
+	// Disallow copying or assignment.
+	CommitPipeline(const CommitPipeline&);
+	CommitPipeline& operator=(const CommitPipeline&);
+
+public:
+	CommitPipeline(const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+				   const list<DICOMStoragePkg::CommitTarget>& committargetlist,
+				   int chunkSize);
+	~CommitPipeline();
+
+	int chunkSize() const { return _chunkSize; }
+
+	// Commit the files from first up to end, stored on the host. Called by
+	// the store task of the storage target. Returns false, and commits
+	// nothing, if one of them was not stored.
+	bool commitChunk(const char* storageHostName, InstanceNode* first, InstanceNode* end);
+
+	// Commit the storage targets of the result that were not committed
+	// chunk by chunk, once all files are stored
+	void commitRest(const DICOMStoragePkg::ResultByStorageTargetList& result);
+};
+
+#endif
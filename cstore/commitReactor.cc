@@ -0,0 +1,361 @@
+/*
+ * file:	commitReactor.cc
+ * purpose:	Implementation of the CommitReactor class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include "commitReactor.h"
+#include "commitListener.h"
+
+extern int CommitReactorThreads;
+extern int CommitReactorTick;
+extern int CommitReactorMaxTick;
+
+CommitReactor* CommitReactor::_instance = NULL;  /* handle of singleton object */
+
+ReactorLoop::ReactorLoop()
+{
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&wakeup, NULL);
+}
+
+ReactorLoop::~ReactorLoop()
+{
+	pthread_cond_destroy(&wakeup);
+	pthread_mutex_destroy(&lock);
+}
+
+ReactorLoop::ReactorLoop(const ReactorLoop&)
+{
+}
+
+ReactorLoop& ReactorLoop::operator=(const ReactorLoop&)
+{
+	return *this;
+}
+
+CommitReactor* CommitReactor::instance()
+{
+	if (!_instance)
+		_instance = new CommitReactor();
+
+	return _instance;
+}
+
+CommitReactor::CommitReactor()
+			: _started (false),
+			  _next (0),
+			  _numWatched (0),
+			  _peakWatched (0),
+			  _numSynch (0),
+			  _numTimedOut (0),
+			  _numFailed (0)
+{
+	pthread_mutex_init(&_lock, NULL);
+}
+
+CommitReactor::~CommitReactor()
+{
+	pthread_mutex_destroy(&_lock);
+}
+
+CommitReactor::CommitReactor(const CommitReactor&)
+{
+}
+
+CommitReactor& CommitReactor::operator=(const CommitReactor&)
+{
+	return *this;
+}
+
+/*
+ * Start the threads. The caller holds the lock.
+ */
+void CommitReactor::start()
+{
+	ReactorLoop*   loop;
+	pthread_t      tid;
+	pthread_attr_t attr;
+
+	_started = true;
+	pthread_attr_init(&attr); // Initialize with the default value
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (int i = 0; i < CommitReactorThreads; i++)
+	{
+		loop = new ReactorLoop();
+		if( pthread_create(&tid, &attr, CommitReactor::run, (void*)loop) != 0)
+		{
+			::Message( MALARM, toEndUser | toService | MLoverall,
+					   "Cstore failed to create a thread to wait for synchronous storage commitments");
+			delete loop;
+			break;
+		}
+		_loops.push_back(loop);
+	}
+	pthread_attr_destroy(&attr);
+
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "%d thread(s) wait for synchronous storage commitments", (int)_loops.size());
+}
+
+bool CommitReactor::watch(const COMMIT_ARGS& commitArgs, int associationID, int waitTime,
+						  const struct timeval& sent)
+{
+	CommitWait*  wait;
+	ReactorLoop* loop;
+
+	pthread_mutex_lock(&_lock);
+	if (!_started && CommitReactorThreads > 0)
+		start();
+	if (_loops.empty())
+	{
+		// Without threads the commit task waits itself
+		pthread_mutex_unlock(&_lock);
+		return false;
+	}
+
+	loop = _loops[_next++ % _loops.size()];
+	if (++_numWatched > _peakWatched)
+		_peakWatched = _numWatched;
+	pthread_mutex_unlock(&_lock);
+
+	wait = new CommitWait;
+	wait->args = commitArgs;
+	wait->associationID = associationID;
+	wait->waitTime = waitTime;
+	wait->sent = sent;
+	wait->lastMessage = time(NULL);
+	wait->nextLook = 0.0;
+	wait->interval = CommitReactorTick;
+	wait->status = TIMEOUT;
+
+	// The waiter is kept until the commit is finished, so neither the last
+	// report nor its owner can free the result while it is looked at here
+	if (wait->args.waiter)
+		wait->args.waiter->commitExpected();
+
+	if (commitArgs.options.Verbose)
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				  "Waiting up to %d seconds for the synchronous N-EVENT-REPORT from %s",
+				  waitTime, commitArgs.options.RemoteHostname);
+
+	pthread_mutex_lock(&loop->lock);
+	loop->added.push_back(wait);
+	pthread_cond_signal(&loop->wakeup);
+	pthread_mutex_unlock(&loop->lock);
+
+	return true;
+}
+
+/****************************************************************************
+ *
+ *  Function    :   step
+ *
+ *  Parameters  :   wait     - the association to look at
+ *                  now      - the time of this look
+ *                  answered - set if a report was answered
+ *
+ *  Returns     :   true if the wait is over, with wait->status set
+ *                  false
+ *
+ *  Description :   One turn of HandleNEventAssociation for an
+ *                  either-commitment, without blocking: answer the message
+ *                  waiting on the association, if there is one.
+ *
+ ****************************************************************************/
+bool CommitReactor::step(CommitWait* wait, time_t now, bool& answered)
+{
+	MC_STATUS  mcStatus;
+	int        messageID;
+	MC_COMMAND command;
+	char*      serviceName;
+
+	// Some reports may have come while the N-ACTIONs went out
+	if (wait->args.result->allReported())
+	{
+		wait->status = SUCCESS;
+		return true;
+	}
+
+	mcStatus = MC_Read_Message( wait->associationID, 0, &messageID, &serviceName, &command);
+	if (mcStatus == MC_NORMAL_COMPLETION)
+	{
+		answered = true;
+		wait->lastMessage = now;
+		if ( !AnswerNEventReport( wait->associationID, messageID, wait->args.result, wait->args.options.Verbose ) )
+		{
+			wait->status = FAILURE;
+			return true;
+		}
+		return false;
+	}
+	else if (mcStatus == MC_TIMEOUT)
+	{
+		if (now - wait->lastMessage < wait->waitTime)
+			return false;
+
+		wait->status = TIMEOUT;
+		return true;
+	}
+	else if (mcStatus == MC_ASSOCIATION_CLOSED)
+	{
+		::Message(MNOTE, toEndUser | toService | MLoverall, "Association Closed.");
+		wait->status = SUCCESS;
+		return true;
+	}
+	else if (mcStatus == MC_NETWORK_SHUT_DOWN
+		 ||  mcStatus == MC_ASSOCIATION_ABORTED
+		 ||  mcStatus == MC_INVALID_MESSAGE_RECEIVED
+		 ||  mcStatus == MC_CONFIG_INFO_ERROR)
+	{
+		PrintError("Unexpected event while waiting for N-EVENT-REPORT, association aborted", mcStatus);
+		wait->status = FAILURE;
+		return true;
+	}
+
+	PrintError("Error on MC_Read_Message while waiting for N-EVENT-REPORT", mcStatus);
+	wait->status = FAILURE;
+	return true;
+}
+
+void CommitReactor::finished(NEVENT_ENUM status)
+{
+	pthread_mutex_lock(&_lock);
+	_numWatched--;
+	if (status == SUCCESS)
+		_numSynch++;
+	else if (status == TIMEOUT)
+		_numTimedOut++;
+	else
+		_numFailed++;
+	pthread_mutex_unlock(&_lock);
+}
+
+/****************************************************************************
+ *
+ *  Function    :   run
+ *
+ *  Parameters  :   thisLoop - the ReactorLoop of the thread
+ *
+ *  Returns     :   NULL
+ *
+ *  Description :   Looks at the associations of the loop that are due, and
+ *                  hands those whose wait is over to the worker pool to
+ *                  finish. An association that had no message is looked at
+ *                  again after twice the time of the last look, up to
+ *                  CommitReactorMaxTick, and one that had a message after
+ *                  CommitReactorTick. The thread sleeps until the next one
+ *                  is due or it is handed another, and while it has none.
+ *
+ ****************************************************************************/
+void* CommitReactor::run(void* thisLoop)
+{
+	ReactorLoop*                 loop = (ReactorLoop*)thisLoop;
+	list<CommitWait*>            watched;
+	list<CommitWait*>::iterator  iter;
+	CommitWait*                  wait;
+	struct timeval               now;
+	struct timespec              wakeup;
+	double                       nowSeconds;
+	double                       nextDue;
+	int                          maxTick;
+	bool                         answered;
+
+	maxTick = CommitReactorMaxTick > CommitReactorTick ? CommitReactorMaxTick : CommitReactorTick;
+	for (;;)
+	{
+		pthread_mutex_lock(&loop->lock);
+		while (watched.empty() && loop->added.empty())
+			pthread_cond_wait(&loop->wakeup, &loop->lock);
+		watched.splice(watched.end(), loop->added);
+		pthread_mutex_unlock(&loop->lock);
+
+		gettimeofday(&now, NULL);
+		nowSeconds = now.tv_sec + now.tv_usec / 1000000.0;
+		nextDue = nowSeconds + maxTick / 1000.0;
+		for (iter = watched.begin(); iter != watched.end(); )
+		{
+			wait = *iter;
+			if (wait->nextLook <= nowSeconds)
+			{
+				answered = false;
+				if (instance()->step(wait, now.tv_sec, answered))
+				{
+					// Closing the association and telling the waiter can take a
+					// while, so it is not done here
+					WorkerPool::instance()->submit(CommitReactor::finish, (void*)wait, true);
+					iter = watched.erase(iter);
+					continue;
+				}
+
+				// A report that was answered may be followed by the next one
+				if (answered)
+					wait->interval = CommitReactorTick;
+				else if ((wait->interval *= 2) > maxTick)
+					wait->interval = maxTick;
+				wait->nextLook = nowSeconds + wait->interval / 1000.0;
+			}
+			if (wait->nextLook < nextDue)
+				nextDue = wait->nextLook;
+			++iter;
+		}
+
+		if (watched.empty())
+			continue;
+
+		wakeup.tv_sec = (time_t)nextDue;
+		wakeup.tv_nsec = (long)((nextDue - wakeup.tv_sec) * 1000000000.0);
+		pthread_mutex_lock(&loop->lock);
+		if (loop->added.empty())
+			pthread_cond_timedwait(&loop->wakeup, &loop->lock, &wakeup);
+		pthread_mutex_unlock(&loop->lock);
+	}
+
+	return NULL;
+}
+
+/****************************************************************************
+ *
+ *  Function    :   finish
+ *
+ *  Parameters  :   thisWait - the CommitWait that is over
+ *
+ *  Returns     :   THREAD_NORMAL_EXIT
+ *
+ *  Description :   Runs on the worker pool. The commit task returned long
+ *                  ago, so a failure is told to the waiter rather than
+ *                  returned. The waiter is let go of only once the commit
+ *                  is finished.
+ *
+ ****************************************************************************/
+void* CommitReactor::finish(void* thisWait)
+{
+	CommitWait*   wait = (CommitWait*)thisWait;
+	NEVENT_ENUM   status = wait->status;
+	CommitWaiter* waiter = wait->args.waiter;
+
+	if (status == FAILURE && waiter)
+		waiter->commitFailed();
+
+	FinishEitherStorageCommitment(&wait->args, wait->associationID, status, wait->waitTime, wait->sent);
+
+	delete wait;
+	instance()->finished(status);
+
+	// May report the commit and free its result
+	if (waiter)
+		waiter->commitReported();
+
+	return (void *) &THREAD_NORMAL_EXIT;
+}
+
+void CommitReactor::report()
+{
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "Commit reactor: %d thread(s), %d association(s) waited on, at most %d; %lu synchronous, %lu left to the listener, %lu failed",
+			  (int)_loops.size(), _numWatched, _peakWatched, _numSynch, _numTimedOut, _numFailed);
+	pthread_mutex_unlock(&_lock);
+}
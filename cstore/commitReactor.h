@@ -0,0 +1,113 @@
+#ifndef _COMMITREACTOR_H_
+#define _COMMITREACTOR_H_
+
+/*
+ * file:	commitReactor.h
+ * purpose:	CommitReactor singleton that waits for the synchronous
+ *          N-EVENT-REPORTs of every either-commitment on the association
+ *          its N-ACTIONs went on, so a commit waiting for them is not a
+ *          thread. Each association is handed to one of CommitReactorThreads
+ *          threads (line 22 of cstoredefaults.txt, 0 keeps a worker thread
+ *          per commit blocked in MC_Read_Message as before). A thread looks
+ *          at each of its associations when it is due and answers the report
+ *          that is there. The toolkit does not give the socket of an
+ *          association it opened, so the look is MC_Read_Message without a
+ *          timeout. An association is looked at again CommitReactorTick
+ *          milliseconds after a message (line 23), and the time doubles
+ *          while it stays silent, up to CommitReactorMaxTick (line 24), so
+ *          commits that wait long cost little. A thread sleeps until its
+ *          next association is due or it is handed another. When the
+ *          reports are in, the association closes or the commit has waited
+ *          its RoleReversalWaitTime, the commit is finished on the worker
+ *          pool by FinishEitherStorageCommitment.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <list>
+#include <vector>
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "cstoreutils.h"
+
+using namespace std;
+
+/*
+ * One association whose reports are waited for
+ */
+class CommitWait
+{
+public:
+	COMMIT_ARGS    args;
+	int            associationID;
+	int            waitTime;      /* seconds without a message before it goes asynchronous */
+	struct timeval sent;          /* when the N-ACTIONs went out */
+	time_t         lastMessage;   /* when the last message came, or the wait started */
+	double         nextLook;      /* seconds since the epoch the association is looked at next */
+	int            interval;      /* ms from the last look to the next */
+	NEVENT_ENUM    status;        /* how the wait ended */
+};
+
+/*
+ * A reactor thread and the associations handed to it
+ */
+class ReactorLoop
+{
+public:
+	pthread_mutex_t   lock;       /* protects added */
+	pthread_cond_t    wakeup;     /* signalled when one is added */
+	list<CommitWait*> added;      /* handed over, not looked at yet */
+
+	ReactorLoop();
+	~ReactorLoop();
+
+private:
+	// Disallow copying or assignment.
+	ReactorLoop(const ReactorLoop&);
+	ReactorLoop& operator=(const ReactorLoop&);
+};
+
+class CommitReactor
+{
+	static CommitReactor*  _instance;
+	pthread_mutex_t        _lock;          /* protects everything below */
+	vector<ReactorLoop*>   _loops;         /* one per running thread */
+	bool                   _started;
+	unsigned int           _next;          /* loop the next association goes to */
+	int                    _numWatched;
+	int                    _peakWatched;
+	unsigned long          _numSynch;      /* reports all came on the association */
+	unsigned long          _numTimedOut;   /* left to the CommitListener */
+	unsigned long          _numFailed;
+
+	CommitReactor();
+
+	// Disallow copying or assignment.
+	CommitReactor(const CommitReactor&);
+	CommitReactor& operator=(const CommitReactor&);
+
+	void start();
+	bool step(CommitWait* wait, time_t now, bool& answered);
+	void finished(NEVENT_ENUM status);
+
+public:
+	static CommitReactor* instance();
+	~CommitReactor();
+
+	// Wait for the reports of the commit on the association, which the
+	// reactor owns from now on. Returns false, and takes nothing, if there
+	// are no reactor threads.
+	bool watch(const COMMIT_ARGS& commitArgs, int associationID, int waitTime,
+			   const struct timeval& sent);
+
+	// Write the associations watched and counts to the log
+	void report();
+
+	static void* run(void* thisLoop);
+	static void* finish(void* thisWait);
+};
+
+#endif
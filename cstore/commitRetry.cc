@@ -0,0 +1,357 @@
+/*
+ * file:	commitRetry.cc
+ * purpose:	Implementation of the CommitRetry class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include "commitRetry.h"
+#include "cstoremanager.h"
+
+extern int CommitRetryDelay;
+extern int CommitRetryMaxDelay;
+extern int CommitRestoreMissing;
+
+/*
+ * Retries waiting for their time, earliest first
+ */
+static pthread_mutex_t   timerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    timerWakeup = PTHREAD_COND_INITIALIZER;
+static list<CommitRetry*> waiting;
+static bool              timerStarted = false;
+
+static bool isBefore(const struct timeval& a, const struct timeval& b)
+{
+	return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_usec < b.tv_usec);
+}
+
+CommitRetry::CommitRetry(CommitWaiter* waiter, CommitStrategy* strategy,
+						 const list<DICOMStoragePkg::StorageTarget>& storageTargets)
+			: _outstanding (0),
+			  _armed (false),
+			  _waiter (waiter),
+			  _strategy (strategy),
+			  _storageTargets (storageTargets),
+			  _numFiles (0),
+			  _numMissing (0)
+{
+	pthread_mutex_init(&_lock, NULL);
+	due.tv_sec = 0;
+	due.tv_usec = 0;
+}
+
+CommitRetry::~CommitRetry()
+{
+	pthread_mutex_destroy(&_lock);
+}
+
+CommitRetry::CommitRetry(const CommitRetry&)
+{
+}
+
+CommitRetry& CommitRetry::operator=(const CommitRetry&)
+{
+	return *this;
+}
+
+bool CommitRetry::add(const COMMIT_ARGS& commitArgs)
+{
+	const DICOMStoragePkg::ResultByStorageTarget& stored = *commitArgs.result->stored;
+	vector<int> files;
+	int         target;
+
+	// Files that were stored, are DICOM and are not committed yet
+	for (int i=0; i<(int)stored.resultByFiles.length(); i++)
+		if (stored.resultByFiles[i].storageOutcome == DICOMStoragePkg::STORAGE_SUCCEESS &&
+			stored.resultByFiles[i].SOPInstanceUID.in()[0] &&
+			commitArgs.result->commitOutcome[i] != DICOMStoragePkg::COMMIT_SUCCEESS)
+			files.push_back(i);
+	if (files.empty())
+		return false;
+
+	target = (int)_retried.length();
+	_retried.length(target + 1);
+	DICOMStoragePkg::ResultByStorageTarget& retried = _retried[target];
+
+	retried.storageHostName = CORBA::string_dup(stored.storageHostName.in());
+	retried.storageCommitRequired = stored.storageCommitRequired;
+	retried.transactionUID = CORBA::string_dup("");
+	retried.resultByFiles.length(files.size());
+	for (int i=0; i<(int)files.size(); i++)
+	{
+		const DICOMStoragePkg::ResultByFile& file = stored.resultByFiles[files[i]];
+
+		retried.resultByFiles[i].imgFile = CORBA::string_dup(file.imgFile.in());
+		retried.resultByFiles[i].SOPClassUID = CORBA::string_dup(file.SOPClassUID.in());
+		retried.resultByFiles[i].SOPInstanceUID = CORBA::string_dup(file.SOPInstanceUID.in());
+		retried.resultByFiles[i].storageOutcome = file.storageOutcome;
+		retried.resultByFiles[i].commitOutcome = DICOMStoragePkg::COMMIT_UNKNOWN;
+		if (commitArgs.result->missing[files[i]])
+			_numMissing++;
+	}
+	CountResultStrings(2 + 3 * files.size());
+
+	_args.push_back(commitArgs);
+	_originals.push_back(commitArgs.result);
+	_files.push_back(files);
+	_numFiles += (int)files.size();
+
+	return true;
+}
+
+void CommitRetry::commitExpected()
+{
+	pthread_mutex_lock(&_lock);
+	_outstanding++;
+	pthread_mutex_unlock(&_lock);
+}
+
+void CommitRetry::commitReported()
+{
+	bool last;
+
+	pthread_mutex_lock(&_lock);
+	last = --_outstanding == 0 && _armed;
+	pthread_mutex_unlock(&_lock);
+
+	if (last)
+		finish();
+}
+
+void CommitRetry::commitFailed()
+{
+	// The files keep the outcomes they had
+}
+
+/*
+ * Store the files the PACS no longer has to their storage target again.
+ * They are committed again whether or not that worked; one that is still
+ * missing fails again.
+ */
+void CommitRetry::restoreMissing()
+{
+	DICOMStoragePkg::ResultByStorageTargetList_var stored;
+	list<DICOMStoragePkg::StorageTarget>           target;
+	list<DICOMStoragePkg::StorageTarget>::const_iterator iter;
+	list<string>                                   files;
+	int                                            numStored;
+
+	for (unsigned int t=0; t<_originals.size(); t++)
+	{
+		const char* storageHostName = _retried[t].storageHostName.in();
+
+		files.clear();
+		for (unsigned int i=0; i<_files[t].size(); i++)
+			if (_originals[t]->missing[_files[t][i]])
+				files.push_back(_retried[t].resultByFiles[i].imgFile.in());
+		if (files.empty())
+			continue;
+
+		for (iter=_storageTargets.begin(); iter != _storageTargets.end(); ++iter)
+			if (!strcmp(iter->exportSystem.hostName.in(), storageHostName))
+				break;
+		if (iter == _storageTargets.end())
+		{
+			::Message(MWARNING, toEndUser | toService | MLoverall,
+					  "%d file(s) are missing on %s, which is not a storage target of this export, they are not stored again",
+					  (int)files.size(), storageHostName);
+			continue;
+		}
+
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				  "Storing %d file(s) missing on %s again", (int)files.size(), storageHostName);
+		target.assign(1, *iter);
+		try
+		{
+			stored = CstoreManager::instance()->executeStore(files, target, NULL);
+
+			numStored = 0;
+			for (int i=0; i<(int)stored->length(); i++)
+				for (int j=0; j<(int)stored[i].resultByFiles.length(); j++)
+					if (stored[i].resultByFiles[j].storageOutcome == DICOMStoragePkg::STORAGE_SUCCEESS)
+						numStored++;
+			::Message(MNOTE, toEndUser | toService | MLoverall,
+					  "%d of %d missing file(s) stored on %s again", numStored, (int)files.size(), storageHostName);
+		}
+		catch ( DictionaryPkg::NucMedException& )
+		{
+			::Message(MWARNING, toEndUser | toService | MLoverall,
+					  "Missing files could not be stored on %s again", storageHostName);
+		}
+	}
+}
+
+/*
+ * Copy what the retry found out back to the original results, and tell
+ * the waiter. An outcome the retry did not learn is left as it was.
+ */
+void CommitRetry::finish()
+{
+	CommitTransaction transaction;
+	int               numCommitted = 0;
+
+	for (unsigned int t=0; t<_originals.size(); t++)
+	{
+		CommitResult* original = _originals[t];
+
+		for (unsigned int i=0; i<_files[t].size(); i++)
+		{
+			if (_results[t].commitOutcome[i] == DICOMStoragePkg::COMMIT_UNKNOWN)
+				continue;
+			original->commitOutcome[_files[t][i]] = _results[t].commitOutcome[i];
+			original->missing[_files[t][i]] = _results[t].missing[i];
+			if (_results[t].commitOutcome[i] == DICOMStoragePkg::COMMIT_SUCCEESS)
+				numCommitted++;
+		}
+
+		// Report the UIDs of the retry with the others. The files of the
+		// original are not in their range.
+		for (unsigned int i=0; i<_results[t].transactions.size(); i++)
+		{
+			transaction = _results[t].transactions[i];
+			transaction.firstFile = 0;
+			transaction.endFile = 0;
+			original->transactions.push_back(transaction);
+		}
+	}
+
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "Recommit of %d file(s) done, %d committed", _numFiles, numCommitted);
+
+	_waiter->commitReported();
+	delete this;
+}
+
+void* CommitRetry::run(void* thisRetry)
+{
+	CommitRetry*      retry = (CommitRetry*)thisRetry;
+	list<TaskFuture*> tasks;
+	void*             status;
+	bool              ready;
+
+	if (CommitRestoreMissing && retry->_numMissing)
+		retry->restoreMissing();
+
+	// The retried results exist now that _retried no longer grows
+	for (int t=0; t<(int)retry->_retried.length(); t++)
+		retry->_results.push_back(CommitResult(&retry->_retried[t]));
+	for (unsigned int t=0; t<retry->_args.size(); t++)
+	{
+		retry->_args[t].result = &retry->_results[t];
+		retry->_args[t].waiter = retry;
+	}
+
+	retry->_strategy->commitAlgorithm(retry->_args, tasks);
+
+	// An asynchronous commit task only sends the N-ACTION
+	for (list<TaskFuture*>::iterator iter=tasks.begin(); iter != tasks.end(); ++iter)
+	{
+		status = (*iter)->wait();
+		(*iter)->release();
+		if ( status == NULL || *(const int*)status == THREAD_EXCEPTION )
+			::Message(MWARNING, toEndUser | toService | MLoverall,
+					  "A recommit task failed, the files keep their outcomes");
+	}
+
+	pthread_mutex_lock(&retry->_lock);
+	retry->_armed = true;
+	ready = retry->_outstanding == 0;
+	pthread_mutex_unlock(&retry->_lock);
+
+	if (ready)
+		retry->finish();
+
+	return (void *) &THREAD_NORMAL_EXIT;
+}
+
+int CommitRetry::backoff(int attempts)
+{
+	int delay = CommitRetryDelay > 0 ? CommitRetryDelay : 0;
+
+	while (attempts-- > 0 && delay < CommitRetryMaxDelay)
+		delay *= 2;
+
+	return delay < CommitRetryMaxDelay ? delay : CommitRetryMaxDelay;
+}
+
+void CommitRetry::schedule(CommitRetry* retry, int delay)
+{
+	list<CommitRetry*>::iterator iter;
+	pthread_t                    tid;
+	pthread_attr_t               attr;
+
+	gettimeofday(&retry->due, NULL);
+	retry->due.tv_sec += delay;
+
+	pthread_mutex_lock(&timerLock);
+	if (!timerStarted)
+	{
+		pthread_attr_init(&attr); // Initialize with the default value
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if( pthread_create(&tid, &attr, CommitRetry::timer, NULL) != 0)
+		{
+			// Without the timer the retry runs now
+			::Message( MALARM, toEndUser | toService | MLoverall,
+					   "Cstore failed to create a thread to time the storage commitment retries");
+			pthread_attr_destroy(&attr);
+			pthread_mutex_unlock(&timerLock);
+			WorkerPool::instance()->submit(CommitRetry::run, (void*)retry, true);
+			return;
+		}
+		timerStarted = true;
+		pthread_attr_destroy(&attr);
+	}
+
+	for (iter=waiting.begin(); iter != waiting.end() && !isBefore(retry->due, (*iter)->due); ++iter)
+		;
+	waiting.insert(iter, retry);
+	pthread_cond_signal(&timerWakeup);
+	pthread_mutex_unlock(&timerLock);
+}
+
+/****************************************************************************
+ *
+ *  Function    :   timer
+ *
+ *  Parameters  :   arg - not used
+ *
+ *  Returns     :   NULL
+ *
+ *  Description :   Sleeps until the earliest retry is due, then hands it
+ *                  to the worker pool to run.
+ *
+ ****************************************************************************/
+void* CommitRetry::timer(void* arg)
+{
+	CommitRetry*    retry;
+	struct timeval  now;
+	struct timespec wakeup;
+
+	pthread_mutex_lock(&timerLock);
+	for (;;)
+	{
+		if (waiting.empty())
+		{
+			pthread_cond_wait(&timerWakeup, &timerLock);
+			continue;
+		}
+
+		gettimeofday(&now, NULL);
+		retry = waiting.front();
+		if (isBefore(now, retry->due))
+		{
+			wakeup.tv_sec = retry->due.tv_sec;
+			wakeup.tv_nsec = retry->due.tv_usec * 1000;
+			pthread_cond_timedwait(&timerWakeup, &timerLock, &wakeup);
+			continue;
+		}
+
+		waiting.pop_front();
+		pthread_mutex_unlock(&timerLock);
+		WorkerPool::instance()->submit(CommitRetry::run, (void*)retry, true);
+		pthread_mutex_lock(&timerLock);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,81 @@
+#ifndef _COMMITRETRY_H_
+#define _COMMITRETRY_H_
+
+/*
+ * file:	commitRetry.h
+ * purpose:	CommitRetry class that commits again only the files of a commit
+ *          target that are not committed yet, failed or never reported,
+ *          rather than the whole export. The CommitContextPool makes one
+ *          per commit target before it reports, up to CommitRetryLimit times
+ *          (line 18 of cstoredefaults.txt, 0 turns it off). The first waits
+ *          CommitRetryDelay seconds (line 19), each next one twice as long,
+ *          at most CommitRetryMaxDelay (line 20). With CommitRestoreMissing
+ *          (line 21) set, files the PACS reported as no such object
+ *          instance are stored again first, if the storage target is known.
+ *          The outcomes are copied back and the pool is told when done.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <list>
+#include <vector>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "commitStrategy.h"
+#include "commitListener.h"
+
+using namespace std;
+
+class CommitRetry : public CommitWaiter
+{
+	pthread_mutex_t                            _lock;         /* protects the two below */
+	int                                        _outstanding;  /* N-EVENT-REPORTs still expected */
+	bool                                       _armed;        /* the commit tasks are done */
+
+	CommitWaiter*                              _waiter;       /* told when the retry is done */
+	CommitStrategy*                            _strategy;     /* of the commit target, not owned */
+	list<DICOMStoragePkg::StorageTarget>       _storageTargets;
+	DICOMStoragePkg::ResultByStorageTargetList _retried;      /* the files committed again */
+	vector<CommitResult>                       _results;      /* over _retried, made when run */
+	vector<COMMIT_ARGS>                        _args;
+	vector<CommitResult*>                      _originals;    /* what the files are copied back to */
+	vector<vector<int> >                       _files;        /* index in the original of each file */
+	int                                        _numFiles;
+	int                                        _numMissing;
+
+	// Disallow copying or assignment.
+	CommitRetry(const CommitRetry&);
+	CommitRetry& operator=(const CommitRetry&);
+
+	void restoreMissing();
+	void finish();
+
+public:
+	struct timeval                             due;
+
+	CommitRetry(CommitWaiter* waiter, CommitStrategy* strategy,
+				const list<DICOMStoragePkg::StorageTarget>& storageTargets);
+	~CommitRetry();
+
+	// Take the stored files of the commit that are not committed. Returns
+	// false if there are none.
+	bool add(const COMMIT_ARGS& commitArgs);
+	int numFiles() const { return _numFiles; }
+
+	// CommitWaiter
+	void commitExpected();
+	void commitReported();
+	void commitFailed();
+
+	// Run the retry after delay seconds
+	static void schedule(CommitRetry* retry, int delay);
+	// Seconds to wait before the retry that follows attempts retries
+	static int backoff(int attempts);
+
+	static void* run(void* thisRetry);
+	static void* timer(void* arg);
+};
+
+#endif
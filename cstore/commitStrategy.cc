@@ -52,10 +52,10 @@ SynchronousCommitStrategy& SynchronousCommitStrategy::operator=(const Synchronou
 }
 
 void SynchronousCommitStrategy::commitAlgorithm(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids)
+						list<TaskFuture*>& tasks)
 {	
 	SynchCommit synchCommit;
-	synchCommit.commit(commitArgs, tids);
+	synchCommit.commit(commitArgs, tasks);
 }
 
 DICOMStoragePkg::CommitType SynchronousCommitStrategy::commitType()
@@ -87,10 +87,10 @@ AsynchronousCommitStrategy& AsynchronousCommitStrategy::operator=(const Asynchro
 }
 
 void AsynchronousCommitStrategy::commitAlgorithm(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids)
+						list<TaskFuture*>& tasks)
 {	
 	AsynchCommit asynchCommit;
-	asynchCommit.commit(commitArgs, tids);
+	asynchCommit.commit(commitArgs, tasks);
 }
 
 DICOMStoragePkg::CommitType AsynchronousCommitStrategy::commitType()
@@ -122,10 +122,10 @@ EitherCommitStrategy& EitherCommitStrategy::operator=(const EitherCommitStrategy
 }
 
 void EitherCommitStrategy::commitAlgorithm(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids)
+						list<TaskFuture*>& tasks)
 {	
 	EitherCommit eitherCommit;
-	eitherCommit.commit(commitArgs, tids);
+	eitherCommit.commit(commitArgs, tasks);
 }
 
 DICOMStoragePkg::CommitType EitherCommitStrategy::commitType()
@@ -157,9 +157,9 @@ NoCommitStrategy& NoCommitStrategy::operator=(const NoCommitStrategy& obj)
 }
 
 void NoCommitStrategy::commitAlgorithm(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids)
+						list<TaskFuture*>& tasks)
 {	// There is nothing to do
-	tids.clear();
+	tasks.clear();
 }
 
 DICOMStoragePkg::CommitType NoCommitStrategy::commitType()
@@ -25,7 +25,7 @@ public:
 	CommitStrategy& operator=(const CommitStrategy& obj);
 
 	virtual void commitAlgorithm(vector<COMMIT_ARGS>& commitArgs,
-								list<pthread_t>& tids)=0;
+								list<TaskFuture*>& tasks)=0;
 	virtual DICOMStoragePkg::CommitType commitType()=0;
 };
 
@@ -37,7 +37,7 @@ public:
 	SynchronousCommitStrategy& operator=(const SynchronousCommitStrategy& obj);
 
 	void commitAlgorithm(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids);
+						list<TaskFuture*>& tasks);
 	DICOMStoragePkg::CommitType commitType();
 };
 
@@ -49,7 +49,7 @@ public:
 	AsynchronousCommitStrategy& operator=(const AsynchronousCommitStrategy& obj);
 
 	void commitAlgorithm(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids);
+						list<TaskFuture*>& tasks);
 	DICOMStoragePkg::CommitType commitType();
 };
 
@@ -61,7 +61,7 @@ public:
 	EitherCommitStrategy& operator=(const EitherCommitStrategy& obj);
 
 	void commitAlgorithm(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids);
+						list<TaskFuture*>& tasks);
 	DICOMStoragePkg::CommitType commitType();
 };
 
@@ -74,7 +74,7 @@ public:
 	NoCommitStrategy& operator=(const NoCommitStrategy& obj);
 
 	void commitAlgorithm(vector<COMMIT_ARGS>& commitArgs,
-						list<pthread_t>& tids);
+						list<TaskFuture*>& tasks);
 	DICOMStoragePkg::CommitType commitType();
 };
 
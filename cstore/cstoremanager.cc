@@ -14,6 +14,19 @@
 #include <syslog.h>
 
 #include "cstoremanager.h"
+#include "targetHealth.h"
+#include "exportScheduler.h"
+#include "bandwidthShaper.h"
+#include "targetGroup.h"
+#include "diskOrder.h"
+#include "fileValidation.h"
+#include "fileSource.h"
+#include "inFlightBudget.h"
+#include "metadataCache.h"
+#include "readAhead.h"
+#include "commitCoalescer.h"
+#include "commitHistory.h"
+#include "commitReactor.h"
 #include "control/lookupmatchutils.h"
 #include "control/stationimpl.h"
 
@@ -21,6 +34,8 @@ static const char rcsName[] = "$Name: Atlantis710R01_branch $";
 extern const char *cstoreBuildDate;
 extern int	AsyncCommitIncomingPort;
 extern char LocalSystemCallingAE[AE_LENGTH+2];
+extern int ExportDiskOrder;
+extern int CommitPipelineChunk;
 
 CstoreManager* CstoreManager::_instance = NULL;  /* handle of singleton object */
 
@@ -50,6 +65,8 @@ CstoreManager::CstoreManager(const char *mergeIniFile)
   _cameraConnection = NULL;
 
   GetCstoreDefaultParameters();
+  BandwidthShaper::instance()->loadProfiles();
+  TargetGroupTable::instance()->loadGroups();
 
   if(false == PerformMergeInitialization( _mergeIniFile, &_applicationID, LocalSystemCallingAE ))
   {
@@ -59,6 +76,26 @@ CstoreManager::CstoreManager(const char *mergeIniFile)
   ::Message( MNOTE, MLoverall | toService | toDeveloper, "Merge Toolkit is initialized with local AE Title %s",
 			 LocalSystemCallingAE );
 
+  // Targets that keep failing are skipped and probed with C-ECHO in the background
+  TargetHealth::instance()->startProbing(_applicationID);
+
+  // Reports for commits made before a restart are still forwarded to the camera
+  CommitListener::instance()->recover(_applicationID);
+
+  // Start the worker threads before the first export needs them
+  WorkerPool::instance();
+
+  // The singletons the export tasks share are made here, before two tasks
+  // can each make one
+  ExportScheduler::instance();
+  InFlightBudget::instance();
+  MetadataCache::instance();
+  ReadAheadEngine::instance();
+  CommitCoalescer::instance();
+  CommitHistory::instance();
+  CommitReactor::instance();
+  ExportJobManager::instance();
+
 #ifdef linux
   pthread_t tid;
 
@@ -108,19 +145,56 @@ void
 CstoreManager::storeAndCommit(const list<string>& filelist,
 							const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
 							const list<DICOMStoragePkg::CommitTarget>& committargetlist)
-{	DICOMStoragePkg::ResultByStorageTargetList_var resultByStorageTargets;
+{
+	DICOMStoragePkg::ResultByStorageTargetList_var resultByStorageTargets;
+
+	if (CommitPipelineChunk <= 0 || !committargetlist.size())
+	{
+		// Now do the storage commitment, handing the result over without a copy
+		commit(new SharedResult(store(filelist, storagetargetlist)), committargetlist, NULL, &storagetargetlist);
+		return;
+	}
 
-	resultByStorageTargets = store(filelist, storagetargetlist);
-	// Now do the storage commitment
-	commit(resultByStorageTargets.in(), committargetlist);
+	// Commit the files chunk by chunk as they are stored
+	CommitPipeline pipeline(storagetargetlist, committargetlist, CommitPipelineChunk);
+
+	resultByStorageTargets = executeStore(filelist, storagetargetlist, NULL, PRIORITY_ROUTINE, &pipeline);
+	if (!auditStorageResult(resultByStorageTargets.in()))
+		throw( DictionaryPkg::NucMedException (DictionaryPkg::NUCMED_NETWORK) );
+
+	pipeline.commitRest(resultByStorageTargets.in());
 }
 
 
 DICOMStoragePkg::ResultByStorageTargetList* 
 CstoreManager::store(const list<string>& filelist,
 					const list<DICOMStoragePkg::StorageTarget>& storagetargetlist)
-{	StorageContextPool storageContextPool;
+{	DICOMStoragePkg::ResultByStorageTargetList_var resultByStorageTargets;
+
+	resultByStorageTargets = executeStore(filelist, storagetargetlist, NULL);
+
+	// Check the storage results here. If not successful, throw it all the way to
+	// the controller or image handling server so they know that storage failed.
+	if (!auditStorageResult(resultByStorageTargets.in()))
+		throw( DictionaryPkg::NucMedException (DictionaryPkg::NUCMED_NETWORK) );
+
+	return resultByStorageTargets._retn();
+}
+
+
+DICOMStoragePkg::ResultByStorageTargetList* 
+CstoreManager::executeStore(const list<string>& entrylist,
+					const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+					ExportProgress* progress,
+					EXPORT_PRIORITY priority,
+					CommitPipeline* pipeline)
+{	list<string> expandedList;
+	// Directories and manifests are enumerated now, when the export runs
+	const list<string>& filelist = ExpandFileSources(entrylist, expandedList) ? expandedList : entrylist;
+	StorageContextPool storageContextPool;
+	ExportProgress localProgress; // identifies the job to the scheduler if the caller has none
 	StorageData storageData;
+	FileValidation* validation;
 	char localAETitle[AE_LENGTH+2];
 	int minLen = 0;
 	DICOMStoragePkg::ResultByStorageTargetList_var resultByStorageTargets;
@@ -152,7 +226,38 @@ CstoreManager::store(const list<string>& filelist,
 					localAETitle, LocalSystemCallingAE);
 
 	StorageStrategy storeStrategy(_applicationID);
-	storageData.createLinkedList(filelist);
+	if (ExportDiskOrder != DISK_ORDER_NONE)
+	{
+		// Read the files in disk order, the results are reported by file name
+		list<string> orderedList(filelist);
+
+		OrderFilesByDiskLocation(orderedList, ExportDiskOrder);
+		storageData.createLinkedList(orderedList);
+		validation = FileValidation::start(orderedList);
+	}
+	else
+	{
+		storageData.createLinkedList(filelist);
+		validation = FileValidation::start(filelist);
+	}
+
+	// Start sending once a file is known to be DICOM, the others are checked
+	// on the worker pool as the senders get to them
+	storageData.setValidation(validation);
+	validation->release(); // storageData keeps it
+	if (!validation->waitForAnyValid())
+	{
+		validation->report();
+		::Message(MWARNING, toEndUser | toService | MLoverall, "There is no valid DICOM file to store for this task. Cstore waits for the next task.");
+		throw( DictionaryPkg::NucMedException (DictionaryPkg::NUCMED_SOFTWARE) );
+	}
+
+	if (!progress)
+		progress = &localProgress;
+	progress->addFiles(GetNumNodes(storageData._instanceList) * (int)storagetargetlist.size());
+	storageData.setProgress(progress);
+	storageData.setPriority(priority);
+	storageData.setCommitPipeline(pipeline);
 
 	for(list<DICOMStoragePkg::StorageTarget>::const_iterator iter=storagetargetlist.begin();
 		iter != storagetargetlist.end(); ++iter)
@@ -163,16 +268,28 @@ CstoreManager::store(const list<string>& filelist,
 
 	storageContextPool.execute(); // execute will create one thread per storage target
 	resultByStorageTargets = storageContextPool.getResult(); // getResult will wait until threads finish
+	validation->report();
+
+	return resultByStorageTargets._retn();
+}
+
+
+bool
+CstoreManager::auditStorageResult(const DICOMStoragePkg::ResultByStorageTargetList& resultByStorageTargets)
+{	bool stored = true;
 
 	openlog( "", LOG_NDELAY | LOG_NOWAIT, LOG_LOCAL7);
-	// Check the storage results here. If not successful, throw it all the way to
-	// the controller or image handling server so they know that storage failed.
 	// If it is successful, send a message to Audit Logs.
-	for(int i=0; i<(int)resultByStorageTargets->length(); i++)
+	for(int i=0; stored && i<(int)resultByStorageTargets.length(); i++)
 		for(int j=0; j<(int)(resultByStorageTargets[i].resultByFiles.length()); j++)
-			if(resultByStorageTargets[i].resultByFiles[j].storageOutcome != DICOMStoragePkg::STORAGE_SUCCEESS)
+			if(IsNotDICOMResult(resultByStorageTargets[i].resultByFiles[j]))
+			{	// Not a DICOM file, reported in the result but not a failure of the export
+				::Message( MWARNING, MLoverall | toService | toDeveloper, "File \"%s\" is not in DICOM format and was not stored", resultByStorageTargets[i].resultByFiles[j].imgFile.in());
+			}
+			else if(resultByStorageTargets[i].resultByFiles[j].storageOutcome != DICOMStoragePkg::STORAGE_SUCCEESS)
 			{	::Message( MWARNING, MLoverall | toService | toDeveloper, "Storage is not successful. Possibly network problem");
-				throw( DictionaryPkg::NucMedException (DictionaryPkg::NUCMED_NETWORK) );
+				stored = false;
+				break;
 			}
 			else
 			{	// Log to the Audit
@@ -180,21 +297,95 @@ CstoreManager::store(const list<string>& filelist,
 			}
 	closelog();
 
-	return resultByStorageTargets._retn();
+	return stored;
+}
+
+
+DICOMStoragePkg::ResultByStorageTargetList* 
+CstoreManager::storeSummary(const list<string>& filelist,
+					const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+					ExportResultSummary& summary)
+{	DICOMStoragePkg::ResultByStorageTargetList_var resultByStorageTargets;
+	ExportJobManager* jobManager = ExportJobManager::instance();
+	bool stored;
+
+	resultByStorageTargets = executeStore(filelist, storagetargetlist, NULL);
+	stored = auditStorageResult(resultByStorageTargets.in());
+
+	summary.jobID = jobManager->keepResult(JOB_STORE, PRIORITY_ROUTINE, resultByStorageTargets.in(), stored);
+	return jobManager->getSummary(summary.jobID, summary);
+}
+
+
+unsigned long
+CstoreManager::submitStore(const list<string>& filelist,
+						const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+						EXPORT_PRIORITY priority)
+{
+	return ExportJobManager::instance()->submit(JOB_STORE, priority, filelist, storagetargetlist,
+												list<DICOMStoragePkg::CommitTarget>());
+}
+
+
+unsigned long
+CstoreManager::submitStoreAndCommit(const list<string>& filelist,
+						const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+						const list<DICOMStoragePkg::CommitTarget>& committargetlist,
+						EXPORT_PRIORITY priority)
+{
+	return ExportJobManager::instance()->submit(JOB_STORE_AND_COMMIT, priority, filelist, storagetargetlist,
+												committargetlist);
+}
+
+
+bool
+CstoreManager::getJobStatus(unsigned long jobID, ExportJobStatus& status)
+{
+	return ExportJobManager::instance()->getStatus(jobID, status);
+}
+
+
+bool
+CstoreManager::cancelJob(unsigned long jobID)
+{
+	return ExportJobManager::instance()->cancel(jobID);
+}
+
+
+DICOMStoragePkg::ResultByStorageTargetList*
+CstoreManager::getJobResult(unsigned long jobID)
+{
+	return ExportJobManager::instance()->getResult(jobID);
+}
+
+
+DICOMStoragePkg::ResultByStorageTargetList*
+CstoreManager::getJobSummary(unsigned long jobID, ExportResultSummary& summary)
+{
+	return ExportJobManager::instance()->getSummary(jobID, summary);
 }
 
 
 void
 CstoreManager::commit(const DICOMStoragePkg::ResultByStorageTargetList& resultByStorageTargets,
 					const list<DICOMStoragePkg::CommitTarget>& committargetlist)
+{
+	commit(SharedResult::copyOf(resultByStorageTargets, false), committargetlist);
+}
+
+
+void
+CstoreManager::commit(SharedResult* sharedResult,
+					const list<DICOMStoragePkg::CommitTarget>& committargetlist,
+					const struct timeval* storeStarted,
+					const list<DICOMStoragePkg::StorageTarget>* storagetargetlist)
 {	CommitContextPool* pCommitContextPool;
 	CommitStrategy*    commitStrategy;
 	CommitConfig       commitConfig;
-	pthread_t          tid;
-	pthread_attr_t     attr;
 
 	if( !committargetlist.size() )
 	{
+		sharedResult->release();
 		::Message(MWARNING, toEndUser | toService | MLoverall, "There is no commit target given for this task. Cstore waits for the next task");
 		throw( DictionaryPkg::NucMedException (DictionaryPkg::NUCMED_SOFTWARE) );
 	}
@@ -236,17 +427,19 @@ CstoreManager::commit(const DICOMStoragePkg::ResultByStorageTargetList& resultBy
 		commitConfig.reportingSystem = iter->reportingSystem;
 		commitConfig.roleReversalWaitTime = iter->roleReversalWaitTime;
 
-		// each CommitContext will make a new copy of resultByStorageTargets for itself
-		CommitContext cmtcxt(_applicationID, commitConfig, resultByStorageTargets, commitStrategy);
+		// each CommitContext shares the result and keeps only its own outcomes
+		CommitContext cmtcxt(_applicationID, commitConfig, sharedResult, commitStrategy);
 		(*pCommitContextPool) += cmtcxt;
 	}
+	sharedResult->release();
 
 	pCommitContextPool->execute(); // multiple threads will be created
 	pCommitContextPool->setCamera(_cameraConnection);
+	if (storeStarted)
+		pCommitContextPool->setStoreStarted(*storeStarted);
+	if (storagetargetlist)
+		pCommitContextPool->setStorageTargets(*storagetargetlist);
 
-	pthread_attr_init(&attr); // Initialize with the default value
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-	// pCommitContextPool will be deleted when the following thread finishes
-	if( pthread_create(&tid, &attr, CommitContextPool::getResult, (void *)pCommitContextPool) != 0)
-        Message( MWARNING, "#Software error: cannot create a thread to send back commit results.");
+	// pCommitContextPool will be deleted when the following task finishes
+	WorkerPool::instance()->submit(CommitContextPool::getResult, (void *)pCommitContextPool, true);
 }
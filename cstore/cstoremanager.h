@@ -19,6 +19,8 @@
 #include "acquire/threadmutex.h"
 #include "storageContext.h"
 #include "commitContext.h"
+#include "exportJob.h"
+#include "commitPipeline.h"
 
 static const char componentName[] = "cstore";
 class CommitReport;
@@ -48,11 +50,48 @@ public:
 									const list<DICOMStoragePkg::StorageTarget>& storagetargetlist);
 	void commit(const DICOMStoragePkg::ResultByStorageTargetList& resultByStorageTargets,
 				const list<DICOMStoragePkg::CommitTarget>& committargetlist);
+	// Same without copying the result. Takes over the caller's reference.
+	// The report logs how long after storeStarted it came, if given.
+	// Files found missing can be stored to storagetargetlist again, if given.
+	void commit(SharedResult* sharedResult,
+				const list<DICOMStoragePkg::CommitTarget>& committargetlist,
+				const struct timeval* storeStarted = NULL,
+				const list<DICOMStoragePkg::StorageTarget>* storagetargetlist = NULL);
 
 	// Do Store and Commit in one step
     void storeAndCommit(const list<string>& filelist,
 						const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
 						const list<DICOMStoragePkg::CommitTarget>& committargetlist);
+
+	// Store without checking the outcome. progress may be NULL. An entry of
+	// filelist may name a directory or a manifest, see fileSource.h.
+	DICOMStoragePkg::ResultByStorageTargetList* executeStore(const list<string>& filelist,
+									const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+									ExportProgress* progress,
+									EXPORT_PRIORITY priority = PRIORITY_ROUTINE,
+									CommitPipeline* pipeline = NULL);
+	// Log stored files to the audit log. Return false if any file was not stored.
+	bool auditStorageResult(const DICOMStoragePkg::ResultByStorageTargetList& resultByStorageTargets);
+
+	// Store and return the counts and only the files that were not stored.
+	// Does not throw if a file was not stored. The full result is kept as a
+	// finished job and can be fetched with getJobResult(summary.jobID).
+	DICOMStoragePkg::ResultByStorageTargetList* storeSummary(const list<string>& filelist,
+									const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+									ExportResultSummary& summary);
+
+	// Asynchronous export jobs. The submit calls return a job ID right away.
+	unsigned long submitStore(const list<string>& filelist,
+						const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+						EXPORT_PRIORITY priority = PRIORITY_ROUTINE);
+	unsigned long submitStoreAndCommit(const list<string>& filelist,
+						const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+						const list<DICOMStoragePkg::CommitTarget>& committargetlist,
+						EXPORT_PRIORITY priority = PRIORITY_ROUTINE);
+	bool getJobStatus(unsigned long jobID, ExportJobStatus& status);
+	bool cancelJob(unsigned long jobID);
+	DICOMStoragePkg::ResultByStorageTargetList* getJobResult(unsigned long jobID);
+	DICOMStoragePkg::ResultByStorageTargetList* getJobSummary(unsigned long jobID, ExportResultSummary& summary);
 };
 
 #endif
@@ -12,18 +12,50 @@
 #include <iomanip> 
 #include <fstream> 
 #include <stdarg.h>
+#include <sys/stat.h>
 #include <fstream> 
 
 #include "cstoreutils.h"
+#include "commitListener.h"
+#include "targetHealth.h"
+#include "exportScheduler.h"
+#include "inFlightBudget.h"
+#include "bandwidthShaper.h"
+#include "targetGroup.h"
+#include "readAhead.h"
+#include "metadataCache.h"
+#include "fileValidation.h"
+#include "sopIndex.h"
+#include "commitPipeline.h"
+#include "commitHistory.h"
+#include "commitReactor.h"
 
 const int MAX_LOOP_ITERATIONS = 604800; // number of seconds in a week, boz some StorageCommittment can get back to us days later
 
-ThreadMutex g_lock_store;   /* Serialize access to the critical section.*/
-ThreadMutex g_lock_sync_commit, g_lock_async_commit, g_lock_either_commit;  /* Serialize access to the critical section.*/
-
 char LocalSystemCallingAE[AE_LENGTH+2];
 int	AsyncCommitIncomingPort;
 char DefaultTransferSyntax[32];
+int CircuitBreakerThreshold;       /* consecutive open failures before a target is skipped */
+int CircuitBreakerProbeInterval;   /* seconds between C-ECHO probes of a skipped target */
+int StoreConcurrency;              /* storage associations open at the same time */
+int StoreConcurrencyPerTarget;     /* storage associations open at the same time to one target */
+int WorkerPoolMaxThreads;          /* cap of the worker threads running storage and commitment tasks */
+int InFlightBudgetMB;              /* megabytes of image messages sent and not yet answered */
+int ExportDiskOrder;               /* DISK_ORDER_ENUM, order of the files read for an export */
+int ReadAheadFiles;                /* files loaded ahead of the one being sent, 0 disables */
+int ReadAheadWindowMB;             /* megabytes loaded ahead per association at most */
+int MetadataCacheEntries;          /* entries of the persistent DICOM metadata cache, 0 disables */
+int ValidationConcurrency;         /* worker pool tasks checking the files of one export */
+int CommitChunkSize;               /* SOP instances per N-ACTION, 0 asks for all in one */
+int CommitCoalesceWindow;          /* ms commits to one commit target wait to go together, 0 disables */
+int CommitPipelineChunk;           /* stored files committed while the rest is sent, 0 commits after the store */
+int CommitRetryLimit;              /* recommits of the files not committed, 0 disables */
+int CommitRetryDelay;              /* seconds before the first recommit, doubled for each next one */
+int CommitRetryMaxDelay;           /* seconds between recommits at most */
+int CommitRestoreMissing;          /* 1 stores files the PACS no longer has again before a recommit */
+int CommitReactorThreads;          /* threads waiting for synchronous commit reports, 0 blocks a worker per commit */
+int CommitReactorTick;             /* ms between two looks at an association that just had a message */
+int CommitReactorMaxTick;          /* ms between two looks at a silent association at most */
 
 /*****************************************************************************
 **
@@ -95,24 +127,46 @@ int PerformMergeInitialization( const char *mergeIniFile, int *p_applicationID,
 StorageData::StorageData()
 {
 	_instanceList=NULL;
+	_progress=NULL;
+	_priority=PRIORITY_ROUTINE;
+	_group=NULL;
+	_groupMember=-1;
+	_validation=NULL;
+	_pipeline=NULL;
+	setCommitPipeline(NULL);
 }
 
 StorageData::~StorageData()
 {
 	freeInstanceList();
+	setValidation(NULL);
 }
 
 StorageData::StorageData(const StorageData& obj)
-			: _instanceList (NULL)
+			: _progress (obj._progress),
+			  _priority (obj._priority),
+			  _group (obj._group),
+			  _groupMember (obj._groupMember),
+			  _validation (NULL),
+			  _pipeline (NULL),
+			  _instanceList (NULL)
 // _filenames will be copy constructed by createLinkedList
 {
 	createLinkedList(obj._filenames);
+	setValidation(obj._validation);
+	setCommitPipeline(obj._pipeline);
 }
 
 StorageData& StorageData::operator=(const StorageData& obj)
 {
 // _filenames will be assigned by createLinkedList
 	createLinkedList(obj._filenames);
+	_progress = obj._progress;
+	_priority = obj._priority;
+	_group = obj._group;
+	_groupMember = obj._groupMember;
+	setValidation(obj._validation);
+	setCommitPipeline(obj._pipeline);
 
 	return *this;
 }
@@ -128,6 +182,7 @@ void StorageData::clear()
  *  Function    :   addFileToList
  *
  *  Parameters  :   A_fname    - The name of file to add to the list
+ *                  A_index    - Position of the file in the list
  *
  *  Returns     :   true
  *                  false
@@ -137,7 +192,7 @@ void StorageData::clear()
  *                  list.
  *
  ****************************************************************************/
-bool StorageData::addFileToList(char* A_fname)
+bool StorageData::addFileToList(char* A_fname, int A_index)
 {
     InstanceNode*    newNode;
     InstanceNode*    listNode;
@@ -158,6 +213,7 @@ bool StorageData::addFileToList(char* A_fname)
     newNode->failedResponse = false;
     newNode->imageSent = false;
     newNode->msgID = -1;
+    newNode->fileIndex = A_index;
 
     newNode->transferSyntax = IMPLICIT_LITTLE_ENDIAN;
 	if(!strncmp(DefaultTransferSyntax, "IMPLICIT_BIG_ENDIAN", sizeof("IMPLICIT_BIG_ENDIAN")))
@@ -246,6 +302,7 @@ void StorageData::freeInstanceList()
 void StorageData::createLinkedList(const list<string>& filelist)
 {	list<string>::const_iterator iter;
 	char filename[256];
+	int index = 0;
 
 	clear();
 	_filenames = filelist;
@@ -258,12 +315,13 @@ void StorageData::createLinkedList(const list<string>& filelist)
 	   memset(filename, 0, sizeof(filename));
 	   strcpy(filename, iter->c_str());
 
-       if (!addFileToList( filename ))
+       if (!addFileToList( filename, index++ ))
        {
          ::Message( MWARNING, toEndUser | toService | MLoverall, 
                    "Warning, cannot add filename to File List, image [%s] will not be sent", filename);
        }
 	}
+	setCommitPipeline(_pipeline);
 }
 
 
@@ -272,20 +330,187 @@ bool StorageData::isEmpty()
 	return _instanceList == NULL;
 }
 
+void StorageData::setProgress(ExportProgress* progress)
+{
+	_progress = progress;
+}
+
+void StorageData::addFiles(int numFiles)
+{
+	if (_progress)
+		_progress->addFiles(numFiles);
+}
+
+void StorageData::fileProcessed(bool sent)
+{
+	if (_progress)
+		_progress->fileProcessed(sent);
+}
+
+bool StorageData::isCancelled()
+{
+	return _progress != NULL && _progress->isCancelled();
+}
+
+void StorageData::setPriority(EXPORT_PRIORITY priority)
+{
+	_priority = priority;
+}
+
+void StorageData::joinGroup(TargetGroupDispatch* group, int member, const StorageData& groupData)
+{
+	clear();
+	_progress = groupData._progress;
+	_priority = groupData._priority;
+	_group = group;
+	_groupMember = member;
+	setValidation(groupData._validation);
+}
+
+void StorageData::setValidation(FileValidation* validation)
+{
+	if (validation)
+		validation->addReference();
+	if (_validation)
+		_validation->release();
+	_validation = validation;
+}
+
+bool StorageData::isValid(const InstanceNode* node)
+{
+	return !_validation || _validation->isValid(node->fileIndex);
+}
+
+void StorageData::setCommitPipeline(CommitPipeline* pipeline)
+{
+	_pipeline = pipeline;
+	_pipelineNext = _instanceList;
+	_pipelineScan = _instanceList;
+	_pipelineCount = 0;
+	_pipelineDone = false;
+}
+
+/****************************************************************************
+ *
+ *  Function    :   commitStored
+ *
+ *  Parameters  :   storageHostName - host of the storage target
+ *                  unprocessed     - first file not sent or skipped yet,
+ *                                    NULL when the store task is done
+ *
+ *  Returns     :   none
+ *
+ *  Description :   Hand the files to the CommitPipeline in chunks, each
+ *                  once all its files are answered, so they are committed
+ *                  while the later ones are still sent. The last chunk
+ *                  is handed over when the store task is done. Stops at
+ *                  the first chunk with a file that was not stored, or if
+ *                  files are left unanswered, as the export then fails.
+ *
+ ****************************************************************************/
+void StorageData::commitStored(const char* storageHostName, InstanceNode* unprocessed)
+{
+	int chunkSize;
+
+	if (!_pipeline || _pipelineDone)
+		return;
+	chunkSize = _pipeline->chunkSize();
+
+	for (;;)
+	{
+		while ( _pipelineScan != unprocessed && _pipelineCount < chunkSize &&
+				!(_pipelineScan->imageSent && !_pipelineScan->responseReceived) )
+		{
+			_pipelineScan = _pipelineScan->Next;
+			_pipelineCount++;
+		}
+
+		if (_pipelineCount < chunkSize && (unprocessed || _pipelineScan))
+		{
+			// Files left unanswered after an abort are not committed
+			_pipelineDone = unprocessed == NULL;
+			return;
+		}
+
+		if (!_pipeline->commitChunk(storageHostName, _pipelineNext, _pipelineScan))
+		{
+			_pipelineDone = true;
+			return;
+		}
+		_pipelineNext = _pipelineScan;
+		_pipelineCount = 0;
+		if (!_pipelineNext)
+		{
+			_pipelineDone = true;
+			return;
+		}
+	}
+}
+
+/*
+ * ExportProgress class.
+ */
+
+ExportProgress::ExportProgress()
+			: _totalFiles (0),
+			  _filesProcessed (0),
+			  _filesFailed (0),
+			  _cancelled (false)
+{
+}
+
+ExportProgress::~ExportProgress()
+{
+}
+
+void ExportProgress::addFiles(int numFiles)
+{
+	MutexGuard guard (_lock);
+	_totalFiles += numFiles;
+}
+
+void ExportProgress::fileProcessed(bool sent)
+{
+	MutexGuard guard (_lock);
+	_filesProcessed++;
+	if (!sent)
+		_filesFailed++;
+}
+
+void ExportProgress::getCounts(int& totalFiles, int& filesProcessed, int& filesFailed)
+{
+	MutexGuard guard (_lock);
+	totalFiles = _totalFiles;
+	filesProcessed = _filesProcessed;
+	filesFailed = _filesFailed;
+}
+
+void ExportProgress::cancel()
+{
+	_cancelled = true;
+}
+
+bool ExportProgress::isCancelled()
+{
+	return _cancelled;
+}
+
 STORE_ARGS::~STORE_ARGS()
 {
 	return; // The thread must preserve the pointer StorageData* as a return value
 }
 
 COMMIT_ARGS::COMMIT_ARGS()
-			: result (NULL)
+			: result (NULL),
+			  waiter (NULL)
 {
 }
 
 COMMIT_ARGS::COMMIT_ARGS(const COMMIT_ARGS& obj)
 			: options (obj.options),
 			  appID (obj.appID),
-			  result (obj.result)  // We need shadow copy
+			  result (obj.result),  // We need shadow copy
+			  waiter (obj.waiter)
 {
 }
 
@@ -294,15 +519,165 @@ COMMIT_ARGS& COMMIT_ARGS::operator=(const COMMIT_ARGS& obj)
 	options = obj.options;
 	appID = obj.appID;
 	result = obj.result;	// We need shadow copy
+	waiter = obj.waiter;
 
 	return *this;
 }
 
 COMMIT_ARGS::~COMMIT_ARGS()
 {
-	return; // The thread must preserve the pointer ResultByStorageTarget* as a return value
+	return; // The thread must preserve the pointer CommitResult* as a return value
+}
+
+/****************************************************************************
+ *
+ *  Function    :   AcquireInFlightCredits
+ *
+ *  Parameters  :   A_options       - storage parameters
+ *                  A_associationID - association the image will be sent on
+ *                  A_node          - the image about to be read and sent
+ *                  A_list          - all images of the association
+ *
+ *  Returns     :   true when the credits are held, or none are because
+ *                  the export was cancelled while waiting
+ *                  false on failure where association must be aborted
+ *
+ *  Description :   Take credits for the size of the file from the
+ *                  InFlightBudget before the image message is built. While
+ *                  waiting, read the responses of this association, which
+ *                  give back the credits it holds itself.
+ *
+ ****************************************************************************/
+static bool AcquireInFlightCredits( STORAGE_OPTIONS&  A_options,
+                                    int               A_associationID,
+                                    InstanceNode*     A_node,
+                                    InstanceNode**    A_list,
+                                    StorageData*      A_storageData )
+{
+    InFlightBudget*  budget = InFlightBudget::instance();
+    struct stat      fileStat;
+    size_t           bytes;
+    unsigned long    ticket;
+
+    bytes = stat(A_node->fname, &fileStat) == 0 ? (size_t)fileStat.st_size : 0;
+
+    ticket = budget->takeTicket();
+    while ( !budget->tryAcquire(ticket, bytes, 100) )
+    {
+        if ( A_storageData->isCancelled() )
+        {
+            budget->abandon(ticket);
+            A_node->creditBytes = 0;
+            return true;
+        }
+        if ( GetNumOutstandingRequests( *A_list ) > 0
+          && !ReadResponseMessages( A_options, A_associationID, 0, A_list ) )
+        {
+            budget->abandon(ticket);
+            return false;
+        }
+    }
+
+    A_node->creditBytes = bytes;
+    return true;
+}
+
+static void ReleaseInFlightCredits( InstanceNode* A_node )
+{
+    if ( A_node->creditBytes )
+    {
+        InFlightBudget::instance()->release( A_node->creditBytes );
+        A_node->creditBytes = 0;
+    }
 }
 
+/****************************************************************************
+ *
+ *  Function    :   AdviseUpcomingFiles
+ *
+ *  Parameters  :   A_node         - the image about to be read
+ *                  A_next         - first image not handed to read-ahead yet
+ *                  A_ahead        - images handed to read-ahead, not read yet
+ *                  A_averageBytes - average size of the images read so far
+ *
+ *  Returns     :   nothing
+ *
+ *  Description :   Keep ReadAheadFiles images ahead of the one being read
+ *                  loading into the page cache, but no more than fit in
+ *                  ReadAheadWindowMB at the average image size.
+ *
+ ****************************************************************************/
+static void AdviseUpcomingFiles( InstanceNode*   A_node,
+                                 InstanceNode**  A_next,
+                                 int*            A_ahead,
+                                 size_t          A_averageBytes )
+{
+    int     target = ReadAheadFiles;
+    size_t  window = (size_t)ReadAheadWindowMB * 1024 * 1024;
+
+    if ( *A_next == A_node )
+        *A_next = A_node->Next;     // it is read on demand
+    else if ( *A_ahead > 0 )
+        (*A_ahead)--;               // it was one of those read ahead
+
+    if ( A_averageBytes > 0 && (size_t)target * A_averageBytes > window )
+        target = window / A_averageBytes > 0 ? (int)(window / A_averageBytes) : 1;
+
+    while ( *A_ahead < target && *A_next )
+    {
+        ReadAheadEngine::instance()->advise( (*A_next)->fname );
+        *A_next = (*A_next)->Next;
+        (*A_ahead)++;
+    }
+}
+
+/*
+ * The outcome of a file sent for a target group is final
+ */
+static void AcknowledgeGroupFile( InstanceNode* A_node )
+{
+    if ( A_node->group )
+        A_node->group->acknowledge( A_node );
+}
+
+/****************************************************************************
+ *
+ *  Function    :   ClaimGroupFile
+ *
+ *  Parameters  :   A_options       - storage parameters
+ *                  A_associationID - association of the group member
+ *                  A_storageData   - the files of the group member
+ *                  A_claim         - returns the outcome of the claim
+ *                  A_node          - returns the file to send
+ *                  A_list          - all images of the association
+ *
+ *  Returns     :   true
+ *                  false on failure where association must be aborted
+ *
+ *  Description :   Take the next file of the target group for this member.
+ *                  When it is not the turn of the member, read one of its
+ *                  responses, which is what makes it its turn.
+ *
+ ****************************************************************************/
+static bool ClaimGroupFile( STORAGE_OPTIONS&   A_options,
+                            int                A_associationID,
+                            StorageData*       A_storageData,
+                            GROUP_CLAIM_ENUM*  A_claim,
+                            InstanceNode**     A_node,
+                            InstanceNode**     A_list )
+{
+    bool outstanding = GetNumOutstandingRequests( *A_list ) > 0;
+
+    *A_claim = A_storageData->getGroup()->claim( A_storageData->getGroupMember(), A_node, outstanding ? 0 : 1000 );
+    if ( *A_claim == GROUP_FILE_CLAIMED )
+        *A_list = A_storageData->_instanceList; // the first claim starts the list
+    else if ( *A_claim == GROUP_FILE_WAIT && outstanding )
+        return ReadResponseMessages( A_options, A_associationID, 1, A_list );
+
+    return true;
+}
+
+
 /****************************************************************************
  *
  *  Function    :   StoreFiles
@@ -320,8 +695,6 @@ COMMIT_ARGS::~COMMIT_ARGS()
  ****************************************************************************/
 void* StoreFiles(void* store_args)
 {
-	MutexGuard guard (g_lock_store);
-
 	bool                    tempBool;
     MC_STATUS               mcStatus;
     int                     associationID = -1;
@@ -330,26 +703,37 @@ void* StoreFiles(void* store_args)
     time_t                  imageStartTime = 0L;
     time_t                  imageEndTime = 0L;
     float                   totalTime = 0L;
+    struct timeval          readStartTime, readEndTime;
+    double                  readTime = 0.0;
     ServiceInfo             servInfo;
     size_t                  totalBytesRead = 0L;
     int                     imagesSent = 0L;
     int                     totalImages = 0L;
+    bool                    associationAborted = false;
+    int                     lentAssociationID = -1;
+    ExportScheduler*        scheduler = ExportScheduler::instance();
+    ExportTicket*           ticket;
+    TargetGroupDispatch*    group;
+    GROUP_CLAIM_ENUM        claim;
     InstanceNode*           node = NULL;
+    InstanceNode*           readAheadNext;
+    int                     readAheadCount = 0;
 	InstanceNode*           instanceList;
 	STORE_ARGS*             storeArgs;
 
 	storeArgs = (STORE_ARGS*)store_args;
 	instanceList = storeArgs->storageData->_instanceList;
+	group = storeArgs->storageData->getGroup();
 
-	totalImages = GetNumNodes( instanceList );
+	// A member of a target group claims its files from the group as it goes
+	totalImages = group ? group->totalFiles() : GetNumNodes( instanceList );
     
     if (totalImages == 0)
     {
         ::Message(MWARNING, toEndUser | toService | MLoverall, "Zero Number of Files to Store!");
 
 		delete storeArgs;
-		guard.release();
-        pthread_exit( (void *) &THREAD_NORMAL_EXIT );
+        return (void *) &THREAD_NORMAL_EXIT;
     }
 
     if (storeArgs->options.Verbose)
@@ -374,26 +758,67 @@ void* StoreFiles(void* store_args)
         ::Message(MNOTE, toEndUser | toService | MLoverall, "Number of Files to Store: %d", totalImages);
     }
 
-    assocStartTime = time(NULL);
-     
     /*
-     *   Open association and override hostname & port parameters if 
-     *   they were supplied.
+     *   Wait for the scheduler. A STAT export may be handed the open
+     *   association of a lower priority export to the same target.
      */
-    mcStatus = MC_Open_Association( storeArgs->applicationID, &associationID,
-                                    storeArgs->options.RemoteAE,
-                                    storeArgs->options.RemotePort != -1 ? &storeArgs->options.RemotePort : 0, 
-                                    storeArgs->options.RemoteHostname[0] ? storeArgs->options.RemoteHostname : NULL,
-                                    storeArgs->options.ServiceList[0] ? storeArgs->options.ServiceList : NULL );
-                                    
-    if (mcStatus != MC_NORMAL_COMPLETION)
+    if (storeArgs->storageData->isCancelled())
     {
-        ::Message(MWARNING, toEndUser | toService | MLoverall, "\t%s", MC_Error_Message(mcStatus));
-        ::Message(MWARNING, toEndUser | toService | MLoverall, "Unable to open association with \"%s\":", storeArgs->options.RemoteAE);
+        ::Message(MWARNING, toEndUser | toService | MLoverall, "Export to \"%s\" was cancelled before it started.", storeArgs->options.RemoteAE);
+        if (group)
+            group->leave(storeArgs->storageData->getGroupMember(), false);
+        delete storeArgs;
+        return (void *) &THREAD_NORMAL_EXIT;
+    }
 
-		delete storeArgs;
-		guard.release();
-        pthread_exit( (void *) &THREAD_EXCEPTION );
+    ticket = scheduler->acquire( storeArgs->options.RemoteAE,
+                                 storeArgs->options.RemoteHostname,
+                                 storeArgs->options.RemotePort,
+                                 storeArgs->storageData->getPriority(),
+                                 storeArgs->storageData->jobKey(),
+                                 &lentAssociationID );
+
+    // Cancelled while queued: give the slot, or the borrowed association, back
+    if (storeArgs->storageData->isCancelled())
+    {
+        ::Message(MWARNING, toEndUser | toService | MLoverall, "Export to \"%s\" was cancelled before it started.", storeArgs->options.RemoteAE);
+        if (group)
+            group->leave(storeArgs->storageData->getGroupMember(), false);
+        scheduler->release(ticket, false);
+        delete storeArgs;
+        return (void *) &THREAD_NORMAL_EXIT;
+    }
+
+    assocStartTime = time(NULL);
+     
+    if (lentAssociationID != -1)
+    {
+        associationID = lentAssociationID;
+        ::Message(MNOTE, toEndUser | toService | MLoverall, "STAT export to \"%s\" is sent over the open association of a lower priority export", storeArgs->options.RemoteAE);
+    }
+    else
+    {
+        /*
+         *   Open association and override hostname & port parameters if 
+         *   they were supplied.
+         */
+        mcStatus = OpenMonitoredAssociation( storeArgs->applicationID, &associationID,
+                                        storeArgs->options.RemoteAE,
+                                        storeArgs->options.RemotePort,
+                                        storeArgs->options.RemoteHostname,
+                                        storeArgs->options.ServiceList );
+                                        
+        if (mcStatus != MC_NORMAL_COMPLETION)
+        {
+            ::Message(MWARNING, toEndUser | toService | MLoverall, "\t%s", MC_Error_Message(mcStatus));
+            ::Message(MWARNING, toEndUser | toService | MLoverall, "Unable to open association with \"%s\":", storeArgs->options.RemoteAE);
+
+            if (group)
+                group->leave(storeArgs->storageData->getGroupMember(), true);
+            scheduler->release(ticket, true);
+            delete storeArgs;
+            return (void *) &THREAD_EXCEPTION;
+        }
     }
    
     mcStatus = MC_Get_Association_Info( associationID, &storeArgs->options.asscInfo); 
@@ -450,29 +875,156 @@ void* StoreFiles(void* store_args)
      *   Send all requested images.  Traverse through instanceList to get all 
      *   files to send
      */
-    node = instanceList;
-    while ( node )
+    node = group ? NULL : instanceList;
+    readAheadNext = node;
+    while ( node || group )
     {
+        /*
+         * Have the files answered so far committed while the rest is sent
+         */
+        storeArgs->storageData->commitStored( storeArgs->options.RemoteHostname, node );
+
+        /*
+         * Stop at a file boundary if the export job was cancelled.
+         * Files already sent are reported with their responses so far.
+         */
+        if (storeArgs->storageData->isCancelled())
+        {
+            if (lentAssociationID != -1)
+            {
+                // Leave the borrowed association to its owner
+                ::Message(MWARNING, toEndUser | toService | MLoverall, "Export to \"%s\" was cancelled.", storeArgs->options.RemoteAE);
+                break;
+            }
+            ::Message(MWARNING, toEndUser | toService | MLoverall, "Export to \"%s\" was cancelled, aborting association.", storeArgs->options.RemoteAE);
+            MC_Abort_Association(&associationID);
+            associationAborted = true;
+            break;
+        }
+
+        /*
+         * Let a waiting STAT export to the same target send its files over
+         * this association. Read our outstanding responses first so that
+         * the borrower only sees its own.
+         */
+        if (scheduler->preemptionPending(ticket))
+        {
+            bool drained = true;
+
+            while ( GetNumOutstandingRequests( instanceList ) > 0 )
+            {
+                drained = ReadResponseMessages( storeArgs->options, associationID, 10, &instanceList );
+                if (!drained)
+                    break;
+            }
+            if (!drained)
+            {
+                ::Message(MWARNING, toEndUser | toService | MLoverall, "Failure in reading response message, aborting association.");
+                MC_Abort_Association(&associationID);
+                associationAborted = true;
+                break;
+            }
+            if (!scheduler->lendAssociation(ticket, associationID))
+            {
+                ::Message(MWARNING, toEndUser | toService | MLoverall, "Association was aborted while lent to a STAT export.");
+                associationAborted = true;
+                break;
+            }
+        }
+
+        /*
+         * A member of a target group takes the next file when it has the
+         * least bytes outstanding of the group.
+         */
+        if (group)
+        {
+            if ( !ClaimGroupFile( storeArgs->options, associationID, storeArgs->storageData, &claim, &node, &instanceList ) )
+            {
+                ::Message(MWARNING, toEndUser | toService | MLoverall, "Failure in reading response message, aborting association.");
+                MC_Abort_Association(&associationID);
+                associationAborted = true;
+                break;
+            }
+            if (claim == GROUP_FILE_DONE)
+                break;
+            if (claim == GROUP_FILE_WAIT)
+                continue;
+        }
+
         imageStartTime = time(NULL);
 
+        /*
+         * Have the next files loaded while this one is read and sent. The
+         * files of a target group member are only known once claimed.
+         */
+        if ( ReadAheadFiles > 0 && !group )
+            AdviseUpcomingFiles( node, &readAheadNext, &readAheadCount,
+                                 imagesSent > 0 ? totalBytesRead / imagesSent : 0 );
+
+        /*
+         * The files are still being checked on the worker pool. One that
+         * is not DICOM is reported with an unknown outcome and skipped.
+         */
+        if ( !storeArgs->storageData->isValid( node ) )
+        {
+            node->imageSent = false;
+            node->responseReceived = true;
+            node->failedResponse = true;
+            AcknowledgeGroupFile( node );
+            storeArgs->storageData->fileProcessed(false);
+            node = node->Next;
+            continue;
+        }
+
+        /*
+         * Hold the size of the image against the in-flight byte budget
+         * until its C-STORE-RSP is read.
+         */
+        if ( !AcquireInFlightCredits( storeArgs->options, associationID, node, &instanceList, storeArgs->storageData ) )
+        {
+            ::Message(MWARNING, toEndUser | toService | MLoverall, "Failure in reading response message, aborting association.");
+            MC_Abort_Association(&associationID);
+            associationAborted = true;
+            break;
+        }
+
+        // Cancelled while waiting for the budget: stop at the top of the loop
+        if (storeArgs->storageData->isCancelled())
+        {
+            ReleaseInFlightCredits( node );
+            continue;
+        }
+
         /*
          * Determine the image format and read the image in.  If the 
          * image is in the part 10 format, convert it into a message.
 		 * ReadImage will read the SOPClassUID and SOPInstanceUID from
 		 * the image and populate the node.
          */
+        gettimeofday(&readStartTime, NULL);
         tempBool = ReadImage( storeArgs->options, 
                               storeArgs->applicationID, 
                               node);
+        gettimeofday(&readEndTime, NULL);
+        readTime += (readEndTime.tv_sec - readStartTime.tv_sec) + (readEndTime.tv_usec - readStartTime.tv_usec) / 1000000.0;
         if (!tempBool)
         {
             node->imageSent = false;
+            ReleaseInFlightCredits( node );
+            AcknowledgeGroupFile( node );
 			::Message(MWARNING, toEndUser | toService | MLoverall, "Cstore will skip this file: UNKNOWN_FORMAT for image [%s]", node->fname);
+            storeArgs->storageData->fileProcessed(false);
             node = node->Next;
             continue;
         }
        
         totalBytesRead += node->imageBytes;
+
+        /*
+         * Hold the send back as long as the bandwidth profile of the
+         * target, or of all targets, requires.
+         */
+        BandwidthShaper::instance()->consume( storeArgs->options.RemoteAE, node->imageBytes );
          
         /*
          * Send image read in with ReadImage.  
@@ -487,7 +1039,16 @@ void* StoreFiles(void* store_args)
         if (!tempBool)
         {
             node->imageSent = false;
+            ReleaseInFlightCredits( node );
             ::Message(MWARNING, toEndUser | toService | MLoverall, "Failure in sending file [%s]", node->fname);
+            if (group)
+            {
+                // Another member of the group takes over the unanswered files
+                MC_Abort_Association(&associationID);
+                associationAborted = true;
+                break;
+            }
+            storeArgs->storageData->fileProcessed(false);
             node = node->Next;
             continue;
 //            MC_Abort_Association(&associationID);
@@ -513,6 +1074,8 @@ void* StoreFiles(void* store_args)
         {
             node->responseReceived = true;
             node->failedResponse = true;
+            ReleaseInFlightCredits( node );
+            AcknowledgeGroupFile( node );
         }
         
         mcStatus = MC_Free_Message(&node->msgID);
@@ -547,6 +1110,7 @@ void* StoreFiles(void* store_args)
         {
             ::Message(MWARNING, toEndUser | toService | MLoverall, "Failure in reading response message, aborting association.");
             MC_Abort_Association(&associationID);
+            associationAborted = true;
             break;
         }
        
@@ -563,9 +1127,13 @@ void* StoreFiles(void* store_args)
                 {
                     ::Message(MWARNING, toEndUser | toService | MLoverall, "Failure in reading response message, aborting association.");
                     MC_Abort_Association(&associationID);
+                    associationAborted = true;
                     break;
                 }
             }
+
+        if (associationAborted)
+            break;
 #endif
 
         /*
@@ -578,6 +1146,8 @@ void* StoreFiles(void* store_args)
         else
             ::Message(MNOTE, toEndUser | toService | MLoverall, "\tSent %s image (%d of %d), elapsed time: %.3f seconds", node->serviceName, imagesSent, totalImages, totalTime);
         
+        storeArgs->storageData->fileProcessed(node->imageSent);
+
         /*
          * Traverse through file list
          */
@@ -590,26 +1160,35 @@ void* StoreFiles(void* store_args)
      * Wait for any remaining C-STORE-RSP messages.  This will only happen
      * when asynchronous communications are used.
      */
-    while ( GetNumOutstandingRequests( instanceList ) > 0 )
+    while ( !associationAborted && GetNumOutstandingRequests( instanceList ) > 0 )
     {
         tempBool = ReadResponseMessages( storeArgs->options, associationID, 10, &instanceList );
         if (!tempBool)
         {
             ::Message(MWARNING, toEndUser | toService | MLoverall, "Failure in reading response message, aborting association.");
             MC_Abort_Association(&associationID);
+            associationAborted = true;
             break;
         }
     }
+
+    /*
+     * And the rest, unless some files are left unanswered
+     */
+    storeArgs->storageData->commitStored( storeArgs->options.RemoteHostname, NULL );
         
     /*
      * A failure on close has no real recovery.  Abort the association
      * and continue on.
      */
-    mcStatus = MC_Close_Association(&associationID);
-    if (mcStatus != MC_NORMAL_COMPLETION)
+    if (!associationAborted && lentAssociationID == -1)
     {
-        PrintError("Close association failed", mcStatus);
-        MC_Abort_Association(&associationID);
+        mcStatus = MC_Close_Association(&associationID);
+        if (mcStatus != MC_NORMAL_COMPLETION)
+        {
+            PrintError("Close association failed", mcStatus);
+            MC_Abort_Association(&associationID);
+        }
     }
 
     if (storeArgs->options.Verbose)
@@ -631,14 +1210,22 @@ void* StoreFiles(void* store_args)
     ::Message(MNOTE, toEndUser | toService | MLoverall, "Data Transferred: %luKB", (long)totalBytesRead / 1024 );
     ::Message(MNOTE, toEndUser | toService | MLoverall, "    Time Elapsed: %.3fs", totalTime);
     ::Message(MNOTE, toEndUser | toService | MLoverall, "   Transfer Rate: %.1fKB/s", ((float)totalBytesRead / totalTime) / 1024.0);
+    if (readTime > 0.0)
+    {
+        ::Message(MNOTE, toEndUser | toService | MLoverall, "       Read Rate: %.1fKB/s (%.3fs reading files)", ((double)totalBytesRead / readTime) / 1024.0, readTime);
+    }
+
+	// Give back the credits of responses that will never be read
+	for (node = instanceList; node; node = node->Next)
+		ReleaseInFlightCredits( node );
 
 	// Do not free the nodelist here. Let the allocator manage it.
 
+	if (group)
+		group->leave(storeArgs->storageData->getGroupMember(), associationAborted);
+	scheduler->release(ticket, associationAborted);
 	delete storeArgs;
-	guard.release();
-    pthread_exit( (void *) &THREAD_NORMAL_EXIT );
-
-	return NULL;
+    return (void *) &THREAD_NORMAL_EXIT;
 }
 
 
@@ -736,6 +1323,64 @@ int GetNumOutstandingRequests(InstanceNode*       A_list)
 }    
 
 
+/*
+ * Split the commit into transactions of CommitChunkSize files, each with a
+ * UID of its own
+ */
+static void StartTransactions(COMMIT_ARGS* commitArgs)
+{
+    CommitResult* result = commitArgs->result;
+
+    result->makeTransactions(CommitChunkSize);
+    for (unsigned int t=0; t<result->transactions.size(); t++)
+        result->transactions[t].transactionUID = Create_Inst_UID();
+
+    if (result->transactions.size() > 1)
+        ::Message(MNOTE, toEndUser | toService | MLoverall, "Commitment of %d objects from %s is split into %d transactions",
+                  (int)result->commitOutcome.size(), commitArgs->options.RemoteHostname, (int)result->transactions.size());
+}
+
+/*
+ * Expect the N-EVENT-REPORT of every transaction before asking for it, so
+ * the commit listener can hand it over however soon it comes
+ */
+static void ExpectTransactions(COMMIT_ARGS* commitArgs, DICOMStoragePkg::CommitType commitType)
+{
+    for (unsigned int t=0; t<commitArgs->result->transactions.size(); t++)
+        CommitListener::instance()->expect( commitArgs->appID, commitArgs->options, commitArgs->result, t,
+                                            commitArgs->waiter, commitType );
+}
+
+/*
+ * Stop expecting the reports, or only those that came on the association.
+ * The last cancel may tell the waiter, which can free the result, so the
+ * UIDs are taken first.
+ */
+static void CancelTransactions(COMMIT_ARGS* commitArgs, bool reportedOnly)
+{
+    vector<string> transactionUIDs;
+
+    for (unsigned int t=0; t<commitArgs->result->transactions.size(); t++)
+        if (!reportedOnly || commitArgs->result->transactions[t].reported)
+            transactionUIDs.push_back( commitArgs->result->transactions[t].transactionUID );
+
+    for (unsigned int t=0; t<transactionUIDs.size(); t++)
+        CommitListener::instance()->cancel( transactionUIDs[t] );
+}
+
+/*
+ * Send the N-ACTION of every transaction, one after the other on the same
+ * association. Each waits only for its N-ACTION-RSP, not for the reports.
+ */
+static bool SendTransactions(COMMIT_ARGS* commitArgs, int associationID)
+{
+    for (unsigned int t=0; t<commitArgs->result->transactions.size(); t++)
+        if ( !SetAndSendNActionMessage( commitArgs->options, associationID, commitArgs->result, t ) )
+            return false;
+
+    return true;
+}
+
 /****************************************************************************
  *
  *  Function    :   SynchStorageCommitment
@@ -755,8 +1400,6 @@ int GetNumOutstandingRequests(InstanceNode*       A_list)
  ****************************************************************************/
 void* SynchStorageCommitment(void* commit_args)
 {
-	MutexGuard guard (g_lock_sync_commit);
-
     int           associationID = -1;
     bool          sampStatus;
     NEVENT_ENUM   NEVENTStatus;
@@ -765,12 +1408,11 @@ void* SynchStorageCommitment(void* commit_args)
 
 	commitArgs = (COMMIT_ARGS*)commit_args;
 
-	if (!commitArgs->result->resultByFiles.length())
+	if (!commitArgs->result->stored->resultByFiles.length())
     {
         ::Message(MNOTE, toEndUser | toService | MLoverall, "No objects to commit.");
 
-		guard.release();
-		pthread_exit( (void *) &THREAD_NORMAL_EXIT );
+		return (void *) &THREAD_NORMAL_EXIT;
     }
 
     /*
@@ -778,10 +1420,10 @@ void* SynchStorageCommitment(void* commit_args)
      * list, use a special service list that only includes storage 
      * commitment.
      */
-    mcStatus = MC_Open_Association( commitArgs->appID, &associationID,
+    mcStatus = OpenMonitoredAssociation( commitArgs->appID, &associationID,
                                     commitArgs->options.RemoteAE,
-                                    commitArgs->options.RemotePort != -1 ? &commitArgs->options.RemotePort : NULL, 
-                                    commitArgs->options.RemoteHostname[0] ? commitArgs->options.RemoteHostname : NULL,
+                                    commitArgs->options.RemotePort,
+                                    commitArgs->options.RemoteHostname,
                                     const_cast<char*>("Storage_Commit_SCU_Service_List") );
                                         
     if (mcStatus != MC_NORMAL_COMPLETION)
@@ -789,23 +1431,20 @@ void* SynchStorageCommitment(void* commit_args)
         ::Message(MWARNING, toEndUser | toService | MLoverall, "Unable to open association with \"%s\":",commitArgs->options.RemoteAE);
         ::Message(MWARNING, toEndUser | toService | MLoverall, "\t%s", MC_Error_Message(mcStatus));
 
-		guard.release();
-		pthread_exit( (void *) &THREAD_EXCEPTION );
+		return (void *) &THREAD_EXCEPTION;
     }
 
     /*
-     * Populate the N-ACTION message for storage commitment and sent it
-     * over the network.  Also wait for a response message.
+     * Populate the N-ACTION messages for storage commitment and sent them
+     * over the network.  Also wait for the response messages.
      */
-    sampStatus = SetAndSendNActionMessage( commitArgs->options,
-                                           associationID,
-                                           commitArgs->result );
+    StartTransactions(commitArgs);
+    sampStatus = SendTransactions( commitArgs, associationID );
     if ( !sampStatus )
     {
         MC_Abort_Association(&associationID);
 
-		guard.release();
-		pthread_exit( (void *) &THREAD_EXCEPTION );
+		return (void *) &THREAD_EXCEPTION;
     }
    
     if (commitArgs->options.Verbose)
@@ -821,8 +1460,7 @@ void* SynchStorageCommitment(void* commit_args)
     {
         MC_Abort_Association(&associationID);
 
-		guard.release();
-		pthread_exit( (void *) &THREAD_EXCEPTION );
+		return (void *) &THREAD_EXCEPTION;
     }
 
     /*
@@ -836,10 +1474,7 @@ void* SynchStorageCommitment(void* commit_args)
         MC_Abort_Association(&associationID);
     }
 
-	guard.release();
-	pthread_exit( (void *) &THREAD_NORMAL_EXIT );
-
-	return NULL;
+	return (void *) &THREAD_NORMAL_EXIT;
 } // end SynchStorageCommitment(...)
 
 
@@ -857,29 +1492,24 @@ void* SynchStorageCommitment(void* commit_args)
  *
  *  Description :   Perform asynchronous storage commitment for a set of
  *                  storage objects. The list was created as the objects
- *                  themselves were sent.
+ *                  themselves were sent. Returns once the N-ACTION is
+ *                  sent; the CommitListener takes the N-EVENT-REPORT.
  *
  ****************************************************************************/
 void* AsynchStorageCommitment(void* commit_args)
 {
-	MutexGuard guard (g_lock_async_commit);
-
     int           associationID = -1;
-    int           calledApplicationID = -1;
     bool          sampStatus;
-    NEVENT_ENUM   NEVENTStatus;
     MC_STATUS     mcStatus;
 	COMMIT_ARGS*  commitArgs;
-	int           cnt = 0, timeout_cnt = 0;
 
 	commitArgs = (COMMIT_ARGS*)commit_args;
 
-	if (!commitArgs->result->resultByFiles.length())
+	if (!commitArgs->result->stored->resultByFiles.length())
     {
         ::Message(MNOTE, toEndUser | toService | MLoverall, "No objects to commit.");
 
-		guard.release();
-		pthread_exit( (void *) &THREAD_NORMAL_EXIT );
+		return (void *) &THREAD_NORMAL_EXIT;
     }
 
 	/*
@@ -887,10 +1517,10 @@ void* AsynchStorageCommitment(void* commit_args)
      * list, use a special service list that only includes storage 
      * commitment.
      */
-    mcStatus = MC_Open_Association( commitArgs->appID, &associationID,
+    mcStatus = OpenMonitoredAssociation( commitArgs->appID, &associationID,
                                     commitArgs->options.RemoteAE,
-                                    commitArgs->options.RemotePort != -1 ? &commitArgs->options.RemotePort : NULL, 
-                                    commitArgs->options.RemoteHostname[0] ? commitArgs->options.RemoteHostname : NULL,
+                                    commitArgs->options.RemotePort,
+                                    commitArgs->options.RemoteHostname,
                                     const_cast<char*>("Storage_Commit_SCU_Service_List") );
     
     if (mcStatus != MC_NORMAL_COMPLETION)
@@ -898,30 +1528,37 @@ void* AsynchStorageCommitment(void* commit_args)
         ::Message(MWARNING, toEndUser | toService | MLoverall, "Unable to open association with \"%s\":",commitArgs->options.RemoteAE);
         ::Message(MWARNING, toEndUser | toService | MLoverall, "\t%s", MC_Error_Message(mcStatus));
 
-		guard.release();
-		pthread_exit( (void *) &THREAD_EXCEPTION );
+		return (void *) &THREAD_EXCEPTION;
     }
 
     /*
-     * Populate the N-ACTION message for storage commitment and sent it
-     * over the network.  Also wait for a response message.
+     * Expect the N-EVENT-REPORTs before asking for them, so the commit
+     * listener can hand them over however soon they come.
      */
-    sampStatus = SetAndSendNActionMessage( commitArgs->options,
-                                           associationID,
-                                           commitArgs->result );
+    StartTransactions(commitArgs);
+    ExpectTransactions(commitArgs, DICOMStoragePkg::ASYNCH_COMMIT);
+    CommitListener::instance()->journal(commitArgs->result);
+
+    /*
+     * Populate the N-ACTION messages for storage commitment and sent them
+     * over the network.  Also wait for the response messages.
+     */
+    sampStatus = SendTransactions( commitArgs, associationID );
     if ( !sampStatus )
     {
+        CancelTransactions(commitArgs, false);
         MC_Abort_Association(&associationID);
 
-		guard.release();
-		pthread_exit( (void *) &THREAD_EXCEPTION );
+		return (void *) &THREAD_EXCEPTION;
     }
     else
     {
         /*
-         * When the close association fails, there's nothing really to be
-         * done.  Let's still continue on and wait for an N-EVENT-REPORT
+         * A report that came before an N-ACTION-RSP is in already. When the
+         * close association fails, there's nothing really to be done.  The
+         * other N-EVENT-REPORTs are still expected.
          */
+        CancelTransactions(commitArgs, true);
         mcStatus = MC_Close_Association( &associationID);
         if (mcStatus != MC_NORMAL_COMPLETION)
         {
@@ -929,112 +1566,16 @@ void* AsynchStorageCommitment(void* commit_args)
             MC_Abort_Association(&associationID);
         }
     }
-   
-	guard.release(); // jhuang 10/22/08 for MLSDB 26711, release the lock here so we do not hold it during the loop
 
+    /*
+     * The thread does not wait for the report. The commit listener accepts
+     * the N-EVENT-REPORT association and tells commitArgs->waiter.
+     */
     if (commitArgs->options.Verbose)
-        ::Message(MNOTE, toEndUser | toService | MLoverall, "Waiting for N-EVENT-REPORT Association in Asynchronous Storage Commitment");
+        ::Message(MNOTE, toEndUser | toService | MLoverall, "Waiting for N-EVENT-REPORT of transaction %s in Asynchronous Storage Commitment",
+                  commitArgs->result->transactionUIDs().c_str());
 
-    for(cnt=0; cnt<=MAX_LOOP_ITERATIONS; cnt++)
-    {
-        /*
-         * Wait as an SCU for an association from the storage commitment
-         * SCP.  This association will contain an N-EVENT-REPORT-RQ message.
-         */
-#ifdef linux
-		if (AsyncCommitIncomingPort == -1)
-			mcStatus = MC_Wait_For_Association( "Storage_Commit_SCU_Service_List", 5,
-				                                &calledApplicationID,
-					                            &associationID);
-		else
-			mcStatus = MC_Wait_For_Association_On_Port( "Storage_Commit_SCU_Service_List", 5,
-				                                calledApplicationID,
-												AsyncCommitIncomingPort,
-					                            &associationID);
-#else
-		mcStatus = MC_Wait_For_Association( "Storage_Commit_SCU_Service_List", 5,
-			                                &calledApplicationID,
-				                            &associationID);
-#endif
-
-        if (mcStatus == MC_TIMEOUT)
-		{
-			timeout_cnt++;
-            continue;
-		}
-        else if (mcStatus == MC_UNKNOWN_HOST_CONNECTED)
-        {
-            ::Message(MWARNING, toEndUser | toService | MLoverall, "\tUnknown host connected, association rejected ");
-			sleep(1);
-            continue;
-        }
-        else if (mcStatus == MC_NEGOTIATION_ABORTED)
-        {
-            ::Message(MWARNING, toEndUser | toService | MLoverall, "\tAssociation aborted during negotiation ");
-			sleep(1);
-            continue;
-        }
-        else if (mcStatus != MC_NORMAL_COMPLETION)
-        {
-            PrintError("Error on MC_Wait_For_Association for asynch storage commitment",mcStatus);
-			guard.release();
-			pthread_exit( (void *) &THREAD_EXCEPTION );
-        }
-        
-		if (commitArgs->options.Verbose)
-	        ::Message(MNOTE, toEndUser | toService | MLoverall, "Accepting N-EVENT association");
-
-		MutexGuard guardNEvent (g_lock_async_commit); // jhuang 10/22/08 for MLSDB 26711
-
-		/*
-	     * Accept the association.
-		 */
-	    mcStatus = MC_Accept_Association( associationID );
-		if (mcStatus != MC_NORMAL_COMPLETION)
-	    {
-		    /*
-			 * Make sure the association is cleaned up.
-			 */
-		    MC_Reject_Association( associationID,
-			                       TRANSIENT_NO_REASON_GIVEN );
-		    PrintError("Error on MC_Accept_Association", mcStatus);
-			continue;
-		}
-
-        /*
-         * Handle the N-EVENT association.  We are only expecting a single
-         * association, so break out after we've handled the association.
-         */
-        NEVENTStatus = HandleNEventAssociation( commitArgs->options, associationID,
-                                             commitArgs->result, DICOMStoragePkg::ASYNCH_COMMIT );
-		guardNEvent.release(); // jhuang 10/22/08 for MLSDB 26711
-		if ( NEVENTStatus != SUCCESS )
-			pthread_exit( (void *) &THREAD_EXCEPTION );
-		else
-			break;
-    }
-
-	guard.release();
-	if (cnt > MAX_LOOP_ITERATIONS)
-	{
-		if(timeout_cnt > MAX_LOOP_ITERATIONS)
-		{
-	        ::Message(MWARNING, toEndUser | toService | MLoverall, "Cstore cannot get asynchronous N-EVENT-REPORT call back from %s", commitArgs->options.RemoteHostname);
-	        ::Message(MWARNING, toEndUser | toService | MLoverall, "Please make sure the camera incoming port %d is open. And make sure %s is asynchronous. If not, re-configure the camera to use synchronous commit and try again", commitArgs->options.RemotePort, commitArgs->options.RemoteHostname);
-	        ::Message(MWARNING, toEndUser | toService | MLoverall, "Cstore is waiting for the next command.");
-
-#ifdef DEBUG_PRINTF
-	        printf("Cstore cannot get asynchronous N-EVENT-REPORT call back from %s\n", commitArgs->options.RemoteHostname);
-	        printf("Please make sure the camera incoming port %d is open. And make sure %s is asynchronous. If not, re-configure the camera to use synchronous commit and try again\n", commitArgs->options.RemotePort, commitArgs->options.RemoteHostname);
-	        printf("Cstore is waiting for the next command.\n");
-#endif
-		}
-		pthread_exit( (void *) &THREAD_EXCEPTION );
-	}
-	else
-		pthread_exit( (void *) &THREAD_NORMAL_EXIT );
-
-	return NULL;
+    return (void *) &THREAD_NORMAL_EXIT;
 } // end AsynchStorageCommitment(...)
 
 
@@ -1052,29 +1593,31 @@ void* AsynchStorageCommitment(void* commit_args)
  *
  *  Description :   Try to perform synchronous storage commitment for a set of
  *                  storage objects first. If timeout, automatically convert into
- *                  asynchronous storage commitment.
+ *                  asynchronous storage commitment, and leave the report to
+ *                  the CommitListener. How long to wait for the synchronous
+ *                  answer comes from the CommitHistory of the remote site.
+ *                  With a waiter to tell, the wait is left to the
+ *                  CommitReactor and the task returns once the N-ACTIONs
+ *                  are sent.
  *
  ****************************************************************************/
 void* EitherStorageCommitment(void* commit_args)
 {
-	MutexGuard guard (g_lock_either_commit);
-
-    int           associationID = -1;
-    int           calledApplicationID = -1;
-    bool          sampStatus;
-    NEVENT_ENUM   NEVENTStatus;
-    MC_STATUS     mcStatus;
-	COMMIT_ARGS*  commitArgs;
-	int           cnt = 0, timeout_cnt = 0;
+    int            associationID = -1;
+    bool           sampStatus;
+    NEVENT_ENUM    NEVENTStatus;
+    MC_STATUS      mcStatus;
+	COMMIT_ARGS*   commitArgs;
+	COMMIT_OPTIONS waitOptions;
+	struct timeval sentTime;
 
 	commitArgs = (COMMIT_ARGS*)commit_args;
 
-	if (!commitArgs->result->resultByFiles.length())
+	if (!commitArgs->result->stored->resultByFiles.length())
     {
         ::Message(MNOTE, toEndUser | toService | MLoverall, "No objects to commit.");
 
-		guard.release();
-		pthread_exit( (void *) &THREAD_NORMAL_EXIT );
+		return (void *) &THREAD_NORMAL_EXIT;
     }
 
     /*
@@ -1082,10 +1625,10 @@ void* EitherStorageCommitment(void* commit_args)
      * list, use a special service list that only includes storage 
      * commitment.
      */
-    mcStatus = MC_Open_Association( commitArgs->appID, &associationID,
+    mcStatus = OpenMonitoredAssociation( commitArgs->appID, &associationID,
                                     commitArgs->options.RemoteAE,
-                                    commitArgs->options.RemotePort != -1 ? &commitArgs->options.RemotePort : NULL, 
-                                    commitArgs->options.RemoteHostname[0] ? commitArgs->options.RemoteHostname : NULL,
+                                    commitArgs->options.RemotePort,
+                                    commitArgs->options.RemoteHostname,
                                     const_cast<char*>("Storage_Commit_SCU_Service_List") );
                                         
     if (mcStatus != MC_NORMAL_COMPLETION)
@@ -1093,44 +1636,99 @@ void* EitherStorageCommitment(void* commit_args)
         ::Message(MWARNING, toEndUser | toService | MLoverall, "Unable to open association with \"%s\":",commitArgs->options.RemoteAE);
         ::Message(MWARNING, toEndUser | toService | MLoverall, "\t%s", MC_Error_Message(mcStatus));
 
-		guard.release();
-		pthread_exit( (void *) &THREAD_EXCEPTION );
+		return (void *) &THREAD_EXCEPTION;
     }
 
     /*
-     * Populate the N-ACTION message for storage commitment and sent it
-     * over the network.  Also wait for a response message.
+     * The reports may come back on this association or, after a timeout, on
+     * associations of their own. Expect them before asking for them, so the
+     * commit listener can hand them over however soon they come.
+     */
+    StartTransactions(commitArgs);
+    ExpectTransactions(commitArgs, DICOMStoragePkg::EITHER_COMMIT);
+
+    /*
+     * A remote site that answered asynchronously lately is not waited for,
+     * one that answered synchronously only a little over its slowest answer
+     */
+    waitOptions = commitArgs->options;
+    waitOptions.RoleReversalWaitTime = CommitHistory::instance()->synchWait(waitOptions);
+
+    /*
+     * Populate the N-ACTION messages for storage commitment and sent them
+     * over the network.  Also wait for the response messages.
      */
-    sampStatus = SetAndSendNActionMessage( commitArgs->options,
-                                           associationID,
-                                           commitArgs->result );
+    gettimeofday(&sentTime, NULL);
+    sampStatus = SendTransactions( commitArgs, associationID );
     if ( !sampStatus )
     {
+        CancelTransactions(commitArgs, false);
         MC_Abort_Association(&associationID);
 
-		guard.release();
-		pthread_exit( (void *) &THREAD_EXCEPTION );
+		return (void *) &THREAD_EXCEPTION;
     }
    
     if (commitArgs->options.Verbose)
         ::Message(MNOTE, toEndUser | toService | MLoverall, "Handle N-EVENT association.");
 
+    /*
+     * A commit with a waiter to tell is done here. The CommitReactor
+     * watches the association with those of the other commits and
+     * finishes the commit when the reports are in or the wait is over.
+     */
+    if (commitArgs->waiter &&
+        CommitReactor::instance()->watch(*commitArgs, associationID, waitOptions.RoleReversalWaitTime, sentTime))
+		return (void *) &THREAD_NORMAL_EXIT;
 
     /*
      * Handle the N-EVENT association.
      */
-    NEVENTStatus = HandleNEventAssociation( commitArgs->options, associationID,								            
+    NEVENTStatus = HandleNEventAssociation( waitOptions, associationID,								            
 											commitArgs->result, DICOMStoragePkg::EITHER_COMMIT );
+
+	return FinishEitherStorageCommitment( commitArgs, associationID, NEVENTStatus,
+										  waitOptions.RoleReversalWaitTime, sentTime );
+} // end EitherStorageCommitment(...)
+
+/****************************************************************************
+ *
+ *  Function    :   FinishEitherStorageCommitment
+ *
+ *  Parameters  :   commitArgs    - of the EitherStorageCommitment
+ *                  associationID - the association the N-ACTIONs went on
+ *                  NEVENTStatus  - how the wait for the reports on it ended
+ *                  waitTime      - seconds waited for a synchronous answer
+ *                  sentTime      - when the N-ACTIONs went out
+ *
+ *  Returns     :   THREAD_NORMAL_EXIT or THREAD_EXCEPTION
+ *
+ *  Description :   Close the association once the synchronous reports are
+ *                  in, or leave the reports still to come to the
+ *                  CommitListener once the wait is over. Called by
+ *                  EitherStorageCommitment or by the CommitReactor.
+ *
+ ****************************************************************************/
+void* FinishEitherStorageCommitment(COMMIT_ARGS* commitArgs, int associationID, NEVENT_ENUM NEVENTStatus,
+									int waitTime, const struct timeval& sentTime)
+{
+    MC_STATUS      mcStatus;
+	string         commitTarget = CommitHistory::key(commitArgs->options);
+	struct timeval answerTime;
+
     if ( NEVENTStatus == FAILURE )
     {
+        CancelTransactions(commitArgs, false);
         MC_Abort_Association(&associationID);
 
-		guard.release();
-		pthread_exit( (void *) &THREAD_EXCEPTION );
+		return (void *) &THREAD_EXCEPTION;
     }
 	else if ( NEVENTStatus == SUCCESS )
 	{
+        CancelTransactions(commitArgs, false);
         ::Message(MNOTE, toEndUser | toService | MLoverall, "Cstore detected and accomplished Synchronous Storage Commitment from remote site %s", commitArgs->options.RemoteHostname);
+        gettimeofday(&answerTime, NULL);
+        CommitHistory::instance()->recordSynch(commitTarget, (answerTime.tv_sec - sentTime.tv_sec) +
+                                                             (answerTime.tv_usec - sentTime.tv_usec) / 1000000.0);
 		/*
 		 * When the close association fails, there's nothing really to be
 		 * done.
@@ -1145,128 +1743,34 @@ void* EitherStorageCommitment(void* commit_args)
 	else // TIMEOUT. Automatically convert into asynchronous commitment
 	{
         ::Message(MNOTE, toEndUser | toService | MLoverall, "Synchronous Storage Commitment timed out from remote site %s. Automatically convert into Asynchronous Storage Commitment.", commitArgs->options.RemoteHostname);
+        if (waitTime < commitArgs->options.RoleReversalWaitTime)
+        {
+            ::Message(MNOTE, toEndUser | toService | MLoverall, "Waited %d of %d seconds for a synchronous answer from %s, %d seconds saved",
+                      waitTime, commitArgs->options.RoleReversalWaitTime, commitArgs->options.RemoteHostname,
+                      commitArgs->options.RoleReversalWaitTime - waitTime);
+            CommitHistory::instance()->recordSaved(commitTarget, commitArgs->options.RoleReversalWaitTime - waitTime);
+        }
         /*
-         * Let's still continue on and wait for an N-EVENT-REPORT asynchronously
+         * The commit listener still expects the N-EVENT-REPORTs that did
+         * not come yet, and tells commitArgs->waiter when they come. From
+         * now on they must survive a restart.
          */
+        CommitListener::instance()->journal(commitArgs->result);
+        CancelTransactions(commitArgs, true);
         mcStatus = MC_Close_Association( &associationID);
         if (mcStatus != MC_NORMAL_COMPLETION)
         {
             PrintError("Close association failed", mcStatus);
             MC_Abort_Association(&associationID);
         }
-   
-		guard.release(); // jhuang 10/22/08 for MLSDB 26711, release the lock here so we do not hold it during the loop
 
         if (commitArgs->options.Verbose)
-            ::Message(MNOTE, toEndUser | toService | MLoverall, "Waiting for N-EVENT-REPORT Association in Asynchronous Storage Commitment");
-
-	    for(cnt=0; cnt<=MAX_LOOP_ITERATIONS; cnt++)
-        {
-            /*
-             * Wait as an SCU for an association from the storage commitment
-             * SCP.  This association will contain an N-EVENT-REPORT-RQ message.
-             */
-#ifdef linux
-			if (AsyncCommitIncomingPort == -1)
-				mcStatus = MC_Wait_For_Association( "Storage_Commit_SCU_Service_List", 5,
-					                                &calledApplicationID,
-						                            &associationID);
-			else
-				mcStatus = MC_Wait_For_Association_On_Port( "Storage_Commit_SCU_Service_List", 5,
-					                                calledApplicationID,
-													AsyncCommitIncomingPort,
-						                            &associationID);
-#else
-			mcStatus = MC_Wait_For_Association( "Storage_Commit_SCU_Service_List", 5,
-				                                &calledApplicationID,
-					                            &associationID);
-#endif
-            if (mcStatus == MC_TIMEOUT)
-			{
-				timeout_cnt++;
-                continue;
-			}
-            else if (mcStatus == MC_UNKNOWN_HOST_CONNECTED)
-            {
-                ::Message(MWARNING, toEndUser | toService | MLoverall, "\tUnknown host connected, association rejected ");
-				sleep(1);
-                continue;
-            }
-            else if (mcStatus == MC_NEGOTIATION_ABORTED)
-            {
-                ::Message(MWARNING, toEndUser | toService | MLoverall, "\tAssociation aborted during negotiation ");
-				sleep(1);
-                continue;
-            }
-            else if (mcStatus != MC_NORMAL_COMPLETION)
-            {
-                PrintError("Error on MC_Wait_For_Association for asynch storage commitment",mcStatus);
-		    	guard.release();
-		    	pthread_exit( (void *) &THREAD_EXCEPTION );
-            }
-        
-	    	if (commitArgs->options.Verbose)
-	            ::Message(MNOTE, toEndUser | toService | MLoverall, "Accepting N-EVENT association");
-
-			MutexGuard guardNEvent (g_lock_async_commit); // jhuang 10/22/08 for MLSDB 26711
-
-	    	/*
-	         * Accept the association.
-		     */
-	        mcStatus = MC_Accept_Association( associationID );
-	    	if (mcStatus != MC_NORMAL_COMPLETION)
-	        {
-	    	    /*
-		    	 * Make sure the association is cleaned up.
-		    	 */
-		        MC_Reject_Association( associationID,
-			                           TRANSIENT_NO_REASON_GIVEN );
-		        PrintError("Error on MC_Accept_Association", mcStatus);
-			    continue;
-		    }
-
-            /*
-             * Handle the N-EVENT association.  We are only expecting a single
-             * association, so break out after we've handled the association.
-             */
-            NEVENTStatus = HandleNEventAssociation( commitArgs->options, associationID,
-                                                 commitArgs->result, DICOMStoragePkg::ASYNCH_COMMIT );
-			guardNEvent.release(); // jhuang 10/22/08 for MLSDB 26711
-		    if ( NEVENTStatus != SUCCESS )
-		    	pthread_exit( (void *) &THREAD_EXCEPTION );
-			else
-			{
-				::Message(MWARNING, toEndUser | toService | MLoverall, "Cstore detected asynchronous commit from %s. Please re-configure the camera to use asynchronous for this host as this will save significant amount of time for each storage commitment", commitArgs->options.RemoteHostname);
-#ifdef DEBUG_PRINTF
-				printf("Cstore detected asynchronous commit from %s. Please re-configure the camera to use asynchronous for this host as this will save significant amount of time for each storage commitment\n", commitArgs->options.RemoteHostname);
-#endif
-			    break;
-			}
-        }
+            ::Message(MNOTE, toEndUser | toService | MLoverall, "Waiting for N-EVENT-REPORT of transaction %s in Asynchronous Storage Commitment",
+                      commitArgs->result->transactionUIDs().c_str());
 	}
 
-	guard.release();
-	if (cnt > MAX_LOOP_ITERATIONS)
-	{
-		if(timeout_cnt > MAX_LOOP_ITERATIONS)
-		{
-	        ::Message(MWARNING, toEndUser | toService | MLoverall, "Cstore cannot get synchronous or asynchronous N-EVENT-REPORT from %s", commitArgs->options.RemoteHostname);
-	        ::Message(MWARNING, toEndUser | toService | MLoverall, "Please double check %s is running and re-configure the camera to use the exact synchronous or asynchronous commitment", commitArgs->options.RemoteHostname);
-	        ::Message(MWARNING, toEndUser | toService | MLoverall, "Cstore is waiting for the next command.");
-
-#ifdef DEBUG_PRINTF
-	        printf("Cstore cannot get synchronous or asynchronous N-EVENT-REPORT from %s\n", commitArgs->options.RemoteHostname);
-	        printf("Please double check %s is running and re-configure the camera to use the exact synchronous or asynchronous commit\n", commitArgs->options.RemoteHostname);
-	        printf("Cstore is waiting for the next command.\n");
-#endif
-		}
-		pthread_exit( (void *) &THREAD_EXCEPTION );
-	}
-	else
-		pthread_exit( (void *) &THREAD_NORMAL_EXIT );
-
-	return NULL;
-} // end EitherStorageCommitment(...)
+	return (void *) &THREAD_NORMAL_EXIT;
+} // end FinishEitherStorageCommitment(...)
 
 /****************************************************************************
  *
@@ -1276,25 +1780,31 @@ void* EitherStorageCommitment(void* commit_args)
  *                               parameters to the application
  *                  A_associationID - Association ID registered 
  *                  A_result   - List of objects to request commitment for.
+ *                  A_transaction - Index of the transaction of A_result
+ *                               whose objects are asked for.
  *
  *  Returns     :   true
  *                  false
  *
  *  Description :   Populate an N-ACTION-RQ message to be sent, and wait
- *                  for a response to the request.
+ *                  for a response to the request. The transaction UID is
+ *                  used if the caller has made one already. An
+ *                  N-EVENT-REPORT of an earlier transaction that comes
+ *                  before the response is answered on the way.
  *
  ****************************************************************************/
 bool SetAndSendNActionMessage(
                         COMMIT_OPTIONS&                         A_options,
                         int                                     A_associationID,
-                        DICOMStoragePkg::ResultByStorageTarget* A_result)
+                        CommitResult*                           A_result,
+                        int                                     A_transaction)
 {
     MC_STATUS      mcStatus;
     int            messageID;
     int            itemID;
-    unsigned int   i;
+    int            i;
     int            responseMessageID;
-    char*          transactionUID;
+    const char*    transactionUID;
     char*          responseService;
     MC_COMMAND     responseCommand;
     int            responseStatus;
@@ -1342,8 +1852,11 @@ bool SetAndSendNActionMessage(
      * the proper storage commitment request.  Commitment or commitment 
      * failure for specific objects can then be tracked.
      */
-    transactionUID = Create_Inst_UID();
-	A_result->transactionUID = CORBA::string_dup(transactionUID);
+    CommitTransaction& transaction = A_result->transactions[A_transaction];
+
+    if (transaction.transactionUID.empty())
+        transaction.transactionUID = Create_Inst_UID();
+    transactionUID = transaction.transactionUID.c_str();
     mcStatus = MC_Set_Value_From_String( messageID, 
                                          MC_ATT_TRANSACTION_UID,
                                          transactionUID );
@@ -1359,13 +1872,14 @@ bool SetAndSendNActionMessage(
 				"\nSending N-Action with transaction UID: %s", transactionUID);
 
     /*
-     * Create an item for each SOP instance we are asking commitment for.
-     * The item contains the SOP Class & Instance UIDs for the object.
+     * Create an item for each SOP instance of the transaction we are asking
+     * commitment for. The item contains the SOP Class & Instance UIDs for
+     * the object.
      */
-	for (i=0; i<A_result->resultByFiles.length(); i++)
+	for (i=transaction.firstFile; i<transaction.endFile; i++)
     {
-		if (!strlen(A_result->resultByFiles[i].SOPClassUID.in()) ||
-			!strlen(A_result->resultByFiles[i].SOPInstanceUID.in()))
+		if (!strlen(A_result->stored->resultByFiles[i].SOPClassUID.in()) ||
+			!strlen(A_result->stored->resultByFiles[i].SOPInstanceUID.in()))
 			continue;
 
         mcStatus = MC_Open_Item( &itemID,
@@ -1394,7 +1908,7 @@ bool SetAndSendNActionMessage(
         
         mcStatus = MC_Set_Value_From_String( itemID,
                                              MC_ATT_REFERENCED_SOP_CLASS_UID,
-                                             A_result->resultByFiles[i].SOPClassUID.in());
+                                             A_result->stored->resultByFiles[i].SOPClassUID.in());
         if ( mcStatus != MC_NORMAL_COMPLETION )
         {
             PrintError("Unable to set SOP Class UID in n-action message", mcStatus);
@@ -1405,7 +1919,7 @@ bool SetAndSendNActionMessage(
         
         mcStatus = MC_Set_Value_From_String( itemID,
                                              MC_ATT_REFERENCED_SOP_INSTANCE_UID,
-                                             A_result->resultByFiles[i].SOPInstanceUID.in());
+                                             A_result->stored->resultByFiles[i].SOPInstanceUID.in());
         if ( mcStatus != MC_NORMAL_COMPLETION )
         {
             PrintError("Unable to set SOP Instance UID in n-action message", mcStatus);
@@ -1416,8 +1930,8 @@ bool SetAndSendNActionMessage(
         
         if (A_options.Verbose)
         {
-            ::Message(MNOTE, toEndUser | toService | MLoverall, "   Object SOP Class UID: %s", A_result->resultByFiles[i].SOPClassUID.in());
-            ::Message(MNOTE, toEndUser | toService | MLoverall, "Object SOP Instance UID: %s\n", A_result->resultByFiles[i].SOPInstanceUID.in());
+            ::Message(MNOTE, toEndUser | toService | MLoverall, "   Object SOP Class UID: %s", A_result->stored->resultByFiles[i].SOPClassUID.in());
+            ::Message(MNOTE, toEndUser | toService | MLoverall, "Object SOP Instance UID: %s\n", A_result->stored->resultByFiles[i].SOPInstanceUID.in());
         }
 
         MC_Free_Item( &itemID );
@@ -1450,12 +1964,21 @@ bool SetAndSendNActionMessage(
     /*
      *  Wait for N-ACTION-RSP message.
      */
-    mcStatus = MC_Read_Message(A_associationID, 300, &responseMessageID,
-                 &responseService, &responseCommand);
-    if (mcStatus != MC_NORMAL_COMPLETION)
+    for (;;)
     {
-        PrintError("MC_Read_Message failed for N-ACTION-RSP", mcStatus);
-        return ( false );
+        mcStatus = MC_Read_Message(A_associationID, 300, &responseMessageID,
+                     &responseService, &responseCommand);
+        if (mcStatus != MC_NORMAL_COMPLETION)
+        {
+            PrintError("MC_Read_Message failed for N-ACTION-RSP", mcStatus);
+            return ( false );
+        }
+
+        if (responseCommand != N_EVENT_REPORT_RQ)
+            break;
+
+        if ( !AnswerNEventReport( A_associationID, responseMessageID, A_result, A_options.Verbose ) )
+            return ( false );
     }
 
     /*
@@ -1503,6 +2026,77 @@ bool SetAndSendNActionMessage(
 
 
 
+/****************************************************************************
+ *
+ *  Function    :   AnswerNEventReport
+ *
+ *  Parameters  :   A_associationID - Association ID registered 
+ *                  A_messageID - N-EVENT-REPORT-RQ read from it, freed here
+ *                  A_result    - List of objects to request commitment for.
+ *                  A_verbose   - Log every SOP instance of the report
+ *
+ *  Returns     :   true
+ *                  false if the association cannot be used any more
+ *
+ *  Description :   Process an N-EVENT-REPORT-RQ read on the association of
+ *                  the N-ACTION and send the N-EVENT-REPORT-RSP.
+ *
+ ****************************************************************************/
+bool AnswerNEventReport(
+                        int                                     A_associationID,
+                        int                                     A_messageID,
+                        CommitResult*                           A_result,
+                        bool                                    A_verbose)
+{
+    MC_STATUS     mcStatus;
+    RESP_STATUS   respStatus;
+    int           rspMessageID;
+
+    if ( ProcessNEventMessage(A_messageID, A_result, A_verbose) )
+        respStatus = N_EVENT_SUCCESS;
+    else
+        respStatus = N_EVENT_PROCESSING_FAILURE; 
+
+    mcStatus = MC_Free_Message(&A_messageID);
+    if (mcStatus != MC_NORMAL_COMPLETION)
+    {
+        PrintError("MC_Free_Message of PRINTER,N_EVENT_REPORT_RSP error",mcStatus);
+        return ( false ); 
+    } 
+
+    /*
+     * Now lets send a response message.
+     */
+    mcStatus = MC_Open_Message ( &rspMessageID, 
+                                 "STORAGE_COMMITMENT_PUSH", 
+                                 N_EVENT_REPORT_RSP );
+    if (mcStatus != MC_NORMAL_COMPLETION)
+    {
+        PrintError("MC_Open_Message error of N-EVENT response",mcStatus);
+        return ( false ); 
+    }
+
+    mcStatus = MC_Send_Response_Message( A_associationID,  
+                                         respStatus, 
+                                         rspMessageID );
+    if (mcStatus != MC_NORMAL_COMPLETION)
+    {
+        PrintError("MC_Send_Response_Message for N_EVENT_REPORT_RSP error",mcStatus);
+        MC_Free_Message(&rspMessageID);
+        return( false ); 
+    }
+
+    mcStatus = MC_Free_Message(&rspMessageID);
+    if (mcStatus != MC_NORMAL_COMPLETION)
+    {
+        PrintError("MC_Free_Message of PRINTER,N_EVENT_REPORT_RSP error",mcStatus);
+        return ( false ); 
+    }
+
+    return ( true );
+} // end of AnswerNEventReport
+
+
 /****************************************************************************
  *
  *  Function    :   HandleNEventAssociation
@@ -1522,21 +2116,28 @@ bool SetAndSendNActionMessage(
 NEVENT_ENUM HandleNEventAssociation(
                         COMMIT_OPTIONS&                         A_options,
                         int                                     A_associationID, 
-                        DICOMStoragePkg::ResultByStorageTarget* A_result,
+                        CommitResult*                           A_result,
                         DICOMStoragePkg::CommitType			    A_commitType)
 {
     MC_STATUS     mcStatus;
-    bool          sampStatus;
-    RESP_STATUS   respStatus;
     int           messageID;
-    int           rspMessageID;
     MC_COMMAND    command;
     char*         serviceName;
     int           cnt;
 
-    ::Message(MNOTE, toEndUser | toService | MLoverall, "Cstore sets Role Reversal WaitTime to be %d seconds.", A_options.RoleReversalWaitTime);
-    for (cnt=0; cnt<=MAX_LOOP_ITERATIONS; cnt++)
-    {
+    ::Message(MNOTE, toEndUser | toService | MLoverall, "Cstore sets Role Reversal WaitTime to be %d seconds.", A_options.RoleReversalWaitTime);
+    for (cnt=0; cnt<=MAX_LOOP_ITERATIONS; cnt++)
+    {
+		/*
+		 * For synchronous commitment, we break out here once every
+		 * transaction is reported, some maybe while the N-ACTIONs went out.
+		 * If an either-commitment gets this far, it must be synchronous.
+         */
+		if ((A_commitType == DICOMStoragePkg::SYNCH_COMMIT || 
+			 A_commitType == DICOMStoragePkg::EITHER_COMMIT) &&
+			A_result->allReported())
+			break;
+
         /*
          * Note, only the requestor of an association can close the association.
          * So for asynchronous commitment, we wait here in the read message call
@@ -1583,56 +2184,8 @@ NEVENT_ENUM HandleNEventAssociation(
 			return ( FAILURE ); 
         }
 
-        sampStatus = ProcessNEventMessage(messageID, A_result);
-        if (sampStatus == true )
-			respStatus = N_EVENT_SUCCESS;
-        else
-            respStatus = N_EVENT_PROCESSING_FAILURE; 
-
-
-        mcStatus = MC_Free_Message(&messageID);
-        if (mcStatus != MC_NORMAL_COMPLETION)
-        {
-            PrintError("MC_Free_Message of PRINTER,N_EVENT_REPORT_RSP error",mcStatus);
-            return ( FAILURE ); 
-        } 
-
-        /*
-         * Now lets send a response message.
-         */
-        mcStatus = MC_Open_Message ( &rspMessageID, 
-                                     "STORAGE_COMMITMENT_PUSH", 
-                                     N_EVENT_REPORT_RSP );
-        if (mcStatus != MC_NORMAL_COMPLETION)
-        {
-            PrintError("MC_Open_Message error of N-EVENT response",mcStatus);
-            return ( FAILURE ); 
-        }
-
-        mcStatus = MC_Send_Response_Message( A_associationID,  
-                                             respStatus, 
-                                             rspMessageID );
-        if (mcStatus != MC_NORMAL_COMPLETION)
-        {
-            PrintError("MC_Send_Response_Message for N_EVENT_REPORT_RSP error",mcStatus);
-            MC_Free_Message(&rspMessageID);
-            return( FAILURE ); 
-        }
-
-        mcStatus = MC_Free_Message(&rspMessageID);
-        if (mcStatus != MC_NORMAL_COMPLETION)
-        {
-            PrintError("MC_Free_Message of PRINTER,N_EVENT_REPORT_RSP error",mcStatus);
+        if ( !AnswerNEventReport( A_associationID, messageID, A_result, A_options.Verbose ) )
             return ( FAILURE ); 
-        }
-
-		/*
-		 * For synchronous commitment, we break out here.
-		 * If an either-commitment gets this far, it must be synchronous.
-         */
-		if (A_commitType == DICOMStoragePkg::SYNCH_COMMIT || 
-			A_commitType == DICOMStoragePkg::EITHER_COMMIT)
-			break;
 	}
 
 	if (cnt > MAX_LOOP_ITERATIONS)
@@ -1648,25 +2201,38 @@ NEVENT_ENUM HandleNEventAssociation(
  *
  *  Parameters  :   A_messageID - Association ID registered 
  *                  A_result    - List of objects to request commitment for.
+ *                  A_verbose   - Log every SOP instance of the report
  *
  *  Returns     :   true
  *                  false
  *
  *  Description :   Handle a storage commitment association when expecting 
- *                  an N-EVENT-REPORT-RQ message.
+ *                  an N-EVENT-REPORT-RQ message. The report is matched with
+ *                  a transaction of A_result by its UID. The files of the
+ *                  transaction are indexed by their UIDs once, before the
+ *                  referenced and failed SOP sequences are walked. One line
+ *                  with the counts is logged per report; an instance is
+ *                  logged on its own only when verbose, or when it failed
+ *                  or matches no file.
  *
  ****************************************************************************/
 bool ProcessNEventMessage(
                         int                    A_messageID, 
-                        DICOMStoragePkg::ResultByStorageTarget* A_result)
+                        CommitResult*                           A_result,
+                        bool                                    A_verbose)
 {
     char           uidBuffer[UI_LENGTH+2];
     char           sopClassUID[UI_LENGTH+2];
     char           sopInstanceUID[UI_LENGTH+2];
     unsigned short eventType;
+    unsigned short failureReason;
     MC_STATUS      mcStatus;
     int            itemID;
     int            index;
+    int            transaction;
+    int            numCommitted = 0;
+    int            numFailed = 0;
+    int            numUnmatched = 0;
 
     mcStatus = MC_Get_Value_To_String( A_messageID, 
                     MC_ATT_TRANSACTION_UID, 
@@ -1682,24 +2248,32 @@ bool ProcessNEventMessage(
      * At this time, the transaction UID is compared to a 
      * transaction UID of a previous storage commitment request.
      */
-	if(strcmp(A_result->transactionUID.in(), uidBuffer))
+	transaction = A_result->findTransaction(uidBuffer);
+	if(transaction < 0)
 	{
 		::Message(MWARNING, toEndUser | toService | MLoverall, 
 			"Different transactionUID for storage commitment: what got from N-EVENT '%s' is different from expected: '%s'.",
-			uidBuffer, A_result->transactionUID.in());
+			uidBuffer, A_result->transactionUIDs().c_str());
 		return false;
 		// work here: may need to put the uidBuffer back to the pipe?
 	}
-	else
+	else if (A_verbose)
 		::Message(MNOTE, toEndUser | toService | MLoverall, 
-			"TransactionUID matches for storage commitment: what got from N-EVENT '%s' is the same as expected: '%s'.",
-			uidBuffer, A_result->transactionUID.in());
+			"TransactionUID matches for storage commitment: what got from N-EVENT '%s' is transaction %d of %d.",
+			uidBuffer, transaction + 1, (int)A_result->transactions.size());
 
     /* 
      * The following code can then compare the successful SOP 
      * instances and failed SOP instances with those that were
      * requested.
      */
+    const DICOMStoragePkg::ResultByFileList& resultByFiles = A_result->stored->resultByFiles;
+    int firstFile = A_result->transactions[transaction].firstFile;
+    int endFile = A_result->transactions[transaction].endFile;
+    SOPInstanceIndex sopIndex(endFile - firstFile);
+
+    for (int i=firstFile; i<endFile; i++)
+        sopIndex.add(resultByFiles[i].SOPClassUID.in(), resultByFiles[i].SOPInstanceUID.in());
 	
     mcStatus = MC_Get_Value_To_UShortInt( A_messageID, 
                                           MC_ATT_EVENT_TYPE_ID, 
@@ -1713,17 +2287,13 @@ bool ProcessNEventMessage(
     switch( eventType )
     {
         case 1: /* SUCCESS */
-            ::Message(MNOTE, toEndUser | toService | MLoverall, "\nCommit for N-EVENT Transaction UID: %s succeeded", uidBuffer );
-            
             break;
         case 2: /* FAILURE */
-            ::Message(MNOTE, toEndUser | toService | MLoverall, "\nCommit for N-EVENT Transaction UID: %s failed", uidBuffer );
             /*
              * At this point, the failure list is traversed through
              * to determine which images failed for the transaction.
              * This should be compared to the originals.
              */
-            ::Message(MWARNING, toEndUser | toService | MLoverall, "    Failed to commit SOP Instances:");
 
             mcStatus = MC_Get_Next_Value_To_Int( A_messageID,
                                                  MC_ATT_FAILED_SOP_SEQUENCE,
@@ -1750,22 +2320,36 @@ bool ProcessNEventMessage(
                     sopInstanceUID[0] = '\0';
                 }
 
-                ::Message(MNOTE, toEndUser | toService | MLoverall, "ProcessNEventMessage gets    SOP Class UID: %s", sopClassUID );
-                ::Message(MNOTE, toEndUser | toService | MLoverall, "ProcessNEventMessage gets SOP Instance UID: %s\n", sopInstanceUID );
+                /*
+                 * 0112H, No such object instance, means the instance is
+                 * lost and has to be stored again before a recommit
+                 */
+                mcStatus = MC_Get_Value_To_UShortInt( itemID,
+                                                      MC_ATT_FAILURE_REASON,
+                                                      &failureReason );
+                if ( mcStatus != MC_NORMAL_COMPLETION )
+                    failureReason = 0;
 
-				index = findNode(A_result->resultByFiles, sopClassUID, sopInstanceUID);
+				index = sopIndex.find(sopClassUID, sopInstanceUID);
 				if (index>=0)
 				{
-					A_result->resultByFiles[index].commitOutcome = DICOMStoragePkg::COMMIT_FAILURE;
-					::Message(MWARNING, toEndUser | toService | MLoverall, "COMMIT_FAILURE for %s.", A_result->resultByFiles[index].imgFile.in());
+					index += firstFile;
+					A_result->commitOutcome[index] = DICOMStoragePkg::COMMIT_FAILURE;
+					A_result->missing[index] = failureReason == 0x0112;
+					numFailed++;
+					::Message(MWARNING, toEndUser | toService | MLoverall, "COMMIT_FAILURE for %s, reason 0x%04X.",
+							  A_result->stored->resultByFiles[index].imgFile.in(), failureReason);
 #ifdef DEBUG_PRINTF
-					printf("COMMIT_FAILURE for %s.\n", A_result->resultByFiles[index].imgFile.in());
+					printf("COMMIT_FAILURE for %s.\n", A_result->stored->resultByFiles[index].imgFile.in());
 #endif
 				}
 				else
+				{
+					numUnmatched++;
 					::Message( MWARNING, toEndUser | toService | MLoverall, 
 							"Storage commit failed for sopClassUID: %s, sopInstanceUID: %s. But could not find the corresponding image file.",
 							sopClassUID, sopInstanceUID);
+				}
 
                 mcStatus = MC_Get_Next_Value_To_Int( A_messageID,
                                                      MC_ATT_FAILED_SOP_SEQUENCE,
@@ -1783,8 +2367,6 @@ bool ProcessNEventMessage(
      * We compare here the original SOP instances in the 
      * original transaction to what was returned here.
      */
-    ::Message(MNOTE, toEndUser | toService | MLoverall, "    Successfully committed SOP Instances:");
-
     mcStatus = MC_Get_Next_Value_To_Int( A_messageID,
                                          MC_ATT_REFERENCED_SOP_SEQUENCE,
                                          &itemID );
@@ -1810,28 +2392,37 @@ bool ProcessNEventMessage(
             sopInstanceUID[0] = '\0';
         }
 
-        ::Message(MNOTE, toEndUser | toService | MLoverall, "       SOP Class UID: %s", sopClassUID );
-        ::Message(MNOTE, toEndUser | toService | MLoverall, "    SOP Instance UID: %s", sopInstanceUID );
-
-		index = findNode(A_result->resultByFiles, sopClassUID, sopInstanceUID);
+		index = sopIndex.find(sopClassUID, sopInstanceUID);
 		if (index>=0)
 		{
-			A_result->resultByFiles[index].commitOutcome = DICOMStoragePkg::COMMIT_SUCCEESS;
-			::Message(MNOTE, toEndUser | toService | MLoverall, "COMMIT_SUCCEESS for %s.", A_result->resultByFiles[index].imgFile.in());
+			index += firstFile;
+			A_result->commitOutcome[index] = DICOMStoragePkg::COMMIT_SUCCEESS;
+			numCommitted++;
+			if (A_verbose)
+				::Message(MNOTE, toEndUser | toService | MLoverall, "COMMIT_SUCCEESS for %s.", A_result->stored->resultByFiles[index].imgFile.in());
 #ifdef DEBUG_PRINTF
-			printf("COMMIT_SUCCEESS for %s.\n", A_result->resultByFiles[index].imgFile.in());
+			printf("COMMIT_SUCCEESS for %s.\n", A_result->stored->resultByFiles[index].imgFile.in());
 #endif
 		}
 		else
+		{
+			numUnmatched++;
 			::Message( MWARNING, toEndUser | toService | MLoverall, 
 					"Storage commit succeeded for sopClassUID: %s, sopInstanceUID: %s. But could not find the corresponding image file.",
 					sopClassUID, sopInstanceUID);
+		}
 
         mcStatus = MC_Get_Next_Value_To_Int( A_messageID,
                                              MC_ATT_REFERENCED_SOP_SEQUENCE,
                                              &itemID );
     }
     
+    ::Message(numFailed || numUnmatched ? MWARNING : MNOTE, toEndUser | toService | MLoverall,
+              "Commit for N-EVENT Transaction UID: %s %s, %d committed, %d failed, %d not matched of %d file(s)",
+              uidBuffer, eventType == 1 ? "succeeded" : "failed", numCommitted, numFailed, numUnmatched,
+              endFile - firstFile);
+
+    A_result->transactions[transaction].reported = true;
     return ( true );
 }  // ProcessNEventMessage
 
@@ -1864,9 +2455,10 @@ bool ReadImage( STORAGE_OPTIONS&  A_options,
     FORMAT_ENUM             format = UNKNOWN_FORMAT;
     bool                    sampBool = false;
     MC_STATUS               mcStatus;
+    DicomMetadata           metadata;
 
 
-    format = CheckFileFormat( A_node->fname );
+    format = CachedFileFormat( A_node->fname );
     switch(format)
     {
         case MEDIA_FORMAT:
@@ -1917,6 +2509,16 @@ bool ReadImage( STORAGE_OPTIONS&  A_options,
         {
             PrintError("MC_Get_Value_To_String for SOP Instance UID failed", mcStatus);
         }
+        else if (A_node->SOPClassUID[0])
+        {
+            metadata.format = format;
+            metadata.transferSyntax = A_node->transferSyntax;
+            metadata.fileBytes = A_node->imageBytes;
+            metadata.uidsKnown = true;
+            strcpy(metadata.SOPClassUID, A_node->SOPClassUID);
+            strcpy(metadata.SOPInstanceUID, A_node->SOPInstanceUID);
+            MetadataCache::instance()->remember(A_node->fname, metadata);
+        }
 
         if (A_options.Verbose)
         {
@@ -2096,6 +2698,7 @@ bool ReadResponseMessages(    STORAGE_OPTIONS&  A_options,
     }
    
     node->responseReceived = true;
+    ReleaseInFlightCredits( node );
         
     sampBool = CheckResponseMessage ( responseMessageID, node );
     if (!sampBool)
@@ -2106,6 +2709,7 @@ bool ReadResponseMessages(    STORAGE_OPTIONS&  A_options,
     ::Message(MNOTE, toEndUser | toService | MLoverall, "Storage Status: file %s %s", node->fname, node->statusMeaning);
         
     node->failedResponse = false;
+    AcknowledgeGroupFile( node );
 
     mcStatus = MC_Free_Message(&responseMessageID);
     if (mcStatus != MC_NORMAL_COMPLETION)
@@ -2681,27 +3285,13 @@ MC_STATUS NOEXP_FUNC StreamToMsgObj( int        A_msgID,
  *
  *  Returns     :   bool
  *
- *  Description :   Check to see if this char* is a valid VR.  This function
- *                  is only used by CheckFileFormat.
+ *  Description :   Check to see if this char* is a valid VR, by a table
+ *                  lookup of DicomVRKind.
  *
  ****************************************************************************/
 bool CheckValidVR( char    *A_VR)
 {
-    static const char* const VR_Table[27] = 
-    {   
-        "AE", "AS", "CS", "DA", "DS", "DT", "IS", "LO", "LT", 
-        "PN", "SH", "ST", "TM", "UT", "UI", "SS", "US", "AT", 
-        "SL", "UL", "FL", "FD", "UN", "OB", "OW", "OL", "SQ" 
-    };
-    int i;
-   
-    for (i =  0; i < 27; i++)
-    {
-        if ( !strcmp( A_VR, VR_Table[i] ) )
-            return true;
-    }
-
-    return false;
+    return DicomVRKind( A_VR ) != DICOM_VR_UNKNOWN;
 } /* CheckValidVR() */
 
 
@@ -2721,218 +3311,75 @@ bool CheckValidVR( char    *A_VR)
  *                   should probably not be used in production equipment,
  *                   unless the format of objects is known ahead of time,
  *                   and it is guarenteed that this algorithm works on those
- *                   objects.
+ *                   objects.  The guessing is done by ScanDicomFormat, which
+ *                   reads the start of the file once.
  *
  ****************************************************************************/
 FORMAT_ENUM CheckFileFormat( const char*    A_filename )
 {
-    FILE*            fp;
-    char             signature[5] = "\0\0\0\0";
-    char             vR[3] = "\0\0";
+    return ScanDicomFormat( A_filename );
+} /* CheckFileFormat() */
 
-    union
-    {
-        unsigned short   groupNumber;
-        char      i[2];
-    } group;
-    
-    unsigned short   elementNumber;
-    
-    union
-    {
-        unsigned short  shorterValueLength;
-        char      i[2];
-    } aint;
-    
-    union
-    {
-        unsigned long   valueLength;
-        char      l[4];
-    } along;
-   
-   
 
-    if ( (fp = fopen(A_filename, BINARY_READ)) != NULL)
-    {
-        if (fseek(fp, 128, SEEK_SET) == 0)
-        {
-            /*
-             * Read the signature, only 4 bytes
-             */
-            if (fread(signature, 1, 4, fp) == 4)
-            {
-                /* 
-                 * if it is the signature, return true.  The file is 
-                 * definately in the DICOM Part 10 format.
-                 */
-                if (!strcmp(signature, "DICM"))
-                {
-                    fclose(fp);
-					return MEDIA_FORMAT;
-                }
-            }
-        }
-        
-        fseek(fp, 0, SEEK_SET);
-        
-        /*
-         * Now try and determine the format if it is not media
-         */
-        if (fread(&group.groupNumber, 1, sizeof(group.groupNumber), fp) != 
-            sizeof(group.groupNumber))
-        {
-            ::Message(MWARNING, toEndUser | toService | MLoverall, "ERROR: reading Group Number");
-            return UNKNOWN_FORMAT;
-        }
-        if (fread(&elementNumber, 1, sizeof(elementNumber), fp) !=
-            sizeof(elementNumber))
-        {
-            ::Message(MWARNING, toEndUser | toService | MLoverall, "ERROR: reading Element Number");
-            return UNKNOWN_FORMAT;
-        }
+/****************************************************************************
+ *
+ *  Function    :    CachedFileFormat
+ *
+ *  Parameters  :    A_filename     file name of the image which is being
+ *                                  checked for a format.
+ *
+ *  Returns     :    FORMAT_ENUM    enumberation of possible return values
+ *
+ *  Description :    CheckFileFormat through the MetadataCache. A file that
+ *                   is unchanged since it was last checked or read is not
+ *                   opened. Otherwise its header is scanned, and the SOP
+ *                   UIDs found are remembered with the format. Files of
+ *                   unknown format are not remembered, so they are checked
+ *                   again once they are complete.
+ *
+ ****************************************************************************/
+FORMAT_ENUM CachedFileFormat( const char*    A_filename )
+{
+    DicomMetadata    metadata;
+    DicomHeaderInfo  header;
 
-        if (fread(vR, 1, 2, fp) != 2)
-        {
-            ::Message(MWARNING, toEndUser | toService | MLoverall, "ERROR: reading VR");
-            return UNKNOWN_FORMAT;
-        }
+    if ( MetadataCache::instance()->lookup( A_filename, &metadata ) )
+        return metadata.format;
 
-        /*
-         * See if this is a valid VR, if not then this is implicit VR
-         */
-        if (CheckValidVR(vR))
-        {
-            /*
-             * we know that this is an explicit endian, but we don't
-             * know which endian yet.
-             */
-            if (!strcmp(vR, "OB") 
-             || !strcmp(vR, "OW") 
-             || !strcmp(vR, "OL") 
-             || !strcmp(vR, "UT") 
-             || !strcmp(vR, "UN") 
-             || !strcmp(vR, "SQ"))
-            {
-                /* 
-                 * need to read the next 2 bytes which should be set to 0
-                 */
-                if (fread(vR, 1, 2, fp) != 2)
-                    ::Message(MWARNING, toEndUser | toService | MLoverall, "ERROR: reading VR");
-                else if (vR[0] == '\0' && vR[1] == '\0')
-                {
-                    /*
-                     * the next 32 bits is the length
-                     */
-                    if (fread(&along.valueLength, 1, sizeof(along.valueLength),
-                        fp) != sizeof(along.valueLength))
-                        ::Message(MWARNING, toEndUser | toService | MLoverall, "ERROR: reading Value Length");
-                    fclose(fp);
-
-                    /*
-                     * Make the assumption that if this tag has a value, the
-                     * length of the value is going to be small, and thus the
-                     * high order 2 bytes will be set to 0.  If the first
-                     * bytes read are 0, then this is a big endian syntax.
-                     *
-                     * If the length of the tag is zero, we look at the 
-                     * group number field.  Most DICOM objects start at
-                     * group 8. Test for big endian format with the group 8
-                     * in the second byte, or else defailt to little endian
-                     * because it is more common.
-                     */
-                    if (along.valueLength)
-                    {
-                        if ( along.l[0] == '\0' && along.l[1] == '\0') 
-							return EXPLICIT_BIG_ENDIAN_FORMAT;
-                        return EXPLICIT_LITTLE_ENDIAN_FORMAT;
-                    }
-                    else
-                    {
-                        if (group.i[1] == 8)
-                            return EXPLICIT_BIG_ENDIAN_FORMAT;
-                        return EXPLICIT_LITTLE_ENDIAN_FORMAT;
-                    }
-                }
-                else
-                {
-                    ::Message(MWARNING, toEndUser | toService | MLoverall, "ERROR: Data Element not correct format");
-                    fclose(fp);
-                }
-            }
-            else
-            {
-                /*
-                 * the next 16 bits is the length
-                 */
-                if (fread(&aint.shorterValueLength, 1,
-                    sizeof(aint.shorterValueLength), fp) !=
-                    sizeof(aint.shorterValueLength))
-                    ::Message(MWARNING, toEndUser | toService | MLoverall, "ERROR: reading short Value Length");
-                fclose(fp);
+    if ( ScanDicomHeader( A_filename, &header ) )
+    {
+        metadata.format = header.format;
+        metadata.transferSyntax = header.transferSyntax;
+        metadata.fileBytes = 0;
+        metadata.uidsKnown = header.SOPClassUID[0] && header.SOPInstanceUID[0];
+        strcpy( metadata.SOPClassUID, header.SOPClassUID );
+        strcpy( metadata.SOPInstanceUID, header.SOPInstanceUID );
+        MetadataCache::instance()->remember( A_filename, metadata );
+    }
 
-                /*
-                 * Again, make the assumption that if this tag has a value,
-                 * the length of the value is going to be small, and thus the
-                 * high order byte will be set to 0.  If the first byte read
-                 * is 0, and it has a length then this is a big endian syntax.
-                 * Because there is a chance the first tag may have a length
-                 * greater than 16 (forcing both bytes to be non-zero, 
-                 * unless we're sure, use the group length to test, and then
-                 * default to explicit little endian.
-                 */
-                if  (aint.shorterValueLength 
-                 && (aint.i[0] == '\0'))
-					return EXPLICIT_BIG_ENDIAN_FORMAT;
-				else
-                {
-                    if (group.i[1] == 8)
-                        return EXPLICIT_BIG_ENDIAN_FORMAT;
-                    return EXPLICIT_LITTLE_ENDIAN_FORMAT;
-                }
-            }
-        }
-        else
-        {
-            /* 
-             * What we read was not a valid VR, so it must be implicit
-             * endian, or maybe format error
-             */
-            if (fseek(fp, -2L, SEEK_CUR) != 0) 
-            {
-                ::Message(MWARNING, toEndUser | toService | MLoverall, "ERROR: seeking in file");
-                return UNKNOWN_FORMAT;
-            }
+    return header.format;
+} /* CachedFileFormat() */
 
-            /*
-             * the next 32 bits is the length
-             */
-            if (fread(&along.valueLength, 1, sizeof(along.valueLength), fp) !=
-                sizeof(along.valueLength))
-                ::Message(MWARNING, toEndUser | toService | MLoverall, "ERROR: reading Value Length");
-            fclose(fp);
 
-            /*
-             * This is a big assumption, if this tag length is a
-             * big number, the Endian must be little endian since
-             * we assume the length should be small for the first
-             * few tags in this message.
-             */
-            if (along.valueLength)
-            {
-                if ( along.l[0] == '\0' && along.l[1] == '\0' ) 
-                    return IMPLICIT_BIG_ENDIAN_FORMAT;
-                return IMPLICIT_LITTLE_ENDIAN_FORMAT;
-            }
-            else
-            {
-                if (group.i[1] == 8)
-                    return IMPLICIT_BIG_ENDIAN_FORMAT;
-                return IMPLICIT_LITTLE_ENDIAN_FORMAT;
-            }
-        }
-    }
-    return UNKNOWN_FORMAT;
-} /* CheckFileFormat() */
+/****************************************************************************
+ *
+ *  Function    :    IsNotDICOMResult
+ *
+ *  Parameters  :    A_file         storage result of a file
+ *
+ *  Returns     :    true if the file is not DICOM
+ *
+ *  Description :    A file that is not DICOM is reported in the result with
+ *                   an unknown outcome and no SOP Instance UID. It was never
+ *                   meant to be stored, so it is not a failure of the export.
+ *
+ ****************************************************************************/
+bool IsNotDICOMResult( const DICOMStoragePkg::ResultByFile& A_file )
+{
+    return A_file.storageOutcome == DICOMStoragePkg::STORAGE_UNKNOWN
+        && !A_file.SOPInstanceUID.in()[0]
+        && CachedFileFormat( A_file.imgFile.in() ) == UNKNOWN_FORMAT;
+} /* IsNotDICOMResult() */
 
 
 /****************************************************************************
@@ -2941,7 +3388,7 @@ FORMAT_ENUM CheckFileFormat( const char*    A_filename )
  *
  *  Parameters  :   none
  *                  
- *  Returns     :   A pointer to a new UID
+ *  Returns     :   A new UID
  *
  *  Description :   This function creates a new UID for use within this 
  *                  application.  Note that this is not a valid method
@@ -2950,25 +3397,33 @@ FORMAT_ENUM CheckFileFormat( const char*    A_filename )
  *                  UID Format:
  *                  <baseuid>.<deviceidentifier>.<serial number>.<process id>
  *                       .<current date>.<current time>.<counter>
+ *                  Commit tasks call it at the same time, so the counter
+ *                  is taken under a lock and the UID is returned by value.
  *
  ****************************************************************************/
-char * Create_Inst_UID()
+string Create_Inst_UID()
 {
-    static short UID_CNTR = 0;
+    static pthread_mutex_t counterLock = PTHREAD_MUTEX_INITIALIZER;
+    static unsigned short UID_CNTR = 0;
     static char  deviceType[] = "1";
     static char  serial[] = "1";
-    static char  Sprnt_uid[68];
+    char         Sprnt_uid[68];
     char         creationDate[68];
     char         creationTime[68];
     time_t       timeReturn;
-    struct tm*   timePtr;
+    struct tm    timeValue;
+    struct tm*   timePtr = &timeValue;
+    unsigned int counter;
 #ifdef linux
     unsigned long pid = getpid();
 #endif
 
+    pthread_mutex_lock(&counterLock);
+    counter = UID_CNTR++;
+    pthread_mutex_unlock(&counterLock);
 
     timeReturn = time(NULL);
-    timePtr = localtime(&timeReturn);
+    localtime_r(&timeReturn, &timeValue);
     sprintf(creationDate, "%d%d%d",
            (timePtr->tm_year + 1900),
            (timePtr->tm_mon + 1),
@@ -2979,52 +3434,25 @@ char * Create_Inst_UID()
             timePtr->tm_sec);
 
 #ifdef linux    
-    sprintf(Sprnt_uid, "2.16.840.1.999999.%s.%s.%ld.%s.%s.%d", 
+    sprintf(Sprnt_uid, "2.16.840.1.999999.%s.%s.%ld.%s.%s.%u", 
                        deviceType,
                        serial,
                        pid,
                        creationDate,
                        creationTime,
-                       UID_CNTR++);
+                       counter);
 #else
-    sprintf(Sprnt_uid, "2.16.840.1.999999.%s.%s.%s.%s.%d", 
+    sprintf(Sprnt_uid, "2.16.840.1.999999.%s.%s.%s.%s.%u", 
                        deviceType,
                        serial,
                        creationDate,
                        creationTime,
-                       UID_CNTR++);
+                       counter);
 #endif
 
     return(Sprnt_uid);
 }
 
-/****************************************************************************
- *
- *  Function    :   findNode
- *
- *  Description :   Return the index (from 0 up) of a matching SOPClassUID and
- *                  SOPInstanceUID pair. Or return -1 if no matching found.
- *
- ****************************************************************************/
-int findNode(DICOMStoragePkg::ResultByFileList& resultByFiles, 
-			 char* sopClassUID, 
-			 char* sopInstanceUID)
-{
-    unsigned int i;
-    
-    /*
-     * Go through the file list
-     */
-    for (i=0; i<resultByFiles.length(); i++)
-    {
-        if ( !strcmp(resultByFiles[i].SOPClassUID.in(), sopClassUID) &&
-			 !strcmp(resultByFiles[i].SOPInstanceUID.in(), sopInstanceUID) )
-            return i;
-    }
-
-	return -1;
-}
-
 void GetCstoreDefaultParameters()
 {
   char line[256];
@@ -3033,6 +3461,27 @@ void GetCstoreDefaultParameters()
   // Set default values
   strcpy(DefaultTransferSyntax, "IMPLICIT_LITTLE_ENDIAN");
   AsyncCommitIncomingPort = -1;
+  CircuitBreakerThreshold = 3;
+  CircuitBreakerProbeInterval = 30;
+  StoreConcurrency = 4;
+  StoreConcurrencyPerTarget = 1;
+  WorkerPoolMaxThreads = 32;
+  InFlightBudgetMB = 256;
+  ExportDiskOrder = 0;
+  ReadAheadFiles = 8;
+  ReadAheadWindowMB = 32;
+  MetadataCacheEntries = 65536;
+  ValidationConcurrency = 4;
+  CommitChunkSize = 5000;
+  CommitCoalesceWindow = 200;
+  CommitPipelineChunk = 0;
+  CommitRetryLimit = 3;
+  CommitRetryDelay = 30;
+  CommitRetryMaxDelay = 600;
+  CommitRestoreMissing = 0;
+  CommitReactorThreads = 2;
+  CommitReactorTick = 20;
+  CommitReactorMaxTick = 320;
 
   std::ifstream cstoreConfigFile("data/Facility/Cstore/cstoredefaults.txt");
   if (!cstoreConfigFile)
@@ -3084,6 +3533,215 @@ void GetCstoreDefaultParameters()
 			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set DEFAULT_TRANSFER_SYNTAX = %s", DefaultTransferSyntax);
 #ifdef DEBUG_PRINTF
 			printf("Set DEFAULT_TRANSFER_SYNTAX = %s\n", DefaultTransferSyntax);
+#endif
+		  }
+		  else if(i==4)
+		  {
+			if (atoi(line) > 0)
+				CircuitBreakerThreshold = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Circuit_Breaker_Failure_Threshold = %d", CircuitBreakerThreshold);
+#ifdef DEBUG_PRINTF
+			printf("Set Circuit_Breaker_Failure_Threshold = %d\n", CircuitBreakerThreshold);
+#endif
+		  }
+		  else if(i==5)
+		  {
+			if (atoi(line) > 0)
+				CircuitBreakerProbeInterval = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Circuit_Breaker_Probe_Interval = %d", CircuitBreakerProbeInterval);
+#ifdef DEBUG_PRINTF
+			printf("Set Circuit_Breaker_Probe_Interval = %d\n", CircuitBreakerProbeInterval);
+#endif
+		  }
+		  else if(i==6)
+		  {
+			if (atoi(line) > 0)
+				StoreConcurrency = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Store_Concurrency = %d", StoreConcurrency);
+#ifdef DEBUG_PRINTF
+			printf("Set Store_Concurrency = %d\n", StoreConcurrency);
+#endif
+		  }
+		  else if(i==7)
+		  {
+			if (atoi(line) > 0)
+				StoreConcurrencyPerTarget = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Store_Concurrency_Per_Target = %d", StoreConcurrencyPerTarget);
+#ifdef DEBUG_PRINTF
+			printf("Set Store_Concurrency_Per_Target = %d\n", StoreConcurrencyPerTarget);
+#endif
+		  }
+		  else if(i==8)
+		  {
+			if (atoi(line) > 0)
+				WorkerPoolMaxThreads = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Worker_Pool_Max_Threads = %d", WorkerPoolMaxThreads);
+#ifdef DEBUG_PRINTF
+			printf("Set Worker_Pool_Max_Threads = %d\n", WorkerPoolMaxThreads);
+#endif
+		  }
+		  else if(i==9)
+		  {
+			if (atoi(line) > 0)
+				InFlightBudgetMB = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set In_Flight_Budget_MB = %d", InFlightBudgetMB);
+#ifdef DEBUG_PRINTF
+			printf("Set In_Flight_Budget_MB = %d\n", InFlightBudgetMB);
+#endif
+		  }
+		  else if(i==10)
+		  {
+			if (atoi(line) >= 0 && atoi(line) <= 2)
+				ExportDiskOrder = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Export_Disk_Order = %d", ExportDiskOrder);
+#ifdef DEBUG_PRINTF
+			printf("Set Export_Disk_Order = %d\n", ExportDiskOrder);
+#endif
+		  }
+		  else if(i==11)
+		  {
+			if (atoi(line) >= 0)
+				ReadAheadFiles = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Read_Ahead_Files = %d", ReadAheadFiles);
+#ifdef DEBUG_PRINTF
+			printf("Set Read_Ahead_Files = %d\n", ReadAheadFiles);
+#endif
+		  }
+		  else if(i==12)
+		  {
+			if (atoi(line) > 0)
+				ReadAheadWindowMB = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Read_Ahead_Window_MB = %d", ReadAheadWindowMB);
+#ifdef DEBUG_PRINTF
+			printf("Set Read_Ahead_Window_MB = %d\n", ReadAheadWindowMB);
+#endif
+		  }
+		  else if(i==13)
+		  {
+			if (atoi(line) >= 0)
+				MetadataCacheEntries = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Metadata_Cache_Entries = %d", MetadataCacheEntries);
+#ifdef DEBUG_PRINTF
+			printf("Set Metadata_Cache_Entries = %d\n", MetadataCacheEntries);
+#endif
+		  }
+		  else if(i==14)
+		  {
+			if (atoi(line) > 0)
+				ValidationConcurrency = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Validation_Concurrency = %d", ValidationConcurrency);
+#ifdef DEBUG_PRINTF
+			printf("Set Validation_Concurrency = %d\n", ValidationConcurrency);
+#endif
+		  }
+		  else if(i==15)
+		  {
+			if (atoi(line) >= 0)
+				CommitChunkSize = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Commit_Chunk_Size = %d", CommitChunkSize);
+#ifdef DEBUG_PRINTF
+			printf("Set Commit_Chunk_Size = %d\n", CommitChunkSize);
+#endif
+		  }
+		  else if(i==16)
+		  {
+			if (atoi(line) >= 0)
+				CommitCoalesceWindow = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Commit_Coalesce_Window = %d", CommitCoalesceWindow);
+#ifdef DEBUG_PRINTF
+			printf("Set Commit_Coalesce_Window = %d\n", CommitCoalesceWindow);
+#endif
+		  }
+		  else if(i==17)
+		  {
+			if (atoi(line) >= 0)
+				CommitPipelineChunk = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Commit_Pipeline_Chunk = %d", CommitPipelineChunk);
+#ifdef DEBUG_PRINTF
+			printf("Set Commit_Pipeline_Chunk = %d\n", CommitPipelineChunk);
+#endif
+		  }
+		  else if(i==18)
+		  {
+			if (atoi(line) >= 0)
+				CommitRetryLimit = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Commit_Retry_Limit = %d", CommitRetryLimit);
+#ifdef DEBUG_PRINTF
+			printf("Set Commit_Retry_Limit = %d\n", CommitRetryLimit);
+#endif
+		  }
+		  else if(i==19)
+		  {
+			if (atoi(line) > 0)
+				CommitRetryDelay = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Commit_Retry_Delay = %d", CommitRetryDelay);
+#ifdef DEBUG_PRINTF
+			printf("Set Commit_Retry_Delay = %d\n", CommitRetryDelay);
+#endif
+		  }
+		  else if(i==20)
+		  {
+			if (atoi(line) > 0)
+				CommitRetryMaxDelay = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Commit_Retry_Max_Delay = %d", CommitRetryMaxDelay);
+#ifdef DEBUG_PRINTF
+			printf("Set Commit_Retry_Max_Delay = %d\n", CommitRetryMaxDelay);
+#endif
+		  }
+		  else if(i==21)
+		  {
+			CommitRestoreMissing = atoi(line) ? 1 : 0;
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Commit_Restore_Missing = %d", CommitRestoreMissing);
+#ifdef DEBUG_PRINTF
+			printf("Set Commit_Restore_Missing = %d\n", CommitRestoreMissing);
+#endif
+		  }
+		  else if(i==22)
+		  {
+			if (atoi(line) >= 0)
+				CommitReactorThreads = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Commit_Reactor_Threads = %d", CommitReactorThreads);
+#ifdef DEBUG_PRINTF
+			printf("Set Commit_Reactor_Threads = %d\n", CommitReactorThreads);
+#endif
+		  }
+		  else if(i==23)
+		  {
+			if (atoi(line) > 0)
+				CommitReactorTick = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Commit_Reactor_Tick = %d", CommitReactorTick);
+#ifdef DEBUG_PRINTF
+			printf("Set Commit_Reactor_Tick = %d\n", CommitReactorTick);
+#endif
+		  }
+		  else if(i==24)
+		  {
+			if (atoi(line) > 0)
+				CommitReactorMaxTick = atoi(line);
+
+			::Message( MNOTE, MLoverall | toService | toDeveloper, "Set Commit_Reactor_Max_Tick = %d", CommitReactorMaxTick);
+#ifdef DEBUG_PRINTF
+			printf("Set Commit_Reactor_Max_Tick = %d\n", CommitReactorMaxTick);
 #endif
 			break;
 		  }
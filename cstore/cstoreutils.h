@@ -15,6 +15,7 @@
 using namespace std;
 
 #include <string.h>
+#include <sys/time.h>
 
 #include "mc3media.h"
 #include "mergecom.h" 
@@ -27,6 +28,9 @@ using namespace std;
 #include "control/DICOMStorage_s.h"
 
 #include "echoSCP.h"
+#include "workerPool.h"
+#include "dicomScanner.h"
+#include "sharedResult.h"
 
 //#define DEBUG_PRINTF
 
@@ -62,6 +66,10 @@ using namespace std;
 #define AE_LENGTH 16
 #define UI_LENGTH 64
 
+class TargetGroupDispatch;
+class FileValidation;
+class CommitPipeline;
+
 /*
  * Structure to maintain list of instances sent & to be sent.
  * The structure keeps track of all instances and is used
@@ -78,6 +86,7 @@ typedef struct instance_node
     char   SOPInstanceUID[UI_LENGTH+2]; /* SOP Instance UID of the file */
     
     size_t imageBytes;                  /* size in bytes of the file */
+    size_t creditBytes;                 /* bytes held from the InFlightBudget until the response */
     
     unsigned int dicomMsgID;            /* DICOM Message ID in group 0x0000 elements */
     unsigned int status;                /* DICOM status value returned for this file. */
@@ -89,18 +98,73 @@ typedef struct instance_node
     DICOMStoragePkg::StorageStatus storageStatus;  /* Storage result */
     DICOMStoragePkg::CommitStatus commitStatus;  /* Storage commitment result */
 
+    TargetGroupDispatch* group;         /* set when sent to a member of a target group */
+    int    groupMember;                 /* index of the member sending it */
+    struct instance_node* groupNode;    /* node of the group list this one is sent for */
+    size_t groupBytes;                  /* bytes counted against the member until the response */
+    int    fileIndex;                   /* position in the file list of the export */
+
     struct instance_node* Next;         /* Pointer to next node in list */
 
 } InstanceNode;
 
 
+/*
+ * Priority class of an export. Lower value is more urgent.
+ */
+typedef enum
+{
+    PRIORITY_STAT = 0,      /* clinically urgent, may borrow associations */
+    PRIORITY_ROUTINE = 1,
+    PRIORITY_BULK = 2,      /* research and archive exports */
+    NUM_EXPORT_PRIORITIES = 3
+} EXPORT_PRIORITY;
+
+/*
+ * Per-file progress and cancellation of one export job.  It is shared
+ * by the StorageData copies of all storage targets of the job.
+ */
+class ExportProgress
+{
+	ThreadMutex   _lock;
+	int           _totalFiles;
+	int           _filesProcessed;
+	int           _filesFailed;
+	volatile bool _cancelled;
+
+	// Disallow copying or assignment.
+	ExportProgress(const ExportProgress&);
+	ExportProgress& operator=(const ExportProgress&);
+
+public:
+	ExportProgress();
+	~ExportProgress();
+
+	void addFiles(int numFiles);
+	void fileProcessed(bool sent);
+	void getCounts(int& totalFiles, int& filesProcessed, int& filesFailed);
+
+	void cancel();
+	bool isCancelled();
+};
+
 /*
  * class to pass info into Storage class
  */
 class StorageData
 {	list<string> _filenames;
-
-	bool addFileToList(char* A_fname);
+	ExportProgress* _progress;  /* not owned, may be NULL */
+	EXPORT_PRIORITY _priority;
+	TargetGroupDispatch* _group; /* not owned, set for a member of a target group */
+	int             _groupMember;
+	FileValidation* _validation; /* shared, NULL if the files were not checked */
+	CommitPipeline* _pipeline;   /* not owned, set when stored files are committed chunk by chunk */
+	InstanceNode*   _pipelineNext;  /* first file not handed to the pipeline */
+	InstanceNode*   _pipelineScan;  /* first file not known to be answered */
+	int             _pipelineCount; /* answered files from _pipelineNext to _pipelineScan */
+	bool            _pipelineDone;
+
+	bool addFileToList(char* A_fname, int A_index);
 	void freeInstanceList();
 
 public:
@@ -114,6 +178,31 @@ public:
 	void clear();
 	void createLinkedList(const list<string>& filelist);
 	bool isEmpty();
+
+	void setProgress(ExportProgress* progress);
+	void addFiles(int numFiles);
+	void fileProcessed(bool sent);
+	bool isCancelled();
+	const void* jobKey() const { return _progress; }
+
+	void setPriority(EXPORT_PRIORITY priority);
+	EXPORT_PRIORITY getPriority() const { return _priority; }
+
+	// A member of a target group starts with an empty list and claims
+	// the files of the group one at a time
+	void joinGroup(TargetGroupDispatch* group, int member, const StorageData& groupData);
+	TargetGroupDispatch* getGroup() const { return _group; }
+	int getGroupMember() const { return _groupMember; }
+
+	// The files are checked by validation, which is waited for file by file
+	void setValidation(FileValidation* validation);
+	bool isValid(const InstanceNode* node);
+
+	// Hand every CommitPipeline::chunkSize() answered files, from the first
+	// file on, to the pipeline. unprocessed is the first file the store
+	// task has not got to yet, NULL once all are sent and answered.
+	void setCommitPipeline(CommitPipeline* pipeline);
+	void commitStored(const char* storageHostName, InstanceNode* unprocessed);
 };
 
 /*
@@ -137,19 +226,6 @@ typedef struct CALLBACKINFO
 } CBinfo;
 
 
-/*
- * Used to identify the format of an object
- */
-typedef enum
-{
-    UNKNOWN_FORMAT = 0,
-    MEDIA_FORMAT = 1,
-    IMPLICIT_LITTLE_ENDIAN_FORMAT,
-    IMPLICIT_BIG_ENDIAN_FORMAT,
-    EXPLICIT_LITTLE_ENDIAN_FORMAT,
-    EXPLICIT_BIG_ENDIAN_FORMAT
-} FORMAT_ENUM;
-
 /*
  * HandleNEventAssociation return status
  */
@@ -201,6 +277,8 @@ public:
 	~STORE_ARGS();
 };
 
+class CommitWaiter;
+
 /*
  * Structure of arguments to pass into A/SynchStorageCommitment() 
  */
@@ -209,7 +287,8 @@ class COMMIT_ARGS
 public:
 	COMMIT_OPTIONS         options;
     int                    appID;
-    DICOMStoragePkg::ResultByStorageTarget* result;
+    CommitResult*          result;
+    CommitWaiter*          waiter;   /* told when an asynchronous report is in */
 
 	COMMIT_ARGS();
 	COMMIT_ARGS(const COMMIT_ARGS& obj);
@@ -239,20 +318,39 @@ void* AsynchStorageCommitment(void*            commit_args);
  */
 void* EitherStorageCommitment(void*            commit_args);
 
+/*
+ * The end of EitherStorageCommitment, once the wait for the reports on the
+ * association is over
+ */
+void* FinishEitherStorageCommitment(
+                        COMMIT_ARGS*                            commitArgs,
+                        int                                     associationID,
+                        NEVENT_ENUM                             NEVENTStatus,
+                        int                                     waitTime,
+                        const struct timeval&                   sentTime);
+
 bool SetAndSendNActionMessage(
                         COMMIT_OPTIONS&                         A_options,
                         int                                     A_associationID,
-                        DICOMStoragePkg::ResultByStorageTarget* A_result);
+                        CommitResult*                           A_result,
+                        int                                     A_transaction);
+
+bool AnswerNEventReport(
+                        int                                     A_associationID,
+                        int                                     A_messageID,
+                        CommitResult*                           A_result,
+                        bool                                    A_verbose = false);
 
 NEVENT_ENUM HandleNEventAssociation(
                         COMMIT_OPTIONS&                         A_options,
                         int                                     A_associationID,
-                        DICOMStoragePkg::ResultByStorageTarget* A_result,
+                        CommitResult*                           A_result,
 						DICOMStoragePkg::CommitType			    A_commitType);
                         
 bool ProcessNEventMessage(
                         int                                     A_messageID,
-                        DICOMStoragePkg::ResultByStorageTarget* A_result);
+                        CommitResult*                           A_result,
+                        bool                                    A_verbose = false);
 
 bool ReadImage(         STORAGE_OPTIONS&    A_options,
                         int                 A_appID, 
@@ -305,11 +403,12 @@ MC_STATUS NOEXP_FUNC StreamToMsgObj(
 bool CheckValidVR( char    *A_VR);
 
 FORMAT_ENUM CheckFileFormat(const char*           A_filename );
-                        
-char* Create_Inst_UID();
 
-int findNode(DICOMStoragePkg::ResultByFileList& resultByFiles, 
-			 char* sopClassUID, char* sopInstanceUID);
+FORMAT_ENUM CachedFileFormat(const char*          A_filename );
+
+bool IsNotDICOMResult(const DICOMStoragePkg::ResultByFile& A_file );
+                        
+string Create_Inst_UID();
 
 void GetCstoreDefaultParameters();
 
@@ -0,0 +1,395 @@
+/*
+ * file:	dicomScanner.cc
+ * purpose:	Implementation of the DICOM header scanner
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dicomScanner.h"
+
+static const unsigned int UndefinedLength = 0xFFFFFFFF;
+static const unsigned int LastScannedTag  = 0x0020000E;   /* Series Instance UID */
+static const unsigned int PixelDataTag    = 0x7FE00010;
+
+/*
+ * VR kinds indexed by (first letter - 'A') * 26 + (second letter - 'A')
+ */
+static unsigned char VRTable[26*26];
+
+static struct VRTableInit
+{
+	VRTableInit()
+	{
+		static const char* const shortVRs[] =
+		{
+			"AE", "AS", "AT", "CS", "DA", "DS", "DT", "FD", "FL", "IS", "LO",
+			"LT", "PN", "SH", "SL", "SS", "ST", "TM", "UI", "UL", "US"
+		};
+		static const char* const longVRs[] =
+		{
+			"OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR",
+			"UT", "UV"
+		};
+		unsigned int i;
+
+		for (i = 0; i < sizeof(shortVRs) / sizeof(shortVRs[0]); i++)
+			VRTable[(shortVRs[i][0] - 'A') * 26 + shortVRs[i][1] - 'A'] = DICOM_VR_SHORT_LENGTH;
+		for (i = 0; i < sizeof(longVRs) / sizeof(longVRs[0]); i++)
+			VRTable[(longVRs[i][0] - 'A') * 26 + longVRs[i][1] - 'A'] = DICOM_VR_LONG_LENGTH;
+	}
+} vrTableInit;
+
+DICOM_VR_KIND DicomVRKind(const char* A_VR)
+{
+	unsigned int first = (unsigned char)A_VR[0] - 'A';
+	unsigned int second = (unsigned char)A_VR[1] - 'A';
+
+	if (first >= 26 || second >= 26)
+		return DICOM_VR_UNKNOWN;
+
+	return (DICOM_VR_KIND)VRTable[first * 26 + second];
+}
+
+/*
+ * Buffered reader over a file descriptor. Skipping past the buffer seeks
+ * instead of reading.
+ */
+class HeaderReader
+{
+	int            _fd;
+	size_t         _pos;
+	size_t         _len;
+	bool           _bigEndian;
+	unsigned char  _buffer[8192];
+
+public:
+	HeaderReader(int fd) : _fd(fd), _pos(0), _len(0), _bigEndian(false) {}
+
+	// Make n bytes available, false at the end of the file
+	bool ensure(size_t n)
+	{
+		ssize_t bytes;
+
+		if (_len - _pos >= n)
+			return true;
+		if (n > sizeof(_buffer))
+			return false;
+
+		memmove(_buffer, _buffer + _pos, _len - _pos);
+		_len -= _pos;
+		_pos = 0;
+		while (_len < n)
+		{
+			bytes = read(_fd, _buffer + _len, sizeof(_buffer) - _len);
+			if (bytes <= 0)
+				return false;
+			_len += bytes;
+		}
+		return true;
+	}
+
+	void skip(size_t n)
+	{
+		if (n <= _len - _pos)
+			_pos += n;
+		else
+		{
+			lseek(_fd, (off_t)(n - (_len - _pos)), SEEK_CUR);
+			_pos = _len = 0;
+		}
+	}
+
+	const unsigned char* data() const { return _buffer + _pos; }
+	size_t available() const { return _len - _pos; }
+	void setBigEndian(bool bigEndian) { _bigEndian = bigEndian; }
+
+	unsigned int u16(size_t offset) const
+	{
+		const unsigned char* p = _buffer + _pos + offset;
+
+		return _bigEndian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+	}
+
+	unsigned int u32(size_t offset) const
+	{
+		const unsigned char* p = _buffer + _pos + offset;
+
+		return _bigEndian ? ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+						  : ((unsigned int)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+	}
+};
+
+/*
+ * Guess the format of a file without a Part 10 preamble from its first
+ * element. The same assumptions as ever: the first values are short, and
+ * if the first length is zero the data set starts at group 8.
+ */
+static FORMAT_ENUM GuessStreamFormat(const unsigned char* A_data, size_t A_length)
+{
+	bool groupHighByte8;
+
+	if (A_length < 8)
+		return UNKNOWN_FORMAT;
+	groupHighByte8 = A_data[1] == 8;
+
+	switch (DicomVRKind((const char*)A_data + 4))
+	{
+		case DICOM_VR_LONG_LENGTH:
+			if (A_data[6] != '\0' || A_data[7] != '\0' || A_length < 12)
+				return UNKNOWN_FORMAT;
+			if (A_data[8] || A_data[9] || A_data[10] || A_data[11])
+				return A_data[8] == '\0' && A_data[9] == '\0' ? EXPLICIT_BIG_ENDIAN_FORMAT : EXPLICIT_LITTLE_ENDIAN_FORMAT;
+			return groupHighByte8 ? EXPLICIT_BIG_ENDIAN_FORMAT : EXPLICIT_LITTLE_ENDIAN_FORMAT;
+
+		case DICOM_VR_SHORT_LENGTH:
+			if ((A_data[6] || A_data[7]) && A_data[6] == '\0')
+				return EXPLICIT_BIG_ENDIAN_FORMAT;
+			return groupHighByte8 ? EXPLICIT_BIG_ENDIAN_FORMAT : EXPLICIT_LITTLE_ENDIAN_FORMAT;
+
+		default:
+			if (A_data[4] || A_data[5] || A_data[6] || A_data[7])
+				return A_data[4] == '\0' && A_data[5] == '\0' ? IMPLICIT_BIG_ENDIAN_FORMAT : IMPLICIT_LITTLE_ENDIAN_FORMAT;
+			return groupHighByte8 ? IMPLICIT_BIG_ENDIAN_FORMAT : IMPLICIT_LITTLE_ENDIAN_FORMAT;
+	}
+}
+
+/*
+ * Transfer syntaxes whose data set is not explicit VR little endian, and
+ * the common compressed ones, which only encapsulate the pixel data
+ */
+static TRANSFER_SYNTAX SyntaxOfUID(const char* A_uid, bool* A_explicit, bool* A_bigEndian, bool* A_deflated)
+{
+	static const struct
+	{
+		const char*     uid;
+		TRANSFER_SYNTAX syntax;
+	} syntaxes[] =
+	{
+		{ "1.2.840.10008.1.2",        IMPLICIT_LITTLE_ENDIAN },
+		{ "1.2.840.10008.1.2.1",      EXPLICIT_LITTLE_ENDIAN },
+		{ "1.2.840.10008.1.2.2",      EXPLICIT_BIG_ENDIAN },
+		{ "1.2.840.10008.1.2.1.99",   DEFLATED_EXPLICIT_LITTLE_ENDIAN },
+		{ "1.2.840.10008.1.2.5",      RLE },
+		{ "1.2.840.10008.1.2.4.50",   JPEG_BASELINE },
+		{ "1.2.840.10008.1.2.4.51",   JPEG_EXTENDED_2_4 },
+		{ "1.2.840.10008.1.2.4.57",   JPEG_LOSSLESS_NON_HIER_14 },
+		{ "1.2.840.10008.1.2.4.70",   JPEG_LOSSLESS_HIER_14 },
+		{ "1.2.840.10008.1.2.4.80",   JPEG_LS_LOSSLESS },
+		{ "1.2.840.10008.1.2.4.81",   JPEG_LS_LOSSY },
+		{ "1.2.840.10008.1.2.4.90",   JPEG_2000_LOSSLESS_ONLY },
+		{ "1.2.840.10008.1.2.4.91",   JPEG_2000 },
+		{ "1.2.840.10008.1.2.4.100",  MPEG2_MPML }
+	};
+
+	*A_explicit = true;
+	*A_bigEndian = false;
+	*A_deflated = false;
+
+	for (unsigned int i = 0; i < sizeof(syntaxes) / sizeof(syntaxes[0]); i++)
+	{
+		if (strcmp(A_uid, syntaxes[i].uid))
+			continue;
+
+		*A_explicit = syntaxes[i].syntax != IMPLICIT_LITTLE_ENDIAN;
+		*A_bigEndian = syntaxes[i].syntax == EXPLICIT_BIG_ENDIAN;
+		*A_deflated = syntaxes[i].syntax == DEFLATED_EXPLICIT_LITTLE_ENDIAN;
+		return syntaxes[i].syntax;
+	}
+
+	return INVALID_TRANSFER_SYNTAX;
+}
+
+/*
+ * Copy a UI value, dropping the padding
+ */
+static void CopyUID(char* A_target, const unsigned char* A_value, unsigned int A_length)
+{
+	memcpy(A_target, A_value, A_length);
+	while (A_length > 0 && (A_target[A_length-1] == '\0' || A_target[A_length-1] == ' '))
+		A_length--;
+	A_target[A_length] = '\0';
+}
+
+/****************************************************************************
+ *
+ *  Function    :   ScanElements
+ *
+ *  Parameters  :   A_reader   - positioned at the first element
+ *                  A_explicit - explicit VR encoding
+ *                  A_metaOnly - stop at the end of group 0002
+ *                  A_syntaxUID - Transfer Syntax UID of the meta header,
+ *                               may be NULL
+ *                  A_info     - UIDs found are filled in
+ *
+ *  Returns     :   true if the scan ended at a tag past the last one wanted
+ *                  false at the end of the file or on a malformed element
+ *
+ *  Description :   Walks the elements, skipping values. Undefined length
+ *                  sequences are walked into, defined length ones skipped;
+ *                  only top level elements are recorded.
+ *
+ ****************************************************************************/
+static bool ScanElements(HeaderReader& A_reader, bool A_explicit, bool A_metaOnly, char* A_syntaxUID, DicomHeaderInfo* A_info)
+{
+	unsigned int  group, element, tag, length, header;
+	int           depth = 0;
+	char*         target;
+
+	while (A_reader.ensure(8))
+	{
+		group = A_reader.u16(0);
+		element = A_reader.u16(2);
+		tag = (group << 16) | element;
+
+		if (A_metaOnly && group != 0x0002)
+			return true;
+
+		if (group == 0xFFFE)
+		{
+			// Item and delimiters have no VR in any syntax
+			length = A_reader.u32(4);
+			A_reader.skip(8);
+			if (element == 0xE000 && length != UndefinedLength)
+				A_reader.skip(length);
+			else if (element == 0xE0DD && depth > 0)
+				depth--;
+			continue;
+		}
+
+		if (tag == PixelDataTag || (depth == 0 && tag > LastScannedTag))
+			return true;
+
+		if (A_explicit)
+		{
+			switch (DicomVRKind((const char*)A_reader.data() + 4))
+			{
+				case DICOM_VR_SHORT_LENGTH:
+					length = A_reader.u16(6);
+					header = 8;
+					break;
+				case DICOM_VR_LONG_LENGTH:
+					if (!A_reader.ensure(12))
+						return false;
+					length = A_reader.u32(8);
+					header = 12;
+					break;
+				default:
+					return false;
+			}
+		}
+		else
+		{
+			length = A_reader.u32(4);
+			header = 8;
+		}
+		A_reader.skip(header);
+
+		if (length == UndefinedLength)
+		{
+			depth++;
+			continue;
+		}
+
+		target = NULL;
+		if (depth == 0)
+		{
+			switch (tag)
+			{
+				case 0x00020002: target = A_info->SOPClassUID;       break;
+				case 0x00020003: target = A_info->SOPInstanceUID;    break;
+				case 0x00020010: target = A_syntaxUID;               break;
+				case 0x00080016: target = A_info->SOPClassUID;       break;
+				case 0x00080018: target = A_info->SOPInstanceUID;    break;
+				case 0x0020000D: target = A_info->StudyInstanceUID;  break;
+				case 0x0020000E: target = A_info->SeriesInstanceUID; break;
+			}
+		}
+
+		if (target && length <= UI_LENGTH && A_reader.ensure(length))
+		{
+			CopyUID(target, A_reader.data(), length);
+			A_reader.skip(length);
+		}
+		else
+			A_reader.skip(length);
+	}
+
+	return false;
+}
+
+static bool Scan(const char* A_filename, DicomHeaderInfo* A_info, bool A_formatOnly)
+{
+	char          syntaxUID[UI_LENGTH+2] = "";
+	bool          isExplicit, bigEndian, deflated;
+	bool          result = false;
+	int           fd;
+
+	memset(A_info, 0, sizeof(*A_info));
+	A_info->format = UNKNOWN_FORMAT;
+	A_info->transferSyntax = INVALID_TRANSFER_SYNTAX;
+
+	fd = open(A_filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	HeaderReader  reader(fd);
+
+	if (reader.ensure(132) && !memcmp(reader.data() + 128, "DICM", 4))
+	{
+		A_info->format = MEDIA_FORMAT;
+		result = true;
+		if (!A_formatOnly)
+		{
+			// The meta header is always explicit VR little endian
+			reader.skip(132);
+			ScanElements(reader, true, true, syntaxUID, A_info);
+			A_info->transferSyntax = SyntaxOfUID(syntaxUID, &isExplicit, &bigEndian, &deflated);
+
+			if (!deflated)
+			{
+				reader.setBigEndian(bigEndian);
+				A_info->complete = ScanElements(reader, isExplicit, false, NULL, A_info);
+			}
+		}
+	}
+	else
+	{
+		reader.ensure(12);
+		A_info->format = GuessStreamFormat(reader.data(), reader.available());
+		result = A_info->format != UNKNOWN_FORMAT;
+		if (result && !A_formatOnly)
+		{
+			switch (A_info->format)
+			{
+				case IMPLICIT_LITTLE_ENDIAN_FORMAT: A_info->transferSyntax = IMPLICIT_LITTLE_ENDIAN; break;
+				case IMPLICIT_BIG_ENDIAN_FORMAT:    A_info->transferSyntax = IMPLICIT_BIG_ENDIAN;    break;
+				case EXPLICIT_LITTLE_ENDIAN_FORMAT: A_info->transferSyntax = EXPLICIT_LITTLE_ENDIAN; break;
+				default:                            A_info->transferSyntax = EXPLICIT_BIG_ENDIAN;    break;
+			}
+			reader.setBigEndian(A_info->format == IMPLICIT_BIG_ENDIAN_FORMAT || A_info->format == EXPLICIT_BIG_ENDIAN_FORMAT);
+			A_info->complete = ScanElements(reader,
+											A_info->format == EXPLICIT_LITTLE_ENDIAN_FORMAT || A_info->format == EXPLICIT_BIG_ENDIAN_FORMAT,
+											false, NULL, A_info);
+		}
+	}
+
+	close(fd);
+	return result;
+}
+
+FORMAT_ENUM ScanDicomFormat(const char* A_filename)
+{
+	DicomHeaderInfo info;
+
+	Scan(A_filename, &info, true);
+	return info.format;
+}
+
+bool ScanDicomHeader(const char* A_filename, DicomHeaderInfo* A_info)
+{
+	return Scan(A_filename, A_info, false);
+}
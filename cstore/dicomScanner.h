@@ -0,0 +1,70 @@
+#ifndef _DICOMSCANNER_H_
+#define _DICOMSCANNER_H_
+
+/*
+ * file:	dicomScanner.h
+ * purpose:	Reads the start of a DICOM file without the toolkit: the Part 10
+ *          meta header if there is one and the data set elements up to the
+ *          Series Instance UID, never the pixel data. Values that are not
+ *          needed are skipped with a seek, so a scan costs one or two small
+ *          reads. Used to tell the format of a file and learn its UIDs
+ *          before it is opened with MC_Open_File or sent.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include "mergecom.h"
+
+#ifndef UI_LENGTH
+#define UI_LENGTH 64
+#endif
+
+/*
+ * Used to identify the format of an object
+ */
+typedef enum
+{
+    UNKNOWN_FORMAT = 0,
+    MEDIA_FORMAT = 1,
+    IMPLICIT_LITTLE_ENDIAN_FORMAT,
+    IMPLICIT_BIG_ENDIAN_FORMAT,
+    EXPLICIT_LITTLE_ENDIAN_FORMAT,
+    EXPLICIT_BIG_ENDIAN_FORMAT
+} FORMAT_ENUM;
+
+/*
+ * How a VR is encoded in an explicit VR data set
+ */
+typedef enum
+{
+    DICOM_VR_UNKNOWN = 0,       /* not a VR, the data set is implicit VR */
+    DICOM_VR_SHORT_LENGTH,      /* followed by a 16 bit length */
+    DICOM_VR_LONG_LENGTH        /* followed by 2 reserved bytes and a 32 bit length */
+} DICOM_VR_KIND;
+
+/*
+ * What a scan found out. Strings are empty if the element was not found.
+ */
+typedef struct dicom_header_info
+{
+    FORMAT_ENUM     format;
+    TRANSFER_SYNTAX transferSyntax;     /* of the data set, INVALID_TRANSFER_SYNTAX if not known */
+    bool            complete;           /* the scan got past the Series Instance UID */
+    char            SOPClassUID[UI_LENGTH+2];
+    char            SOPInstanceUID[UI_LENGTH+2];
+    char            StudyInstanceUID[UI_LENGTH+2];
+    char            SeriesInstanceUID[UI_LENGTH+2];
+} DicomHeaderInfo;
+
+// Look the two characters up in a table indexed by them, not by comparing
+DICOM_VR_KIND DicomVRKind(const char* A_VR);
+
+// Format of the file only, from the first read of it
+FORMAT_ENUM ScanDicomFormat(const char* A_filename);
+
+// Format, transfer syntax and UIDs. Returns false if the file cannot be
+// read or is not DICOM; info is filled as far as the scan got.
+bool ScanDicomHeader(const char* A_filename, DicomHeaderInfo* A_info);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * file:	diskOrder.cc
+ * purpose:	Ordering of export files by disk location
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <vector>
+#include <algorithm>
+#ifdef linux
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+#include "diskOrder.h"
+#include "cstoreutils.h"
+
+/*
+ * Where one file is, and where the caller put it
+ */
+typedef struct file_location
+{
+    string             fname;
+    bool               located;     /* false if the file cannot be stat'ed */
+    dev_t              device;
+    bool               byExtent;    /* false if physical is the inode number */
+    unsigned long long physical;
+    int                run;         /* run of files of the same directory */
+    int                position;    /* in the order of the caller */
+} FileLocation;
+
+/*
+ * Sort key. The run comes first only when the series order is kept.
+ */
+class LocationOrder
+{
+	bool _keepRuns;
+
+public:
+	LocationOrder(bool keepRuns) : _keepRuns (keepRuns) {}
+
+	bool operator()(const FileLocation& a, const FileLocation& b) const
+	{
+		if (_keepRuns && a.run != b.run)
+			return a.run < b.run;
+		if (a.located != b.located)
+			return a.located;     // missing files last, ReadImage reports them
+		if (a.device != b.device)
+			return a.device < b.device;
+		if (a.byExtent != b.byExtent)
+			return a.byExtent;
+		if (a.physical != b.physical)
+			return a.physical < b.physical;
+		return a.position < b.position;
+	}
+};
+
+/****************************************************************************
+ *
+ *  Function    :   FirstExtent
+ *
+ *  Parameters  :   A_filename - file to map
+ *                  A_physical - returns the byte offset on the device
+ *
+ *  Returns     :   true
+ *                  false if the file system cannot map the file
+ *
+ *  Description :   Ask the file system for the first extent of the file.
+ *                  Delayed allocation, inline data and network file systems
+ *                  give no usable offset.
+ *
+ ****************************************************************************/
+static bool FirstExtent(const char* A_filename, unsigned long long* A_physical)
+{
+#ifdef linux
+    unsigned long long buffer[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(unsigned long long) + 1];
+    struct fiemap*     map = (struct fiemap*)buffer;
+    bool               mapped;
+    int                fd;
+
+    fd = open(A_filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    memset(buffer, 0, sizeof(buffer));
+    map->fm_start = 0;
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+
+    mapped = ioctl(fd, FS_IOC_FIEMAP, map) == 0
+          && map->fm_mapped_extents > 0
+          && !(map->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE));
+    close(fd);
+
+    if (mapped)
+        *A_physical = map->fm_extents[0].fe_physical;
+    return mapped;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Head travel between consecutive mapped files of one device, in megabytes
+ */
+static double HeadTravel(const vector<FileLocation>& files)
+{
+	const FileLocation* previous = NULL;
+	double              travel = 0.0;
+
+	for (vector<FileLocation>::const_iterator iter=files.begin(); iter != files.end(); ++iter)
+	{
+		if (!iter->located || !iter->byExtent)
+			continue;
+
+		if (previous && previous->device == iter->device)
+			travel += iter->physical > previous->physical ? iter->physical - previous->physical
+														  : previous->physical - iter->physical;
+		previous = &*iter;
+	}
+
+	return travel / (1024.0 * 1024.0);
+}
+
+/****************************************************************************
+ *
+ *  Function    :   OrderFilesByDiskLocation
+ *
+ *  Parameters  :   filelist - the files of the export, reordered in place
+ *                  mode     - DISK_ORDER_ENUM
+ *
+ *  Returns     :   nothing
+ *
+ *  Description :   Stat and map every file, then sort the list by device
+ *                  and physical location. The result of each file is
+ *                  reported by its name, so the caller sees no difference
+ *                  other than the order.
+ *
+ ****************************************************************************/
+void OrderFilesByDiskLocation(list<string>& filelist, int mode)
+{
+	vector<FileLocation> files;
+	FileLocation         location;
+	struct stat          fileStat;
+	struct timeval       start, end;
+	string               directory, previousDirectory;
+	string::size_type    slash;
+	int                  numByExtent = 0, numByInode = 0, run = 0;
+	double               travelBefore;
+
+	if (mode != DISK_ORDER_WITHIN_SERIES && mode != DISK_ORDER_ALL)
+		return;
+
+	gettimeofday(&start, NULL);
+	files.reserve(filelist.size());
+
+	for (list<string>::const_iterator iter=filelist.begin(); iter != filelist.end(); ++iter)
+	{
+		slash = iter->rfind('/');
+		directory = slash == string::npos ? string() : iter->substr(0, slash);
+		if (iter != filelist.begin() && directory != previousDirectory)
+			run++;
+		previousDirectory = directory;
+
+		location.fname = *iter;
+		location.run = run;
+		location.position = (int)files.size();
+		location.located = stat(iter->c_str(), &fileStat) == 0;
+		location.device = location.located ? fileStat.st_dev : 0;
+		location.byExtent = location.located && FirstExtent(iter->c_str(), &location.physical);
+		if (location.byExtent)
+			numByExtent++;
+		else if (location.located)
+		{
+			location.physical = (unsigned long long)fileStat.st_ino;
+			numByInode++;
+		}
+		else
+			location.physical = 0;
+
+		files.push_back(location);
+	}
+
+	travelBefore = HeadTravel(files);
+	std::sort(files.begin(), files.end(), LocationOrder(mode == DISK_ORDER_WITHIN_SERIES));
+
+	filelist.clear();
+	for (vector<FileLocation>::const_iterator iter=files.begin(); iter != files.end(); ++iter)
+		filelist.push_back(iter->fname);
+
+	gettimeofday(&end, NULL);
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "Ordered %d file(s) by disk location%s: %d by extent, %d by inode, estimated head travel %.1fMB instead of %.1fMB, took %.1fms",
+			  (int)files.size(), mode == DISK_ORDER_WITHIN_SERIES ? " within each series" : "",
+			  numByExtent, numByInode, HeadTravel(files), travelBefore,
+			  (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0);
+}
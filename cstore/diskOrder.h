@@ -0,0 +1,37 @@
+#ifndef _DISKORDER_H_
+#define _DISKORDER_H_
+
+/*
+ * file:	diskOrder.h
+ * purpose:	Optional pre-pass that orders the files of an export by where
+ *          they are on disk, so that a spinning disk reads them with
+ *          short seeks instead of in the order the caller listed them.
+ *          The key is the device and the physical offset of the first
+ *          extent (FIEMAP), or the inode number where the file system
+ *          cannot map extents. Set by ExportDiskOrder in cstoredefaults.txt:
+ *
+ *              0  as listed by the caller
+ *              1  by disk location within each run of files of the same
+ *                 directory, so the series are still sent in the order
+ *                 of the caller
+ *              2  by disk location over the whole export
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <list>
+#include <string>
+
+using namespace std;
+
+typedef enum
+{
+    DISK_ORDER_NONE = 0,
+    DISK_ORDER_WITHIN_SERIES = 1,
+    DISK_ORDER_ALL = 2
+} DISK_ORDER_ENUM;
+
+void OrderFilesByDiskLocation(list<string>& filelist, int mode);
+
+#endif
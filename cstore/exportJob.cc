@@ -0,0 +1,470 @@
+/*
+ * file:	exportJob.cc
+ * purpose:	Implementation of the ExportJob and ExportJobManager classes
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <stdio.h>
+
+#include "exportJob.h"
+#include "exportScheduler.h"
+#include "cstoremanager.h"
+
+extern int CommitPipelineChunk;
+
+static const int NumJobRunners = 2;            /* exports running at the same time, plus one for STAT */
+static const int FinishedJobLifetime = 3600;   /* seconds a finished job can be polled */
+
+ExportJobManager* ExportJobManager::_instance = NULL;  /* handle of singleton object */
+
+const char* JobStateName(JOB_STATE state)
+{
+	switch (state)
+	{
+		case JOB_QUEUED:    return "QUEUED";
+		case JOB_RUNNING:   return "RUNNING";
+		case JOB_COMPLETED: return "COMPLETED";
+		case JOB_FAILED:    return "FAILED";
+		case JOB_CANCELLED: return "CANCELLED";
+	}
+	return "UNKNOWN";
+}
+
+/*
+ * ExportJob class.
+ */
+
+ExportJob::ExportJob(unsigned long jobID, JOB_TYPE type, EXPORT_PRIORITY priority)
+			: _jobID (jobID),
+			  _type (type),
+			  _priority (priority),
+			  _state (JOB_QUEUED),
+			  _result (NULL),
+			  _submitted (time(NULL)),
+			  _started (0),
+			  _finished (0)
+{
+}
+
+ExportJob::~ExportJob()
+{
+	delete _result;
+}
+
+ExportJob::ExportJob(const ExportJob&)
+{
+}
+
+ExportJob& ExportJob::operator=(const ExportJob&)
+{
+	return *this;
+}
+
+/*
+ * The caller must hold the lock of ExportJobManager
+ */
+bool ExportJob::isFinished()
+{
+	return _state == JOB_COMPLETED || _state == JOB_FAILED || _state == JOB_CANCELLED;
+}
+
+/*
+ * The caller must hold the lock of ExportJobManager
+ */
+void ExportJob::getStatus(ExportJobStatus& status)
+{
+	status.jobID = _jobID;
+	status.type = _type;
+	status.priority = _priority;
+	status.state = _state;
+	status.submitted = _submitted;
+	status.started = _started;
+	status.finished = _finished;
+	_progress.getCounts(status.totalFiles, status.filesProcessed, status.filesFailed);
+}
+
+/*
+ * ExportJobManager class.
+ */
+
+ExportJobManager* ExportJobManager::instance()
+{
+	if (!_instance)
+		_instance = new ExportJobManager();
+
+	return _instance;
+}
+
+ExportJobManager::ExportJobManager()
+			: _nextJobID (1),
+			  _numRunners (0),
+			  _statRunner (false)
+{
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_jobQueued, NULL);
+}
+
+ExportJobManager::~ExportJobManager()
+{
+	for(map<unsigned long, ExportJob*>::iterator iter=_jobs.begin(); iter != _jobs.end(); ++iter)
+		delete iter->second;
+
+	pthread_cond_destroy(&_jobQueued);
+	pthread_mutex_destroy(&_lock);
+}
+
+ExportJobManager::ExportJobManager(const ExportJobManager&)
+{
+}
+
+ExportJobManager& ExportJobManager::operator=(const ExportJobManager&)
+{
+	return *this;
+}
+
+/*
+ * The caller must hold _lock
+ */
+void ExportJobManager::startRunners()
+{
+	pthread_t      tid;
+	pthread_attr_t attr;
+
+	pthread_attr_init(&attr); // Initialize with the default value
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while (_numRunners < NumJobRunners)
+	{
+		if( pthread_create(&tid, &attr, ExportJobManager::jobRunner, (void*)this) != 0)
+		{
+			::Message( MALARM, toEndUser | toService | MLoverall,
+					   "Cstore failed to create a thread to run export jobs");
+			break;
+		}
+		_numRunners++;
+	}
+	if (!_statRunner)
+	{
+		if( pthread_create(&tid, &attr, ExportJobManager::statJobRunner, (void*)this) != 0)
+			::Message( MALARM, toEndUser | toService | MLoverall,
+					   "Cstore failed to create a thread to run STAT export jobs");
+		else
+			_statRunner = true;
+	}
+	pthread_attr_destroy(&attr);
+}
+
+/*
+ * The caller must hold _lock
+ */
+void ExportJobManager::purgeFinishedJobs()
+{
+	time_t now = time(NULL);
+	map<unsigned long, ExportJob*>::iterator iter = _jobs.begin();
+
+	while (iter != _jobs.end())
+	{
+		if (iter->second->isFinished() && now - iter->second->_finished > FinishedJobLifetime)
+		{
+			delete iter->second;
+			_jobs.erase(iter++);
+		}
+		else
+			++iter;
+	}
+}
+
+unsigned long ExportJobManager::submit(JOB_TYPE type,
+						EXPORT_PRIORITY priority,
+						const list<string>& filelist,
+						const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+						const list<DICOMStoragePkg::CommitTarget>& committargetlist)
+{
+	ExportJob*    job;
+	unsigned long jobID;
+
+	pthread_mutex_lock(&_lock);
+
+	purgeFinishedJobs();
+	startRunners();
+
+	jobID = _nextJobID++;
+	job = new ExportJob(jobID, type, priority);
+	job->_fileList = filelist;
+	job->_storageTargets = storagetargetlist;
+	job->_commitTargets = committargetlist;
+
+	_jobs[jobID] = job;
+	_queue[priority].push_back(job);
+	pthread_cond_broadcast(&_jobQueued);
+
+	pthread_mutex_unlock(&_lock);
+
+	::Message(MNOTE, toEndUser | toService | MLoverall, "%s export job %lu is queued with %d file(s) for %d storage target(s)",
+			  PriorityName(priority), jobID, (int)filelist.size(), (int)storagetargetlist.size());
+
+	return jobID;
+}
+
+bool ExportJobManager::getStatus(unsigned long jobID, ExportJobStatus& status)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&_lock);
+	map<unsigned long, ExportJob*>::iterator iter = _jobs.find(jobID);
+	if (iter != _jobs.end())
+	{
+		iter->second->getStatus(status);
+		found = true;
+	}
+	pthread_mutex_unlock(&_lock);
+
+	return found;
+}
+
+/*
+ * A queued job is dropped right away. A running job stops sending at the
+ * next file boundary; files that were already sent stay stored.
+ */
+bool ExportJobManager::cancel(unsigned long jobID)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&_lock);
+	map<unsigned long, ExportJob*>::iterator iter = _jobs.find(jobID);
+	if (iter != _jobs.end() && !iter->second->isFinished())
+	{
+		ExportJob* job = iter->second;
+
+		job->_progress.cancel();
+		if (job->_state == JOB_QUEUED)
+		{
+			_queue[job->_priority].remove(job);
+			job->_state = JOB_CANCELLED;
+			job->_finished = time(NULL);
+		}
+		found = true;
+	}
+	pthread_mutex_unlock(&_lock);
+
+	if (found)
+		::Message(MNOTE, toEndUser | toService | MLoverall, "Export job %lu is cancelled", jobID);
+
+	return found;
+}
+
+/*
+ * The job is added already finished, and is purged like any other.
+ */
+unsigned long ExportJobManager::keepResult(JOB_TYPE type,
+						EXPORT_PRIORITY priority,
+						const DICOMStoragePkg::ResultByStorageTargetList& result,
+						bool stored)
+{
+	ExportJob*          job;
+	unsigned long       jobID;
+	ExportResultSummary summary;
+	CompactResult*      compact = new CompactResult(result);
+
+	compact->getCounts(summary);
+
+	pthread_mutex_lock(&_lock);
+
+	purgeFinishedJobs();
+
+	jobID = _nextJobID++;
+	job = new ExportJob(jobID, type, priority);
+	job->_result = compact;
+	job->_progress.addFiles(summary.numFiles);
+	for (int i=0; i<summary.numFiles; i++)
+		job->_progress.fileProcessed(i < summary.stored);
+	job->_state = stored ? JOB_COMPLETED : JOB_FAILED;
+	job->_started = job->_finished = time(NULL);
+	_jobs[jobID] = job;
+
+	pthread_mutex_unlock(&_lock);
+
+	return jobID;
+}
+
+DICOMStoragePkg::ResultByStorageTargetList* ExportJobManager::getResult(unsigned long jobID)
+{
+	DICOMStoragePkg::ResultByStorageTargetList* result = NULL;
+
+	pthread_mutex_lock(&_lock);
+	map<unsigned long, ExportJob*>::iterator iter = _jobs.find(jobID);
+	if (iter != _jobs.end() && iter->second->isFinished() && iter->second->_result != NULL)
+		result = iter->second->_result->expand();
+	pthread_mutex_unlock(&_lock);
+
+	return result;
+}
+
+DICOMStoragePkg::ResultByStorageTargetList* ExportJobManager::getSummary(unsigned long jobID, ExportResultSummary& summary)
+{
+	DICOMStoragePkg::ResultByStorageTargetList* result = NULL;
+
+	pthread_mutex_lock(&_lock);
+	map<unsigned long, ExportJob*>::iterator iter = _jobs.find(jobID);
+	if (iter != _jobs.end() && iter->second->isFinished() && iter->second->_result != NULL)
+	{
+		result = iter->second->_result->summarize(summary);
+		summary.jobID = jobID;
+	}
+	pthread_mutex_unlock(&_lock);
+
+	return result;
+}
+
+void ExportJobManager::report()
+{
+	ExportJobStatus status;
+
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall, "%d export job(s), %d STAT, %d ROUTINE and %d BULK queued:", (int)_jobs.size(),
+			  (int)_queue[PRIORITY_STAT].size(), (int)_queue[PRIORITY_ROUTINE].size(), (int)_queue[PRIORITY_BULK].size());
+	for(map<unsigned long, ExportJob*>::iterator iter=_jobs.begin(); iter != _jobs.end(); ++iter)
+	{
+		iter->second->getStatus(status);
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				"  job %lu %-16s %-7s %-9s processed=%d/%d failed=%d",
+				status.jobID, status.type == JOB_STORE ? "store" : "store-and-commit",
+				PriorityName(status.priority), JobStateName(status.state), status.filesProcessed, status.totalFiles, status.filesFailed);
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+/*
+ * Block until a job is queued, then mark the most urgent one running and
+ * return it
+ */
+ExportJob* ExportJobManager::nextJob(bool statOnly)
+{
+	ExportJob* job = NULL;
+	int        numClasses = statOnly ? PRIORITY_STAT+1 : NUM_EXPORT_PRIORITIES;
+
+	pthread_mutex_lock(&_lock);
+	while (!job)
+	{
+		for (int i=0; !job && i<numClasses; i++)
+			if (!_queue[i].empty())
+			{
+				job = _queue[i].front();
+				_queue[i].pop_front();
+			}
+
+		if (!job)
+			pthread_cond_wait(&_jobQueued, &_lock);
+	}
+
+	job->_state = JOB_RUNNING;
+	job->_started = time(NULL);
+	pthread_mutex_unlock(&_lock);
+
+	return job;
+}
+
+/****************************************************************************
+ *
+ *  Function    :   runJob
+ *
+ *  Parameters  :   job - the job taken off the queue
+ *
+ *  Returns     :   none
+ *
+ *  Description :   Store the files of the job, and for a store-and-commit
+ *                  job start the storage commitment if every file was
+ *                  stored. Commit results are reported to the camera as
+ *                  with a synchronous storeAndCommit.
+ *
+ ****************************************************************************/
+void ExportJobManager::runJob(ExportJob* job)
+{
+	CstoreManager* manager = CstoreManager::instance();
+	DICOMStoragePkg::ResultByStorageTargetList_var result;
+	CompactResult* compact = NULL;
+	JOB_STATE state = JOB_FAILED;
+	CommitPipeline* pipeline = NULL;
+
+	::Message(MNOTE, toEndUser | toService | MLoverall, "Export job %lu is started", job->_jobID);
+
+	// Commit the files chunk by chunk as they are stored
+	if (job->_type == JOB_STORE_AND_COMMIT && CommitPipelineChunk > 0 && job->_commitTargets.size())
+		pipeline = new CommitPipeline(job->_storageTargets, job->_commitTargets, CommitPipelineChunk);
+
+	try
+	{
+		result = manager->executeStore(job->_fileList, job->_storageTargets, &job->_progress, job->_priority, pipeline);
+		compact = new CompactResult(result.in());
+
+		if (job->_progress.isCancelled())
+			state = JOB_CANCELLED;
+		else if (manager->auditStorageResult(result.in()))
+		{
+			if (pipeline)
+				pipeline->commitRest(result.in());
+			else if (job->_type == JOB_STORE_AND_COMMIT)
+				manager->commit(new SharedResult(result._retn()), job->_commitTargets, NULL, &job->_storageTargets);
+			state = JOB_COMPLETED;
+		}
+	}
+	catch ( DictionaryPkg::NucMedException& )
+	{
+		state = job->_progress.isCancelled() ? JOB_CANCELLED : JOB_FAILED;
+	}
+	catch ( ... )
+	{
+		// The job must not be left running
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				  "Export job %lu caught an unexpected exception", job->_jobID);
+		state = job->_progress.isCancelled() ? JOB_CANCELLED : JOB_FAILED;
+	}
+	delete pipeline;
+
+	pthread_mutex_lock(&_lock);
+	job->_result = compact;
+	job->_state = state;
+	job->_finished = time(NULL);
+	pthread_mutex_unlock(&_lock);
+
+	::Message(state == JOB_COMPLETED ? MNOTE : MWARNING, toEndUser | toService | MLoverall,
+			  "Export job %lu finished: %s", job->_jobID, JobStateName(state));
+}
+
+/****************************************************************************
+ *
+ *  Function    :   jobRunner
+ *
+ *  Parameters  :   thisClass - the ExportJobManager instance
+ *
+ *  Returns     :   NULL
+ *
+ *  Description :   Job runner thread. Takes the most urgent job off the
+ *                  queues, in submission order within a priority class, and
+ *                  runs them one at a time.
+ *
+ ****************************************************************************/
+void* ExportJobManager::jobRunner(void* thisClass)
+{
+	ExportJobManager* jobManager = (ExportJobManager*)thisClass;
+
+	for (;;)
+		jobManager->runJob(jobManager->nextJob(false));
+
+	return NULL;
+}
+
+/*
+ * Runs STAT jobs only, so a STAT job starts even while the other runners
+ * are busy with long exports.
+ */
+void* ExportJobManager::statJobRunner(void* thisClass)
+{
+	ExportJobManager* jobManager = (ExportJobManager*)thisClass;
+
+	for (;;)
+		jobManager->runJob(jobManager->nextJob(true));
+
+	return NULL;
+}
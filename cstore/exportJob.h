@@ -0,0 +1,139 @@
+#ifndef _EXPORTJOB_H_
+#define _EXPORTJOB_H_
+
+/*
+ * file:	exportJob.h
+ * purpose:	ExportJob and the ExportJobManager singleton. A job is an
+ *          export (store, or store and commit) submitted without waiting
+ *          for it. The caller gets a job ID back right away, and polls
+ *          the job for its state and progress, cancels it, or picks up
+ *          its result when it has finished.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <map>
+#include <list>
+#include <string>
+#include "cstoreutils.h"
+#include "exportResult.h"
+
+using namespace std;
+
+typedef enum
+{
+    JOB_QUEUED = 0,         /* waiting for a job runner */
+    JOB_RUNNING = 1,
+    JOB_COMPLETED = 2,      /* all files were stored */
+    JOB_FAILED = 3,         /* at least one file was not stored */
+    JOB_CANCELLED = 4
+} JOB_STATE;
+
+typedef enum
+{
+    JOB_STORE = 0,
+    JOB_STORE_AND_COMMIT = 1
+} JOB_TYPE;
+
+/*
+ * Snapshot of a job returned to the caller
+ */
+typedef struct export_job_status
+{
+    unsigned long jobID;
+    JOB_TYPE      type;
+    EXPORT_PRIORITY priority;
+    JOB_STATE     state;
+    int           totalFiles;       /* files times storage targets */
+    int           filesProcessed;
+    int           filesFailed;
+    time_t        submitted;
+    time_t        started;
+    time_t        finished;
+} ExportJobStatus;
+
+class ExportJob
+{
+	ExportJob(const ExportJob&);
+	ExportJob& operator=(const ExportJob&);
+
+public:
+	unsigned long                            _jobID;
+	JOB_TYPE                                 _type;
+	EXPORT_PRIORITY                          _priority;
+	JOB_STATE                                _state;
+	list<string>                             _fileList;
+	list<DICOMStoragePkg::StorageTarget>     _storageTargets;
+	list<DICOMStoragePkg::CommitTarget>      _commitTargets;
+	ExportProgress                           _progress;
+	CompactResult*                           _result;      /* NULL until the job has finished */
+	time_t                                   _submitted;
+	time_t                                   _started;
+	time_t                                   _finished;
+
+	ExportJob(unsigned long jobID, JOB_TYPE type, EXPORT_PRIORITY priority);
+	~ExportJob();
+
+	bool isFinished();
+	void getStatus(ExportJobStatus& status);
+};
+
+class ExportJobManager
+{
+	static ExportJobManager*         _instance;
+	pthread_mutex_t                  _lock;      /* protects everything below */
+	pthread_cond_t                   _jobQueued;
+	map<unsigned long, ExportJob*>   _jobs;
+	list<ExportJob*>                 _queue[NUM_EXPORT_PRIORITIES];
+	unsigned long                    _nextJobID;
+	int                              _numRunners;
+	bool                             _statRunner;   /* a runner is kept free for STAT jobs */
+
+	ExportJobManager();
+
+	// Disallow copying or assignment.
+	ExportJobManager(const ExportJobManager&);
+	ExportJobManager& operator=(const ExportJobManager&);
+
+	void startRunners();
+	void purgeFinishedJobs();
+	ExportJob* nextJob(bool statOnly);
+	void runJob(ExportJob* job);
+
+public:
+	static ExportJobManager* instance();
+	~ExportJobManager();
+
+	unsigned long submit(JOB_TYPE type,
+						EXPORT_PRIORITY priority,
+						const list<string>& filelist,
+						const list<DICOMStoragePkg::StorageTarget>& storagetargetlist,
+						const list<DICOMStoragePkg::CommitTarget>& committargetlist);
+
+	// Return false if the job ID is unknown or the job has been purged
+	bool getStatus(unsigned long jobID, ExportJobStatus& status);
+	bool cancel(unsigned long jobID);
+
+	// Keep the result of an export that ran synchronously as a finished job,
+	// so its full result can be fetched later. Returns the job ID.
+	unsigned long keepResult(JOB_TYPE type,
+						EXPORT_PRIORITY priority,
+						const DICOMStoragePkg::ResultByStorageTargetList& result,
+						bool stored);
+
+	// Return a copy of the storage result of a finished job, NULL otherwise
+	DICOMStoragePkg::ResultByStorageTargetList* getResult(unsigned long jobID);
+	// Same with only the files that were not stored, see CompactResult
+	DICOMStoragePkg::ResultByStorageTargetList* getSummary(unsigned long jobID, ExportResultSummary& summary);
+
+	// Write all known jobs to the log
+	void report();
+
+	static void* jobRunner(void* thisClass);
+	static void* statJobRunner(void* thisClass);
+};
+
+const char* JobStateName(JOB_STATE state);
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * file:	exportResult.cc
+ * purpose:	Implementation of the CompactResult class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include "exportResult.h"
+
+CompactResult::CompactResult(const DICOMStoragePkg::ResultByStorageTargetList& result)
+{
+	Outcome outcome;
+
+	_targets.resize(result.length());
+	for (int i=0; i<(int)result.length(); i++)
+	{
+		TargetEntry& target = _targets[i];
+
+		target.hostName = result[i].storageHostName.in() ? result[i].storageHostName.in() : "";
+		target.commitRequired = result[i].storageCommitRequired;
+		target.transactionUID = result[i].transactionUID.in() ? result[i].transactionUID.in() : "";
+		target.outcomes.reserve(result[i].resultByFiles.length());
+
+		for (int j=0; j<(int)result[i].resultByFiles.length(); j++)
+		{
+			outcome.file = addFile(result[i].resultByFiles[j]);
+			outcome.storageOutcome = result[i].resultByFiles[j].storageOutcome;
+			outcome.commitOutcome = result[i].resultByFiles[j].commitOutcome;
+			target.outcomes.push_back(outcome);
+		}
+	}
+}
+
+CompactResult::~CompactResult()
+{
+}
+
+CompactResult::CompactResult(const CompactResult&)
+{
+}
+
+CompactResult& CompactResult::operator=(const CompactResult&)
+{
+	return *this;
+}
+
+const char* CompactResult::intern(const char* str)
+{
+	return _strings.insert(str ? str : "").first->c_str();
+}
+
+/*
+ * Return the index of the file, adding it the first time it is seen. A file
+ * whose UIDs were not read by the first target picks them up from a later one.
+ */
+int CompactResult::addFile(const DICOMStoragePkg::ResultByFile& resultByFile)
+{
+	const char* path = resultByFile.imgFile.in() ? resultByFile.imgFile.in() : "";
+	map<string, int>::iterator iter = _fileIndex.find(path);
+	FileEntry  entry;
+
+	if (iter != _fileIndex.end())
+	{
+		FileEntry& known = _files[iter->second];
+
+		if (!known.SOPInstanceUID[0] && resultByFile.SOPInstanceUID.in() && resultByFile.SOPInstanceUID.in()[0])
+		{
+			known.SOPClassUID = intern(resultByFile.SOPClassUID.in());
+			known.SOPInstanceUID = intern(resultByFile.SOPInstanceUID.in());
+		}
+		return iter->second;
+	}
+
+	entry.path = path;
+	entry.SOPClassUID = intern(resultByFile.SOPClassUID.in());
+	entry.SOPInstanceUID = intern(resultByFile.SOPInstanceUID.in());
+	_files.push_back(entry);
+	_fileIndex[path] = (int)_files.size() - 1;
+
+	return (int)_files.size() - 1;
+}
+
+void CompactResult::fillResultByFile(const Outcome& outcome, DICOMStoragePkg::ResultByFile& resultByFile) const
+{
+	const FileEntry& file = _files[outcome.file];
+
+	resultByFile.imgFile = CORBA::string_dup(file.path.c_str());
+	resultByFile.SOPClassUID = CORBA::string_dup(file.SOPClassUID);
+	resultByFile.SOPInstanceUID = CORBA::string_dup(file.SOPInstanceUID);
+	resultByFile.storageOutcome = outcome.storageOutcome;
+	resultByFile.commitOutcome = outcome.commitOutcome;
+}
+
+void CompactResult::getCounts(ExportResultSummary& summary) const
+{
+	summary.numTargets = (int)_targets.size();
+	summary.numFiles = summary.stored = summary.notStored = 0;
+
+	for (int i=0; i<(int)_targets.size(); i++)
+		for (int j=0; j<(int)_targets[i].outcomes.size(); j++)
+		{
+			summary.numFiles++;
+			if (_targets[i].outcomes[j].storageOutcome == DICOMStoragePkg::STORAGE_SUCCEESS)
+				summary.stored++;
+			else
+				summary.notStored++;
+		}
+}
+
+DICOMStoragePkg::ResultByStorageTargetList* CompactResult::expand() const
+{
+	DICOMStoragePkg::ResultByStorageTargetList_var result = new DICOMStoragePkg::ResultByStorageTargetList;
+
+	result->length(_targets.size());
+	for (int i=0; i<(int)_targets.size(); i++)
+	{
+		const TargetEntry& target = _targets[i];
+
+		result[i].storageHostName = CORBA::string_dup(target.hostName.c_str());
+		result[i].storageCommitRequired = target.commitRequired;
+		result[i].transactionUID = CORBA::string_dup(target.transactionUID.c_str());
+		result[i].resultByFiles.length(target.outcomes.size());
+		for (int j=0; j<(int)target.outcomes.size(); j++)
+			fillResultByFile(target.outcomes[j], result[i].resultByFiles[j]);
+	}
+
+	return result._retn();
+}
+
+DICOMStoragePkg::ResultByStorageTargetList* CompactResult::summarize(ExportResultSummary& summary) const
+{
+	DICOMStoragePkg::ResultByStorageTargetList_var result = new DICOMStoragePkg::ResultByStorageTargetList;
+	int count;
+
+	getCounts(summary);
+
+	result->length(_targets.size());
+	for (int i=0; i<(int)_targets.size(); i++)
+	{
+		const TargetEntry& target = _targets[i];
+
+		result[i].storageHostName = CORBA::string_dup(target.hostName.c_str());
+		result[i].storageCommitRequired = target.commitRequired;
+		result[i].transactionUID = CORBA::string_dup(target.transactionUID.c_str());
+
+		count = 0;
+		for (int j=0; j<(int)target.outcomes.size(); j++)
+			if (target.outcomes[j].storageOutcome != DICOMStoragePkg::STORAGE_SUCCEESS)
+				count++;
+
+		result[i].resultByFiles.length(count);
+		count = 0;
+		for (int j=0; j<(int)target.outcomes.size(); j++)
+			if (target.outcomes[j].storageOutcome != DICOMStoragePkg::STORAGE_SUCCEESS)
+				fillResultByFile(target.outcomes[j], result[i].resultByFiles[count++]);
+	}
+
+	return result._retn();
+}
@@ -0,0 +1,91 @@
+#ifndef _EXPORTRESULT_H_
+#define _EXPORTRESULT_H_
+
+/*
+ * file:	exportResult.h
+ * purpose:	CompactResult class that holds the storage result of an export
+ *          with each file, and its UIDs, kept once for all storage targets.
+ *          SOP class UIDs are interned, so a study of one modality keeps one
+ *          copy. A ResultByStorageTargetList repeats path and UIDs for every
+ *          target; this is what finished export jobs keep, and what the
+ *          summary result of a store is cut from.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "cstoreutils.h"
+
+using namespace std;
+
+/*
+ * Counts returned with a summary result, which lists only the files that
+ * were not stored. The full result can be fetched with the job ID.
+ */
+typedef struct export_result_summary
+{
+    unsigned long jobID;
+    int           numTargets;
+    int           numFiles;       /* files times storage targets */
+    int           stored;
+    int           notStored;      /* failed, warning or not sent */
+} ExportResultSummary;
+
+class CompactResult
+{
+	typedef struct
+	{
+		string      path;
+		const char* SOPClassUID;      /* interned */
+		const char* SOPInstanceUID;   /* interned */
+	} FileEntry;
+
+	typedef struct
+	{
+		int                            file;   /* index into _files */
+		DICOMStoragePkg::StorageStatus storageOutcome;
+		DICOMStoragePkg::CommitStatus  commitOutcome;
+	} Outcome;
+
+	typedef struct
+	{
+		string          hostName;
+		bool            commitRequired;
+		string          transactionUID;
+		vector<Outcome> outcomes;
+	} TargetEntry;
+
+	set<string>         _strings;
+	vector<FileEntry>   _files;
+	map<string, int>    _fileIndex;  /* path to index into _files */
+	vector<TargetEntry> _targets;
+
+	// Disallow copying or assignment.
+	CompactResult(const CompactResult&);
+	CompactResult& operator=(const CompactResult&);
+
+	const char* intern(const char* str);
+	int addFile(const DICOMStoragePkg::ResultByFile& resultByFile);
+	void fillResultByFile(const Outcome& outcome, DICOMStoragePkg::ResultByFile& resultByFile) const;
+
+public:
+	CompactResult(const DICOMStoragePkg::ResultByStorageTargetList& result);
+	~CompactResult();
+
+	int numFiles() const { return (int)_files.size(); }
+	void getCounts(ExportResultSummary& summary) const;
+
+	// Return the full result, as the export returned it
+	DICOMStoragePkg::ResultByStorageTargetList* expand() const;
+
+	// Return the result with only the files that were not stored, and the
+	// counts. Targets are all listed, with their files left out if all were
+	// stored.
+	DICOMStoragePkg::ResultByStorageTargetList* summarize(ExportResultSummary& summary) const;
+};
+
+#endif
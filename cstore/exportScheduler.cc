@@ -0,0 +1,336 @@
+/*
+ * file:	exportScheduler.cc
+ * purpose:	Implementation of the ExportScheduler class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <stdio.h>
+
+#include "exportScheduler.h"
+
+extern int StoreConcurrency;
+extern int StoreConcurrencyPerTarget;
+
+/*
+ * Share of the slots each priority class gets while all classes are waiting
+ */
+static const int PriorityWeight[NUM_EXPORT_PRIORITIES] = { 16, 4, 1 };
+
+ExportScheduler* ExportScheduler::_instance = NULL;  /* handle of singleton object */
+
+const char* PriorityName(EXPORT_PRIORITY priority)
+{
+	switch (priority)
+	{
+		case PRIORITY_STAT:    return "STAT";
+		case PRIORITY_ROUTINE: return "ROUTINE";
+		case PRIORITY_BULK:    return "BULK";
+		default:               break;
+	}
+	return "UNKNOWN";
+}
+
+static string makeTargetKey(const char* remoteAE, const char* remoteHost, int remotePort)
+{
+	char key[AE_LENGTH+128+32];
+
+	sprintf(key, "%s@%s:%d", remoteAE, remoteHost ? remoteHost : "", remotePort);
+	return string(key);
+}
+
+ExportScheduler* ExportScheduler::instance()
+{
+	if (!_instance)
+		_instance = new ExportScheduler();
+
+	return _instance;
+}
+
+ExportScheduler::ExportScheduler()
+			: _virtualTime (0.0),
+			  _numRunning (0)
+{
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_changed, NULL);
+
+	for (int i=0; i<NUM_EXPORT_PRIORITIES; i++)
+		_pass[i] = 0.0;
+	memset(_stats, 0, sizeof(_stats));
+}
+
+ExportScheduler::~ExportScheduler()
+{
+	pthread_cond_destroy(&_changed);
+	pthread_mutex_destroy(&_lock);
+}
+
+ExportScheduler::ExportScheduler(const ExportScheduler&)
+{
+}
+
+ExportScheduler& ExportScheduler::operator=(const ExportScheduler&)
+{
+	return *this;
+}
+
+/*
+ * The caller must hold _lock
+ */
+bool ExportScheduler::targetHasRoom(const string& targetKey)
+{
+	map<string, int>::iterator iter = _runningByTarget.find(targetKey);
+
+	return iter == _runningByTarget.end() || iter->second < StoreConcurrencyPerTarget;
+}
+
+/*
+ * Among the waiters of one class whose target has room, pick the one whose
+ * job holds the fewest slots, so that a big job does not starve the jobs
+ * that came after it. Ties go to the earliest request.
+ *
+ * The caller must hold _lock
+ */
+ExportTicket* ExportScheduler::pickWaiter(int priority)
+{
+	ExportTicket* best = NULL;
+	int           bestRunning = 0;
+
+	for(list<ExportTicket*>::iterator iter=_waiting[priority].begin(); iter != _waiting[priority].end(); ++iter)
+	{
+		if (!targetHasRoom((*iter)->targetKey))
+			continue;
+
+		map<const void*, int>::iterator job = _runningByJob.find((*iter)->job);
+		int running = job == _runningByJob.end() ? 0 : job->second;
+
+		if (best == NULL || running < bestRunning)
+		{
+			best = *iter;
+			bestRunning = running;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * The caller must hold _lock
+ */
+void ExportScheduler::recordWait(ExportTicket* ticket, bool loan)
+{
+	struct timeval now;
+	double         wait;
+
+	gettimeofday(&now, NULL);
+	wait = (now.tv_sec - ticket->requested.tv_sec) * 1000.0 + (now.tv_usec - ticket->requested.tv_usec) / 1000.0;
+
+	ExportWaitStats& stats = _stats[ticket->priority];
+	stats.grants++;
+	if (loan)
+		stats.loans++;
+	stats.totalWait += wait;
+	if (wait > stats.maxWait)
+		stats.maxWait = wait;
+}
+
+/****************************************************************************
+ *
+ *  Function    :   schedule
+ *
+ *  Parameters  :   none
+ *
+ *  Returns     :   none
+ *
+ *  Description :   Grant free slots to waiters. Classes are served by
+ *                  stride scheduling: each grant advances the pass of the
+ *                  class by 1/weight, and the class with the lowest pass
+ *                  that has a grantable waiter goes next.
+ *
+ *                  The caller must hold _lock
+ *
+ ****************************************************************************/
+void ExportScheduler::schedule()
+{
+	bool granted = false;
+
+	while (_numRunning < StoreConcurrency)
+	{
+		ExportTicket* ticket = NULL;
+		int           priority = -1;
+
+		for (int i=0; i<NUM_EXPORT_PRIORITIES; i++)
+		{
+			if (priority != -1 && _pass[i] >= _pass[priority])
+				continue;
+
+			ExportTicket* candidate = pickWaiter(i);
+			if (candidate)
+			{
+				ticket = candidate;
+				priority = i;
+			}
+		}
+
+		if (!ticket)
+			break;
+
+		_waiting[priority].remove(ticket);
+		_virtualTime = _pass[priority];
+		_pass[priority] += 1.0 / PriorityWeight[priority];
+
+		ticket->granted = true;
+		_numRunning++;
+		_runningByTarget[ticket->targetKey]++;
+		_runningByJob[ticket->job]++;
+		recordWait(ticket, false);
+		granted = true;
+	}
+
+	if (granted)
+		pthread_cond_broadcast(&_changed);
+}
+
+ExportTicket* ExportScheduler::acquire(const char* remoteAE, const char* remoteHost, int remotePort,
+									   EXPORT_PRIORITY priority, const void* job, int* lentAssociationID)
+{
+	ExportTicket* ticket = new ExportTicket;
+
+	ticket->targetKey = makeTargetKey(remoteAE, remoteHost, remotePort);
+	ticket->priority = priority;
+	ticket->job = job;
+	ticket->granted = false;
+	ticket->lentAssociationID = -1;
+	ticket->lender = NULL;
+	ticket->onLoan = false;
+	ticket->loanLost = false;
+	gettimeofday(&ticket->requested, NULL);
+
+	pthread_mutex_lock(&_lock);
+
+	// A class that was idle does not get credit for the time it was idle
+	if (_waiting[priority].empty() && _pass[priority] < _virtualTime)
+		_pass[priority] = _virtualTime;
+
+	_waiting[priority].push_back(ticket);
+	schedule();
+
+	if (!ticket->granted && priority == PRIORITY_STAT)
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				  "STAT export to %s is waiting for a lower priority export to reach a file boundary", ticket->targetKey.c_str());
+
+	while (!ticket->granted)
+		pthread_cond_wait(&_changed, &_lock);
+
+	*lentAssociationID = ticket->lentAssociationID;
+	pthread_mutex_unlock(&_lock);
+
+	return ticket;
+}
+
+bool ExportScheduler::preemptionPending(ExportTicket* ticket)
+{
+	bool pending = false;
+
+	if (ticket->priority == PRIORITY_STAT || ticket->lender != NULL)
+		return false;
+
+	pthread_mutex_lock(&_lock);
+	for(list<ExportTicket*>::iterator iter=_waiting[PRIORITY_STAT].begin(); iter != _waiting[PRIORITY_STAT].end(); ++iter)
+		if ((*iter)->targetKey == ticket->targetKey)
+		{
+			pending = true;
+			break;
+		}
+	pthread_mutex_unlock(&_lock);
+
+	return pending;
+}
+
+/*
+ * The caller must have read all outstanding responses on the association,
+ * so that the borrower sees only the responses to its own requests.
+ */
+bool ExportScheduler::lendAssociation(ExportTicket* ticket, int associationID)
+{
+	ExportTicket* borrower = NULL;
+	bool          usable;
+
+	pthread_mutex_lock(&_lock);
+	for(list<ExportTicket*>::iterator iter=_waiting[PRIORITY_STAT].begin(); iter != _waiting[PRIORITY_STAT].end(); ++iter)
+		if ((*iter)->targetKey == ticket->targetKey)
+		{
+			borrower = *iter;
+			_waiting[PRIORITY_STAT].erase(iter);
+			break;
+		}
+
+	if (!borrower) // served by another slot in the meantime
+	{
+		pthread_mutex_unlock(&_lock);
+		return true;
+	}
+
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "%s export to %s lends its association to a STAT export", PriorityName(ticket->priority), ticket->targetKey.c_str());
+
+	borrower->granted = true;
+	borrower->lentAssociationID = associationID;
+	borrower->lender = ticket;
+	ticket->onLoan = true;
+	recordWait(borrower, true);
+	pthread_cond_broadcast(&_changed);
+
+	while (ticket->onLoan)
+		pthread_cond_wait(&_changed, &_lock);
+
+	usable = !ticket->loanLost;
+	pthread_mutex_unlock(&_lock);
+
+	return usable;
+}
+
+void ExportScheduler::release(ExportTicket* ticket, bool associationLost)
+{
+	pthread_mutex_lock(&_lock);
+
+	if (ticket->lender)
+	{
+		ticket->lender->onLoan = false;
+		ticket->lender->loanLost = associationLost;
+		pthread_cond_broadcast(&_changed);
+	}
+	else if (ticket->granted)
+	{
+		_numRunning--;
+		if (--_runningByTarget[ticket->targetKey] <= 0)
+			_runningByTarget.erase(ticket->targetKey);
+		if (--_runningByJob[ticket->job] <= 0)
+			_runningByJob.erase(ticket->job);
+		schedule();
+	}
+
+	pthread_mutex_unlock(&_lock);
+
+	delete ticket;
+}
+
+void ExportScheduler::report()
+{
+	pthread_mutex_lock(&_lock);
+
+	::Message(MNOTE, toEndUser | toService | MLoverall, "Export scheduler: %d of %d association slot(s) in use, at most %d per target",
+			  _numRunning, StoreConcurrency, StoreConcurrencyPerTarget);
+	for (int i=0; i<NUM_EXPORT_PRIORITIES; i++)
+	{
+		const ExportWaitStats& stats = _stats[i];
+
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				"  %-8s waiting=%d granted=%lu borrowed=%lu average wait=%.1fms max wait=%.1fms",
+				PriorityName((EXPORT_PRIORITY)i), (int)_waiting[i].size(), stats.grants, stats.loans,
+				stats.grants ? stats.totalWait / stats.grants : 0.0, stats.maxWait);
+	}
+
+	pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,104 @@
+#ifndef _EXPORTSCHEDULER_H_
+#define _EXPORTSCHEDULER_H_
+
+/*
+ * file:	exportScheduler.h
+ * purpose:	ExportScheduler singleton class that decides which storage
+ *          association may be opened next. It replaces the single global
+ *          store lock with a limited number of slots, shared between the
+ *          STAT, ROUTINE and BULK priority classes by weight, with a cap
+ *          per target. A STAT export that cannot get a slot to a busy
+ *          target borrows the association of the lower priority export
+ *          at its next file boundary.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <map>
+#include <list>
+#include <string>
+#include <sys/time.h>
+#include "cstoreutils.h"
+
+using namespace std;
+
+/*
+ * One storage association asking for, or holding, a slot
+ */
+typedef struct export_ticket
+{
+    string                 targetKey;
+    EXPORT_PRIORITY        priority;
+    const void*            job;             /* jobKey of the StorageData */
+    struct timeval         requested;
+    bool                   granted;
+
+    /* borrowing and lending the association of a lower priority export */
+    int                    lentAssociationID;   /* -1 if the ticket owns its slot */
+    struct export_ticket*  lender;
+    bool                   onLoan;              /* the association is lent out */
+    bool                   loanLost;            /* the borrower aborted it */
+} ExportTicket;
+
+/*
+ * Queue wait time per priority class
+ */
+typedef struct export_wait_stats
+{
+    unsigned long grants;
+    unsigned long loans;            /* grants served by borrowing */
+    double        totalWait;        /* milliseconds */
+    double        maxWait;
+} ExportWaitStats;
+
+class ExportScheduler
+{
+	static ExportScheduler*      _instance;
+	pthread_mutex_t              _lock;      /* protects everything below */
+	pthread_cond_t               _changed;
+	list<ExportTicket*>          _waiting[NUM_EXPORT_PRIORITIES];
+	double                       _pass[NUM_EXPORT_PRIORITIES];
+	double                       _virtualTime;
+	ExportWaitStats              _stats[NUM_EXPORT_PRIORITIES];
+	map<string, int>             _runningByTarget;
+	map<const void*, int>        _runningByJob;
+	int                          _numRunning;
+
+	ExportScheduler();
+
+	// Disallow copying or assignment.
+	ExportScheduler(const ExportScheduler&);
+	ExportScheduler& operator=(const ExportScheduler&);
+
+	bool targetHasRoom(const string& targetKey);
+	ExportTicket* pickWaiter(int priority);
+	void schedule();
+	void recordWait(ExportTicket* ticket, bool loan);
+
+public:
+	static ExportScheduler* instance();
+	~ExportScheduler();
+
+	// Block until the association may be used. *lentAssociationID is the
+	// borrowed association to send over, or -1 to open a new one.
+	ExportTicket* acquire(const char* remoteAE, const char* remoteHost, int remotePort,
+						  EXPORT_PRIORITY priority, const void* job, int* lentAssociationID);
+
+	// Called at file boundaries by the owner of an association.
+	bool preemptionPending(ExportTicket* ticket);
+
+	// Lend the association to a waiting STAT export and block until it is
+	// given back. Return false if the borrower lost the association.
+	bool lendAssociation(ExportTicket* ticket, int associationID);
+
+	// Free the slot, or give a borrowed association back.
+	void release(ExportTicket* ticket, bool associationLost);
+
+	// Write the queue wait times to the log
+	void report();
+};
+
+const char* PriorityName(EXPORT_PRIORITY priority);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * file:	fileSource.cc
+ * purpose:	Implementation of the FileSource class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <string.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include "acquire/mesg.h"
+#include "fileSource.h"
+
+FileSource::FileSource(const string& entry)
+			: _type (SOURCE_FILE),
+			  _root (entry),
+			  _done (false),
+			  _manifest (NULL)
+{
+	struct stat rootStat;
+	string      root;
+	size_t      start, end;
+
+	end = entry.find('|');
+	root = entry.substr(0, end);
+
+	if (!root.empty() && root[0] == '@')
+	{
+		_type = SOURCE_MANIFEST;
+		_root = root.substr(1);
+		_manifest = fopen(_root.c_str(), "r");
+		if (!_manifest)
+			::Message(MWARNING, toEndUser | toService | MLoverall, "Cannot open export manifest \"%s\"", _root.c_str());
+		_manifestDir = _root.find('/') == string::npos ? string(".") : _root.substr(0, _root.rfind('/'));
+	}
+	else if (stat(root.c_str(), &rootStat) == 0 && S_ISDIR(rootStat.st_mode))
+	{
+		_type = SOURCE_DIRECTORY;
+		_root = root;
+		while (_root.size() > 1 && _root[_root.size()-1] == '/')
+			_root.erase(_root.size()-1);
+		openDirectory(_root);
+	}
+	else
+		return; // an ordinary file, even if its name has a '|'
+
+	while (end != string::npos)
+	{
+		start = end + 1;
+		end = entry.find('|', start);
+		if (end != start && start < entry.size())
+			_patterns.push_back(entry.substr(start, end == string::npos ? string::npos : end - start));
+	}
+}
+
+FileSource::~FileSource()
+{
+	if (_manifest)
+		fclose(_manifest);
+}
+
+FileSource::FileSource(const FileSource&)
+{
+}
+
+FileSource& FileSource::operator=(const FileSource&)
+{
+	return *this;
+}
+
+bool FileSource::matches(const string& name) const
+{
+	const char* base = strrchr(name.c_str(), '/');
+
+	if (_patterns.empty())
+		return true;
+
+	base = base ? base + 1 : name.c_str();
+	for (size_t i = 0; i < _patterns.size(); i++)
+		if (fnmatch(_patterns[i].c_str(), base, 0) == 0)
+			return true;
+
+	return false;
+}
+
+/*
+ * Read the names of a directory, sorted, onto the stack of names to visit
+ */
+bool FileSource::openDirectory(const string& path)
+{
+	DIR*           dir;
+	struct dirent* entry;
+	list<string>   names;
+
+	dir = opendir(path.c_str());
+	if (!dir)
+	{
+		::Message(MWARNING, toEndUser | toService | MLoverall, "Cannot read export directory \"%s\"", path.c_str());
+		return false;
+	}
+
+	while ((entry = readdir(dir)) != NULL)
+		if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+			names.push_back(entry->d_name);
+	closedir(dir);
+
+	names.sort();
+	_pending.push_front(list<string>());
+	_pending.front().swap(names);
+	_dirs.push_front(path);
+
+	return true;
+}
+
+bool FileSource::next(string& filename)
+{
+	struct stat fileStat;
+	char        line[1024];
+	size_t      length;
+	string      path;
+
+	switch (_type)
+	{
+		case SOURCE_FILE:
+			if (_done)
+				return false;
+			_done = true;
+			filename = _root;
+			return true;
+
+		case SOURCE_DIRECTORY:
+			while (!_pending.empty())
+			{
+				if (_pending.front().empty())
+				{
+					_pending.pop_front();
+					_dirs.pop_front();
+					continue;
+				}
+
+				path = _dirs.front() + "/" + _pending.front().front();
+				_pending.front().pop_front();
+
+				if (lstat(path.c_str(), &fileStat) != 0)
+					continue;
+				if (S_ISDIR(fileStat.st_mode))
+				{
+					openDirectory(path);
+					continue;
+				}
+				if (S_ISLNK(fileStat.st_mode) && (stat(path.c_str(), &fileStat) != 0 || !S_ISREG(fileStat.st_mode)))
+					continue;
+				if (!S_ISREG(fileStat.st_mode) || !matches(path))
+					continue;
+
+				filename = path;
+				return true;
+			}
+			return false;
+
+		case SOURCE_MANIFEST:
+			while (_manifest && fgets(line, sizeof(line), _manifest))
+			{
+				length = strcspn(line, "\r\n");
+				line[length] = '\0';
+				while (length > 0 && (line[length-1] == ' ' || line[length-1] == '\t'))
+					line[--length] = '\0';
+				if (!line[0] || line[0] == '#' || !matches(line))
+					continue;
+
+				filename = line[0] == '/' ? string(line) : _manifestDir + "/" + line;
+				return true;
+			}
+			return false;
+	}
+
+	return false;
+}
+
+/****************************************************************************
+ *
+ *  Function    :   ExpandFileSources
+ *
+ *  Parameters  :   entries - file list of an export
+ *                  files   - returns the files the entries name
+ *
+ *  Returns     :   true if an entry named a directory or a manifest
+ *                  false if all entries are files, files is left empty
+ *
+ *  Description :   Enumerate the files of an export when it runs rather
+ *                  than when it is submitted, so a caller can name a whole
+ *                  study with one entry.
+ *
+ ****************************************************************************/
+bool ExpandFileSources(const list<string>& entries, list<string>& files)
+{
+	list<string>::const_iterator iter;
+	string                       filename;
+	bool                         expanded = false;
+	int                          count;
+
+	files.clear();
+	for (iter = entries.begin(); iter != entries.end(); ++iter)
+	{
+		FileSource source(*iter);
+
+		if (source.type() == SOURCE_FILE && !expanded)
+			continue;
+
+		if (!expanded)
+		{
+			// Copy the plain files listed before the first source
+			for (list<string>::const_iterator prior = entries.begin(); prior != iter; ++prior)
+				files.push_back(*prior);
+			expanded = true;
+		}
+
+		count = 0;
+		while (source.next(filename))
+		{
+			files.push_back(filename);
+			count++;
+		}
+		if (source.type() != SOURCE_FILE)
+			::Message(MNOTE, toEndUser | toService | MLoverall, "Export %s \"%s\" names %d file(s)",
+					  source.type() == SOURCE_DIRECTORY ? "directory" : "manifest", source.root().c_str(), count);
+	}
+
+	return expanded;
+}
@@ -0,0 +1,73 @@
+#ifndef _FILESOURCE_H_
+#define _FILESOURCE_H_
+
+/*
+ * file:	fileSource.h
+ * purpose:	FileSource class that enumerates the files named by one entry
+ *          of an export file list, one at a time. Besides a file, an entry
+ *          may name
+ *
+ *              <directory>[|<pattern>...]       all files below it
+ *              @<manifest file>[|<pattern>...]  the files listed in it
+ *
+ *          so a caller can hand over a study of thousands of files as a
+ *          single entry. Patterns are fnmatch(3) patterns matched against
+ *          the file name; a file is taken if it matches any of them.
+ *          Manifests have one path per line, relative to the manifest, and
+ *          may have blank and # comment lines. Directories are walked
+ *          depth first in name order, without following symbolic links to
+ *          directories. Nothing is read before it is asked for.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <stdio.h>
+#include <dirent.h>
+#include <list>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef enum
+{
+    SOURCE_FILE = 0,
+    SOURCE_DIRECTORY,
+    SOURCE_MANIFEST
+} FILE_SOURCE_ENUM;
+
+class FileSource
+{
+	FILE_SOURCE_ENUM        _type;
+	string                  _root;       /* file, directory or manifest */
+	vector<string>          _patterns;
+	bool                    _done;
+	FILE*                   _manifest;
+	string                  _manifestDir;
+	list< list<string> >    _pending;    /* names still to visit, one list per open directory */
+	list<string>            _dirs;       /* path of each directory in _pending */
+
+	// Disallow copying or assignment.
+	FileSource(const FileSource&);
+	FileSource& operator=(const FileSource&);
+
+	bool matches(const string& name) const;
+	bool openDirectory(const string& path);
+
+public:
+	FileSource(const string& entry);
+	~FileSource();
+
+	FILE_SOURCE_ENUM type() const { return _type; }
+	const string& root() const { return _root; }
+
+	// Return the next file, false when there are no more
+	bool next(string& filename);
+};
+
+// Replace the directory and manifest entries of the list with the files
+// they name. Returns false, leaving files empty, if there are none.
+bool ExpandFileSources(const list<string>& entries, list<string>& files);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * file:	fileValidation.cc
+ * purpose:	Implementation of the FileValidation class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <sys/time.h>
+
+#include "fileValidation.h"
+#include "cstoreutils.h"
+
+extern int ValidationConcurrency;
+
+static const size_t ValidationChunkFiles = 16;   /* files claimed by a checker at a time */
+
+FileValidation::FileValidation(const list<string>& files)
+			: _files (files.begin(), files.end()),
+			  _states (files.size(), FILE_UNCHECKED),
+			  _nextChunk (0),
+			  _numChecked (0),
+			  _numInvalid (0),
+			  _references (1),
+			  _elapsed (0.0)
+{
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_checked, NULL);
+	gettimeofday(&_startTime, NULL);
+}
+
+FileValidation::~FileValidation()
+{
+	pthread_cond_destroy(&_checked);
+	pthread_mutex_destroy(&_lock);
+}
+
+FileValidation::FileValidation(const FileValidation&)
+{
+}
+
+FileValidation& FileValidation::operator=(const FileValidation&)
+{
+	return *this;
+}
+
+FileValidation* FileValidation::start(const list<string>& files)
+{
+	FileValidation* validation = new FileValidation(files);
+	size_t          chunks = (files.size() + ValidationChunkFiles - 1) / ValidationChunkFiles;
+	size_t          tasks = ValidationConcurrency > 0 ? (size_t)ValidationConcurrency : 1;
+
+	if (tasks > chunks)
+		tasks = chunks;
+
+	for (size_t i = 0; i < tasks; i++)
+	{
+		validation->addReference();
+		WorkerPool::instance()->submit(FileValidation::checker, (void*)validation, true);
+	}
+
+	return validation;
+}
+
+void FileValidation::addReference()
+{
+	pthread_mutex_lock(&_lock);
+	_references++;
+	pthread_mutex_unlock(&_lock);
+}
+
+void FileValidation::release()
+{
+	bool last;
+
+	pthread_mutex_lock(&_lock);
+	last = --_references == 0;
+	pthread_mutex_unlock(&_lock);
+
+	if (last)
+		delete this;
+}
+
+/*
+ * Claim the next chunk and check it. Returns false if every file has been
+ * claimed already.
+ */
+bool FileValidation::checkNextChunk()
+{
+	struct timeval now;
+	size_t         first, last, i;
+	bool           valid;
+
+	pthread_mutex_lock(&_lock);
+	first = _nextChunk;
+	last = first + ValidationChunkFiles < _files.size() ? first + ValidationChunkFiles : _files.size();
+	for (i = first; i < last; i++)
+		_states[i] = FILE_CHECKING;
+	_nextChunk = last;
+	pthread_mutex_unlock(&_lock);
+
+	if (first == last)
+		return false;
+
+	for (i = first; i < last; i++)
+	{
+		valid = UNKNOWN_FORMAT != CachedFileFormat(_files[i].c_str());
+		if (!valid)
+			::Message(MWARNING, toEndUser | toService | MLoverall, "Skip file [%s] because it either doesn't exist or is not in DICOM format.", _files[i].c_str());
+
+		pthread_mutex_lock(&_lock);
+		_states[i] = valid ? FILE_VALID : FILE_INVALID;
+		_numChecked++;
+		if (!valid)
+			_numInvalid++;
+		if (_numChecked == (int)_files.size())
+		{
+			gettimeofday(&now, NULL);
+			_elapsed = (now.tv_sec - _startTime.tv_sec) + (now.tv_usec - _startTime.tv_usec) / 1000000.0;
+		}
+		pthread_cond_broadcast(&_checked);
+		pthread_mutex_unlock(&_lock);
+	}
+
+	return true;
+}
+
+bool FileValidation::isValid(int index)
+{
+	bool valid;
+
+	if (index < 0 || index >= (int)_files.size())
+		return false;
+
+	pthread_mutex_lock(&_lock);
+	while (_states[index] != FILE_VALID && _states[index] != FILE_INVALID)
+	{
+		if (_states[index] == FILE_UNCHECKED)
+		{
+			// The checkers are behind, help them up to this file
+			pthread_mutex_unlock(&_lock);
+			checkNextChunk();
+			pthread_mutex_lock(&_lock);
+		}
+		else
+			pthread_cond_wait(&_checked, &_lock);
+	}
+	valid = _states[index] == FILE_VALID;
+	pthread_mutex_unlock(&_lock);
+
+	return valid;
+}
+
+bool FileValidation::waitForAnyValid()
+{
+	bool found;
+
+	pthread_mutex_lock(&_lock);
+	while (_numChecked == _numInvalid && _numChecked < (int)_files.size())
+	{
+		if (_nextChunk < _files.size())
+		{
+			pthread_mutex_unlock(&_lock);
+			checkNextChunk();
+			pthread_mutex_lock(&_lock);
+		}
+		else
+			pthread_cond_wait(&_checked, &_lock);
+	}
+	found = _numChecked > _numInvalid;
+	pthread_mutex_unlock(&_lock);
+
+	return found;
+}
+
+void FileValidation::report()
+{
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall, "Checked %d of %d file(s) in %.3fs, %d not in DICOM format",
+			  _numChecked, (int)_files.size(), _elapsed, _numInvalid);
+	pthread_mutex_unlock(&_lock);
+}
+
+/****************************************************************************
+ *
+ *  Function    :   checker
+ *
+ *  Parameters  :   thisClass - the FileValidation instance
+ *
+ *  Returns     :   THREAD_NORMAL_EXIT
+ *
+ *  Description :   Worker pool task. Checks chunks until none are left and
+ *                  drops its reference.
+ *
+ ****************************************************************************/
+void* FileValidation::checker(void* thisClass)
+{
+	FileValidation* validation = (FileValidation*)thisClass;
+
+	while (validation->checkNextChunk())
+		;
+
+	validation->release();
+	return (void *) &THREAD_NORMAL_EXIT;
+}
@@ -0,0 +1,79 @@
+#ifndef _FILEVALIDATION_H_
+#define _FILEVALIDATION_H_
+
+/*
+ * file:	fileValidation.h
+ * purpose:	FileValidation class that checks the files of an export on the
+ *          worker pool while the first ones are already being sent. The
+ *          files are checked in order, a chunk at a time, by a few tasks;
+ *          a sender only waits for the file it is about to send. A sender
+ *          that gets ahead of the tasks checks the next chunk itself.
+ *
+ *          It is shared by the StorageData of every target of the export
+ *          and reference counted: one reference for the creator, one per
+ *          StorageData and one per running task.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <list>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/time.h>
+
+using namespace std;
+
+typedef enum
+{
+    FILE_UNCHECKED = 0,
+    FILE_CHECKING,
+    FILE_VALID,
+    FILE_INVALID
+} FILE_CHECK_STATE;
+
+class FileValidation
+{
+	pthread_mutex_t         _lock;       /* protects everything below */
+	pthread_cond_t          _checked;
+	vector<string>          _files;
+	vector<unsigned char>   _states;     /* FILE_CHECK_STATE of each file */
+	size_t                  _nextChunk;  /* first file no one has claimed */
+	int                     _numChecked;
+	int                     _numInvalid;
+	int                     _references;
+	struct timeval          _startTime;
+	double                  _elapsed;    /* seconds until the last file was checked */
+
+	FileValidation(const list<string>& files);
+	~FileValidation();
+
+	// Disallow copying or assignment.
+	FileValidation(const FileValidation&);
+	FileValidation& operator=(const FileValidation&);
+
+	bool checkNextChunk();
+
+public:
+	// Start checking the files in the order of the list. The caller owns
+	// one reference and must release() it.
+	static FileValidation* start(const list<string>& files);
+
+	void addReference();
+	void release();
+
+	// Block until the file at index is checked. A file no task has picked
+	// up yet is checked in the calling thread.
+	bool isValid(int index);
+
+	// Block until a file is found to be DICOM. False if none is.
+	bool waitForAnyValid();
+
+	// Log how many files were checked, how long it took and how many failed
+	void report();
+
+	static void* checker(void* thisClass);
+};
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * file:	inFlightBudget.cc
+ * purpose:	Implementation of the InFlightBudget class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <time.h>
+
+#include "inFlightBudget.h"
+#include "cstoreutils.h"
+
+extern int InFlightBudgetMB;
+
+InFlightBudget* InFlightBudget::_instance = NULL;  /* handle of singleton object */
+
+InFlightBudget* InFlightBudget::instance()
+{
+	if (!_instance)
+		_instance = new InFlightBudget();
+
+	return _instance;
+}
+
+InFlightBudget::InFlightBudget()
+			: _budget ((size_t)InFlightBudgetMB * 1024 * 1024),
+			  _inFlight (0),
+			  _peak (0),
+			  _nextTicket (0),
+			  _serving (0),
+			  _grants (0),
+			  _throttled (0),
+			  _totalWait (0.0)
+{
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_changed, NULL);
+}
+
+InFlightBudget::~InFlightBudget()
+{
+	pthread_cond_destroy(&_changed);
+	pthread_mutex_destroy(&_lock);
+}
+
+InFlightBudget::InFlightBudget(const InFlightBudget&)
+{
+}
+
+InFlightBudget& InFlightBudget::operator=(const InFlightBudget&)
+{
+	return *this;
+}
+
+/*
+ * The caller must hold _lock
+ */
+void InFlightBudget::skipAbandoned()
+{
+	set<unsigned long>::iterator iter;
+
+	while ((iter = _abandoned.find(_serving)) != _abandoned.end())
+	{
+		_abandoned.erase(iter);
+		_serving++;
+	}
+}
+
+unsigned long InFlightBudget::takeTicket()
+{
+	unsigned long ticket;
+
+	pthread_mutex_lock(&_lock);
+	ticket = _nextTicket++;
+	pthread_mutex_unlock(&_lock);
+
+	return ticket;
+}
+
+bool InFlightBudget::tryAcquire(unsigned long ticket, size_t bytes, int waitTime)
+{
+	struct timeval  start, now;
+	struct timespec deadline;
+	bool            granted = false;
+	map<unsigned long, struct timeval>::iterator since;
+
+	gettimeofday(&start, NULL);
+	deadline.tv_sec = start.tv_sec + waitTime / 1000;
+	deadline.tv_nsec = (start.tv_usec + (waitTime % 1000) * 1000L) * 1000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&_lock);
+	for (;;)
+	{
+		// An image bigger than the whole budget goes when nothing else is in flight
+		if (ticket == _serving && (_inFlight + bytes <= _budget || _inFlight == 0))
+		{
+			granted = true;
+			break;
+		}
+
+		if (_waitingSince.find(ticket) == _waitingSince.end())
+			_waitingSince[ticket] = start;
+
+		if (pthread_cond_timedwait(&_changed, &_lock, &deadline) != 0)
+			break;
+	}
+
+	if (granted)
+	{
+		_serving++;
+		skipAbandoned();
+		_inFlight += bytes;
+		if (_inFlight > _peak)
+			_peak = _inFlight;
+
+		_grants++;
+		since = _waitingSince.find(ticket);
+		if (since != _waitingSince.end())
+		{
+			gettimeofday(&now, NULL);
+			_throttled++;
+			_totalWait += (now.tv_sec - since->second.tv_sec) * 1000.0 + (now.tv_usec - since->second.tv_usec) / 1000.0;
+			_waitingSince.erase(since);
+		}
+		pthread_cond_broadcast(&_changed);
+	}
+	pthread_mutex_unlock(&_lock);
+
+	return granted;
+}
+
+void InFlightBudget::abandon(unsigned long ticket)
+{
+	pthread_mutex_lock(&_lock);
+	_waitingSince.erase(ticket);
+	if (ticket == _serving)
+	{
+		_serving++;
+		skipAbandoned();
+		pthread_cond_broadcast(&_changed);
+	}
+	else if (ticket > _serving)
+		_abandoned.insert(ticket);
+	pthread_mutex_unlock(&_lock);
+}
+
+void InFlightBudget::release(size_t bytes)
+{
+	pthread_mutex_lock(&_lock);
+	_inFlight = bytes > _inFlight ? 0 : _inFlight - bytes;
+	pthread_cond_broadcast(&_changed);
+	pthread_mutex_unlock(&_lock);
+}
+
+size_t InFlightBudget::bytesInFlight()
+{
+	size_t inFlight;
+
+	pthread_mutex_lock(&_lock);
+	inFlight = _inFlight;
+	pthread_mutex_unlock(&_lock);
+
+	return inFlight;
+}
+
+void InFlightBudget::report()
+{
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "In-flight image bytes: %luKB of %luKB, peak %luKB, %lu sender(s) waiting",
+			  (unsigned long)(_inFlight / 1024), (unsigned long)(_budget / 1024), (unsigned long)(_peak / 1024),
+			  _nextTicket - _serving - (unsigned long)_abandoned.size());
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "  %lu grant(s), %lu throttled, average throttled wait %.1fms",
+			  _grants, _throttled, _throttled ? _totalWait / _throttled : 0.0);
+	pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,73 @@
+#ifndef _INFLIGHTBUDGET_H_
+#define _INFLIGHTBUDGET_H_
+
+/*
+ * file:	inFlightBudget.h
+ * purpose:	InFlightBudget singleton class that bounds the bytes of image
+ *          messages alive in cstore at any time. With asynchronous
+ *          operations every outstanding C-STORE-RQ keeps its message
+ *          until the C-STORE-RSP arrives, across all targets and jobs.
+ *          A sender takes credits for the size of an image before it is
+ *          read and sent, and gives them back when the response is read.
+ *          Senders that hit the budget are served first come, first served.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <set>
+#include <map>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+using namespace std;
+
+class InFlightBudget
+{
+	static InFlightBudget*   _instance;
+	pthread_mutex_t          _lock;      /* protects everything below */
+	pthread_cond_t           _changed;
+	size_t                   _budget;
+	size_t                   _inFlight;
+	size_t                   _peak;
+	unsigned long            _nextTicket;
+	unsigned long            _serving;   /* the ticket to be granted next */
+	set<unsigned long>       _abandoned;
+	map<unsigned long, struct timeval> _waitingSince;
+	unsigned long            _grants;
+	unsigned long            _throttled; /* grants that had to wait */
+	double                   _totalWait; /* milliseconds */
+
+	InFlightBudget();
+
+	// Disallow copying or assignment.
+	InFlightBudget(const InFlightBudget&);
+	InFlightBudget& operator=(const InFlightBudget&);
+
+	void skipAbandoned();
+
+public:
+	static InFlightBudget* instance();
+	~InFlightBudget();
+
+	// Take a place in line for the next acquire
+	unsigned long takeTicket();
+
+	// Wait up to waitTime milliseconds for the credits. Return false on
+	// timeout; the ticket keeps its place in line.
+	bool tryAcquire(unsigned long ticket, size_t bytes, int waitTime);
+
+	// Give up the place in line of a ticket that was not granted
+	void abandon(unsigned long ticket);
+
+	void release(size_t bytes);
+
+	// Gauge of the bytes in flight
+	size_t bytesInFlight();
+
+	// Write the gauge and throttling counts to the log
+	void report();
+};
+
+#endif
@@ -0,0 +1,289 @@
+/*
+ * file:	metadataCache.cc
+ * purpose:	Implementation of the MetadataCache class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <time.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "metadataCache.h"
+
+extern int MetadataCacheEntries;
+
+static const char         metadataFile[] = "data/Facility/Cstore/metadata.cache";
+static const char         metadataMagic[8] = { 'C', 'S', 'T', 'M', 'E', 'T', 'A', '1' };
+static const unsigned int metadataProbes = 8;   /* slots looked at per path */
+
+/*
+ * Layout of the file. Changing it changes the slot size, which makes the
+ * next start discard the old file.
+ */
+struct metadata_header
+{
+    char               magic[8];
+    unsigned int       numSlots;
+    unsigned int       slotBytes;
+};
+
+struct metadata_slot
+{
+    unsigned long long pathHash;        /* 0 for an empty slot */
+    unsigned long long fileBytes;
+    long long          mtime;
+    long long          mtimeNsec;
+    unsigned long long inode;
+    int                format;
+    int                transferSyntax;
+    int                uidsKnown;
+    unsigned int       lastUsed;        /* days since the epoch */
+    char               SOPClassUID[UI_LENGTH+2];
+    char               SOPInstanceUID[UI_LENGTH+2];
+    unsigned long long checksum;        /* of everything above */
+};
+
+MetadataCache* MetadataCache::_instance = NULL;  /* handle of singleton object */
+
+/*
+ * 64 bit FNV-1a. Two paths with the same hash are taken to be the same
+ * file, which the size, time and inode checks make harmless in practice.
+ */
+static unsigned long long fnv1a(const void* data, size_t length, unsigned long long hash = 14695981039346656037ULL)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static unsigned long long pathHashOf(const char* filename)
+{
+	unsigned long long hash = fnv1a(filename, strlen(filename));
+
+	return hash ? hash : 1;  // 0 marks an empty slot
+}
+
+static unsigned long long checksumOf(const struct metadata_slot* slot)
+{
+	return fnv1a(slot, offsetof(struct metadata_slot, checksum));
+}
+
+static long long mtimeNsecOf(const struct stat& fileStat)
+{
+#ifdef linux
+	return fileStat.st_mtim.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+MetadataCache* MetadataCache::instance()
+{
+	if (!_instance)
+		_instance = new MetadataCache();
+
+	return _instance;
+}
+
+MetadataCache::MetadataCache()
+			: _header (NULL),
+			  _slots (NULL),
+			  _mappedBytes (0),
+			  _lookups (0),
+			  _hits (0),
+			  _stale (0),
+			  _stores (0)
+{
+	pthread_mutex_init(&_lock, NULL);
+
+	if (MetadataCacheEntries > 0 && !open((unsigned int)MetadataCacheEntries))
+		::Message( MWARNING, MLoverall | toService | toDeveloper, "Cstore: cannot map \"%s\", DICOM files are parsed every time.", metadataFile);
+}
+
+MetadataCache::~MetadataCache()
+{
+	if (_header)
+		munmap(_header, _mappedBytes);
+	pthread_mutex_destroy(&_lock);
+}
+
+MetadataCache::MetadataCache(const MetadataCache&)
+{
+}
+
+MetadataCache& MetadataCache::operator=(const MetadataCache&)
+{
+	return *this;
+}
+
+/*
+ * Map the file, creating it anew if it does not have the expected layout
+ */
+bool MetadataCache::open(unsigned int numSlots)
+{
+	struct metadata_header header;
+	struct stat            fileStat;
+	size_t                 bytes = sizeof(struct metadata_header) + (size_t)numSlots * sizeof(struct metadata_slot);
+	void*                  mapped;
+	bool                   valid = false;
+	int                    fd;
+
+	fd = ::open(metadataFile, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &fileStat) == 0 && (size_t)fileStat.st_size == bytes
+	 && read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header))
+		valid = memcmp(header.magic, metadataMagic, sizeof(metadataMagic)) == 0
+			 && header.numSlots == numSlots
+			 && header.slotBytes == sizeof(struct metadata_slot);
+
+	if (!valid)
+	{
+		::Message( MNOTE, MLoverall | toService | toDeveloper, "Cstore: creating \"%s\" with %u entries", metadataFile, numSlots);
+
+		memcpy(header.magic, metadataMagic, sizeof(metadataMagic));
+		header.numSlots = numSlots;
+		header.slotBytes = sizeof(struct metadata_slot);
+		if (ftruncate(fd, 0) != 0 || ftruncate(fd, bytes) != 0
+		 || pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+		{
+			close(fd);
+			return false;
+		}
+	}
+
+	mapped = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return false;
+
+	_header = (struct metadata_header*)mapped;
+	_slots = (struct metadata_slot*)((char*)mapped + sizeof(struct metadata_header));
+	_mappedBytes = bytes;
+
+	return true;
+}
+
+/*
+ * The caller must hold _lock. Returns the slot of the path, or with
+ * forStore the slot to put it in.
+ */
+struct metadata_slot* MetadataCache::find(unsigned long long pathHash, bool forStore)
+{
+	struct metadata_slot* slot;
+	struct metadata_slot* victim = NULL;
+
+	for (unsigned int i = 0; i < metadataProbes; i++)
+	{
+		slot = &_slots[(pathHash + i) % _header->numSlots];
+		if (slot->pathHash == pathHash)
+			return slot;
+
+		if (forStore && (!victim || (victim->pathHash != 0 && (slot->pathHash == 0 || slot->lastUsed < victim->lastUsed))))
+			victim = slot;
+	}
+
+	return victim;
+}
+
+bool MetadataCache::lookup(const char* filename, DicomMetadata* metadata)
+{
+	struct stat           fileStat;
+	struct metadata_slot* slot;
+	unsigned int          today = (unsigned int)(time(NULL) / 86400);
+	bool                  found = false;
+
+	if (!_header || stat(filename, &fileStat) != 0)
+		return false;
+
+	pthread_mutex_lock(&_lock);
+	_lookups++;
+	slot = find(pathHashOf(filename), false);
+	if (slot && slot->checksum == checksumOf(slot))
+	{
+		if (slot->fileBytes == (unsigned long long)fileStat.st_size
+		 && slot->mtime == (long long)fileStat.st_mtime
+		 && slot->mtimeNsec == mtimeNsecOf(fileStat)
+		 && slot->inode == (unsigned long long)fileStat.st_ino)
+		{
+			metadata->format = (FORMAT_ENUM)slot->format;
+			metadata->transferSyntax = (TRANSFER_SYNTAX)slot->transferSyntax;
+			metadata->fileBytes = (size_t)slot->fileBytes;
+			metadata->uidsKnown = slot->uidsKnown != 0;
+			strcpy(metadata->SOPClassUID, slot->SOPClassUID);
+			strcpy(metadata->SOPInstanceUID, slot->SOPInstanceUID);
+
+			if (slot->lastUsed != today)
+			{
+				slot->lastUsed = today;
+				slot->checksum = checksumOf(slot);
+			}
+			_hits++;
+			found = true;
+		}
+		else
+		{
+			// The file has changed, the entry is of no use any more
+			memset(slot, 0, sizeof(*slot));
+			_stale++;
+		}
+	}
+	pthread_mutex_unlock(&_lock);
+
+	return found;
+}
+
+void MetadataCache::remember(const char* filename, const DicomMetadata& metadata)
+{
+	struct stat           fileStat;
+	struct metadata_slot* slot;
+	unsigned long long    pathHash = pathHashOf(filename);
+
+	if (!_header || stat(filename, &fileStat) != 0)
+		return;
+
+	pthread_mutex_lock(&_lock);
+	slot = find(pathHash, true);
+	memset(slot, 0, sizeof(*slot));
+	slot->pathHash = pathHash;
+	slot->fileBytes = (unsigned long long)fileStat.st_size;
+	slot->mtime = (long long)fileStat.st_mtime;
+	slot->mtimeNsec = mtimeNsecOf(fileStat);
+	slot->inode = (unsigned long long)fileStat.st_ino;
+	slot->format = (int)metadata.format;
+	slot->transferSyntax = (int)metadata.transferSyntax;
+	slot->uidsKnown = metadata.uidsKnown ? 1 : 0;
+	slot->lastUsed = (unsigned int)(time(NULL) / 86400);
+	if (metadata.uidsKnown)
+	{
+		strncpy(slot->SOPClassUID, metadata.SOPClassUID, sizeof(slot->SOPClassUID)-1);
+		strncpy(slot->SOPInstanceUID, metadata.SOPInstanceUID, sizeof(slot->SOPInstanceUID)-1);
+	}
+	slot->checksum = checksumOf(slot);
+	_stores++;
+	pthread_mutex_unlock(&_lock);
+}
+
+void MetadataCache::report()
+{
+	pthread_mutex_lock(&_lock);
+	if (!_header)
+		::Message(MNOTE, toEndUser | toService | MLoverall, "DICOM metadata cache is disabled");
+	else
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				  "DICOM metadata cache: %u entries, %lu lookup(s), %lu hit(s) (%.1f%%), %lu stale, %lu stored",
+				  _header->numSlots, _lookups, _hits, _lookups ? _hits * 100.0 / _lookups : 0.0, _stale, _stores);
+	pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,79 @@
+#ifndef _METADATACACHE_H_
+#define _METADATACACHE_H_
+
+/*
+ * file:	metadataCache.h
+ * purpose:	MetadataCache singleton class that remembers what parsing a
+ *          DICOM file found out: its format, transfer syntax and SOP
+ *          Class and Instance UIDs. The entries are keyed by path and are
+ *          only valid while the size, modification time and inode of the
+ *          file are the same, so a changed file is parsed again.
+ *
+ *          The table lives in data/Facility/Cstore/metadata.cache, a
+ *          header followed by fixed-size slots that are mapped into
+ *          memory and survive restarts. A path hashes to a slot and is
+ *          looked for in the next few; a new entry replaces the least
+ *          recently used of them. Each slot has a checksum, so a slot
+ *          torn by a crash is a miss rather than wrong data.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "cstoreutils.h"
+
+/*
+ * What a lookup returns
+ */
+typedef struct dicom_metadata
+{
+    FORMAT_ENUM     format;
+    TRANSFER_SYNTAX transferSyntax;     /* valid if uidsKnown */
+    size_t          fileBytes;
+    bool            uidsKnown;          /* false if only the format was checked */
+    char            SOPClassUID[UI_LENGTH+2];
+    char            SOPInstanceUID[UI_LENGTH+2];
+} DicomMetadata;
+
+struct metadata_slot;
+struct metadata_header;
+
+class MetadataCache
+{
+	static MetadataCache*    _instance;
+	pthread_mutex_t          _lock;      /* protects everything below */
+	struct metadata_header*  _header;    /* the mapped file, NULL if disabled */
+	struct metadata_slot*    _slots;
+	size_t                   _mappedBytes;
+	unsigned long            _lookups;
+	unsigned long            _hits;
+	unsigned long            _stale;     /* found, but the file has changed */
+	unsigned long            _stores;
+
+	MetadataCache();
+
+	// Disallow copying or assignment.
+	MetadataCache(const MetadataCache&);
+	MetadataCache& operator=(const MetadataCache&);
+
+	bool open(unsigned int numSlots);
+	struct metadata_slot* find(unsigned long long pathHash, bool forStore);
+
+public:
+	static MetadataCache* instance();
+	~MetadataCache();
+
+	// Return true and fill metadata if the file is known and unchanged
+	bool lookup(const char* filename, DicomMetadata* metadata);
+
+	// Remember the metadata of the file as it is now
+	void remember(const char* filename, const DicomMetadata& metadata);
+
+	// Write the hit rate to the log
+	void report();
+};
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * file:	readAhead.cc
+ * purpose:	Implementation of the ReadAheadEngine class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "acquire/mesg.h"
+#include "readAhead.h"
+
+static const size_t ReadAheadQueueLimit = 1024;  /* files queued at most */
+
+ReadAheadEngine* ReadAheadEngine::_instance = NULL;  /* handle of singleton object */
+
+ReadAheadEngine* ReadAheadEngine::instance()
+{
+	if (!_instance)
+		_instance = new ReadAheadEngine();
+
+	return _instance;
+}
+
+ReadAheadEngine::ReadAheadEngine()
+				: _running (false),
+				  _requested (0),
+				  _advised (0),
+				  _dropped (0),
+				  _failed (0),
+				  _bytesAdvised (0.0)
+{
+	pthread_t      tid;
+	pthread_attr_t attr;
+
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_queued, NULL);
+
+	pthread_attr_init(&attr); // Initialize with the default value
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&tid, &attr, ReadAheadEngine::worker, (void*)this) == 0)
+		_running = true;
+	else
+		::Message( MALARM, toEndUser | toService | MLoverall,
+				   "Cstore failed to create the read-ahead thread, files are read on demand");
+	pthread_attr_destroy(&attr);
+}
+
+ReadAheadEngine::~ReadAheadEngine()
+{
+	// The thread lives as long as the process
+}
+
+ReadAheadEngine::ReadAheadEngine(const ReadAheadEngine&)
+{
+}
+
+ReadAheadEngine& ReadAheadEngine::operator=(const ReadAheadEngine&)
+{
+	return *this;
+}
+
+void ReadAheadEngine::advise(const char* filename)
+{
+	pthread_mutex_lock(&_lock);
+	_requested++;
+	if (!_running || _queue.size() >= ReadAheadQueueLimit)
+		_dropped++;
+	else
+	{
+		_queue.push_back(filename);
+		pthread_cond_signal(&_queued);
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+void ReadAheadEngine::report()
+{
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "Read-ahead: %lu file(s) requested, %lu advised (%.0fKB), %lu dropped, %lu failed, %d queued",
+			  _requested, _advised, _bytesAdvised / 1024.0, _dropped, _failed, (int)_queue.size());
+	pthread_mutex_unlock(&_lock);
+}
+
+/****************************************************************************
+ *
+ *  Function    :   worker
+ *
+ *  Parameters  :   thisClass - the ReadAheadEngine instance
+ *
+ *  Returns     :   NULL
+ *
+ *  Description :   Read-ahead thread. Opens the queued files in order and
+ *                  advises the kernel to read all of each one. Opening may
+ *                  block on a network file system, which is why it is not
+ *                  done by the senders.
+ *
+ ****************************************************************************/
+void* ReadAheadEngine::worker(void* thisClass)
+{
+	ReadAheadEngine* engine = (ReadAheadEngine*)thisClass;
+	string           filename;
+	struct stat      fileStat;
+	bool             advised;
+	int              fd;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&engine->_lock);
+		while (engine->_queue.empty())
+			pthread_cond_wait(&engine->_queued, &engine->_lock);
+		filename = engine->_queue.front();
+		engine->_queue.pop_front();
+		pthread_mutex_unlock(&engine->_lock);
+
+		advised = false;
+		fd = open(filename.c_str(), O_RDONLY);
+		if (fd >= 0)
+		{
+			advised = fstat(fd, &fileStat) == 0
+				   && posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0;
+			close(fd);
+		}
+
+		pthread_mutex_lock(&engine->_lock);
+		if (advised)
+		{
+			engine->_advised++;
+			engine->_bytesAdvised += fileStat.st_size;
+		}
+		else
+			engine->_failed++;
+		pthread_mutex_unlock(&engine->_lock);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,56 @@
+#ifndef _READAHEAD_H_
+#define _READAHEAD_H_
+
+/*
+ * file:	readAhead.h
+ * purpose:	ReadAheadEngine singleton class that asks the kernel to load
+ *          export files into the page cache before ReadImage() gets to
+ *          them. Senders queue the names of their next files; one thread
+ *          opens each file and advises POSIX_FADV_WILLNEED, which starts
+ *          the disk reads and returns, so the reads of the next files
+ *          overlap the sending of the current one. When the queue is
+ *          full a request is dropped; the file is then read on demand.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <deque>
+#include <string>
+#include <pthread.h>
+
+using namespace std;
+
+class ReadAheadEngine
+{
+	static ReadAheadEngine*  _instance;
+	pthread_mutex_t          _lock;      /* protects everything below */
+	pthread_cond_t           _queued;
+	deque<string>            _queue;
+	bool                     _running;
+	unsigned long            _requested;
+	unsigned long            _advised;
+	unsigned long            _dropped;   /* queue was full */
+	unsigned long            _failed;    /* could not open or advise */
+	double                   _bytesAdvised;
+
+	ReadAheadEngine();
+
+	// Disallow copying or assignment.
+	ReadAheadEngine(const ReadAheadEngine&);
+	ReadAheadEngine& operator=(const ReadAheadEngine&);
+
+	static void* worker(void* thisClass);
+
+public:
+	static ReadAheadEngine* instance();
+	~ReadAheadEngine();
+
+	// Queue a file to be loaded. Returns right away.
+	void advise(const char* filename);
+
+	// Write the counts to the log
+	void report();
+};
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * file:	sharedResult.cc
+ * purpose:	Implementation of the SharedResult and CommitResult classes
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include "acquire/mesg.h"
+#include "sharedResult.h"
+
+static pthread_mutex_t counterLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long   resultsShared = 0;      /* SharedResults made */
+static unsigned long   resultsCopied = 0;      /* storage target results deep copied */
+static unsigned long   stringsDuplicated = 0;
+static unsigned long   stringsMoved = 0;
+
+static void countStrings(unsigned long copied, unsigned long duplicated, unsigned long moved)
+{
+	pthread_mutex_lock(&counterLock);
+	resultsCopied += copied;
+	stringsDuplicated += duplicated;
+	stringsMoved += moved;
+	pthread_mutex_unlock(&counterLock);
+}
+
+/*
+ * SharedResult class
+ */
+
+SharedResult::SharedResult(DICOMStoragePkg::ResultByStorageTargetList* result)
+			: _references (1),
+			  _result (result)
+{
+	pthread_mutex_init(&_lock, NULL);
+
+	pthread_mutex_lock(&counterLock);
+	resultsShared++;
+	pthread_mutex_unlock(&counterLock);
+}
+
+SharedResult::~SharedResult()
+{
+	delete _result;
+	pthread_mutex_destroy(&_lock);
+}
+
+SharedResult::SharedResult(const SharedResult&)
+{
+}
+
+SharedResult& SharedResult::operator=(const SharedResult&)
+{
+	return *this;
+}
+
+SharedResult* SharedResult::copyOf(const DICOMStoragePkg::ResultByStorageTargetList& result,
+								   bool commitRequiredOnly)
+{
+	DICOMStoragePkg::ResultByStorageTargetList* copy = new DICOMStoragePkg::ResultByStorageTargetList;
+	int count = 0;
+
+	for (int i=0; i<(int)result.length(); i++)
+		if (!commitRequiredOnly || result[i].storageCommitRequired)
+			count++;
+
+	copy->length(count);
+	count = 0;
+	for (int i=0; i<(int)result.length(); i++)
+		if (!commitRequiredOnly || result[i].storageCommitRequired)
+			CopyResultByStorageTarget(result[i], (*copy)[count++]);
+
+	return new SharedResult(copy);
+}
+
+void SharedResult::addReference()
+{
+	pthread_mutex_lock(&_lock);
+	_references++;
+	pthread_mutex_unlock(&_lock);
+}
+
+void SharedResult::release()
+{
+	bool last;
+
+	pthread_mutex_lock(&_lock);
+	last = --_references == 0;
+	pthread_mutex_unlock(&_lock);
+
+	if (last)
+		delete this;
+}
+
+bool SharedResult::isShared()
+{
+	bool shared;
+
+	pthread_mutex_lock(&_lock);
+	shared = _references > 1;
+	pthread_mutex_unlock(&_lock);
+
+	return shared;
+}
+
+/*
+ * CommitResult class
+ */
+
+CommitResult::CommitResult(const DICOMStoragePkg::ResultByStorageTarget* storedResult)
+			: stored (storedResult),
+			  commitOutcome (storedResult->resultByFiles.length()),
+			  missing (storedResult->resultByFiles.length(), false)
+{
+	for (int i=0; i<(int)commitOutcome.size(); i++)
+		commitOutcome[i] = storedResult->resultByFiles[i].commitOutcome;
+}
+
+void CommitResult::makeTransactions(int chunkSize)
+{
+	CommitTransaction transaction;
+	int               numFiles = (int)commitOutcome.size();
+
+	if (chunkSize <= 0 || chunkSize > numFiles)
+		chunkSize = numFiles > 0 ? numFiles : 1;
+
+	// At least one transaction, even without files
+	transactions.clear();
+	transaction.reported = false;
+	for (int first=0; first==0 || first<numFiles; first+=chunkSize)
+	{
+		transaction.firstFile = first;
+		transaction.endFile = first + chunkSize < numFiles ? first + chunkSize : numFiles;
+		transactions.push_back(transaction);
+	}
+}
+
+int CommitResult::findTransaction(const char* transactionUID) const
+{
+	for (int i=0; i<(int)transactions.size(); i++)
+		if (transactions[i].transactionUID == transactionUID)
+			return i;
+
+	return -1;
+}
+
+bool CommitResult::allReported() const
+{
+	for (int i=0; i<(int)transactions.size(); i++)
+		if (!transactions[i].reported)
+			return false;
+
+	return true;
+}
+
+string CommitResult::transactionUIDs() const
+{
+	string uids;
+
+	for (int i=0; i<(int)transactions.size(); i++)
+	{
+		if (i)
+			uids += "\\";
+		uids += transactions[i].transactionUID;
+	}
+
+	return uids;
+}
+
+void MoveResultByStorageTarget(DICOMStoragePkg::ResultByStorageTarget& from,
+							   DICOMStoragePkg::ResultByStorageTarget& to)
+{
+	int numFiles = (int)from.resultByFiles.length();
+
+	to.storageHostName = from.storageHostName._retn();
+	to.storageCommitRequired = from.storageCommitRequired;
+	to.transactionUID = from.transactionUID._retn();
+	to.resultByFiles.length(numFiles);
+	for (int i=0; i<numFiles; i++)
+	{
+		DICOMStoragePkg::ResultByFile& fromFile = from.resultByFiles[i];
+		DICOMStoragePkg::ResultByFile& toFile = to.resultByFiles[i];
+
+		toFile.imgFile = fromFile.imgFile._retn();
+		toFile.SOPClassUID = fromFile.SOPClassUID._retn();
+		toFile.SOPInstanceUID = fromFile.SOPInstanceUID._retn();
+		toFile.storageOutcome = fromFile.storageOutcome;
+		toFile.commitOutcome = fromFile.commitOutcome;
+	}
+	from.resultByFiles.length(0);
+
+	countStrings(0, 0, 2 + 3 * numFiles);
+}
+
+void CopyResultByStorageTarget(const DICOMStoragePkg::ResultByStorageTarget& from,
+							   DICOMStoragePkg::ResultByStorageTarget& to)
+{
+	int numFiles = (int)from.resultByFiles.length();
+
+	to.storageHostName = CORBA::string_dup(from.storageHostName.in());
+	to.storageCommitRequired = from.storageCommitRequired;
+	to.transactionUID = CORBA::string_dup(from.transactionUID.in());
+	to.resultByFiles.length(numFiles);
+	for (int i=0; i<numFiles; i++)
+	{
+		const DICOMStoragePkg::ResultByFile& fromFile = from.resultByFiles[i];
+		DICOMStoragePkg::ResultByFile& toFile = to.resultByFiles[i];
+
+		toFile.imgFile = CORBA::string_dup(fromFile.imgFile.in());
+		toFile.SOPClassUID = CORBA::string_dup(fromFile.SOPClassUID.in());
+		toFile.SOPInstanceUID = CORBA::string_dup(fromFile.SOPInstanceUID.in());
+		toFile.storageOutcome = fromFile.storageOutcome;
+		toFile.commitOutcome = fromFile.commitOutcome;
+	}
+
+	countStrings(1, 2 + 3 * numFiles, 0);
+}
+
+void ApplyCommitResult(const CommitResult& commitResult,
+					   DICOMStoragePkg::ResultByStorageTarget& to)
+{
+	to.transactionUID = CORBA::string_dup(commitResult.transactionUIDs().c_str());
+	for (int i=0; i<(int)to.resultByFiles.length() && i<(int)commitResult.commitOutcome.size(); i++)
+		to.resultByFiles[i].commitOutcome = commitResult.commitOutcome[i];
+
+	countStrings(0, 1, 0);
+}
+
+void CountResultStrings(int duplicated)
+{
+	countStrings(0, duplicated, 0);
+}
+
+void ReportResultCounters()
+{
+	pthread_mutex_lock(&counterLock);
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "Result data: %lu shared, %lu storage target result(s) deep copied, %lu string(s) duplicated, %lu moved",
+			  resultsShared, resultsCopied, stringsDuplicated, stringsMoved);
+	pthread_mutex_unlock(&counterLock);
+}
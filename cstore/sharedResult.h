@@ -0,0 +1,126 @@
+#ifndef _SHAREDRESULT_H_
+#define _SHAREDRESULT_H_
+
+/*
+ * file:	sharedResult.h
+ * purpose:	SharedResult class that holds the storage result of an export
+ *          once for all of its commit targets. It does not change once it
+ *          is made and is reference counted. Each commit target keeps its
+ *          transaction UID and commit outcomes in a CommitResult of its own
+ *          that points at the shared paths and UIDs, so the strings are
+ *          copied only into the commit report for the camera, and not at
+ *          all for the last commit target.
+ *
+ *          A commit of many files is split into CommitTransactions, one
+ *          N-ACTION each, whose reports all land in the same CommitResult.
+ *
+ *          The functions below move results between sequences without
+ *          duplicating the strings, and count the strings duplicated and
+ *          moved. remoteDebug "results" writes the counts to the log.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "control/DICOMStorage_s.h"
+
+using namespace std;
+
+class SharedResult
+{
+	pthread_mutex_t                             _lock;
+	int                                         _references;
+	DICOMStoragePkg::ResultByStorageTargetList* _result;
+
+	~SharedResult();
+
+	// Disallow copying or assignment.
+	SharedResult(const SharedResult&);
+	SharedResult& operator=(const SharedResult&);
+
+public:
+	// Take over the result without copying it. The caller owns one
+	// reference and must release() it.
+	SharedResult(DICOMStoragePkg::ResultByStorageTargetList* result);
+
+	// Copy the storage targets that require commitment, or all of them
+	static SharedResult* copyOf(const DICOMStoragePkg::ResultByStorageTargetList& result,
+								bool commitRequiredOnly);
+
+	void addReference();
+	void release();
+
+	// True if someone else holds a reference too
+	bool isShared();
+
+	int numTargets() const { return (int)_result->length(); }
+	const DICOMStoragePkg::ResultByStorageTarget& target(int index) const { return (*_result)[index]; }
+
+	// Only the holder of the last reference may move the strings out
+	DICOMStoragePkg::ResultByStorageTarget& takeTarget(int index) { return (*_result)[index]; }
+};
+
+/*
+ * One N-ACTION of a commit, for the files [firstFile, endFile) of the
+ * storage target
+ */
+class CommitTransaction
+{
+public:
+	string transactionUID;
+	int    firstFile;
+	int    endFile;
+	bool   reported;        /* its N-EVENT-REPORT has been read */
+};
+
+/*
+ * What one commit target finds out about the files of one storage target
+ */
+class CommitResult
+{
+public:
+	const DICOMStoragePkg::ResultByStorageTarget* stored;          /* in a SharedResult */
+	vector<DICOMStoragePkg::CommitStatus>         commitOutcome;   /* one per file of stored */
+	vector<CommitTransaction>                     transactions;    /* empty until the commit starts */
+	vector<bool>                                  missing;         /* failed as no such object instance */
+
+	CommitResult(const DICOMStoragePkg::ResultByStorageTarget* storedResult);
+
+	// Split the files into transactions of at most chunkSize files, or
+	// one for all if chunkSize is 0. The UIDs are left empty.
+	void makeTransactions(int chunkSize);
+
+	// Return the index of the transaction, or -1 if it is not one of ours
+	int findTransaction(const char* transactionUID) const;
+
+	bool allReported() const;
+
+	// The transaction UIDs separated by backslashes, as DICOM separates values
+	string transactionUIDs() const;
+};
+
+// Move the strings and files of one result into another. from is left
+// without files and its strings NULL, to be thrown away.
+void MoveResultByStorageTarget(DICOMStoragePkg::ResultByStorageTarget& from,
+							   DICOMStoragePkg::ResultByStorageTarget& to);
+
+// Deep copy, counted
+void CopyResultByStorageTarget(const DICOMStoragePkg::ResultByStorageTarget& from,
+							   DICOMStoragePkg::ResultByStorageTarget& to);
+
+// Set the transaction UID and commit outcomes of a report entry that was
+// moved or copied from commitResult.stored
+void ApplyCommitResult(const CommitResult& commitResult,
+					   DICOMStoragePkg::ResultByStorageTarget& to);
+
+// Count strings duplicated elsewhere for a result
+void CountResultStrings(int duplicated);
+
+// Write the counts to the log
+void ReportResultCounters();
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * file:	sopIndex.cc
+ * purpose:	Implementation of the SOPInstanceIndex class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <string.h>
+
+#include "sopIndex.h"
+
+/*
+ * 32 bit FNV-1a. The instance UID alone tells the entries apart.
+ */
+unsigned int SOPInstanceIndex::hash(const char* sopInstanceUID)
+{
+	unsigned int hash = 2166136261U;
+
+	for (const unsigned char* p = (const unsigned char*)sopInstanceUID; *p; p++)
+	{
+		hash ^= *p;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+SOPInstanceIndex::SOPInstanceIndex(int expected)
+{
+	unsigned int numSlots = 16;
+
+	// Keep the table at most half full
+	while (numSlots < 2 * (unsigned int)(expected > 0 ? expected : 0))
+		numSlots *= 2;
+
+	_slots.assign(numSlots, -1);
+	_mask = numSlots - 1;
+	_classUIDs.reserve(expected > 0 ? expected : 0);
+	_instanceUIDs.reserve(expected > 0 ? expected : 0);
+}
+
+void SOPInstanceIndex::add(const char* sopClassUID, const char* sopInstanceUID)
+{
+	unsigned int slot;
+	int          entry = (int)_classUIDs.size();
+
+	sopClassUID = sopClassUID ? sopClassUID : "";
+	sopInstanceUID = sopInstanceUID ? sopInstanceUID : "";
+	_classUIDs.push_back(sopClassUID);
+	_instanceUIDs.push_back(sopInstanceUID);
+
+	// More entries than expected, grow and put the old ones back
+	if (2 * _classUIDs.size() > _slots.size())
+	{
+		_slots.assign(2 * _slots.size(), -1);
+		_mask = (unsigned int)_slots.size() - 1;
+		for (int i = 0; i < entry; i++)
+		{
+			slot = hash(_instanceUIDs[i]) & _mask;
+			while (_slots[slot] >= 0)
+				slot = (slot + 1) & _mask;
+			_slots[slot] = i;
+		}
+	}
+
+	for (slot = hash(sopInstanceUID) & _mask; _slots[slot] >= 0; slot = (slot + 1) & _mask)
+	{
+		if (!strcmp(_instanceUIDs[_slots[slot]], sopInstanceUID) &&
+			!strcmp(_classUIDs[_slots[slot]], sopClassUID))
+			return;
+	}
+	_slots[slot] = entry;
+}
+
+int SOPInstanceIndex::find(const char* sopClassUID, const char* sopInstanceUID) const
+{
+	unsigned int slot;
+
+	for (slot = hash(sopInstanceUID) & _mask; _slots[slot] >= 0; slot = (slot + 1) & _mask)
+	{
+		if (!strcmp(_instanceUIDs[_slots[slot]], sopInstanceUID) &&
+			!strcmp(_classUIDs[_slots[slot]], sopClassUID))
+			return _slots[slot];
+	}
+	return -1;
+}
@@ -0,0 +1,44 @@
+#ifndef _SOPINDEX_H_
+#define _SOPINDEX_H_
+
+/*
+ * file:	sopIndex.h
+ * purpose:	SOPInstanceIndex class that finds a SOP instance of a storage
+ *          commitment transaction by its SOP Class UID and SOP Instance UID
+ *          in constant time. It is built once per N-EVENT-REPORT, so each
+ *          item of the referenced and failed SOP sequences costs a hash and
+ *          one or two string compares rather than a scan of all the files.
+ *          The UIDs are not copied and must outlive the index.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <vector>
+
+using namespace std;
+
+class SOPInstanceIndex
+{
+	vector<const char*> _classUIDs;
+	vector<const char*> _instanceUIDs;
+	vector<int>         _slots;     /* entry index, -1 if empty; open addressing */
+	unsigned int        _mask;
+
+	static unsigned int hash(const char* sopInstanceUID);
+
+public:
+	// expected is the number of entries that will be added
+	SOPInstanceIndex(int expected);
+
+	// Add the next entry, numbered from 0 up. A pair that is already in
+	// the index keeps its first number, as the linear scan did.
+	void add(const char* sopClassUID, const char* sopInstanceUID);
+
+	// Return the number of the matching entry, or -1 if there is none
+	int find(const char* sopClassUID, const char* sopInstanceUID) const;
+
+	int size() const { return (int)_classUIDs.size(); }
+};
+
+#endif
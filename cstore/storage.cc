@@ -63,28 +63,19 @@ bool Storage::populateOptions()
     
 }/* populateOptions() */
 
-pthread_t Storage::storage(const DICOMStoragePkg::DICOMTarget& storagetarget,
+TaskFuture* Storage::storage(const DICOMStoragePkg::DICOMTarget& storagetarget,
 						StorageData& storageData)
 {
 	STORE_ARGS *store_args;
-	pthread_t tid;
 
 	_remoteTarget = storagetarget;
 	populateOptions();
 
-	store_args = new STORE_ARGS; // The thread will delete it before pthread_exit
+	store_args = new STORE_ARGS; // The task will delete it before it returns
 
 	store_args->applicationID = _applicationID;
 	store_args->options = _options;
 	store_args->storageData = &storageData;
 
-	if( pthread_create(&tid, NULL, StoreFiles, (void*)store_args) != 0)
-	{
-		::Message( MALARM, toEndUser | toService | MLoverall, 
-				"#Software error: cannot create a thread for storage to %s.",
-				CORBA::string_dup(storagetarget.hostName));
-		return (pthread_t)(-1);
-	}
-
-	return tid;
+	return WorkerPool::instance()->submit(StoreFiles, (void*)store_args);
 }
@@ -26,7 +26,7 @@ public:
 	Storage(const Storage& obj);
 	Storage& operator=(const Storage& obj);
 
-	pthread_t storage(const DICOMStoragePkg::DICOMTarget& storagetarget,
+	TaskFuture* storage(const DICOMStoragePkg::DICOMTarget& storagetarget,
 					StorageData& storageData);
 };
 
@@ -18,7 +18,8 @@ StorageContext::StorageContext(const DICOMStoragePkg::StorageTarget& storageTarg
 				:_storageTarget (storageTarget),
 				 _storageData (storageData),
 				 _storageStrategy (storageStrategy),
-				 _tid ((pthread_t)-1)
+				 _task (NULL),
+				 _group (NULL)
 {
 }
 
@@ -30,7 +31,10 @@ StorageContext::StorageContext(const StorageContext& obj)
 				:_storageTarget (obj._storageTarget),
 				 _storageData (obj._storageData),
 				 _storageStrategy (obj._storageStrategy),
-				 _tid (obj._tid)
+				 _task (obj._task),
+				 _group (obj._group),
+				 _memberData (obj._memberData),
+				 _memberTasks (obj._memberTasks)
 {
 }
 
@@ -39,38 +43,119 @@ StorageContext& StorageContext::operator=(const StorageContext& obj)
 	_storageTarget = obj._storageTarget;
 	_storageData = obj._storageData;
 	_storageStrategy = obj._storageStrategy;
-	_tid = obj._tid;
+	_task = obj._task;
+	_group = obj._group;
+	_memberData = obj._memberData;
+	_memberTasks = obj._memberTasks;
 
 	return *this;
 }
 
-pthread_t StorageContext::execute()
-{	
-	_tid = _storageStrategy.storageAlgorithm(_storageTarget.exportSystem, _storageData);
-	return _tid;
+TaskFuture* StorageContext::execute()
+{	vector<DICOMStoragePkg::DICOMTarget> members;
+
+	if (TargetGroupTable::instance()->members(_storageTarget.exportSystem, members))
+		return executeGroup(members);
+
+	_task = _storageStrategy.storageAlgorithm(_storageTarget.exportSystem, _storageData);
+	return _task;
+}
+
+/*
+ * Spread the files of this context across the members of the target group.
+ * Returns the task of the first member.
+ */
+TaskFuture* StorageContext::executeGroup(const vector<DICOMStoragePkg::DICOMTarget>& members)
+{	list<StorageData*>::iterator memberData;
+	int i;
+
+	::Message(MNOTE, toEndUser | toService | MLoverall, "Storage target \"%s\" is a target group of %d member(s)",
+			  _storageTarget.exportSystem.remoteAETitle.in(), (int)members.size());
+
+	_group = new TargetGroupDispatch(_storageTarget.exportSystem.remoteAETitle.in(), _storageData);
+
+	// All members join before the first task asks for a file
+	for(i=0; i<(int)members.size(); i++)
+	{
+		StorageData* data = new StorageData;
+
+		data->joinGroup(_group, _group->addMember(members[i].remoteAETitle.in(), data), _storageData);
+		_memberData.push_back(data);
+	}
+
+	for(i=0, memberData=_memberData.begin(); memberData != _memberData.end(); ++i, ++memberData)
+		_memberTasks.push_back(_storageStrategy.storageAlgorithm(members[i], **memberData));
+
+	return _memberTasks.front();
+}
+
+/*
+ * Wait for the tasks of all members. Return false if none of them could
+ * open its association.
+ */
+bool StorageContext::waitForGroup()
+{	void* status;
+	int   numStored = 0;
+
+	for(list<TaskFuture*>::iterator iter=_memberTasks.begin(); iter != _memberTasks.end(); ++iter)
+	{
+		status = (*iter)->wait();
+		(*iter)->release();
+		if ( status != NULL && *(const int*)status != THREAD_EXCEPTION )
+			numStored++;
+	}
+	_memberTasks.clear();
+
+	_group->summarize();
+	delete _group;
+	_group = NULL;
+
+	for(list<StorageData*>::iterator iter=_memberData.begin(); iter != _memberData.end(); ++iter)
+		delete *iter;
+	_memberData.clear();
+
+	return numStored > 0;
 }
 
-DICOMStoragePkg::ResultByStorageTarget StorageContext::getResult()
+void StorageContext::getResult(DICOMStoragePkg::ResultByStorageTarget& result)
 {
 	InstanceNode*                          node;
-	DICOMStoragePkg::ResultByStorageTarget result;
-	int                                    i, status;
-	DICOMStoragePkg::ResultByFile          resultByFile;
+	int                                    i;
+	void*                                  status;
 
-	if (_tid == (pthread_t)(-1))
+	if (_group)
 	{
-		::Message(MWARNING, toEndUser | toService | MLoverall, 
-			"StorageContext::getResult() should not be called before the thread is created.");
-		return result; // return NULL result
+		// The files are reported in the order of the caller, whichever
+		// member stored them
+		if (!waitForGroup())
+		{
+			::Message(MWARNING, toEndUser | toService | MLoverall, 
+					"StorageContext::getResult() no member of target group \"%s\" could be reached.",
+					_storageTarget.exportSystem.remoteAETitle.in());
+			throw (DictionaryPkg::NucMedException(DictionaryPkg::NUCMED_NETWORK));
+		}
 	}
-
-	// Wait for the thread to finish.
-	pthread_join(_tid, (void **)&status);
-	if ( status == THREAD_EXCEPTION )
+	else
 	{
-		::Message(MWARNING, toEndUser | toService | MLoverall, 
-				"StorageContext::getResult() catches thread exception.");
-		throw (DictionaryPkg::NucMedException(DictionaryPkg::NUCMED_NETWORK));
+		if (_task == NULL)
+		{
+			::Message(MWARNING, toEndUser | toService | MLoverall, 
+				"StorageContext::getResult() should not be called before the task is submitted.");
+			result.resultByFiles.length(0);
+			return; // return NULL result
+		}
+
+		// Wait for the task to finish. The status points to THREAD_NORMAL_EXIT
+		// or THREAD_EXCEPTION of the translation unit of the task.
+		status = _task->wait();
+		_task->release();
+		_task = NULL;
+		if ( status == NULL || *(const int*)status == THREAD_EXCEPTION )
+		{
+			::Message(MWARNING, toEndUser | toService | MLoverall, 
+					"StorageContext::getResult() catches thread exception.");
+			throw (DictionaryPkg::NucMedException(DictionaryPkg::NUCMED_NETWORK));
+		}
 	}
 
 	result.storageHostName = CORBA::string_dup(_storageTarget.exportSystem.hostName);
@@ -82,18 +167,17 @@ DICOMStoragePkg::ResultByStorageTarget StorageContext::getResult()
 	node = _storageData._instanceList;
 	while (node)
 	{
+		DICOMStoragePkg::ResultByFile& resultByFile = result.resultByFiles[i++];
+
 		resultByFile.imgFile = CORBA::string_dup(node->fname);
 		resultByFile.SOPClassUID = CORBA::string_dup(node->SOPClassUID);
 		resultByFile.SOPInstanceUID = CORBA::string_dup(node->SOPInstanceUID);
 		resultByFile.storageOutcome = node->storageStatus; // jhuang 2/20/2009 for MLSDB 29607
 		resultByFile.commitOutcome = node->commitStatus; // Commit outcome is unknown yet at this point
 
-		result.resultByFiles[i++]=resultByFile;
-
         node = node->Next;
 	}
-
-	return result;
+	CountResultStrings(1 + 3 * i);
 }
 
 
@@ -138,7 +222,7 @@ void StorageContextPool::execute()
 
 	tid.clear();
     for(iter=pool.begin(); iter != pool.end(); ++iter)
-	{	// Each execute returns a thread ID
+	{	// Each execute returns a submitted task
 		tid.push_back(iter->execute());
 	}
 }
@@ -149,22 +233,40 @@ StorageContextPool::getResult()
 	int                                             i = 0, j;
 	DICOMStoragePkg::ResultByStorageTargetList_var  tmpResult;
 	DICOMStoragePkg::ResultByStorageTargetList_var  resultByStorageTargets;
+	bool                                            failed = false;
 
 	tmpResult = new DICOMStoragePkg::ResultByStorageTargetList;
 	tmpResult->length(pool.size());
 
+	// The tasks of the other targets still use the storage data of the
+	// caller, so all of them are waited for before a failure is thrown
     for(iter=pool.begin(); iter != pool.end(); ++iter)
 	{
-		tmpResult[i]=iter->getResult();
+		try
+		{
+			iter->getResult(tmpResult[i]);
+		}
+		catch (DictionaryPkg::NucMedException&)
+		{
+			failed = true;
+			continue;
+		}
 		if (tmpResult[i].resultByFiles.length()!=0)
 			i++;
 	}
 
+	if (failed)
+		throw (DictionaryPkg::NucMedException(DictionaryPkg::NUCMED_NETWORK));
+
+	if (i == (int)pool.size())
+		return tmpResult._retn();
+
+	// Drop the targets without files, moving the others over
 	resultByStorageTargets = new DICOMStoragePkg::ResultByStorageTargetList;
 	resultByStorageTargets->length(i);
 
     for(j=0; j < i; ++j)
-		resultByStorageTargets[j]=tmpResult[j];
+		MoveResultByStorageTarget(tmpResult[j], resultByStorageTargets[j]);
 	
 	return resultByStorageTargets._retn();
 }
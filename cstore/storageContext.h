@@ -5,20 +5,29 @@
  * file:	storageContext.h
  * purpose:	StorageContext is a place holder for storage information,
  *          one per storage target. StorageContextPool manages the
- *          group of storage targets.
+ *          group of storage targets. A storage target that names a
+ *          target group runs one task per member of the group.
  *
  * revision history:
  *   Jiantao Huang		    initial version
  */
 
+#include <vector>
 #include "storageStrategy.h"
+#include "targetGroup.h"
 
 class StorageContext
 {
 	DICOMStoragePkg::StorageTarget _storageTarget;
 	StorageData                    _storageData;
 	StorageStrategy                _storageStrategy;
-	pthread_t                      _tid;
+	TaskFuture*                    _task;
+	TargetGroupDispatch*           _group;       /* set when the target names a target group */
+	list<StorageData*>             _memberData;  /* one list per member of the group */
+	list<TaskFuture*>              _memberTasks;
+
+	TaskFuture* executeGroup(const vector<DICOMStoragePkg::DICOMTarget>& members);
+	bool waitForGroup();
 
 public:
 
@@ -30,14 +39,15 @@ public:
 	StorageContext(const StorageContext& obj);
 	StorageContext& operator=(const StorageContext& obj);
 
-	pthread_t execute();
-	DICOMStoragePkg::ResultByStorageTarget getResult();
+	TaskFuture* execute();
+	// Fill in result, in place so the files are not copied again
+	void getResult(DICOMStoragePkg::ResultByStorageTarget& result);
 };
 
 class StorageContextPool
 {
 	list<StorageContext> pool;
-	list<pthread_t>      tid;
+	list<TaskFuture*>    tid;
 
 public:
 
@@ -29,7 +29,7 @@ StorageStrategy& StorageStrategy::operator=(const StorageStrategy& obj)
 	return *this;
 }
 
-pthread_t StorageStrategy::storageAlgorithm(const DICOMStoragePkg::DICOMTarget& storeTarget,
+TaskFuture* StorageStrategy::storageAlgorithm(const DICOMStoragePkg::DICOMTarget& storeTarget,
 										StorageData& storageData)
 {	Storage storage(_applicationID);
 	return storage.storage(storeTarget, storageData);
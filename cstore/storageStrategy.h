@@ -27,7 +27,7 @@ public:
 	StorageStrategy(const StorageStrategy& obj);
 	StorageStrategy& operator=(const StorageStrategy& obj);
 
-	virtual pthread_t storageAlgorithm(const DICOMStoragePkg::DICOMTarget& storeTarget,
+	virtual TaskFuture* storageAlgorithm(const DICOMStoragePkg::DICOMTarget& storeTarget,
 									StorageData& storageData);
 };
 
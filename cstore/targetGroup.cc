@@ -0,0 +1,477 @@
+/*
+ * file:	targetGroup.cc
+ * purpose:	Implementation of the TargetGroupTable and TargetGroupDispatch
+ *          classes
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <fstream>
+
+#include "targetGroup.h"
+
+static const char targetGroupFile[] = "data/Facility/Cstore/targetgroups.txt";
+
+TargetGroupTable* TargetGroupTable::_instance = NULL;  /* handle of singleton object */
+
+/*
+ * TargetGroupTable class.
+ */
+
+TargetGroupTable* TargetGroupTable::instance()
+{
+	if (!_instance)
+		_instance = new TargetGroupTable();
+
+	return _instance;
+}
+
+TargetGroupTable::TargetGroupTable()
+{
+	pthread_mutex_init(&_lock, NULL);
+}
+
+TargetGroupTable::~TargetGroupTable()
+{
+	pthread_mutex_destroy(&_lock);
+}
+
+TargetGroupTable::TargetGroupTable(const TargetGroupTable&)
+{
+}
+
+TargetGroupTable& TargetGroupTable::operator=(const TargetGroupTable&)
+{
+	return *this;
+}
+
+void TargetGroupTable::loadGroups()
+{
+	map<string, vector<GroupMemberConfig> > groups;
+	char                                    line[256];
+	char                                    groupAE[AE_LENGTH+2];
+	char                                    memberAE[AE_LENGTH+2];
+	char                                    hostName[128];
+	int                                     port;
+
+	std::ifstream groupConfigFile(targetGroupFile);
+	if (!groupConfigFile)
+	{
+		::Message( MNOTE, MLoverall | toService | toDeveloper, "Cstore: no \"%s\", no target groups are defined.", targetGroupFile);
+		pthread_mutex_lock(&_lock);
+		_groups.clear();
+		pthread_mutex_unlock(&_lock);
+		return;
+	}
+
+	memset(line, 0, sizeof(line));
+	while(!groupConfigFile.getline(line, sizeof(line)).eof())
+	{
+		if (isalpha(line[0]) || isdigit(line[0]))
+		{
+			if (sscanf(line, "%16s %16s %127s %d", groupAE, memberAE, hostName, &port) == 4)
+			{
+				GroupMemberConfig member;
+
+				member.remoteAE = memberAE;
+				member.hostName = hostName;
+				member.port = port;
+				groups[groupAE].push_back(member);
+
+				::Message( MNOTE, MLoverall | toService | toDeveloper, "Target group %s: member %s at %s:%d",
+						   groupAE, memberAE, hostName, port);
+			}
+			else
+				::Message( MWARNING, MLoverall | toService | toDeveloper, "Cstore: ignoring line \"%s\" of \"%s\"", line, targetGroupFile);
+		}
+		memset(line, 0, sizeof(line));
+	}
+
+	pthread_mutex_lock(&_lock);
+	_groups = groups;
+	pthread_mutex_unlock(&_lock);
+}
+
+bool TargetGroupTable::members(const DICOMStoragePkg::DICOMTarget& groupTarget,
+							   vector<DICOMStoragePkg::DICOMTarget>& members)
+{
+	map<string, vector<GroupMemberConfig> >::const_iterator group;
+
+	members.clear();
+
+	pthread_mutex_lock(&_lock);
+	group = _groups.find(groupTarget.remoteAETitle.in());
+	if (group != _groups.end())
+	{
+		for(vector<GroupMemberConfig>::const_iterator iter=group->second.begin(); iter != group->second.end(); ++iter)
+		{
+			// The member inherits everything else, e.g. the local AE title
+			DICOMStoragePkg::DICOMTarget member = groupTarget;
+
+			member.remoteAETitle = CORBA::string_dup(iter->remoteAE.c_str());
+			member.hostName = CORBA::string_dup(iter->hostName.c_str());
+			member.portNumber = iter->port;
+			members.push_back(member);
+		}
+	}
+	pthread_mutex_unlock(&_lock);
+
+	return !members.empty();
+}
+
+void TargetGroupTable::record(const string& remoteAE, const GroupMemberStats& stats)
+{
+	pthread_mutex_lock(&_lock);
+	map<string, GroupMemberStats>::iterator iter = _stats.find(remoteAE);
+	if (iter == _stats.end())
+		_stats[remoteAE] = stats;
+	else
+	{
+		iter->second.filesStored += stats.filesStored;
+		iter->second.bytesStored += stats.bytesStored;
+		iter->second.busySeconds += stats.busySeconds;
+		iter->second.filesFailedOver += stats.filesFailedOver;
+		iter->second.associationsLost += stats.associationsLost;
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+void TargetGroupTable::report()
+{
+	map<string, GroupMemberStats>::const_iterator stats;
+
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall, "Target groups: %d", (int)_groups.size());
+	for(map<string, vector<GroupMemberConfig> >::const_iterator group=_groups.begin(); group != _groups.end(); ++group)
+	{
+		::Message(MNOTE, toEndUser | toService | MLoverall, "  %s", group->first.c_str());
+		for(vector<GroupMemberConfig>::const_iterator iter=group->second.begin(); iter != group->second.end(); ++iter)
+		{
+			stats = _stats.find(iter->remoteAE);
+			if (stats == _stats.end())
+			{
+				::Message(MNOTE, toEndUser | toService | MLoverall, "    %-16s %s:%d, not used yet",
+						  iter->remoteAE.c_str(), iter->hostName.c_str(), iter->port);
+				continue;
+			}
+
+			::Message(MNOTE, toEndUser | toService | MLoverall,
+					  "    %-16s %s:%d, %lu file(s) %.0fKB at %.1fKB/s, %lu file(s) failed over, %lu association(s) lost",
+					  iter->remoteAE.c_str(), iter->hostName.c_str(), iter->port,
+					  stats->second.filesStored, stats->second.bytesStored / 1024.0,
+					  stats->second.busySeconds > 0.0 ? stats->second.bytesStored / stats->second.busySeconds / 1024.0 : 0.0,
+					  stats->second.filesFailedOver, stats->second.associationsLost);
+		}
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+/*
+ * TargetGroupDispatch class.
+ */
+
+TargetGroupDispatch::TargetGroupDispatch(const string& groupAE, StorageData& groupData)
+				: _groupAE (groupAE),
+				  _groupData (groupData),
+				  _numLive (0)
+{
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_changed, NULL);
+
+	for (InstanceNode* node = _groupData._instanceList; node; node = node->Next)
+		_queue.push_back(node);
+}
+
+TargetGroupDispatch::~TargetGroupDispatch()
+{
+	pthread_cond_destroy(&_changed);
+	pthread_mutex_destroy(&_lock);
+}
+
+TargetGroupDispatch::TargetGroupDispatch(const TargetGroupDispatch& obj)
+				: _groupData (obj._groupData)
+{
+}
+
+TargetGroupDispatch& TargetGroupDispatch::operator=(const TargetGroupDispatch&)
+{
+	return *this;
+}
+
+int TargetGroupDispatch::addMember(const string& remoteAE, StorageData* memberData)
+{
+	MemberState member;
+
+	member.remoteAE = remoteAE;
+	member.storageData = memberData;
+	member.tail = NULL;
+	member.outstandingBytes = 0;
+	member.live = true;
+	member.started = false;
+	gettimeofday(&member.joined, NULL);  /* reset by the first claim */
+	memset(&member.stats, 0, sizeof(member.stats));
+
+	pthread_mutex_lock(&_lock);
+	_members.push_back(member);
+	_numLive++;
+	pthread_mutex_unlock(&_lock);
+
+	return (int)_members.size() - 1;
+}
+
+int TargetGroupDispatch::totalFiles()
+{
+	return GetNumNodes(_groupData._instanceList);
+}
+
+/*
+ * The caller must hold _lock
+ */
+bool TargetGroupDispatch::leastLoaded(int member)
+{
+	size_t bytes = _members[member].outstandingBytes;
+
+	if (bytes == 0)
+		return true;
+
+	// A member still waiting for its association does not count
+	for (int i = 0; i < (int)_members.size(); i++)
+		if (i != member && _members[i].live && _members[i].started && _members[i].outstandingBytes < bytes)
+			return false;
+
+	return true;
+}
+
+/*
+ * The caller must hold _lock
+ */
+size_t TargetGroupDispatch::totalUnacknowledged()
+{
+	size_t total = 0;
+
+	for (int i = 0; i < (int)_members.size(); i++)
+		if (_members[i].live)
+			total += _members[i].unacknowledged.size();
+
+	return total;
+}
+
+/****************************************************************************
+ *
+ *  Function    :   claim
+ *
+ *  Parameters  :   member   - index of the member asking
+ *                  node     - returns the node appended to the member list
+ *                  waitTime - milliseconds to wait for the turn of the member
+ *
+ *  Returns     :   GROUP_FILE_CLAIMED, GROUP_FILE_WAIT or GROUP_FILE_DONE
+ *
+ *  Description :   The member takes the next file in line if it has the
+ *                  least bytes outstanding of the live members. The node
+ *                  it sends is a copy of the node of the group list, so
+ *                  each member has its own list to match its responses.
+ *                  A member is done only when no file is in line and no
+ *                  member holds a file that could still come back.
+ *
+ ****************************************************************************/
+GROUP_CLAIM_ENUM TargetGroupDispatch::claim(int member, InstanceNode** node, int waitTime)
+{
+	InstanceNode*   groupNode = NULL;
+	InstanceNode*   copy;
+	struct timeval  now;
+	struct timespec deadline;
+	struct stat     fileStat;
+	MemberState*    state;
+
+	gettimeofday(&now, NULL);
+	deadline.tv_sec = now.tv_sec + waitTime / 1000;
+	deadline.tv_nsec = (now.tv_usec + (waitTime % 1000) * 1000L) * 1000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&_lock);
+	if (!_members[member].started)
+	{
+		_members[member].started = true;
+		_members[member].joined = now;
+	}
+	for (;;)
+	{
+		if (!_queue.empty() && leastLoaded(member))
+		{
+			groupNode = _queue.front();
+			_queue.pop_front();
+			break;
+		}
+
+		if (_queue.empty() && totalUnacknowledged() == 0)
+		{
+			pthread_mutex_unlock(&_lock);
+			return GROUP_FILE_DONE;
+		}
+
+		if (waitTime <= 0 || pthread_cond_timedwait(&_changed, &_lock, &deadline) != 0)
+		{
+			pthread_mutex_unlock(&_lock);
+			return GROUP_FILE_WAIT;
+		}
+	}
+
+	copy = (InstanceNode*)malloc(sizeof(InstanceNode));
+	if (!copy)
+	{
+		_queue.push_front(groupNode);
+		pthread_mutex_unlock(&_lock);
+		PrintError("Unable to allocate object to store instance information", MC_NORMAL_COMPLETION);
+		return GROUP_FILE_WAIT;
+	}
+
+	memcpy(copy, groupNode, sizeof(InstanceNode));
+	copy->msgID = -1;
+	copy->creditBytes = 0;
+	copy->Next = NULL;
+	copy->group = this;
+	copy->groupMember = member;
+	copy->groupNode = groupNode;
+
+	state = &_members[member];
+	if (state->tail)
+		state->tail->Next = copy;
+	else
+		state->storageData->_instanceList = copy;
+	state->tail = copy;
+	state->unacknowledged.push_back(copy);
+	pthread_mutex_unlock(&_lock);
+
+	// Size the file outside the lock, the file system may be slow
+	copy->groupBytes = stat(copy->fname, &fileStat) == 0 ? (size_t)fileStat.st_size : 0;
+
+	pthread_mutex_lock(&_lock);
+	state->outstandingBytes += copy->groupBytes;
+	pthread_mutex_unlock(&_lock);
+
+	*node = copy;
+	return GROUP_FILE_CLAIMED;
+}
+
+void TargetGroupDispatch::acknowledge(InstanceNode* node)
+{
+	InstanceNode* groupNode = node->groupNode;
+	MemberState*  state;
+
+	pthread_mutex_lock(&_lock);
+	state = &_members[node->groupMember];
+	state->unacknowledged.remove(node);
+	state->outstandingBytes = node->groupBytes > state->outstandingBytes ? 0 : state->outstandingBytes - node->groupBytes;
+	if (node->storageStatus == DICOMStoragePkg::STORAGE_SUCCEESS)
+	{
+		state->stats.filesStored++;
+		state->stats.bytesStored += node->imageBytes;
+	}
+
+	// Only the outcome, the message and the list belong to the member
+	groupNode->transferSyntax = node->transferSyntax;
+	strcpy(groupNode->SOPClassUID, node->SOPClassUID);
+	strcpy(groupNode->serviceName, node->serviceName);
+	strcpy(groupNode->SOPInstanceUID, node->SOPInstanceUID);
+	groupNode->imageBytes = node->imageBytes;
+	groupNode->status = node->status;
+	strcpy(groupNode->statusMeaning, node->statusMeaning);
+	groupNode->responseReceived = node->responseReceived;
+	groupNode->failedResponse = node->failedResponse;
+	groupNode->imageSent = node->imageSent;
+	groupNode->mediaFormat = node->mediaFormat;
+	groupNode->storageStatus = node->storageStatus;
+
+	pthread_cond_broadcast(&_changed);
+	pthread_mutex_unlock(&_lock);
+}
+
+void TargetGroupDispatch::leave(int member, bool associationLost)
+{
+	MemberState*  state;
+	struct timeval now;
+	int           requeued = 0;
+	bool          cancelled = _groupData.isCancelled();
+
+	gettimeofday(&now, NULL);
+
+	pthread_mutex_lock(&_lock);
+	state = &_members[member];
+	if (!state->live)
+	{
+		pthread_mutex_unlock(&_lock);
+		return;
+	}
+
+	state->live = false;
+	_numLive--;
+	state->stats.busySeconds = (now.tv_sec - state->joined.tv_sec) + (now.tv_usec - state->joined.tv_usec) / 1000000.0;
+
+	if (associationLost)
+	{
+		state->stats.associationsLost++;
+
+		// Put the files back at the head of the line, in their order
+		if (!cancelled && _numLive > 0)
+		{
+			for (list<InstanceNode*>::reverse_iterator iter=state->unacknowledged.rbegin();
+				 iter != state->unacknowledged.rend(); ++iter)
+			{
+				_queue.push_front((*iter)->groupNode);
+				requeued++;
+			}
+			state->stats.filesFailedOver += requeued;
+		}
+	}
+	state->unacknowledged.clear();
+	state->outstandingBytes = 0;
+
+	// With no member left, the files still in line will never be sent
+	if (_numLive == 0)
+	{
+		for (deque<InstanceNode*>::iterator iter=_queue.begin(); iter != _queue.end(); ++iter)
+			_groupData.fileProcessed(false);
+		_queue.clear();
+	}
+
+	pthread_cond_broadcast(&_changed);
+	pthread_mutex_unlock(&_lock);
+
+	if (requeued)
+	{
+		// The files will be processed once more by another member
+		_groupData.addFiles(requeued);
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				  "Lost the association with \"%s\" of target group \"%s\", %d unanswered file(s) are failed over to the other member(s)",
+				  state->remoteAE.c_str(), _groupAE.c_str(), requeued);
+	}
+	else if (associationLost && !cancelled && _numLive == 0)
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				  "Lost the association with \"%s\", the last member of target group \"%s\"",
+				  state->remoteAE.c_str(), _groupAE.c_str());
+}
+
+void TargetGroupDispatch::summarize()
+{
+	pthread_mutex_lock(&_lock);
+	for (vector<MemberState>::const_iterator iter=_members.begin(); iter != _members.end(); ++iter)
+	{
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				  "Target group %s: member %s stored %lu file(s), %.0fKB at %.1fKB/s%s",
+				  _groupAE.c_str(), iter->remoteAE.c_str(), iter->stats.filesStored, iter->stats.bytesStored / 1024.0,
+				  iter->stats.busySeconds > 0.0 ? iter->stats.bytesStored / iter->stats.busySeconds / 1024.0 : 0.0,
+				  iter->stats.associationsLost ? ", association lost" : "");
+		TargetGroupTable::instance()->record(iter->remoteAE, iter->stats);
+	}
+	pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,162 @@
+#ifndef _TARGETGROUP_H_
+#define _TARGETGROUP_H_
+
+/*
+ * file:	targetGroup.h
+ * purpose:	Target groups: a storage target whose remote AE title names a
+ *          group stands for several equivalent nodes, e.g. the ingest
+ *          nodes of one PACS. The files of the export are spread across
+ *          the members instead of being sent to each of them. The groups
+ *          come from data/Facility/Cstore/targetgroups.txt, one member
+ *          per line:
+ *
+ *              <group AE title> <member AE title> <member host> <member port>
+ *
+ *          TargetGroupTable holds the configuration and the statistics.
+ *          TargetGroupDispatch hands out the files of one export to the
+ *          member associations. A member only takes the next file while
+ *          it has the least bytes sent and not yet answered, so a faster
+ *          node gets more files. The files a member has not had answered
+ *          when its association is lost go back in line for the others.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <map>
+#include <list>
+#include <deque>
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "cstoreutils.h"
+
+using namespace std;
+
+/*
+ * One member of a group, from targetgroups.txt
+ */
+typedef struct group_member_config
+{
+    string        remoteAE;
+    string        hostName;
+    int           port;
+} GroupMemberConfig;
+
+/*
+ * Accumulated statistics of one member over all exports
+ */
+typedef struct group_member_stats
+{
+    unsigned long filesStored;      /* files answered by the member */
+    double        bytesStored;
+    double        busySeconds;      /* time the member had an association open */
+    unsigned long filesFailedOver;  /* files moved to other members after a loss */
+    unsigned long associationsLost;
+} GroupMemberStats;
+
+class TargetGroupTable
+{
+	static TargetGroupTable*                    _instance;
+	pthread_mutex_t                             _lock;      /* protects everything below */
+	map<string, vector<GroupMemberConfig> >     _groups;
+	map<string, GroupMemberStats>               _stats;     /* by member AE title */
+
+	TargetGroupTable();
+
+	// Disallow copying or assignment.
+	TargetGroupTable(const TargetGroupTable&);
+	TargetGroupTable& operator=(const TargetGroupTable&);
+
+public:
+	static TargetGroupTable* instance();
+	~TargetGroupTable();
+
+	// Read targetgroups.txt. Called at startup and on request.
+	void loadGroups();
+
+	// Fill members with the targets of the group named by the storage
+	// target. Return false if it does not name a group.
+	bool members(const DICOMStoragePkg::DICOMTarget& groupTarget,
+				 vector<DICOMStoragePkg::DICOMTarget>& members);
+
+	// Add the outcome of one member in one export
+	void record(const string& remoteAE, const GroupMemberStats& stats);
+
+	// Write the groups and the throughput of their members to the log
+	void report();
+};
+
+/*
+ * Return values of TargetGroupDispatch::claim()
+ */
+typedef enum
+{
+    GROUP_FILE_CLAIMED = 0,     /* a file was appended to the member list */
+    GROUP_FILE_WAIT,            /* try again after reading responses */
+    GROUP_FILE_DONE             /* every file has been answered or given up */
+} GROUP_CLAIM_ENUM;
+
+class TargetGroupDispatch
+{
+	/*
+	 * State of one member association in this export
+	 */
+	typedef struct member_state
+	{
+		string                remoteAE;
+		StorageData*          storageData;      /* the list the member sends */
+		InstanceNode*         tail;
+		list<InstanceNode*>   unacknowledged;   /* claimed, not answered yet */
+		size_t                outstandingBytes;
+		bool                  live;
+		bool                  started;          /* has asked for a file */
+		struct timeval        joined;
+		GroupMemberStats      stats;
+	} MemberState;
+
+	string                _groupAE;
+	StorageData&          _groupData;       /* the files in the order of the caller */
+	pthread_mutex_t       _lock;            /* protects everything below */
+	pthread_cond_t        _changed;
+	deque<InstanceNode*>  _queue;           /* group nodes not claimed yet */
+	vector<MemberState>   _members;
+	int                   _numLive;
+
+	// Disallow copying or assignment.
+	TargetGroupDispatch(const TargetGroupDispatch&);
+	TargetGroupDispatch& operator=(const TargetGroupDispatch&);
+
+	bool leastLoaded(int member);
+	size_t totalUnacknowledged();
+
+public:
+	TargetGroupDispatch(const string& groupAE, StorageData& groupData);
+	~TargetGroupDispatch();
+
+	// Add a member before the tasks are started. Returns the member index
+	// to give to StorageData::joinGroup().
+	int addMember(const string& remoteAE, StorageData* memberData);
+
+	int totalFiles();
+
+	// Give the member the next file, waiting up to waitTime milliseconds
+	// when it is not its turn.
+	GROUP_CLAIM_ENUM claim(int member, InstanceNode** node, int waitTime);
+
+	// A file of the member was answered or failed for good. Copy the
+	// outcome to the node of the group list.
+	void acknowledge(InstanceNode* node);
+
+	// The member task ends. When its association was lost the files it
+	// has not had answered are put back in line for the other members.
+	void leave(int member, bool associationLost);
+
+	// Log the share of each member and add it to the statistics
+	void summarize();
+};
+
+#endif
@@ -0,0 +1,383 @@
+/*
+ * file:	targetHealth.cc
+ * purpose:	Implementation of the TargetHealth class
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "targetHealth.h"
+
+extern int CircuitBreakerThreshold;
+extern int CircuitBreakerProbeInterval;
+
+TargetHealth* TargetHealth::_instance = NULL;  /* handle of singleton object */
+
+static string makeTargetKey(const char* remoteAE, const char* remoteHost, int remotePort)
+{
+	char key[AE_LENGTH+128+32];
+
+	sprintf(key, "%s@%s:%d", remoteAE, remoteHost ? remoteHost : "", remotePort);
+	return string(key);
+}
+
+/*
+ * Only a target that could not be reached, timed out or dropped the
+ * connection is unhealthy. One that rejected the association or the
+ * request answered, and a local configuration error says nothing of it.
+ */
+static bool isTargetFailure(MC_STATUS mcStatus)
+{
+	switch (mcStatus)
+	{
+		case MC_TIMEOUT:
+		case MC_SYSTEM_ERROR:
+		case MC_NETWORK_SHUT_DOWN:
+		case MC_ASSOCIATION_ABORTED:
+		case MC_ASSOCIATION_CLOSED:
+		case MC_INVALID_MESSAGE_RECEIVED:
+			return true;
+		default:
+			return false;
+	}
+}
+
+TargetHealth* TargetHealth::instance()
+{
+	if (!_instance)
+		_instance = new TargetHealth();
+
+	return _instance;
+}
+
+TargetHealth::TargetHealth()
+		:_applicationID (-1),
+		 _probing (false)
+{
+}
+
+TargetHealth::~TargetHealth()
+{
+}
+
+TargetHealth::TargetHealth(const TargetHealth&)
+{
+}
+
+TargetHealth& TargetHealth::operator=(const TargetHealth&)
+{
+	return *this;
+}
+
+/*
+ * The caller must hold _lock
+ */
+TargetHealthRecord& TargetHealth::findRecord(const char* remoteAE, const char* remoteHost, int remotePort)
+{
+	string key = makeTargetKey(remoteAE, remoteHost, remotePort);
+	map<string, TargetHealthRecord>::iterator iter = _targets.find(key);
+
+	if (iter == _targets.end())
+	{
+		TargetHealthRecord record;
+
+		memset(&record, 0, sizeof(record));
+		strncpy(record.RemoteAE, remoteAE, sizeof(record.RemoteAE));
+		record.RemoteAE[sizeof(record.RemoteAE)-1] = '\0';
+		if (remoteHost)
+			strncpy(record.RemoteHostname, remoteHost, sizeof(record.RemoteHostname));
+		record.RemoteHostname[sizeof(record.RemoteHostname)-1] = '\0';
+		record.RemotePort = remotePort;
+		record.state = CIRCUIT_CLOSED;
+
+		iter = _targets.insert(make_pair(key, record)).first;
+	}
+
+	return iter->second;
+}
+
+void TargetHealth::startProbing(int applicationID)
+{
+	pthread_t      tid;
+	pthread_attr_t attr;
+
+	if (_probing)
+		return;
+
+	_applicationID = applicationID;
+	_probing = true;
+
+	pthread_attr_init(&attr); // Initialize with the default value
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if( pthread_create(&tid, &attr, TargetHealth::probeTargets, (void*)this) != 0)
+	{
+		_probing = false;
+		::Message( MALARM, toEndUser | toService | MLoverall,
+				   "Cstore failed to create a thread to probe unreachable DICOM targets");
+	}
+}
+
+bool TargetHealth::allowOpen(const char* remoteAE, const char* remoteHost, int remotePort)
+{
+	MutexGuard guard (_lock);
+
+	TargetHealthRecord& record = findRecord(remoteAE, remoteHost, remotePort);
+	time_t              now;
+
+	if (record.state == CIRCUIT_CLOSED)
+		return true;
+
+	// A trial that ended without a verdict, a rejection, does not hold the
+	// circuit half-open for longer than the interval
+	now = time(NULL);
+	if (now - (record.state == CIRCUIT_OPEN ? record.openedAt : record.trialAt) < CircuitBreakerProbeInterval)
+		return false;
+
+	record.state = CIRCUIT_HALF_OPEN;
+	record.trialAt = now;
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			"DICOM target %s at %s:%d is tried with one association.", remoteAE, record.RemoteHostname, remotePort);
+	return true;
+}
+
+void TargetHealth::recordSuccess(const char* remoteAE, const char* remoteHost, int remotePort, double latency)
+{
+	MutexGuard guard (_lock);
+
+	TargetHealthRecord& record = findRecord(remoteAE, remoteHost, remotePort);
+
+	record.totalOpens++;
+	record.lastLatency = latency;
+	if (record.totalOpens == 1)
+		record.averageLatency = latency;
+	else
+		record.averageLatency = 0.8 * record.averageLatency + 0.2 * latency;
+
+	record.consecutiveFailures = 0;
+	if (record.state != CIRCUIT_CLOSED)
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				"DICOM target %s at %s:%d is reachable again.", remoteAE, record.RemoteHostname, remotePort);
+	record.state = CIRCUIT_CLOSED;
+}
+
+void TargetHealth::recordFailure(const char* remoteAE, const char* remoteHost, int remotePort, double latency)
+{
+	MutexGuard guard (_lock);
+
+	TargetHealthRecord& record = findRecord(remoteAE, remoteHost, remotePort);
+
+	record.totalOpens++;
+	record.totalFailures++;
+	record.lastLatency = latency;
+	record.consecutiveFailures++;
+
+	if (record.state == CIRCUIT_HALF_OPEN)
+	{
+		record.state = CIRCUIT_OPEN;
+		record.openedAt = time(NULL);
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				"DICOM target %s at %s:%d failed the trial association. Cstore will try it again in %d seconds.",
+				remoteAE, record.RemoteHostname, remotePort, CircuitBreakerProbeInterval);
+	}
+	else if (record.state == CIRCUIT_CLOSED && record.consecutiveFailures >= CircuitBreakerThreshold)
+	{
+		record.state = CIRCUIT_OPEN;
+		record.openedAt = time(NULL);
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				"DICOM target %s at %s:%d failed %d times in a row. Cstore will not contact it until it answers C-ECHO or a trial association.",
+				remoteAE, record.RemoteHostname, remotePort, record.consecutiveFailures);
+	}
+}
+
+void TargetHealth::report()
+{
+	MutexGuard guard (_lock);
+
+	::Message(MNOTE, toEndUser | toService | MLoverall, "Health of %d DICOM target(s):", (int)_targets.size());
+	for(map<string, TargetHealthRecord>::const_iterator iter=_targets.begin(); iter != _targets.end(); ++iter)
+	{
+		const TargetHealthRecord& record = iter->second;
+
+		::Message(MNOTE, toEndUser | toService | MLoverall,
+				"  %-40s %-6s opens=%lu failures=%lu consecutive=%d last=%.1fms average=%.1fms",
+				iter->first.c_str(), record.state == CIRCUIT_CLOSED ? "CLOSED" : (record.state == CIRCUIT_OPEN ? "OPEN" : "HALF"),
+				record.totalOpens, record.totalFailures, record.consecutiveFailures,
+				record.lastLatency, record.averageLatency);
+	}
+}
+
+/****************************************************************************
+ *
+ *  Function    :   probeTargets
+ *
+ *  Parameters  :   thisClass - the TargetHealth instance
+ *
+ *  Returns     :   NULL
+ *
+ *  Description :   Background loop. Every CircuitBreakerProbeInterval seconds
+ *                  send a C-ECHO-RQ to each target whose circuit is not
+ *                  closed, and close the circuit when the target answers.
+ *
+ ****************************************************************************/
+void* TargetHealth::probeTargets(void* thisClass)
+{
+	TargetHealth*              health = (TargetHealth*)thisClass;
+	vector<TargetHealthRecord> downTargets;
+	struct timeval             start, end;
+	double                     latency;
+
+	for (;;)
+	{
+		sleep(CircuitBreakerProbeInterval);
+
+		/*
+		 * Take a snapshot so that the lock is not held over the network
+		 */
+		downTargets.clear();
+		{
+			MutexGuard guard (health->_lock);
+			for(map<string, TargetHealthRecord>::iterator iter=health->_targets.begin(); iter != health->_targets.end(); ++iter)
+				if (iter->second.state != CIRCUIT_CLOSED)
+				{
+					iter->second.lastProbe = time(NULL);
+					downTargets.push_back(iter->second);
+				}
+		}
+
+		for(unsigned int i=0; i < downTargets.size(); i++)
+		{
+			gettimeofday(&start, NULL);
+			bool alive = health->echoProbe(downTargets[i]);
+			gettimeofday(&end, NULL);
+			latency = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+
+			if (alive)
+				health->recordSuccess(downTargets[i].RemoteAE, downTargets[i].RemoteHostname, downTargets[i].RemotePort, latency);
+		}
+	}
+
+	return NULL;
+}
+
+/****************************************************************************
+ *
+ *  Function    :   echoProbe
+ *
+ *  Parameters  :   target - the remote AE to verify
+ *
+ *  Returns     :   true if the target answered the C-ECHO-RQ with success
+ *                  false otherwise
+ *
+ *  Description :   Verification SCU. Uses the same Verification_Service_List
+ *                  that echoSCP accepts associations with.
+ *
+ ****************************************************************************/
+bool TargetHealth::echoProbe(const TargetHealthRecord& target)
+{
+	MC_STATUS     mcStatus;
+	int           associationID = -1;
+	int           messageID = -1;
+	int           responseMessageID = -1;
+	char*         responseService;
+	MC_COMMAND    responseCommand;
+	unsigned int  responseStatus;
+	int           remotePort = target.RemotePort;
+
+	mcStatus = MC_Open_Association( _applicationID, &associationID,
+                                    const_cast<char*>(target.RemoteAE),
+                                    remotePort != -1 ? &remotePort : NULL,
+                                    target.RemoteHostname[0] ? const_cast<char*>(target.RemoteHostname) : NULL,
+                                    const_cast<char*>("Verification_Service_List") );
+	if (mcStatus != MC_NORMAL_COMPLETION)
+		return false;
+
+	mcStatus = MC_Open_Message( &messageID, "STANDARD_ECHO", C_ECHO_RQ );
+	if (mcStatus != MC_NORMAL_COMPLETION)
+	{
+		PrintError("MC_Open_Message failed for C-ECHO-RQ", mcStatus);
+		MC_Abort_Association(&associationID);
+		return false;
+	}
+
+	mcStatus = MC_Send_Request_Message( associationID, messageID );
+	MC_Free_Message( &messageID );
+	if (mcStatus != MC_NORMAL_COMPLETION)
+	{
+		MC_Abort_Association(&associationID);
+		return false;
+	}
+
+	mcStatus = MC_Read_Message( associationID, 30, &responseMessageID,
+                                &responseService, &responseCommand );
+	if (mcStatus != MC_NORMAL_COMPLETION)
+	{
+		MC_Abort_Association(&associationID);
+		return false;
+	}
+
+	mcStatus = MC_Get_Value_To_UInt( responseMessageID, MC_ATT_STATUS, &responseStatus );
+	MC_Free_Message( &responseMessageID );
+
+	if (MC_Close_Association( &associationID ) != MC_NORMAL_COMPLETION)
+		MC_Abort_Association(&associationID);
+
+	return mcStatus == MC_NORMAL_COMPLETION && responseStatus == C_ECHO_SUCCESS;
+}
+
+/****************************************************************************
+ *
+ *  Function    :   OpenMonitoredAssociation
+ *
+ *  Parameters  :   Same as MC_Open_Association, -1 for A_remotePort and an
+ *                  empty A_remoteHost mean the default in mergecom.app
+ *
+ *  Returns     :   MC_STATUS of MC_Open_Association, or
+ *                  MC_ASSOCIATION_REJECTED if the circuit of the target is open
+ *
+ *  Description :   Open an association and record its outcome and latency
+ *                  in the TargetHealth table. A rejection by the target
+ *                  is not held against its health, only network errors
+ *                  and timeouts are.
+ *
+ ****************************************************************************/
+MC_STATUS OpenMonitoredAssociation(
+                        int                 A_appID,
+                        int*                A_associationID,
+                        char*               A_remoteAE,
+                        int                 A_remotePort,
+                        char*               A_remoteHost,
+                        char*               A_serviceList)
+{
+	TargetHealth*   health = TargetHealth::instance();
+	MC_STATUS       mcStatus;
+	struct timeval  start, end;
+	double          latency;
+
+	if (!health->allowOpen(A_remoteAE, A_remoteHost, A_remotePort))
+	{
+		::Message(MWARNING, toEndUser | toService | MLoverall,
+				"DICOM target %s at %s:%d is unreachable. Cstore will not wait for it.",
+				A_remoteAE, A_remoteHost, A_remotePort);
+		return MC_ASSOCIATION_REJECTED;
+	}
+
+	gettimeofday(&start, NULL);
+	mcStatus = MC_Open_Association( A_appID, A_associationID,
+                                    A_remoteAE,
+                                    A_remotePort != -1 ? &A_remotePort : NULL,
+                                    A_remoteHost[0] ? A_remoteHost : NULL,
+                                    A_serviceList[0] ? A_serviceList : NULL );
+	gettimeofday(&end, NULL);
+	latency = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+
+	if (mcStatus == MC_NORMAL_COMPLETION)
+		health->recordSuccess(A_remoteAE, A_remoteHost, A_remotePort, latency);
+	else if (isTargetFailure(mcStatus))
+		health->recordFailure(A_remoteAE, A_remoteHost, A_remotePort, latency);
+
+	return mcStatus;
+}
@@ -0,0 +1,103 @@
+#ifndef _TARGETHEALTH_H_
+#define _TARGETHEALTH_H_
+
+/*
+ * file:	targetHealth.h
+ * purpose:	TargetHealth singleton class that tracks association opens
+ *          that failed on the network or timed out, and their latency, per
+ *          remote target, and trips a circuit
+ *          breaker so that cstore does not wait for the full connect
+ *          timeout of a dead PACS on every store or commit. Targets with
+ *          an open circuit are probed in the background with C-ECHO, and
+ *          every CircuitBreakerProbeInterval seconds one real association
+ *          is let through as a trial, for a target without Verification
+ *          SCP. Either success closes the circuit.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <map>
+#include <string>
+#include "cstoreutils.h"
+
+using namespace std;
+
+typedef enum
+{
+    CIRCUIT_CLOSED = 0,     /* target is healthy, associations are opened */
+    CIRCUIT_OPEN = 1,       /* target is down, fail without touching the network */
+    CIRCUIT_HALF_OPEN = 2   /* one association is let through as a trial */
+} CIRCUIT_STATE;
+
+/*
+ * Health information kept for one remote AE
+ */
+typedef struct target_health
+{
+    char          RemoteAE[AE_LENGTH+2];
+    char          RemoteHostname[128];
+    int           RemotePort;
+
+    CIRCUIT_STATE state;
+    int           consecutiveFailures;
+    unsigned long totalOpens;           /* number of MC_Open_Association attempts */
+    unsigned long totalFailures;        /* number of failed attempts */
+    double        lastLatency;          /* milliseconds of the last open */
+    double        averageLatency;       /* moving average in milliseconds */
+    time_t        openedAt;             /* when the circuit was tripped, or the last trial failed */
+    time_t        trialAt;              /* when the last trial association was let through */
+    time_t        lastProbe;            /* when the last C-ECHO probe was sent */
+} TargetHealthRecord;
+
+class TargetHealth
+{
+	static TargetHealth*              _instance;
+	ThreadMutex                       _lock;
+	map<string, TargetHealthRecord>   _targets;
+	int                               _applicationID;
+	bool                              _probing;
+
+	TargetHealth();
+
+	// Disallow copying or assignment.
+	TargetHealth(const TargetHealth&);
+	TargetHealth& operator=(const TargetHealth&);
+
+	TargetHealthRecord& findRecord(const char* remoteAE, const char* remoteHost, int remotePort);
+	bool echoProbe(const TargetHealthRecord& target);
+
+public:
+	static TargetHealth* instance();
+	~TargetHealth();
+
+	// Start the background C-ECHO prober. Called once after Merge is initialized.
+	void startProbing(int applicationID);
+
+	// Return false when the circuit of the target is open, unless the
+	// association is let through as the trial of a half-open circuit.
+	bool allowOpen(const char* remoteAE, const char* remoteHost, int remotePort);
+
+	void recordSuccess(const char* remoteAE, const char* remoteHost, int remotePort, double latency);
+	void recordFailure(const char* remoteAE, const char* remoteHost, int remotePort, double latency);
+
+	// Write the health table to the log
+	void report();
+
+	static void* probeTargets(void* thisClass);
+};
+
+/*
+ * MC_Open_Association wrapper that consults and updates the TargetHealth.
+ * Returns MC_ASSOCIATION_REJECTED without touching the network when the
+ * circuit of the target is open.
+ */
+MC_STATUS OpenMonitoredAssociation(
+                        int                 A_appID,
+                        int*                A_associationID,
+                        char*               A_remoteAE,
+                        int                 A_remotePort,
+                        char*               A_remoteHost,
+                        char*               A_serviceList);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * file:	testreadahead.cc
+ * purpose:	Cold-cache benchmark of the ReadAheadEngine. Reads a list of
+ *          files the way StoreFiles does, once on demand only and once
+ *          with the next files advised ahead, and compares the time spent
+ *          waiting for reads.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <vector>
+#include <string>
+
+#include "readAhead.h"
+
+using namespace std;
+
+static double now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+ * Drop the clean pages of the files, so every run starts from disk
+ */
+static void evict(const vector<string>& files)
+{
+    int fd;
+
+    for (int i = 0; i < (int)files.size(); i++)
+    {
+        fd = open(files[i].c_str(), O_RDONLY);
+        if (fd < 0)
+            continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/*
+ * Read all files in 64KB chunks like the CBinfo buffer of cstore. While a
+ * file is "sent", sendMs milliseconds, the files read ahead load.
+ */
+static void run(const vector<string>& files, int ahead, int sendMs)
+{
+    static char  buffer[64*1024];
+    double       start, readStart, readTime = 0.0, bytes = 0.0;
+    ssize_t      n;
+    int          fd, next = 0;
+
+    evict(files);
+    start = now();
+
+    for (int i = 0; i < (int)files.size(); i++)
+    {
+        if (next <= i)
+            next = i + 1;
+        while (next < (int)files.size() && next <= i + ahead)
+            ReadAheadEngine::instance()->advise(files[next++].c_str());
+
+        readStart = now();
+        fd = open(files[i].c_str(), O_RDONLY);
+        if (fd >= 0)
+        {
+            while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+                bytes += n;
+            close(fd);
+        }
+        readTime += now() - readStart;
+
+        if (sendMs > 0)
+            usleep(sendMs * 1000);
+    }
+
+    printf("%2d file(s) ahead: %d files, %.1fMB in %.3fs, %.3fs waiting for reads, read rate %.1fMB/s\n",
+           ahead, (int)files.size(), bytes / (1024.0 * 1024.0), now() - start, readTime,
+           readTime > 0.0 ? bytes / readTime / (1024.0 * 1024.0) : 0.0);
+}
+
+int
+main( int argc, char *const *argv)
+{
+    vector<string> files;
+    char           line[1024];
+    FILE*          list;
+    int            ahead, sendMs;
+
+    if (argc < 3)
+    {
+        printf("Usage: testreadahead <file with one path per line> <files ahead> [send ms per file]\n");
+        printf("Run it against files on the disk to measure, as root to evict their pages.\n");
+        return 0;
+    }
+
+    list = fopen(argv[1], "r");
+    if (!list)
+    {
+        printf("Cannot open %s\n", argv[1]);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), list))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0])
+            files.push_back(line);
+    }
+    fclose(list);
+
+    ahead = atoi(argv[2]);
+    sendMs = argc > 3 ? atoi(argv[3]) : 0;
+    printf("%d file(s), %dms to send each\n", (int)files.size(), sendMs);
+
+    run(files, 0, sendMs);
+    run(files, ahead, sendMs);
+
+    ReadAheadEngine::instance()->report();
+    return 0;
+}
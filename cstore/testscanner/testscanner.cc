@@ -0,0 +1,145 @@
+/*
+ * file:	testscanner.cc
+ * purpose:	Micro-benchmark of the DICOM header scanner. Scans a list of
+ *          files from the page cache a number of times and reports files
+ *          per minute, and compares the VR table lookup with the strcmp
+ *          loop it replaced.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+#include <string>
+
+#include "dicomScanner.h"
+
+using namespace std;
+
+static double now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+ * The VR check as it was before the table
+ */
+static bool strcmpValidVR(const char* A_VR)
+{
+    static const char* const VR_Table[27] =
+    {
+        "AE", "AS", "CS", "DA", "DS", "DT", "IS", "LO", "LT",
+        "PN", "SH", "ST", "TM", "UT", "UI", "SS", "US", "AT",
+        "SL", "UL", "FL", "FD", "UN", "OB", "OW", "OL", "SQ"
+    };
+
+    for (int i = 0; i < 27; i++)
+    {
+        if (!strcmp(A_VR, VR_Table[i]))
+            return true;
+    }
+    return false;
+}
+
+static void compareVRLookup()
+{
+    static const char* const samples[] = { "UI", "SQ", "PN", "OB", "xx", "\x08\x00", "US", "LO" };
+    const int  count = 10000000;
+    double     start, strcmpTime, tableTime;
+    int        found = 0;
+
+    start = now();
+    for (int i = 0; i < count; i++)
+        found += strcmpValidVR(samples[i & 7]);
+    strcmpTime = now() - start;
+
+    start = now();
+    for (int i = 0; i < count; i++)
+        found += DicomVRKind(samples[i & 7]) != DICOM_VR_UNKNOWN;
+    tableTime = now() - start;
+
+    printf("VR lookup: strcmp %.1fns, table %.1fns per lookup (%d)\n",
+           strcmpTime * 1e9 / count, tableTime * 1e9 / count, found);
+}
+
+int
+main( int argc, char *const *argv)
+{
+    vector<string>  files;
+    DicomHeaderInfo info;
+    char            line[1024];
+    FILE*           list;
+    double          start, elapsed;
+    int             passes, scanned, complete, withUIDs;
+
+    if (argc < 2)
+    {
+        printf("Usage: testscanner <file with one path per line> [passes] [-v]\n");
+        printf("The first pass loads the files into the page cache and is not timed.\n");
+        return 0;
+    }
+
+    list = fopen(argv[1], "r");
+    if (!list)
+    {
+        printf("Cannot open %s\n", argv[1]);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), list))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0])
+            files.push_back(line);
+    }
+    fclose(list);
+    passes = argc > 2 ? atoi(argv[2]) : 5;
+
+    for (int i = 0; i < (int)files.size(); i++)
+    {
+        ScanDicomHeader(files[i].c_str(), &info);
+        if (argc > 3 && !strcmp(argv[3], "-v"))
+            printf("%s: format %d, syntax %d%s\n  SOP Class %s\n  SOP Instance %s\n  Study %s\n  Series %s\n",
+                   files[i].c_str(), info.format, info.transferSyntax, info.complete ? "" : ", incomplete",
+                   info.SOPClassUID, info.SOPInstanceUID, info.StudyInstanceUID, info.SeriesInstanceUID);
+    }
+
+    scanned = complete = withUIDs = 0;
+    start = now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (int i = 0; i < (int)files.size(); i++)
+        {
+            if (!ScanDicomHeader(files[i].c_str(), &info))
+                continue;
+            scanned++;
+            complete += info.complete;
+            withUIDs += info.SOPInstanceUID[0] && info.SeriesInstanceUID[0];
+        }
+    }
+    elapsed = now() - start;
+
+    printf("%d file(s) x %d pass(es): %d scanned, %d complete, %d with SOP and series UIDs\n",
+           (int)files.size(), passes, scanned, complete, withUIDs);
+    printf("%.3fs, %.1fus per file, %.0f files per minute\n",
+           elapsed, elapsed * 1e6 / (files.size() * passes),
+           elapsed > 0.0 ? files.size() * passes * 60.0 / elapsed : 0.0);
+
+    start = now();
+    for (int pass = 0; pass < passes; pass++)
+        for (int i = 0; i < (int)files.size(); i++)
+            ScanDicomFormat(files[i].c_str());
+    elapsed = now() - start;
+    printf("format only: %.1fus per file, %.0f files per minute\n",
+           elapsed * 1e6 / (files.size() * passes),
+           elapsed > 0.0 ? files.size() * passes * 60.0 / elapsed : 0.0);
+
+    compareVRLookup();
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * file:	testsopindex.cc
+ * purpose:	Micro-benchmark of the SOP instance index used to match the
+ *          items of an N-EVENT-REPORT with the files of the transaction.
+ *          Builds a synthetic transaction and report of the given size and
+ *          compares the index with the linear strcmp scan it replaced.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "sopIndex.h"
+
+using namespace std;
+
+static const char* const SOPClasses[] =
+{
+    "1.2.840.10008.5.1.4.1.1.20",      /* NM Image */
+    "1.2.840.10008.5.1.4.1.1.128",     /* PET Image */
+    "1.2.840.10008.5.1.4.1.1.2",       /* CT Image */
+    "1.2.840.10008.5.1.4.1.1.7"        /* Secondary Capture */
+};
+
+static double now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+ * The lookup as it was before the index
+ */
+static int findNode(const vector<string>& classUIDs, const vector<string>& instanceUIDs,
+                    const char* sopClassUID, const char* sopInstanceUID)
+{
+    for (unsigned int i = 0; i < classUIDs.size(); i++)
+    {
+        if ( !strcmp(classUIDs[i].c_str(), sopClassUID) &&
+             !strcmp(instanceUIDs[i].c_str(), sopInstanceUID) )
+            return i;
+    }
+
+    return -1;
+}
+
+int
+main( int argc, char *const *argv)
+{
+    vector<string> classUIDs, instanceUIDs;
+    vector<int>    report;           /* files in the order the report names them, -1 unknown */
+    char           uid[80];
+    double         start, buildTime, indexTime, linearTime;
+    int            count, sample, found, mismatches;
+
+    count = argc > 1 ? atoi(argv[1]) : 50000;
+    sample = argc > 2 ? atoi(argv[2]) : 5000;
+    if (count <= 0)
+    {
+        printf("Usage: testsopindex [items, 50000] [items timed with the linear scan, 5000]\n");
+        return 0;
+    }
+    sample = min(max(sample, 1), count);
+
+    /*
+     * Instance UIDs share a long root, as they do from a camera, so strcmp
+     * has to read most of each one
+     */
+    srand(1);
+    for (int i = 0; i < count; i++)
+    {
+        sprintf(uid, "1.2.840.113619.2.55.3.2831208458.%d.%d.%d", 1000 + i / 512, i, rand() % 100000);
+        classUIDs.push_back(SOPClasses[i & 3]);
+        instanceUIDs.push_back(uid);
+        report.push_back(i);
+    }
+    // One item in a hundred names an instance that was not sent
+    for (int i = 0; i < count; i += 100)
+        report[i] = -1;
+    random_shuffle(report.begin(), report.end());
+
+    vector<string> reportClassUIDs(count), reportInstanceUIDs(count);
+    for (int i = 0; i < count; i++)
+    {
+        reportClassUIDs[i] = report[i] >= 0 ? classUIDs[report[i]] : SOPClasses[0];
+        reportInstanceUIDs[i] = report[i] >= 0 ? instanceUIDs[report[i]] : "1.2.3.4.unknown";
+    }
+
+    start = now();
+    SOPInstanceIndex index(count);
+    for (int i = 0; i < count; i++)
+        index.add(classUIDs[i].c_str(), instanceUIDs[i].c_str());
+    buildTime = now() - start;
+
+    found = mismatches = 0;
+    start = now();
+    for (int i = 0; i < count; i++)
+    {
+        int entry = index.find(reportClassUIDs[i].c_str(), reportInstanceUIDs[i].c_str());
+        found += entry >= 0;
+        mismatches += entry != report[i];
+    }
+    indexTime = now() - start;
+
+    start = now();
+    for (int i = 0; i < sample; i++)
+        mismatches += findNode(classUIDs, instanceUIDs, reportClassUIDs[i].c_str(),
+                               reportInstanceUIDs[i].c_str()) != report[i];
+    linearTime = (now() - start) * count / sample;
+
+    printf("%d item(s) in the transaction and the report, %d found, %d mismatch(es)\n",
+           count, found, mismatches);
+    printf("index: %.3fms to build, %.3fms to match, %.2fus per item\n",
+           buildTime * 1e3, indexTime * 1e3, (buildTime + indexTime) * 1e6 / count);
+    printf("linear scan: %.3fs to match%s, %.2fus per item\n",
+           linearTime, sample < count ? " (from a sample)" : "", linearTime * 1e6 / count);
+    printf("speedup: %.0fx\n",
+           buildTime + indexTime > 0.0 ? linearTime / (buildTime + indexTime) : 0.0);
+
+    return mismatches ? 1 : 0;
+}
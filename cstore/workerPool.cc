@@ -0,0 +1,283 @@
+/*
+ * file:	workerPool.cc
+ * purpose:	Implementation of the WorkerPool and TaskFuture classes
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <time.h>
+#include <errno.h>
+
+#include "workerPool.h"
+#include "cstoreutils.h"
+
+extern int WorkerPoolMaxThreads;
+
+static const int WorkerPoolMinThreads = 4;     /* threads kept even when idle */
+static const int WorkerIdleTimeout = 60;       /* seconds before an extra idle thread exits */
+
+WorkerPool* WorkerPool::_instance = NULL;  /* handle of singleton object */
+
+/*
+ * TaskFuture class.
+ */
+
+TaskFuture::TaskFuture(TaskFunction function, void* argument)
+			: _function (function),
+			  _argument (argument),
+			  _result (NULL),
+			  _state (TASK_QUEUED),
+			  _references (1)
+{
+}
+
+TaskFuture::~TaskFuture()
+{
+}
+
+TaskFuture::TaskFuture(const TaskFuture&)
+{
+}
+
+TaskFuture& TaskFuture::operator=(const TaskFuture&)
+{
+	return *this;
+}
+
+void* TaskFuture::wait()
+{
+	WorkerPool* pool = WorkerPool::instance();
+	void*       result;
+
+	pthread_mutex_lock(&pool->_lock);
+	if (_state == TASK_QUEUED)
+	{
+		// Nobody has picked it up yet. Run it here rather than block a
+		// thread, which also keeps a task that waits for other tasks from
+		// deadlocking a pool that has reached its cap.
+		pool->_queue.remove(this);
+		_state = TASK_RUNNING;
+		pool->_tasksRunInline++;
+		pthread_mutex_unlock(&pool->_lock);
+
+		pool->run(this);
+
+		pthread_mutex_lock(&pool->_lock);
+	}
+
+	while (_state != TASK_DONE)
+		pthread_cond_wait(&pool->_taskDone, &pool->_lock);
+
+	result = _result;
+	pthread_mutex_unlock(&pool->_lock);
+
+	return result;
+}
+
+void TaskFuture::release()
+{
+	WorkerPool* pool = WorkerPool::instance();
+
+	pthread_mutex_lock(&pool->_lock);
+	pool->dropReference(this);
+	pthread_mutex_unlock(&pool->_lock);
+}
+
+/*
+ * WorkerPool class.
+ */
+
+WorkerPool* WorkerPool::instance()
+{
+	if (!_instance)
+		_instance = new WorkerPool();
+
+	return _instance;
+}
+
+WorkerPool::WorkerPool()
+			: _numThreads (0),
+			  _numIdle (0),
+			  _maxThreads (WorkerPoolMaxThreads),
+			  _tasksRun (0),
+			  _tasksRunInline (0),
+			  _peakThreads (0)
+{
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_taskQueued, NULL);
+	pthread_cond_init(&_taskDone, NULL);
+
+	if (_maxThreads < WorkerPoolMinThreads)
+		_maxThreads = WorkerPoolMinThreads;
+
+	// Start the minimum number of threads now, so that the first export
+	// does not pay for them
+	pthread_mutex_lock(&_lock);
+	while (_numThreads < WorkerPoolMinThreads && addThread())
+		;
+	pthread_mutex_unlock(&_lock);
+}
+
+WorkerPool::~WorkerPool()
+{
+	// The worker threads live as long as the process
+}
+
+WorkerPool::WorkerPool(const WorkerPool&)
+{
+}
+
+WorkerPool& WorkerPool::operator=(const WorkerPool&)
+{
+	return *this;
+}
+
+/*
+ * The caller must hold _lock
+ */
+bool WorkerPool::addThread()
+{
+	pthread_t      tid;
+	pthread_attr_t attr;
+	bool           created;
+
+	pthread_attr_init(&attr); // Initialize with the default value
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	created = pthread_create(&tid, &attr, WorkerPool::worker, (void*)this) == 0;
+	pthread_attr_destroy(&attr);
+
+	if (!created)
+	{
+		::Message( MALARM, toEndUser | toService | MLoverall,
+				   "Cstore failed to create a worker thread, %d thread(s) running", _numThreads);
+		return false;
+	}
+
+	_numThreads++;
+	if (_numThreads > _peakThreads)
+		_peakThreads = _numThreads;
+
+	return true;
+}
+
+/*
+ * The caller must hold _lock
+ */
+void WorkerPool::dropReference(TaskFuture* future)
+{
+	if (--future->_references == 0)
+		delete future;
+}
+
+/*
+ * Run the task outside the lock and mark it done
+ */
+void WorkerPool::run(TaskFuture* future)
+{
+	void* result = future->_function(future->_argument);
+
+	pthread_mutex_lock(&_lock);
+	future->_result = result;
+	future->_state = TASK_DONE;
+	_tasksRun++;
+	pthread_cond_broadcast(&_taskDone);
+	dropReference(future); // the reference of the pool
+	pthread_mutex_unlock(&_lock);
+}
+
+TaskFuture* WorkerPool::submit(TaskFunction function, void* argument, bool detached)
+{
+	TaskFuture* future = new TaskFuture(function, argument);
+	bool        runInline = false;
+
+	if (!detached)
+		future->_references++;
+
+	pthread_mutex_lock(&_lock);
+	_queue.push_back(future);
+
+	// Grow only when the queued tasks outnumber the idle threads
+	if (_numIdle < (int)_queue.size() && _numThreads < _maxThreads)
+		addThread();
+
+	if (_numThreads == 0)
+	{
+		// No thread at all. Run it in the caller rather than never.
+		_queue.remove(future);
+		future->_state = TASK_RUNNING;
+		_tasksRunInline++;
+		runInline = true;
+	}
+	else
+		pthread_cond_signal(&_taskQueued);
+	pthread_mutex_unlock(&_lock);
+
+	if (runInline)
+		run(future);
+
+	return detached ? NULL : future;
+}
+
+void WorkerPool::report()
+{
+	pthread_mutex_lock(&_lock);
+	::Message(MNOTE, toEndUser | toService | MLoverall,
+			  "Worker pool: %d thread(s), %d idle, peak %d, cap %d, %d task(s) queued, %lu run, %lu run by the waiting thread",
+			  _numThreads, _numIdle, _peakThreads, _maxThreads, (int)_queue.size(), _tasksRun, _tasksRunInline);
+	pthread_mutex_unlock(&_lock);
+}
+
+/****************************************************************************
+ *
+ *  Function    :   worker
+ *
+ *  Parameters  :   thisClass - the WorkerPool instance
+ *
+ *  Returns     :   NULL
+ *
+ *  Description :   Worker thread. Runs queued tasks in FIFO order. A thread
+ *                  above the minimum count exits after it has been idle for
+ *                  WorkerIdleTimeout seconds.
+ *
+ ****************************************************************************/
+void* WorkerPool::worker(void* thisClass)
+{
+	WorkerPool*     pool = (WorkerPool*)thisClass;
+	TaskFuture*     future;
+	struct timespec deadline;
+	int             rc;
+
+	pthread_mutex_lock(&pool->_lock);
+	for (;;)
+	{
+		rc = 0;
+		while (pool->_queue.empty())
+		{
+			if (rc == ETIMEDOUT && pool->_numThreads > WorkerPoolMinThreads)
+			{
+				pool->_numThreads--;
+				pthread_mutex_unlock(&pool->_lock);
+				return NULL;
+			}
+
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += WorkerIdleTimeout;
+
+			pool->_numIdle++;
+			rc = pthread_cond_timedwait(&pool->_taskQueued, &pool->_lock, &deadline);
+			pool->_numIdle--;
+		}
+
+		future = pool->_queue.front();
+		pool->_queue.pop_front();
+		future->_state = TASK_RUNNING;
+		pthread_mutex_unlock(&pool->_lock);
+
+		pool->run(future);
+
+		pthread_mutex_lock(&pool->_lock);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,108 @@
+#ifndef _WORKERPOOL_H_
+#define _WORKERPOOL_H_
+
+/*
+ * file:	workerPool.h
+ * purpose:	WorkerPool singleton class that runs the storage and
+ *          commitment tasks on persistent worker threads, instead of
+ *          creating a thread per target on every call. Thread stacks and
+ *          the per-thread toolkit state are reused from task to task. The
+ *          pool starts with a few threads and grows on demand up to a cap;
+ *          tasks beyond the cap wait in a FIFO queue.
+ *
+ *          A task returns its result through a TaskFuture, in the same
+ *          form as a thread function: a pointer to THREAD_NORMAL_EXIT or
+ *          THREAD_EXCEPTION.
+ *
+ * revision history:
+ *   Jiantao Huang		    initial version
+ */
+
+#include <list>
+#include <pthread.h>
+
+using namespace std;
+
+typedef void* (*TaskFunction)(void*);
+
+typedef enum
+{
+    TASK_QUEUED = 0,
+    TASK_RUNNING = 1,
+    TASK_DONE = 2
+} TASK_STATE;
+
+class WorkerPool;
+
+/*
+ * Result of a submitted task. It is reference counted: one reference for
+ * the caller and one for the pool until the task has run.
+ */
+class TaskFuture
+{
+	friend class WorkerPool;
+
+	TaskFunction  _function;
+	void*         _argument;
+	void*         _result;
+	TASK_STATE    _state;
+	int           _references;   /* protected by the lock of WorkerPool */
+
+	TaskFuture(TaskFunction function, void* argument);
+	~TaskFuture();
+
+	// Disallow copying or assignment.
+	TaskFuture(const TaskFuture&);
+	TaskFuture& operator=(const TaskFuture&);
+
+public:
+	// Block until the task has run and return its result. A task that has
+	// not been picked up yet is run in the calling thread.
+	void* wait();
+
+	// Drop the reference of the caller. The future must not be used after.
+	void release();
+};
+
+class WorkerPool
+{
+	static WorkerPool*      _instance;
+	pthread_mutex_t         _lock;      /* protects everything below */
+	pthread_cond_t          _taskQueued;
+	pthread_cond_t          _taskDone;
+	list<TaskFuture*>       _queue;
+	int                     _numThreads;
+	int                     _numIdle;
+	int                     _maxThreads;
+	unsigned long           _tasksRun;
+	unsigned long           _tasksRunInline;
+	int                     _peakThreads;
+
+	WorkerPool();
+
+	// Disallow copying or assignment.
+	WorkerPool(const WorkerPool&);
+	WorkerPool& operator=(const WorkerPool&);
+
+	bool addThread();
+	void run(TaskFuture* future);
+	void dropReference(TaskFuture* future);
+
+	friend class TaskFuture;
+
+public:
+	static WorkerPool* instance();
+	~WorkerPool();
+
+	// Queue a task. The caller owns one reference of the returned future and
+	// must release() it. With detached set the pool keeps the only
+	// reference and NULL is returned.
+	TaskFuture* submit(TaskFunction function, void* argument, bool detached=false);
+
+	// Write the pool size and task counts to the log
+	void report();
+
+	static void* worker(void* thisClass);
+};
+
+#endif